@@ -0,0 +1,218 @@
+#include "abbrev.h"
+
+#include <dwarf.h>
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "binary.h"
+#include "scanner.h"
+
+using namespace std;
+
+int fixedFormSize(uint16_t form) {
+  switch (form) {
+  case DW_FORM_flag_present:
+  case DW_FORM_implicit_const:
+    return 0;
+  case DW_FORM_data1:
+  case DW_FORM_ref1:
+  case DW_FORM_flag:
+    return 1;
+  case DW_FORM_data2:
+  case DW_FORM_ref2:
+    return 2;
+  case DW_FORM_ref_sup4:
+    return 4;
+  case DW_FORM_data8:
+  case DW_FORM_ref_sig8:
+  case DW_FORM_ref_sup8:
+    return 8;
+  case DW_FORM_data16:
+    return 16;
+  default:
+    return -1;
+  }
+}
+
+// Writes the plan of |num_attrs| attributes to |plan| and returns the
+// number of ops, which is never more than |num_attrs|.
+static uint16_t compilePlan(const Attr* attrs, uint16_t num_attrs, Op* plan) {
+  uint16_t num_ops = 0;
+  for (uint16_t i = 0; i < num_attrs; i++) {
+    const Attr& attr = attrs[i];
+    int size = fixedFormSize(attr.form);
+    if (size < 0) {
+      Op op = { attr.name, attr.form, 0 };
+      plan[num_ops++] = op;
+    } else if (num_ops && !plan[num_ops - 1].form) {
+      plan[num_ops - 1].size += size;
+    } else {
+      Op op = { 0, 0, (uint16_t)size };
+      plan[num_ops++] = op;
+    }
+  }
+  return num_ops;
+}
+
+// Walks the table at |p| and returns its end.
+static const uint8_t* countAbbrevs(const uint8_t* p, uint64_t* max_number,
+                                   size_t* total_attrs) {
+  *max_number = 0;
+  *total_attrs = 0;
+  while (true) {
+    uint64_t number = uleb128(p);
+    if (!number)
+      break;
+    if (*max_number < number)
+      *max_number = number;
+    uleb128(p);
+    p++;
+    while (true) {
+      uint64_t name = uleb128(p);
+      uint64_t form = uleb128(p);
+      if (form == DW_FORM_implicit_const)
+        sleb128(p);
+      if (!name)
+        break;
+      ++*total_attrs;
+    }
+  }
+  return p;
+}
+
+size_t abbrevTableSize(const uint8_t* p) {
+  uint64_t max_number;
+  size_t total_attrs;
+  return countAbbrevs(p, &max_number, &total_attrs) - p;
+}
+
+AbbrevTable* parseAbbrev(const uint8_t* start) {
+  // Count the abbrevs and attributes first to allocate the arena at once.
+  uint64_t max_number;
+  size_t total_attrs;
+  countAbbrevs(start, &max_number, &total_attrs);
+
+  size_t num_abbrevs = max_number + 1;
+  size_t abbrevs_size = sizeof(Abbrev) * num_abbrevs;
+  size_t attrs_size = sizeof(Attr) * total_attrs;
+  char* arena = (char*)calloc(
+    1, abbrevs_size + attrs_size + sizeof(Op) * total_attrs);
+  if (!arena)
+    err(1, "calloc failed");
+  Abbrev* abbrevs = (Abbrev*)arena;
+  Attr* attrs = (Attr*)(arena + abbrevs_size);
+  Op* plan = (Op*)(arena + abbrevs_size + attrs_size);
+
+  const uint8_t* p = start;
+  while (true) {
+    uint64_t number = uleb128(p);
+    if (!number)
+      break;
+
+    Abbrev* abbrev = &abbrevs[number];
+    abbrev->tag = uleb128(p);
+    abbrev->has_children = *p++;
+    abbrev->attrs = attrs;
+    while (true) {
+      Attr attr;
+      attr.name = uleb128(p);
+      attr.form = uleb128(p);
+      attr.implicit_const = 0;
+      if (attr.form == DW_FORM_implicit_const)
+        attr.implicit_const = sleb128(p);
+      //printf("abbrev attr parsed: %x %x\n", attr.name, attr.form);
+      if (!attr.name)
+        break;
+      *attrs++ = attr;
+    }
+    abbrev->num_attrs = attrs - abbrev->attrs;
+    abbrev->plan = plan;
+    abbrev->num_ops = compilePlan(abbrev->attrs, abbrev->num_attrs, plan);
+    plan += abbrev->num_ops;
+    //printf("abbrev parsed: %d %d %d\n",
+    //       abbrev->tag, abbrev->has_children, (int)abbrev->num_attrs);
+  }
+
+  AbbrevTable* table = new AbbrevTable();
+  table->abbrevs = abbrevs;
+  table->num_abbrevs = num_abbrevs;
+  table->num_attrs = total_attrs;
+  table->arena = arena;
+  return table;
+}
+
+void freeAbbrev(AbbrevTable* table) {
+  free(table->arena);
+  delete table;
+}
+
+// Tables shared by the caches of all binaries keyed by their bytes, or
+// NULL unless shareAbbrevTables was called.
+static map<string, AbbrevTable*>* shared_tables;
+static pthread_mutex_t shared_mu = PTHREAD_MUTEX_INITIALIZER;
+
+void shareAbbrevTables() {
+  if (!shared_tables)
+    shared_tables = new map<string, AbbrevTable*>();
+}
+
+// Returns the shared table with the same bytes as the one at |start|.
+static AbbrevTable* getSharedAbbrev(const uint8_t* start) {
+  uint64_t max_number;
+  size_t total_attrs;
+  const uint8_t* end = countAbbrevs(start, &max_number, &total_attrs);
+  string key((const char*)start, end - start);
+  pthread_mutex_lock(&shared_mu);
+  map<string, AbbrevTable*>::iterator found = shared_tables->find(key);
+  AbbrevTable* table = found != shared_tables->end() ? found->second : NULL;
+  pthread_mutex_unlock(&shared_mu);
+  if (table)
+    return table;
+
+  AbbrevTable* parsed = parseAbbrev(start);
+  pthread_mutex_lock(&shared_mu);
+  table = shared_tables->insert(make_pair(key, parsed)).first->second;
+  pthread_mutex_unlock(&shared_mu);
+  if (table != parsed)
+    freeAbbrev(parsed);
+  return table;
+}
+
+AbbrevCache::AbbrevCache(const Binary* binary)
+  : binary_(binary),
+    shared_(shared_tables != NULL) {
+  pthread_mutex_init(&mu_, NULL);
+}
+
+AbbrevCache::~AbbrevCache() {
+  // Shared tables are owned by shared_tables.
+  for (map<uint64_t, AbbrevTable*>::iterator iter = tables_.begin();
+       iter != tables_.end() && !shared_;
+       ++iter) {
+    freeAbbrev(iter->second);
+  }
+  pthread_mutex_destroy(&mu_);
+}
+
+const AbbrevTable* AbbrevCache::get(uint64_t offset) {
+  pthread_mutex_lock(&mu_);
+  map<uint64_t, AbbrevTable*>::iterator found = tables_.find(offset);
+  AbbrevTable* table = found != tables_.end() ? found->second : NULL;
+  pthread_mutex_unlock(&mu_);
+  if (table)
+    return table;
+
+  // Parse without the lock. If another thread has added the same table
+  // meanwhile, use it and drop ours.
+  const uint8_t* start = (const uint8_t*)binary_->debug_abbrev + offset;
+  AbbrevTable* parsed = shared_ ? getSharedAbbrev(start) : parseAbbrev(start);
+  pthread_mutex_lock(&mu_);
+  table = tables_.insert(make_pair(offset, parsed)).first->second;
+  pthread_mutex_unlock(&mu_);
+  if (table != parsed && !shared_)
+    freeAbbrev(parsed);
+  return table;
+}
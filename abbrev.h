@@ -0,0 +1,80 @@
+#ifndef ABBREV_H_
+#define ABBREV_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+
+class Binary;
+
+struct Attr {
+  uint16_t name;
+  uint16_t form;
+  // The value of DW_FORM_implicit_const, which is in the abbrev.
+  int64_t implicit_const;
+};
+
+// A step of the decode plan of an abbrev. Consecutive attributes whose
+// forms have a fixed size and are the same in raw and zipped .debug_info
+// are merged into a run of |size| bytes, which has form 0.
+struct Op {
+  uint16_t name;
+  uint16_t form;
+  uint16_t size;
+};
+
+struct Abbrev {
+  uint16_t tag;
+  bool has_children;
+  uint16_t num_attrs;
+  uint16_t num_ops;
+  const Attr* attrs;
+  const Op* plan;
+};
+
+// The abbrevs of a CU indexed by their numbers. The abbrevs, their
+// attributes and their plans live in a single allocation.
+struct AbbrevTable {
+  const Abbrev* abbrevs;
+  size_t num_abbrevs;
+  size_t num_attrs;
+  char* arena;
+};
+
+// Returns the size of a form which is copied as is, or -1. Attributes of
+// such forms are merged into runs.
+int fixedFormSize(uint16_t form);
+
+// Returns the size of the table at |p| of .debug_abbrev.
+size_t abbrevTableSize(const uint8_t* p);
+
+// Parses the table at |p| of .debug_abbrev.
+AbbrevTable* parseAbbrev(const uint8_t* p);
+void freeAbbrev(AbbrevTable* table);
+
+// Parsed abbrev tables keyed by their offsets in .debug_abbrev, so CUs
+// which share a table parse it only once. Tables are never modified or
+// freed once returned, and get() may be called from multiple threads.
+class AbbrevCache {
+public:
+  explicit AbbrevCache(const Binary* binary);
+  ~AbbrevCache();
+
+  const AbbrevTable* get(uint64_t offset);
+
+private:
+  const Binary* binary_;
+  // Whether the tables are shared ones, which aren't freed.
+  bool shared_;
+  pthread_mutex_t mu_;
+  std::map<uint64_t, AbbrevTable*> tables_;
+};
+
+// Makes the caches of binaries read after this share parsed tables with
+// the same bytes, so binaries built from the same objects parse each of
+// their tables once. Shared tables are kept until the process exits.
+void shareAbbrevTables();
+
+#endif  // ABBREV_H_
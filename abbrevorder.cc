@@ -0,0 +1,269 @@
+#include "abbrevorder.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+#include "abbrev.h"
+#include "binary.h"
+#include "leb128.h"
+#include "parallel.h"
+#include "scanner.h"
+#include "zipscanner.h"
+
+using namespace std;
+
+static const size_t COUNT_CHUNK_SIZE = 1024 * 1024;
+
+static bool tableLess(const AbbrevOrderTable& a, const AbbrevOrderTable& b) {
+  return a.abbrev_offset < b.abbrev_offset;
+}
+
+// Counts the DIEs of each abbrev number of the orders, whose counts start
+// at |starts| in |counts|.
+class AbbrevCounter : public Scanner<AbbrevCounter> {
+public:
+  AbbrevCounter(Binary* binary, const vector<AbbrevOrderTable>& tables,
+                const vector<uint64_t>& starts, uint64_t* counts)
+    : Scanner<AbbrevCounter>(binary),
+      tables_(tables),
+      starts_(starts),
+      counts_(counts),
+      cu_counts_(NULL) {
+  }
+
+private:
+  friend class Scanner<AbbrevCounter>;
+
+  static const bool kMergeRuns = true;
+
+  void onCU(const CU* cu, uint64_t) {
+    AbbrevOrderTable key = { cu->abbrev_offset, 0 };
+    vector<AbbrevOrderTable>::const_iterator found =
+      lower_bound(tables_.begin(), tables_.end(), key, tableLess);
+    cu_counts_ = counts_ + starts_[found->order];
+  }
+
+  void onAbbrev(uint64_t number, const Abbrev*, uint64_t) {
+    cu_counts_[number]++;
+  }
+
+  template <bool kZipped, int kPtrSize, int kOffsetSize>
+  void onAttr(uint16_t, uint16_t, uint64_t, uint64_t) {}
+  void onRun(uint64_t) {}
+
+  const vector<AbbrevOrderTable>& tables_;
+  const vector<uint64_t>& starts_;
+  uint64_t* counts_;
+  uint64_t* cu_counts_;
+};
+
+struct CountJob {
+  Binary* binary;
+  const vector<uint64_t>* starts;
+  const vector<AbbrevOrderTable>* tables;
+  const ZipChunk* chunks;
+  vector<vector<uint64_t> > counts;
+};
+
+static void countChunk(void* arg, size_t i) {
+  CountJob* job = static_cast<CountJob*>(arg);
+  job->counts[i].resize(job->starts->back());
+  AbbrevCounter counter(job->binary, *job->tables, *job->starts,
+                        &job->counts[i][0]);
+  counter.run(job->chunks[i].orig_offset, job->chunks[i + 1].orig_offset);
+}
+
+// Ranks are by counts, and numbers of the same count keep their order.
+struct RankLess {
+  const uint64_t* counts;
+
+  bool operator()(uint32_t a, uint32_t b) const {
+    if (counts[a] != counts[b])
+      return counts[a] > counts[b];
+    return a < b;
+  }
+};
+
+AbbrevOrder* AbbrevOrder::build(Binary* binary, int num_threads) {
+  AbbrevOrder* order = new AbbrevOrder();
+  const uint8_t* dinfo = (const uint8_t*)binary->debug_info;
+  const uint8_t* dabbrev = (const uint8_t*)binary->debug_abbrev;
+  map<uint64_t, uint64_t> offsets;
+  for (uint64_t offset = 0; offset + CU_HEADER_SIZE < binary->debug_info_len;
+       offset += cuSize(dinfo + offset)) {
+    CU cu;
+    readCU(dinfo + offset, &cu);
+    offsets[cu.abbrev_offset] = 0;
+  }
+  if (offsets.empty()) {
+    delete order;
+    return NULL;
+  }
+
+  // Tables with the same bytes get the same order.
+  map<string, uint64_t> orders;
+  order->starts_.push_back(0);
+  for (map<uint64_t, uint64_t>::iterator it = offsets.begin();
+       it != offsets.end(); ++it) {
+    const uint8_t* p = dabbrev + it->first;
+    string bytes((const char*)p, abbrevTableSize(p));
+    map<string, uint64_t>::iterator found = orders.find(bytes);
+    if (found == orders.end()) {
+      size_t num_abbrevs =
+        binary->abbrev_cache->get(it->first)->num_abbrevs;
+      found = orders.insert(make_pair(bytes, orders.size())).first;
+      order->starts_.push_back(order->starts_.back() + num_abbrevs);
+    }
+    AbbrevOrderTable table = { it->first, found->second };
+    order->tables_.push_back(table);
+  }
+
+  vector<ZipChunk> chunks;
+  splitChunks(binary, COUNT_CHUNK_SIZE, &chunks);
+  CountJob job;
+  job.binary = binary;
+  job.starts = &order->starts_;
+  job.tables = &order->tables_;
+  job.chunks = &chunks[0];
+  job.counts.resize(chunks.size() - 1);
+  parallelFor(num_threads, job.counts.size(), countChunk, &job);
+  vector<uint64_t> counts(order->starts_.back());
+  for (size_t i = 0; i < job.counts.size(); i++) {
+    for (size_t j = 0; j < counts.size(); j++)
+      counts[j] += job.counts[i][j];
+  }
+
+  // An order is only kept if the DIEs save more bytes than its numbers
+  // take, which isn't the case when the compiler already numbered the
+  // common abbrevs first. The tables must save their own bytes too.
+  int64_t saved = -(int64_t)(sizeof(AbbrevOrderHeader) +
+                             sizeof(AbbrevOrderTable) * order->tables_.size());
+  order->numbers_.resize(counts.size());
+  for (size_t i = 0; i + 1 < order->starts_.size(); i++) {
+    uint64_t start = order->starts_[i];
+    uint64_t end = order->starts_[i + 1];
+    uint32_t* numbers = &order->numbers_[start];
+    for (uint32_t j = 0; j < end - start; j++)
+      numbers[j] = j;
+    RankLess less = { &counts[start] };
+    sort(numbers + 1, numbers + (end - start), less);
+    uint64_t num_ranked = 0;
+    int64_t order_saved = -ulebSize(end - start);
+    for (uint32_t j = 1; j < end - start; j++) {
+      uint64_t count = counts[start + numbers[j]];
+      if (count)
+        num_ranked = j;
+      order_saved += count * (ulebSize(numbers[j]) - ulebSize(j));
+    }
+    for (uint32_t j = 1; j <= num_ranked; j++)
+      order_saved -= ulebSize(numbers[j]);
+    if (order_saved <= 0) {
+      for (uint32_t j = 0; j < end - start; j++)
+        numbers[j] = j;
+      num_ranked = 0;
+    } else {
+      saved += order_saved;
+    }
+    order->num_ranked_.push_back(num_ranked);
+  }
+  if (saved <= 0) {
+    delete order;
+    return NULL;
+  }
+  order->invert();
+  return order;
+}
+
+AbbrevOrder* AbbrevOrder::read(const uint8_t* p, size_t* size) {
+  const uint8_t* start = p;
+  const AbbrevOrderHeader* header = (const AbbrevOrderHeader*)p;
+  AbbrevOrder* order = new AbbrevOrder();
+  const AbbrevOrderTable* tables = (const AbbrevOrderTable*)(header + 1);
+  order->tables_.assign(tables, tables + header->num_tables);
+  p = (const uint8_t*)(tables + header->num_tables);
+
+  order->starts_.push_back(0);
+  for (uint64_t i = 0; i < header->num_orders; i++) {
+    uint64_t num_abbrevs = uleb128(p);
+    uint64_t num_ranked = uleb128(p);
+    order->numbers_.resize(order->starts_.back() + num_abbrevs);
+    uint32_t* numbers = &order->numbers_[order->starts_.back()];
+    vector<bool> ranked(num_abbrevs);
+    for (uint64_t j = 1; j <= num_ranked; j++) {
+      numbers[j] = uleb128(p);
+      if (!numbers[j] || numbers[j] >= num_abbrevs || ranked[numbers[j]])
+        bug("Bad abbrev order: %" PRIu64 "\n", i);
+      ranked[numbers[j]] = true;
+    }
+    uint64_t next = num_ranked + 1;
+    for (uint32_t j = 1; j < num_abbrevs; j++) {
+      if (!ranked[j])
+        numbers[next++] = j;
+    }
+    order->starts_.push_back(order->starts_.back() + num_abbrevs);
+    order->num_ranked_.push_back(num_ranked);
+  }
+  order->invert();
+  *size = p - start;
+  return order;
+}
+
+void AbbrevOrder::write(vector<uint8_t>* out) const {
+  AbbrevOrderHeader header;
+  header.num_tables = tables_.size();
+  header.num_orders = num_ranked_.size();
+  out->insert(out->end(), (const uint8_t*)&header,
+              (const uint8_t*)(&header + 1));
+  out->insert(out->end(), (const uint8_t*)&tables_[0],
+              (const uint8_t*)(&tables_[0] + tables_.size()));
+  for (size_t i = 0; i < num_ranked_.size(); i++) {
+    uint8_t buf[20];
+    uint8_t* p = buf;
+    uleb128o(starts_[i + 1] - starts_[i], p);
+    uleb128o(num_ranked_[i], p);
+    out->insert(out->end(), buf, p);
+    for (uint64_t j = 1; j <= num_ranked_[i]; j++) {
+      p = buf;
+      uleb128o(numbers_[starts_[i] + j], p);
+      out->insert(out->end(), buf, p);
+    }
+  }
+}
+
+int64_t AbbrevOrder::find(uint64_t abbrev_offset) const {
+  AbbrevOrderTable key = { abbrev_offset, 0 };
+  vector<AbbrevOrderTable>::const_iterator found =
+    lower_bound(tables_.begin(), tables_.end(), key, tableLess);
+  if (found == tables_.end() || found->abbrev_offset != abbrev_offset)
+    return -1;
+  return starts_[found->order];
+}
+
+const uint32_t* AbbrevOrder::numbers(uint64_t abbrev_offset) const {
+  int64_t start = find(abbrev_offset);
+  return start < 0 ? NULL : &numbers_[start];
+}
+
+const uint32_t* AbbrevOrder::ranks(uint64_t abbrev_offset) const {
+  int64_t start = find(abbrev_offset);
+  return start < 0 ? NULL : &ranks_[start];
+}
+
+int AbbrevOrder::maxRankSize() const {
+  uint64_t max_rank = 0;
+  for (size_t i = 0; i + 1 < starts_.size(); i++)
+    max_rank = max(max_rank, starts_[i + 1] - starts_[i] - 1);
+  return ulebSize(max_rank);
+}
+
+void AbbrevOrder::invert() {
+  ranks_.resize(numbers_.size());
+  for (size_t i = 0; i + 1 < starts_.size(); i++) {
+    for (uint64_t j = starts_[i]; j < starts_[i + 1]; j++)
+      ranks_[starts_[i] + numbers_[j]] = j - starts_[i];
+  }
+}
@@ -0,0 +1,83 @@
+#ifndef ABBREVORDER_H_
+#define ABBREVORDER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+class Binary;
+
+// Compilers number abbrevs in the order of their first use, so the
+// numbers of common DIEs may take two bytes of ULEB128. Zipped binaries
+// with ZIP_ABBREVS code the abbrev number of each DIE as its rank in the
+// frequency of the abbrevs of its table, and Scanner maps ranks back to
+// the numbers of .debug_abbrev, which is kept as is. Tables with the same
+// bytes, which CUs of a linked binary often have, share an order ranked
+// by the DIEs of all their CUs. The orders follow ZipHeader, the
+// dictionary id, the templates of subtrees and the address index as
+//
+//   AbbrevOrderHeader
+//   AbbrevOrderTable for each table of CUs, in the order of offsets
+//   for each order, ULEB128 num_abbrevs and num_ranked, and the numbers
+//     of the num_ranked most frequent abbrevs
+//
+// Numbers which aren't ranked, as no DIE has them, follow in their order,
+// so an order without ranked numbers keeps them as they are.
+// Ranks and numbers 0 are the null entry.
+struct AbbrevOrderHeader {
+  uint64_t num_tables;
+  uint64_t num_orders;
+};
+
+struct AbbrevOrderTable {
+  // The offset of the table in .debug_abbrev.
+  uint64_t abbrev_offset;
+  uint64_t order;
+};
+
+class AbbrevOrder {
+public:
+  // Ranks the abbrevs of the tables of a raw binary by the DIEs of its
+  // .debug_info. Orders whose DIEs save fewer bytes than their numbers
+  // take keep the numbers. Returns NULL if no order is worth its bytes.
+  static AbbrevOrder* build(Binary* binary, int num_threads);
+
+  // Reads AbbrevOrderHeader at |p| of a zipped binary. Sets |size| to the
+  // bytes it took.
+  static AbbrevOrder* read(const uint8_t* p, size_t* size);
+
+  // Appends AbbrevOrderHeader, the tables and the orders to |out|.
+  void write(std::vector<uint8_t>* out) const;
+
+  // Returns the numbers of the table at |abbrev_offset| by their ranks,
+  // or NULL if no CU has the table.
+  const uint32_t* numbers(uint64_t abbrev_offset) const;
+
+  // Returns the ranks of the table at |abbrev_offset| by their numbers,
+  // or NULL.
+  const uint32_t* ranks(uint64_t abbrev_offset) const;
+
+  // Returns the most bytes of ULEB128 a rank takes.
+  int maxRankSize() const;
+
+private:
+  AbbrevOrder() {}
+
+  // Returns the start of the table at |abbrev_offset| in |numbers_| and
+  // |ranks_|, or -1.
+  int64_t find(uint64_t abbrev_offset) const;
+
+  // Fills |ranks_| from |numbers_|.
+  void invert();
+
+  std::vector<AbbrevOrderTable> tables_;
+  // Where each order starts in |numbers_| and |ranks_|, and the number
+  // of its ranked abbrevs. One past the last order ends them.
+  std::vector<uint64_t> starts_;
+  std::vector<uint64_t> num_ranked_;
+  std::vector<uint32_t> numbers_;
+  std::vector<uint32_t> ranks_;
+};
+
+#endif  // ABBREVORDER_H_
@@ -0,0 +1,103 @@
+#include "abbrevtables.h"
+
+#include <dwarf.h>
+#include <err.h>
+
+#include <map>
+#include <string>
+
+#include "binary.h"
+#include "leb128.h"
+
+using namespace std;
+
+static void appendUleb(vector<uint8_t>* out, uint64_t v) {
+  uint8_t buf[16];
+  uint8_t* p = buf;
+  uleb128o(v, p);
+  out->insert(out->end(), buf, p);
+}
+
+// Walks the table at |p| like abbrevTableSize, and returns its end, or
+// NULL if it runs past |end|.
+static const uint8_t* tableEnd(const uint8_t* p, const uint8_t* end) {
+  while (p < end) {
+    if (!uleb128(p))
+      return p <= end ? p : NULL;
+    uleb128(p);
+    p++;
+    while (p < end) {
+      uint64_t name = uleb128(p);
+      uint64_t form = uleb128(p);
+      if (form == DW_FORM_implicit_const)
+        sleb128(p);
+      if (!name)
+        break;
+    }
+  }
+  return NULL;
+}
+
+bool encodeAbbrevTables(const Binary* binary, vector<uint8_t>* out) {
+  const uint8_t* p = (const uint8_t*)binary->debug_abbrev;
+  const uint8_t* end = p + binary->debug_abbrev_len;
+  map<string, uint64_t> indexes;
+  vector<uint64_t> tables;
+  vector<uint8_t> distinct;
+  while (p < end) {
+    const uint8_t* table_end = tableEnd(p, end);
+    if (!table_end)
+      return false;
+    string bytes((const char*)p, table_end - p);
+    pair<map<string, uint64_t>::iterator, bool> added =
+      indexes.insert(make_pair(bytes, indexes.size()));
+    if (added.second)
+      distinct.insert(distinct.end(), p, table_end);
+    tables.push_back(added.first->second);
+    p = table_end;
+  }
+
+  out->clear();
+  appendUleb(out, tables.size());
+  appendUleb(out, indexes.size());
+  for (size_t i = 0; i < tables.size(); i++)
+    appendUleb(out, tables[i]);
+  out->insert(out->end(), distinct.begin(), distinct.end());
+  return out->size() < binary->debug_abbrev_len;
+}
+
+void decodeAbbrevTables(const uint8_t* p, size_t size, vector<char>* out) {
+  const uint8_t* end = p + size;
+  uint64_t num_tables = uleb128(p);
+  uint64_t num_distinct = uleb128(p);
+  vector<uint64_t> tables;
+  uint64_t next = 0;
+  for (uint64_t i = 0; i < num_tables && p < end; i++) {
+    uint64_t index = uleb128(p);
+    if (index > next)
+      errx(1, "broken abbrev tables");
+    if (index == next)
+      next++;
+    tables.push_back(index);
+  }
+  if (p > end || tables.size() != num_tables || next != num_distinct)
+    errx(1, "broken abbrev tables");
+
+  // The distinct tables, and the end of the last one.
+  vector<const uint8_t*> starts;
+  for (uint64_t i = 0; i < num_distinct; i++) {
+    starts.push_back(p);
+    p = tableEnd(p, end);
+    if (!p)
+      errx(1, "broken abbrev tables");
+  }
+  starts.push_back(p);
+  if (p != end)
+    errx(1, "broken abbrev tables");
+
+  out->clear();
+  for (size_t i = 0; i < tables.size(); i++) {
+    out->insert(out->end(), (const char*)starts[tables[i]],
+                (const char*)starts[tables[i] + 1]);
+  }
+}
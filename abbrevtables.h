@@ -0,0 +1,34 @@
+#ifndef ABBREVTABLES_H_
+#define ABBREVTABLES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+class Binary;
+
+// Compilers emit an abbrev table for each CU and linkers concatenate them,
+// so CUs of similar code often have tables with the same bytes. Zipped
+// binaries with ZIP_ABBREV_TABLES keep each distinct table once in place
+// of .debug_abbrev, laid out as
+//
+//   ULEB128 num_tables and num_distinct
+//   ULEB128 index of the distinct table of each table, in the order of
+//     offsets
+//   the distinct tables in the order of their indexes
+//
+// A table unlike all before it has the next index. Tables follow each
+// other from the start of .debug_abbrev to its end, so their offsets are
+// restored from the sizes of the distinct tables.
+
+// Codes .debug_abbrev of a raw binary into |out|. Returns false if it
+// isn't a run of tables, or if coding it saves no bytes.
+bool encodeAbbrevTables(const Binary* binary, std::vector<uint8_t>* out);
+
+// Restores .debug_abbrev from the |size| bytes at |p| of a zipped binary
+// with ZIP_ABBREV_TABLES into |out|.
+void decodeAbbrevTables(const uint8_t* p, size_t size,
+                        std::vector<char>* out);
+
+#endif  // ABBREVTABLES_H_
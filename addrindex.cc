@@ -0,0 +1,285 @@
+#include "addrindex.h"
+
+#include <dwarf.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "binary.h"
+#include "leb128.h"
+#include "scanner.h"
+
+using namespace std;
+
+static const uint64_t NO_BASE = -1;
+
+void initUnitAddrs(UnitAddrs* unit, const CU& cu, uint64_t cu_offset) {
+  memset(unit, 0, sizeof(*unit));
+  unit->cu_offset = cu_offset;
+  unit->version = cu.version;
+  unit->ptrsize = cu.ptrsize;
+  unit->offset_size = cu.offset_size;
+  unit->addr_base = NO_BASE;
+  unit->rnglists_base = NO_BASE;
+}
+
+void UnitAddrs::onAttr(uint16_t name, uint16_t form, uint64_t value) {
+  switch (name) {
+  case DW_AT_low_pc:
+    low_pc_form = form;
+    low_pc = value;
+    break;
+  case DW_AT_high_pc:
+    high_pc_form = form;
+    high_pc = value;
+    break;
+  case DW_AT_ranges:
+    ranges_form = form;
+    ranges = value;
+    break;
+  case DW_AT_addr_base:
+  case DW_AT_GNU_addr_base:
+    addr_base = value;
+    break;
+  case DW_AT_rnglists_base:
+    rnglists_base = value;
+    break;
+  }
+}
+
+// Reads entry |index| of the .debug_addr table of |unit|. Returns false
+// if the CU has no table or the entry is out of .debug_addr.
+static bool readAddrx(const Binary* binary, const UnitAddrs& unit,
+                      uint64_t index, uint64_t* addr) {
+  if (unit.addr_base == NO_BASE)
+    return false;
+  uint64_t offset = unit.addr_base + index * unit.ptrsize;
+  if (offset + unit.ptrsize > binary->debug_addr_len)
+    return false;
+  *addr = readFixed((const uint8_t*)binary->debug_addr + offset,
+                    unit.ptrsize);
+  return true;
+}
+
+// Reads an address of |form|, which may be an index of .debug_addr.
+static bool readAddr(const Binary* binary, const UnitAddrs& unit,
+                     uint16_t form, uint64_t value, uint64_t* addr) {
+  if (indexKind(form) == INDEX_ADDR)
+    return readAddrx(binary, unit, value, addr);
+  *addr = value;
+  return true;
+}
+
+// Linkers resolve addresses in discarded sections, such as duplicates of
+// inline functions, to 0, -1 or -2, so ranges there are dropped. Neither
+// are those of relocatable objects, where every section starts at 0.
+static void addRange(uint64_t low, uint64_t high, uint64_t cu_offset,
+                     vector<AddrRange>* ranges) {
+  if (low >= high || !low || low >= (uint64_t)-2)
+    return;
+  AddrRange range = { low, high, cu_offset };
+  ranges->push_back(range);
+}
+
+// Appends the ranges of the list at |offset| of .debug_ranges, which are
+// relative to |base| until a base address entry.
+static void readRanges(const Binary* binary, const UnitAddrs& unit,
+                       uint64_t offset, uint64_t base,
+                       vector<AddrRange>* ranges) {
+  const uint8_t* p = (const uint8_t*)binary->debug_ranges;
+  int ptrsize = unit.ptrsize;
+  uint64_t max_addr = ptrsize == 8 ? -1 : (1ull << (ptrsize * 8)) - 1;
+  for (; offset + 2 * ptrsize <= binary->debug_ranges_len;
+       offset += 2 * ptrsize) {
+    uint64_t begin = readFixed(p + offset, ptrsize);
+    uint64_t end = readFixed(p + offset + ptrsize, ptrsize);
+    if (!begin && !end)
+      break;
+    if (begin == max_addr)
+      base = end;
+    else
+      addRange(base + begin, base + end, unit.cu_offset, ranges);
+  }
+}
+
+// Appends the ranges of the list at |offset| of .debug_rnglists of
+// DWARF 5. Stops at an entry it can't read.
+static void readRngList(const Binary* binary, const UnitAddrs& unit,
+                        uint64_t offset, uint64_t base,
+                        vector<AddrRange>* ranges) {
+  if (offset >= binary->debug_rnglists_len)
+    return;
+  const uint8_t* p = (const uint8_t*)binary->debug_rnglists + offset;
+  const uint8_t* end =
+    (const uint8_t*)binary->debug_rnglists + binary->debug_rnglists_len;
+  int ptrsize = unit.ptrsize;
+  while (p < end) {
+    uint8_t kind = *p++;
+    // Lists end with DW_RLE_end_of_list, so only addresses are checked.
+    if ((kind == DW_RLE_base_address || kind == DW_RLE_start_length) &&
+        end - p < ptrsize)
+      return;
+    if (kind == DW_RLE_start_end && end - p < 2 * ptrsize)
+      return;
+    uint64_t low, high;
+    switch (kind) {
+    case DW_RLE_end_of_list:
+      return;
+    case DW_RLE_base_addressx:
+      if (!readAddrx(binary, unit, uleb128(p), &base))
+        return;
+      break;
+    case DW_RLE_startx_endx: {
+      uint64_t begin = uleb128(p);
+      if (!readAddrx(binary, unit, begin, &low) ||
+          !readAddrx(binary, unit, uleb128(p), &high))
+        return;
+      addRange(low, high, unit.cu_offset, ranges);
+      break;
+    }
+    case DW_RLE_startx_length:
+      if (!readAddrx(binary, unit, uleb128(p), &low))
+        return;
+      addRange(low, low + uleb128(p), unit.cu_offset, ranges);
+      break;
+    case DW_RLE_offset_pair:
+      low = base + uleb128(p);
+      high = base + uleb128(p);
+      addRange(low, high, unit.cu_offset, ranges);
+      break;
+    case DW_RLE_base_address:
+      base = readFixed(p, ptrsize);
+      p += ptrsize;
+      break;
+    case DW_RLE_start_end:
+      low = readFixed(p, ptrsize);
+      high = readFixed(p + ptrsize, ptrsize);
+      p += 2 * ptrsize;
+      addRange(low, high, unit.cu_offset, ranges);
+      break;
+    case DW_RLE_start_length:
+      low = readFixed(p, ptrsize);
+      p += ptrsize;
+      addRange(low, low + uleb128(p), unit.cu_offset, ranges);
+      break;
+    default:
+      return;
+    }
+  }
+}
+
+// Appends the ranges of a CU. A unit DIE has either DW_AT_low_pc and
+// DW_AT_high_pc, or DW_AT_ranges with DW_AT_low_pc as the base address.
+static void addUnitRanges(const Binary* binary, const UnitAddrs& unit,
+                          vector<AddrRange>* ranges) {
+  uint64_t low = 0;
+  if (unit.low_pc_form &&
+      !readAddr(binary, unit, unit.low_pc_form, unit.low_pc, &low))
+    return;
+
+  if (unit.ranges_form) {
+    uint64_t offset = unit.ranges;
+    if (unit.ranges_form == DW_FORM_rnglistx) {
+      // The index is of the offsets after the header of the CU's lists,
+      // which are relative to the offsets.
+      uint64_t base = unit.rnglists_base;
+      uint64_t entry = base + offset * unit.offset_size;
+      if (base == NO_BASE ||
+          entry + unit.offset_size > binary->debug_rnglists_len)
+        return;
+      offset = base + readFixed(
+        (const uint8_t*)binary->debug_rnglists + entry, unit.offset_size);
+    }
+    if (unit.version >= 5)
+      readRngList(binary, unit, offset, low, ranges);
+    else
+      readRanges(binary, unit, offset, low, ranges);
+    return;
+  }
+
+  if (!unit.low_pc_form || !unit.high_pc_form)
+    return;
+  // Since DWARF 4, DW_AT_high_pc of a constant class is the size.
+  uint64_t high;
+  if (unit.high_pc_form == DW_FORM_addr ||
+      indexKind(unit.high_pc_form) == INDEX_ADDR) {
+    if (!readAddr(binary, unit, unit.high_pc_form, unit.high_pc, &high))
+      return;
+  } else {
+    high = low + unit.high_pc;
+  }
+  addRange(low, high, unit.cu_offset, ranges);
+}
+
+static bool compareLow(const AddrRange& a, const AddrRange& b) {
+  if (a.low != b.low)
+    return a.low < b.low;
+  return a.cu_offset < b.cu_offset;
+}
+
+static bool compareHigh(uint64_t pc, const AddrRange& range) {
+  return pc < range.high;
+}
+
+AddrIndex::AddrIndex()
+  : ranges_(NULL),
+    num_ranges_(0) {
+}
+
+AddrIndex* AddrIndex::build(const Binary* binary,
+                            const vector<UnitAddrs>& units) {
+  vector<AddrRange> ranges;
+  for (size_t i = 0; i < units.size(); i++)
+    addUnitRanges(binary, units[i], &ranges);
+  if (ranges.empty())
+    return NULL;
+  sort(ranges.begin(), ranges.end(), compareLow);
+
+  // Overlapping parts go to the earlier range, and adjacent ranges of a
+  // CU are merged.
+  AddrIndex* index = new AddrIndex();
+  vector<AddrRange>& built = index->built_;
+  for (size_t i = 0; i < ranges.size(); i++) {
+    AddrRange range = ranges[i];
+    if (!built.empty()) {
+      AddrRange& last = built.back();
+      if (range.high <= last.high)
+        continue;
+      range.low = max(range.low, last.high);
+      if (range.low == last.high && range.cu_offset == last.cu_offset) {
+        last.high = range.high;
+        continue;
+      }
+    }
+    built.push_back(range);
+  }
+  index->ranges_ = &built[0];
+  index->num_ranges_ = built.size();
+  return index;
+}
+
+AddrIndex* AddrIndex::read(const uint8_t* p, size_t* size) {
+  const AddrIndexHeader* header = (const AddrIndexHeader*)p;
+  AddrIndex* index = new AddrIndex();
+  index->ranges_ = (const AddrRange*)(header + 1);
+  index->num_ranges_ = header->num_ranges;
+  *size = sizeof(*header) + sizeof(AddrRange) * header->num_ranges;
+  return index;
+}
+
+void AddrIndex::write(vector<uint8_t>* out) const {
+  AddrIndexHeader header;
+  header.num_ranges = num_ranges_;
+  out->insert(out->end(), (const uint8_t*)&header,
+              (const uint8_t*)(&header + 1));
+  out->insert(out->end(), (const uint8_t*)ranges_,
+              (const uint8_t*)(ranges_ + num_ranges_));
+}
+
+const AddrRange* AddrIndex::find(uint64_t pc) const {
+  const AddrRange* found = upper_bound(ranges_, ranges_ + num_ranges_, pc,
+                                       compareHigh);
+  if (found == ranges_ + num_ranges_ || pc < found->low)
+    return NULL;
+  return found;
+}
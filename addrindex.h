@@ -0,0 +1,89 @@
+#ifndef ADDRINDEX_H_
+#define ADDRINDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+class Binary;
+struct CU;
+
+// Symbolizers look up the CU of an address, which would take decoding
+// every CU of a zipped binary. Zipped binaries with ZIP_ADDRS have an
+// index of the address ranges of CUs, from DW_AT_low_pc, DW_AT_high_pc
+// and DW_AT_ranges of their unit DIEs, which follows ZipHeader, the
+// dictionary id and the templates of subtrees as
+//
+//   AddrIndexHeader
+//   AddrRange in the order of addresses
+//
+// Ranges don't overlap. Where ranges of CUs overlap, the range which
+// starts first keeps the addresses, and of ranges which start together,
+// that of the first CU.
+struct AddrIndexHeader {
+  uint64_t num_ranges;
+};
+
+struct AddrRange {
+  uint64_t low;
+  // One past the last address.
+  uint64_t high;
+  // The offset of the CU header in the original .debug_info.
+  uint64_t cu_offset;
+};
+
+// The attributes of a unit DIE which tell the addresses of its CU, as
+// the compressor sees them. Forms are 0 for missing attributes.
+struct UnitAddrs {
+  uint64_t cu_offset;
+  uint16_t version;
+  uint8_t ptrsize;
+  uint8_t offset_size;
+  uint16_t low_pc_form;
+  uint16_t high_pc_form;
+  uint16_t ranges_form;
+  uint64_t low_pc;
+  uint64_t high_pc;
+  uint64_t ranges;
+  // DW_AT_addr_base and DW_AT_rnglists_base, or -1 if missing.
+  uint64_t addr_base;
+  uint64_t rnglists_base;
+
+  void onAttr(uint16_t name, uint16_t form, uint64_t value);
+};
+
+void initUnitAddrs(UnitAddrs* unit, const CU& cu, uint64_t cu_offset);
+
+class AddrIndex {
+public:
+  // Builds the index of a raw binary from the unit DIEs of its CUs, which
+  // may refer to .debug_ranges, .debug_rnglists and .debug_addr. Returns
+  // NULL if no CU has addresses.
+  static AddrIndex* build(const Binary* binary,
+                          const std::vector<UnitAddrs>& units);
+
+  // Reads AddrIndexHeader at |p| of a zipped binary. The ranges are used
+  // where they are. Sets |size| to the bytes it took.
+  static AddrIndex* read(const uint8_t* p, size_t* size);
+
+  // Appends AddrIndexHeader and the ranges to |out|.
+  void write(std::vector<uint8_t>* out) const;
+
+  // Returns the range which contains |pc|, or NULL.
+  const AddrRange* find(uint64_t pc) const;
+
+  size_t num_ranges() const {
+    return num_ranges_;
+  }
+
+private:
+  AddrIndex();
+
+  const AddrRange* ranges_;
+  size_t num_ranges_;
+  // The ranges of a built index.
+  std::vector<AddrRange> built_;
+};
+
+#endif  // ADDRINDEX_H_
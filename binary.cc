@@ -13,8 +13,16 @@
 
 #include <elf.h>
 
+#include "abbrev.h"
+#include "abbrevorder.h"
+#include "abbrevtables.h"
+#include "addrindex.h"
+#include "strpool.h"
+#include "subtree.h"
+
 #define Elf_Ehdr Elf64_Ehdr
 #define Elf_Shdr Elf64_Shdr
+#define Elf_Off Elf64_Off
 
 Binary::Binary(int fd, char* p, size_t sz, size_t msz)
   : head(NULL),
@@ -24,78 +32,284 @@ Binary::Binary(int fd, char* p, size_t sz, size_t msz)
     debug_info(NULL),
     debug_abbrev(NULL),
     debug_str(NULL),
+    debug_line(NULL),
+    debug_addr(NULL),
+    debug_ranges(NULL),
+    debug_rnglists(NULL),
     debug_info_len(0),
     debug_abbrev_len(0),
     debug_str_len(0),
+    debug_line_len(0),
+    debug_addr_len(0),
+    debug_ranges_len(0),
+    debug_rnglists_len(0),
+    debug_info_offset(0),
     is_zipped(false),
     reduced_size(0),
+    zip_flags(0),
+    zip_chunks(NULL),
+    num_zip_chunks(0),
+    is_streamed(false),
+    string_pool(NULL),
+    abbrev_cache(new AbbrevCache(this)),
+    dictionary(NULL),
+    dict_id(0),
+    subtrees(NULL),
+    addr_index(NULL),
+    abbrev_order(NULL),
+    abbrev_tables(NULL),
+    abbrev_tables_len(0),
+    error(NULL),
     fd_(fd) {
 }
 
-static bool isDwarfZip(char* p) {
+Binary::~Binary() {
+  delete abbrev_cache;
+  delete string_pool;
+  delete subtrees;
+  delete addr_index;
+  delete abbrev_order;
+  if (mapped_head)
+    munmap(mapped_head, mapped_size);
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+static bool isDwarfZip(const char* p) {
   return !strncmp(p, "\xdfZIP", 4);
 }
 
+// Returns the size of the header of a zipped binary before the head.
+static size_t zipHeaderSize(const char* p) {
+  if (!isDwarfZip(p))
+    return 0;
+  if (*(const uint64_t*)(p + 4) == ZIP_REPLACED) {
+    const ZipSectionsHeader* header =
+      (const ZipSectionsHeader*)(p + ZIP_FILE_HEADER_SIZE);
+    return (ZIP_FILE_HEADER_SIZE + sizeof(*header) +
+            sizeof(ZipSection) * header->num_sections);
+  }
+  if (*(const uint64_t*)(p + 4) != ZIP_STREAMED)
+    return ZIP_FILE_HEADER_SIZE;
+  const ZipStreamHeader* header =
+    (const ZipStreamHeader*)(p + ZIP_FILE_HEADER_SIZE);
+  return ZIP_FILE_HEADER_SIZE + sizeof(*header) + header->debug_abbrev_size;
+}
+
+char* Binary::readZipHeader(char* p) {
+  if (!isDwarfZip(p))
+    return p;
+  is_zipped = true;
+  reduced_size = *(uint64_t*)(p + 4);
+  if (reduced_size == ZIP_REPLACED) {
+    const ZipSectionsHeader* header =
+      (const ZipSectionsHeader*)(p + ZIP_FILE_HEADER_SIZE);
+    const ZipSection* sections = (const ZipSection*)(header + 1);
+    reduced_size = header->reduced_size;
+    replaced_sections_.assign(sections, sections + header->num_sections);
+    return p + zipHeaderSize(p);
+  }
+  if (reduced_size != ZIP_STREAMED)
+    return p + ZIP_FILE_HEADER_SIZE;
+
+  // The sizes are only known from the frames.
+  is_streamed = true;
+  char* head = p + zipHeaderSize(p);
+  const ZipStreamHeader* header =
+    (const ZipStreamHeader*)(p + ZIP_FILE_HEADER_SIZE);
+  const ZipHeader* zip_header = (const ZipHeader*)(head + header->head_size);
+  const char* q = (const char*)(zip_header + 1);
+  if (zip_header->flags & ZIP_DICT)
+    q += sizeof(uint64_t);
+  size_t orig_size = 0;
+  for (;;) {
+    const ZipFrame* frame = (const ZipFrame*)q;
+    q += sizeof(*frame) + frame->zip_size;
+    if (!frame->orig_size)
+      break;
+    orig_size += frame->orig_size;
+  }
+  reduced_size = orig_size - (q - (head + header->head_size));
+  return head;
+}
+
+size_t Binary::sectionShift(uint64_t offset) const {
+  size_t shift = 0;
+  for (size_t i = 0; i < replaced_sections_.size(); i++) {
+    const ZipSection& sec = replaced_sections_[i];
+    if (offset < sec.offset + sec.orig_size)
+      break;
+    shift += sec.orig_size - sec.size;
+  }
+  return shift;
+}
+
+size_t Binary::sectionSize(uint64_t offset, size_t size) const {
+  for (size_t i = 0; i < replaced_sections_.size(); i++) {
+    if (replaced_sections_[i].offset == offset)
+      return replaced_sections_[i].size;
+  }
+  return size;
+}
+
+void Binary::readZipChunks() {
+  const ZipHeader* header = (const ZipHeader*)debug_info;
+  zip_flags = header->flags;
+  if (zip_flags & ZIP_STRINGS)
+    string_pool = StringPool::read((const uint8_t*)debug_str, debug_str_len);
+  if (zip_flags & ZIP_ABBREV_TABLES) {
+    abbrev_tables = debug_abbrev;
+    abbrev_tables_len = debug_abbrev_len;
+    decodeAbbrevTables((const uint8_t*)abbrev_tables, abbrev_tables_len,
+                       &restored_abbrev_);
+    debug_abbrev = restored_abbrev_.data();
+    debug_abbrev_len = restored_abbrev_.size();
+  }
+  const char* p = (const char*)(header + 1);
+  if (zip_flags & ZIP_DICT) {
+    dict_id = *(const uint64_t*)p;
+    p += sizeof(dict_id);
+  }
+  if (zip_flags & ZIP_SUBTREES) {
+    size_t size;
+    subtrees = SubtreeTable::read((const uint8_t*)p, &size);
+    p += size;
+  }
+  if (zip_flags & ZIP_ADDRS) {
+    size_t size;
+    addr_index = AddrIndex::read((const uint8_t*)p, &size);
+    p += size;
+  }
+  if (zip_flags & ZIP_ABBREVS) {
+    size_t size;
+    abbrev_order = AbbrevOrder::read((const uint8_t*)p, &size);
+    p += size;
+  }
+  if (is_streamed) {
+    readZipFrames(p);
+    return;
+  }
+  num_zip_chunks = header->num_chunks;
+  zip_chunks = (const ZipChunk*)p;
+  debug_info = (const char*)(zip_chunks + num_zip_chunks + 1);
+  debug_info_len = zip_chunks[num_zip_chunks].zip_offset;
+}
+
+// Builds the chunk table of a streamed binary. The offsets of chunks
+// point at their bytes, so there are gaps of ZipFrame between them.
+void Binary::readZipFrames(const char* frames) {
+  const char* start = frames + sizeof(ZipFrame);
+  const char* q = frames;
+  ZipChunk chunk = { 0, 0 };
+  for (;;) {
+    const ZipFrame* frame = (const ZipFrame*)q;
+    q += sizeof(*frame);
+    chunk.zip_offset = q - start;
+    frame_chunks_.push_back(chunk);
+    if (!frame->orig_size)
+      break;
+    chunk.orig_offset += frame->orig_size;
+    q += frame->zip_size;
+  }
+  zip_chunks = &frame_chunks_[0];
+  num_zip_chunks = frame_chunks_.size() - 1;
+  debug_info = start;
+  debug_info_len = zip_chunks[num_zip_chunks].zip_offset;
+}
+
+const uint8_t* Binary::zipChunk(size_t index, size_t* size) const {
+  const ZipChunk& chunk = zip_chunks[index];
+  const ZipChunk& next = zip_chunks[index + 1];
+  *size = next.zip_offset - chunk.zip_offset;
+  if (is_streamed)
+    *size -= sizeof(ZipFrame);
+  return (const uint8_t*)debug_info + chunk.zip_offset;
+}
+
+// Whether |name| is |section| or its split DWARF version in a .dwo file.
+static bool isSection(const char* name, const char* section) {
+  size_t len = strlen(section);
+  return (!strncmp(name, section, len) &&
+          (!name[len] || !strcmp(name + len, ".dwo")));
+}
+
 class ELFBinary : public Binary {
 public:
-  explicit ELFBinary(const char* filename,
-                     int fd, char* p, size_t sz, size_t msz)
+  ELFBinary(int fd, char* p, size_t sz, size_t msz)
     : Binary(fd, p, sz, msz) {
-    reduced_size = 0;
-    if (isDwarfZip(p)) {
-      is_zipped = true;
-      reduced_size = *(uint32_t*)(p + 4);
-      p += 8;
-    }
-
+    p = readZipHeader(p);
     head = p;
 
     Elf_Ehdr* ehdr = (Elf_Ehdr*)p;
-    if (!ehdr->e_shoff || !ehdr->e_shnum)
-      err(1, "no section header: %s", filename);
-    if (!ehdr->e_shstrndx)
-      err(1, "no section name: %s", filename);
-
-    Elf_Shdr* shdr = (Elf_Shdr*)(p + ehdr->e_shoff - reduced_size);
-    const char* shstr = (const char*)(p + shdr[ehdr->e_shstrndx].sh_offset);
-    shstr -= reduced_size;
+    if (!ehdr->e_shoff || !ehdr->e_shnum) {
+      error = "no section header";
+      return;
+    }
+    if (!ehdr->e_shstrndx) {
+      error = "no section name";
+      return;
+    }
+
+    Elf_Shdr* shdr = (Elf_Shdr*)(p + ehdr->e_shoff - reduced_size -
+                                 sectionShift(ehdr->e_shoff));
+    Elf_Off shstr_offset = shdr[ehdr->e_shstrndx].sh_offset;
+    const char* shstr = p + shstr_offset - reduced_size;
+    shstr -= sectionShift(shstr_offset);
     bool debug_info_seen = false;
     for (int i = 0; i < ehdr->e_shnum; i++) {
       Elf_Shdr* sec = shdr + i;
       const char* pos = p + sec->sh_offset;
       if (debug_info_seen)
         pos -= reduced_size;
-      size_t sz = sec->sh_size;
-      if (!strcmp(shstr + sec->sh_name, ".debug_info")) {
+      pos -= sectionShift(sec->sh_offset);
+      size_t sz = sectionSize(sec->sh_offset, sec->sh_size);
+      if (isSection(shstr + sec->sh_name, ".debug_info")) {
+        // Type units in COMDAT groups have their own sections, and
+        // dwarfzip only codes one of them.
+        if (debug_info_seen) {
+          error = "more than one .debug_info section";
+          return;
+        }
         debug_info = pos;
         debug_info_len = sz - reduced_size;
         debug_info_seen = true;
-      } else if (!strcmp(shstr + sec->sh_name, ".debug_abbrev")) {
+      } else if (isSection(shstr + sec->sh_name, ".debug_abbrev")) {
         debug_abbrev = pos;
         debug_abbrev_len = sz;
-      } else if (!strcmp(shstr + sec->sh_name, ".debug_str")) {
+      } else if (isSection(shstr + sec->sh_name, ".debug_str")) {
         debug_str = pos;
         debug_str_len = sz;
+      } else if (isSection(shstr + sec->sh_name, ".debug_line")) {
+        debug_line = pos;
+        debug_line_len = sz;
+      } else if (isSection(shstr + sec->sh_name, ".debug_addr")) {
+        debug_addr = pos;
+        debug_addr_len = sz;
+      } else if (isSection(shstr + sec->sh_name, ".debug_ranges")) {
+        debug_ranges = pos;
+        debug_ranges_len = sz;
+      } else if (isSection(shstr + sec->sh_name, ".debug_rnglists")) {
+        debug_rnglists = pos;
+        debug_rnglists_len = sz;
       }
     }
 
-    if (!debug_info || !debug_abbrev || !debug_str)
-      err(1, "no debug info: %s", filename);
-  }
+    if (!debug_info || !debug_abbrev || !debug_str) {
+      error = "no debug info";
+      return;
+    }
 
-  ~ELFBinary() {
-    munmap(head, mapped_size);
-    close(fd_);
+    debug_info_offset = debug_info - head;
+    if (is_zipped)
+      readZipChunks();
   }
 
   static bool isELF(const char* p) {
-    if (strncmp(p, ELFMAG, SELFMAG)) {
-      return false;
-    }
-    if (p[EI_CLASS] != ELFCLASS64) {
-      err(1, "non 64bit ELF isn't supported yet");
-    }
-    return true;
+    return !strncmp(p, ELFMAG, SELFMAG);
+  }
+
+  static bool is64Bit(const char* p) {
+    return p[EI_CLASS] == ELFCLASS64;
   }
 };
 
@@ -103,21 +317,18 @@ public:
 
 class MachOBinary : public Binary {
 public:
-  explicit MachOBinary(const char* filename,
-                       int fd, char* p, size_t sz, size_t msz)
+  MachOBinary(int fd, char* p, size_t sz, size_t msz)
     : Binary(fd, p, sz, msz) {
-    reduced_size = 0;
-    if (isDwarfZip(p)) {
-      is_zipped = true;
-      reduced_size = *(uint32_t*)(p + 4);
-      p += 8;
-    }
-
+    p = readZipHeader(p);
     head = p;
 
     mach_header* header = reinterpret_cast<mach_header*>(p);
     p += sizeof(mach_header_64);
     struct load_command* cmds_ptr = reinterpret_cast<struct load_command*>(p);
+    // Sections after __debug_info moved by the size it was reduced by, and
+    // the load commands don't have to list them in the order of offsets.
+    const section_64* info = findSection(header, cmds_ptr, "__debug_info");
+    uint64_t info_offset = info ? info->offset : 0;
 
     for (uint32_t i = 0; i < header->ncmds; i++) {
       switch (cmds_ptr->cmd) {
@@ -132,17 +343,31 @@ public:
           const section_64& sec = sections[j];
           if (strcmp(sec.segname, "__DWARF"))
             continue;
-          const char* pos = head + sec.offset;
-          size_t sz = sec.size;
+          const char* pos = head + sec.offset - sectionShift(sec.offset);
+          if (sec.offset > info_offset)
+            pos -= reduced_size;
+          size_t sz = sectionSize(sec.offset, sec.size);
           if (!strcmp(sec.sectname, "__debug_info")) {
             debug_info = pos;
-            debug_info_len = sz;
+            debug_info_len = sz - reduced_size;
           } else if (!strcmp(sec.sectname, "__debug_abbrev")) {
             debug_abbrev = pos;
             debug_abbrev_len = sz;
           } else if (!strcmp(sec.sectname, "__debug_str")) {
             debug_str = pos;
             debug_str_len = sz;
+          } else if (!strcmp(sec.sectname, "__debug_line")) {
+            debug_line = pos;
+            debug_line_len = sz;
+          } else if (!strcmp(sec.sectname, "__debug_addr")) {
+            debug_addr = pos;
+            debug_addr_len = sz;
+          } else if (!strcmp(sec.sectname, "__debug_ranges")) {
+            debug_ranges = pos;
+            debug_ranges_len = sz;
+          } else if (!strcmp(sec.sectname, "__debug_rnglists")) {
+            debug_rnglists = pos;
+            debug_rnglists_len = sz;
           }
         }
 
@@ -154,30 +379,60 @@ public:
         reinterpret_cast<char*>(cmds_ptr) + cmds_ptr->cmdsize);
     }
 
-    if (!debug_info || !debug_abbrev || !debug_str)
-      err(1, "no debug info: %s", filename);
+    if (!debug_info || !debug_abbrev || !debug_str) {
+      error = "no debug info";
+      return;
+    }
+
+    debug_info_offset = debug_info - head;
+    if (is_zipped)
+      readZipChunks();
+  }
+
+  // Returns the section |name| of the __DWARF segment, or NULL.
+  static const section_64* findSection(const mach_header* header,
+                                       const load_command* cmds_ptr,
+                                       const char* name) {
+    for (uint32_t i = 0; i < header->ncmds; i++) {
+      if (cmds_ptr->cmd == LC_SEGMENT_64) {
+        const segment_command_64* segment =
+          reinterpret_cast<const segment_command_64*>(cmds_ptr);
+        const section_64* sections = reinterpret_cast<const section_64*>(
+          reinterpret_cast<const char*>(cmds_ptr) +
+          sizeof(segment_command_64));
+        for (uint32_t j = 0; j < segment->nsects; j++) {
+          // Names of 16 characters aren't terminated.
+          if (!strncmp(sections[j].segname, "__DWARF", 16) &&
+              !strncmp(sections[j].sectname, name, 16))
+            return &sections[j];
+        }
+      }
+      cmds_ptr = reinterpret_cast<const load_command*>(
+        reinterpret_cast<const char*>(cmds_ptr) + cmds_ptr->cmdsize);
+    }
+    return NULL;
   }
 
   static bool isMachO(const char* p) {
     const mach_header* header = reinterpret_cast<const mach_header*>(p);
-    if (header->magic == MH_MAGIC_64) {
-      return true;
-    }
-    if (header->magic == MH_MAGIC) {
-      err(1, "non 64bit Mach-O isn't supported yet");
-    }
-    return false;
+    return header->magic == MH_MAGIC_64 || header->magic == MH_MAGIC;
   }
-};
 
-Binary* readBinary(const char* filename) {
-  int fd = open(filename, O_RDONLY);
-  if (fd < 0)
-    err(1, "open failed: %s", filename);
+  static bool is64Bit(const char* p) {
+    const mach_header* header = reinterpret_cast<const mach_header*>(p);
+    return header->magic == MH_MAGIC_64;
+  }
+};
 
+// Maps |fd| and parses the binary in it. Returns NULL and sets |error| if
+// it isn't a binary with debug info. |fd| is closed then.
+static Binary* openBinary(int fd, const char** error) {
   size_t size = lseek(fd, 0, SEEK_END);
-  if (size < 8 + 16)
-    err(1, "too small file: %s", filename);
+  if (size < 8 + 16) {
+    close(fd);
+    *error = "too small file";
+    return NULL;
+  }
 
   size_t mapped_size = (size + 0xfff) & ~0xfff;
 
@@ -185,16 +440,55 @@ Binary* readBinary(const char* filename) {
                         PROT_READ, MAP_SHARED,
                         fd, 0);
   if (p == MAP_FAILED)
-    err(1, "mmap failed: %s", filename);
+    err(1, "mmap failed");
 
-  char* header = p;
-  if (isDwarfZip(header)) {
-    header += 8;
-  }
+  char* header = p + zipHeaderSize(p);
+  Binary* binary = NULL;
   if (ELFBinary::isELF(header)) {
-    return new ELFBinary(filename, fd, p, size, mapped_size);
+    if (ELFBinary::is64Bit(header))
+      binary = new ELFBinary(fd, p, size, mapped_size);
+    else
+      *error = "non 64bit ELF isn't supported yet";
   } else if (MachOBinary::isMachO(header)) {
-    return new MachOBinary(filename, fd, p, size, mapped_size);
+    if (MachOBinary::is64Bit(header))
+      binary = new MachOBinary(fd, p, size, mapped_size);
+    else
+      *error = "non 64bit Mach-O isn't supported yet";
+  } else {
+    *error = "unknown file format";
+  }
+  if (binary && binary->error) {
+    *error = binary->error;
+    delete binary;
+    return NULL;
+  }
+  if (!binary) {
+    munmap(p, mapped_size);
+    close(fd);
+  }
+  return binary;
+}
+
+Binary* readBinary(const char* filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    err(1, "open failed: %s", filename);
+  return readBinaryFd(fd, filename);
+}
+
+Binary* readBinaryFd(int fd, const char* filename) {
+  const char* error;
+  Binary* binary = openBinary(fd, &error);
+  if (!binary)
+    errx(1, "%s: %s", error, filename);
+  return binary;
+}
+
+Binary* tryReadBinary(const char* filename, const char** error) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    *error = "open failed";
+    return NULL;
   }
-  err(1, "unknown file format: %s", filename);
+  return openBinary(fd, error);
 }
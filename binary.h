@@ -1,11 +1,130 @@
 #ifndef BINARY_H_
 #define BINARY_H_
 
+#include <stdint.h>
 #include <stdio.h>
 
+#include <vector>
+
+class AbbrevCache;
+class AbbrevOrder;
+class AddrIndex;
+class Dictionary;
+class StringPool;
+class SubtreeTable;
+
+// A zipped binary starts with "\xdfZIP" and the uint64_t reduced_size,
+// by which .debug_info shrank, followed by the original binary with
+// compressed .debug_info.
+static const size_t ZIP_FILE_HEADER_SIZE = 12;
+
+// Compressed .debug_info starts with ZipHeader and a table of
+// num_chunks + 1 ZipChunk, the last of which has the total sizes. A chunk
+// is a run of CUs which can be encoded and decoded independently.
+struct ZipHeader {
+  // The lowest 2 bits are DeltaContext. See also ZIP_ENTROPY and
+  // ZIP_STREAMS.
+  uint32_t flags;
+  uint32_t num_chunks;
+};
+
+// Set in ZipHeader::flags if the delta coded chunks are also entropy
+// coded. Such a chunk starts with the uint64_t size of the delta coded CUs.
+static const uint32_t ZIP_ENTROPY = 4;
+// Set if the fields of the delta coded chunks are split into streams (see
+// streams.h).
+static const uint32_t ZIP_STREAMS = 8;
+
+struct ZipChunk {
+  uint64_t orig_offset;
+  uint64_t zip_offset;
+};
+
+// The reduced_size of binaries compressed to a pipe, which can't be
+// back-patched. Such a binary has ZipStreamHeader and a copy of
+// .debug_abbrev before the original head, so it can be decompressed
+// sequentially, and its chunks are framed instead of indexed: ZipHeader
+// with num_chunks 0 is followed by a ZipFrame and the bytes of each
+// chunk, and a ZipFrame with zero sizes ends them.
+static const uint64_t ZIP_STREAMED = 0xffffffffffffffffull;
+
+struct ZipStreamHeader {
+  // The size of the original binary before .debug_info.
+  uint64_t head_size;
+  uint64_t debug_abbrev_size;
+};
+
+struct ZipFrame {
+  uint64_t orig_size;
+  uint64_t zip_size;
+};
+
+// Set in ZipHeader::flags if DW_FORM_strp and DW_FORM_string refer to the
+// entries of a string pool (see strpool.h), which replaces .debug_str in
+// the rest of the binary.
+static const uint32_t ZIP_STRINGS = 16;
+
+// Set if the line programs of .debug_line are coded (see lines.h), and
+// the coded ones replace .debug_line in the rest of the binary.
+static const uint32_t ZIP_LINES = 32;
+
+// Set if entropy coding may use the models of a dictionary (see dict.h),
+// whose uint64_t id follows ZipHeader.
+static const uint32_t ZIP_DICT = 64;
+
+// Set if duplicate subtrees of DIEs are copies of templates (see
+// subtree.h), which follow ZipHeader and the dictionary id.
+static const uint32_t ZIP_SUBTREES = 128;
+
+// Set if an index of the address ranges of CUs (see addrindex.h) follows
+// the templates.
+static const uint32_t ZIP_ADDRS = 256;
+
+// Set if DW_FORM_ref4 values are coded by predictors chosen per attribute
+// and CU (see refcoder.h) instead of by the last values.
+static const uint32_t ZIP_PREDICT = 512;
+
+// Set if abbrev numbers of DIEs are coded by their ranks (see
+// abbrevorder.h), whose orders follow the address index.
+static const uint32_t ZIP_ABBREVS = 1024;
+
+// Set with ZIP_ENTROPY if the chunks are coded by the static frequencies
+// of RansEncoder (see rans.h) instead of by context mixing.
+static const uint32_t ZIP_STATIC = 2048;
+
+// Set if the chunks code CUs apart from where the linker put them and
+// what they refer to, which are in side data before the coded CUs (see
+// rebase.h). --cache sets it, so relinked CUs hit.
+static const uint32_t ZIP_REBASED = 4096;
+
+// Set if the distinct abbrev tables (see abbrevtables.h) replace
+// .debug_abbrev in the rest of the binary.
+static const uint32_t ZIP_ABBREV_TABLES = 8192;
+
+// The reduced_size of binaries with replaced sections, which have
+// ZipSectionsHeader and a ZipSection for each replaced section before the
+// original head. Sections after a replaced one moved by the sizes of both
+// compressed .debug_info and the replacements, and readers need to know
+// that before they find .debug_info.
+static const uint64_t ZIP_REPLACED = 0xfffffffffffffffeull;
+
+struct ZipSectionsHeader {
+  uint64_t reduced_size;
+  uint64_t num_sections;
+};
+
+// Replaced sections are in the order of offsets.
+struct ZipSection {
+  // The offset in the original binary.
+  uint64_t offset;
+  uint64_t orig_size;
+  uint64_t size;
+};
+
 class Binary {
 public:
   Binary(int fd, char* p, size_t sz, size_t msz);
+  virtual ~Binary();
 
   char* head;
   size_t size;
@@ -14,16 +133,93 @@ public:
   const char* debug_info;
   const char* debug_abbrev;
   const char* debug_str;
+  // NULL if the binary has no .debug_line.
+  const char* debug_line;
+  // NULL if the binary doesn't have them. Only the address index reads
+  // them.
+  const char* debug_addr;
+  const char* debug_ranges;
+  const char* debug_rnglists;
   size_t debug_info_len;
   size_t debug_abbrev_len;
   size_t debug_str_len;
+  size_t debug_line_len;
+  size_t debug_addr_len;
+  size_t debug_ranges_len;
+  size_t debug_rnglists_len;
+  // The offset of .debug_info section from head. For zipped binaries,
+  // debug_info points after the chunk table.
+  size_t debug_info_offset;
   bool is_zipped;
   size_t reduced_size;
+  uint32_t zip_flags;
+  const ZipChunk* zip_chunks;
+  size_t num_zip_chunks;
+  // Whether the chunks are framed. See ZIP_STREAMED.
+  bool is_streamed;
+  // Set for zipped binaries with ZIP_STRINGS, where debug_str points to
+  // the pool, and by the compressor when it pools strings. Owned by the
+  // binary.
+  StringPool* string_pool;
+  // Shared by all scanners of this binary.
+  AbbrevCache* abbrev_cache;
+  // The dictionary of entropy coding, which isn't owned. Set by
+  // useDictionary().
+  const Dictionary* dictionary;
+  // The id of the dictionary for zipped binaries with ZIP_DICT.
+  uint64_t dict_id;
+  // Set for zipped binaries with ZIP_SUBTREES, and by the compressor when
+  // it finds duplicate subtrees. Owned by the binary.
+  SubtreeTable* subtrees;
+  // Set for zipped binaries with ZIP_ADDRS, and by the compressor when it
+  // indexes addresses. Owned by the binary.
+  AddrIndex* addr_index;
+  // Set for zipped binaries with ZIP_ABBREVS, and by the compressor when
+  // it ranks abbrevs. Owned by the binary.
+  AbbrevOrder* abbrev_order;
+  // Set for zipped binaries with ZIP_ABBREV_TABLES to the distinct tables
+  // in place of .debug_abbrev, whose restored bytes debug_abbrev points
+  // to.
+  const char* abbrev_tables;
+  size_t abbrev_tables_len;
+  // Set by the constructor if the file isn't a binary with debug info.
+  const char* error;
+
+  // Returns the compressed bytes of chunk |index| and sets their size.
+  const uint8_t* zipChunk(size_t index, size_t* size) const;
+
+  // The file mapped at mapped_head from its start.
+  int fd() const {
+    return fd_;
+  }
 
 protected:
+  // Reads the header of a zipped binary at |p| and returns the head.
+  char* readZipHeader(char* p);
+  void readZipChunks();
+  // Returns how much further than .debug_info the section at |offset| of
+  // the original binary moved, which is by the replaced sections before it.
+  size_t sectionShift(uint64_t offset) const;
+  // Returns the size of the section at |offset| of the original binary,
+  // whose original size is |size|, in the zipped binary.
+  size_t sectionSize(uint64_t offset, size_t size) const;
+
   int fd_;
+  std::vector<ZipSection> replaced_sections_;
+  // The restored .debug_abbrev of a binary with ZIP_ABBREV_TABLES.
+  std::vector<char> restored_abbrev_;
+
+private:
+  void readZipFrames(const char* frames);
+
+  std::vector<ZipChunk> frame_chunks_;
 };
 
 Binary* readBinary(const char* filename);
+// Takes the ownership of |fd|, which must be seekable.
+Binary* readBinaryFd(int fd, const char* filename);
+// Like readBinary, but returns NULL and sets |error| instead of exiting if
+// |filename| can't be opened or isn't a binary with debug info.
+Binary* tryReadBinary(const char* filename, const char** error);
 
 #endif  // BINARY_H_
@@ -0,0 +1,204 @@
+#include "chunkcache.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "abbrev.h"
+#include "binary.h"
+#include "dict.h"
+#include "hash.h"
+#include "parallel.h"
+#include "scanner.h"
+#include "zipscanner.h"
+
+using namespace std;
+
+// Changed whenever the coding of chunks changes, so entries of older
+// versions are never hit.
+static const uint64_t CACHE_VERSION = 2;
+
+// Flags which don't change the bytes of chunks.
+static const uint32_t UNKEYED_FLAGS = ZIP_LINES | ZIP_ADDRS;
+
+struct HashJob {
+  Binary* binary;
+  uint32_t flags;
+  // The offsets of CUs and the end of the last one.
+  vector<uint64_t> offsets;
+  // Two lanes for each CU.
+  vector<uint64_t> hashes;
+};
+
+// Hashes CU |i| by its delta coded bytes with ZIP_REBASED, which are what
+// the entropy coder codes, and by its abbrev table, which tells it how.
+// The side data aren't coded, so neither the offsets nor the contents of
+// the strings of the CU change its hash.
+static void hashCU(void* arg, size_t i) {
+  HashJob* job = static_cast<HashJob*>(arg);
+  Binary* binary = job->binary;
+  UnitBases bases;
+  size_t size;
+  const uint8_t* delta = deltaChunk(binary, job->flags, job->offsets[i],
+                                    job->offsets[i + 1], false, &bases,
+                                    NULL, &size);
+  CU cu;
+  readCU((const uint8_t*)binary->debug_info + job->offsets[i], &cu);
+  const uint8_t* abbrevs =
+    (const uint8_t*)binary->debug_abbrev + cu.abbrev_offset;
+  uint64_t* h = &job->hashes[i * 2];
+  h[0] = 0;
+  h[1] = size;
+  hashBytes(delta, size, h);
+  hashBytes(abbrevs, abbrevTableSize(abbrevs), h);
+}
+
+void splitKeyedChunks(Binary* binary, uint32_t flags,
+                      size_t chunk_size, int num_threads,
+                      vector<ZipChunk>* chunks, vector<ChunkKey>* keys) {
+  HashJob job;
+  job.binary = binary;
+  job.flags = flags;
+  const uint8_t* dinfo = (const uint8_t*)binary->debug_info;
+  uint64_t offset = 0;
+  while (offset + CU_HEADER_SIZE < binary->debug_info_len) {
+    job.offsets.push_back(offset);
+    offset += cuSize(dinfo + offset);
+  }
+  job.offsets.push_back(offset);
+  size_t num_cus = job.offsets.size() - 1;
+  job.hashes.resize(num_cus * 2);
+  parallelFor(num_threads, num_cus, hashCU, &job);
+
+  uint64_t head[3] = {
+    CACHE_VERSION,
+    flags & ~UNKEYED_FLAGS,
+    binary->dictionary ? binary->dictionary->id() : 0,
+  };
+  ZipChunk chunk = { 0, 0 };
+  chunks->push_back(chunk);
+  size_t first = 0;
+  for (size_t i = 0; i < num_cus; i++) {
+    uint64_t size = job.offsets[i + 1] - job.offsets[i];
+    if (chunk_size && job.hashes[i * 2] % chunk_size >= size &&
+        i + 1 < num_cus)
+      continue;
+    ChunkKey key = { { 0, 0 } };
+    hashBytes((const uint8_t*)head, sizeof(head), key.hash);
+    hashBytes((const uint8_t*)&job.hashes[first * 2],
+              sizeof(uint64_t) * 2 * (i + 1 - first), key.hash);
+    keys->push_back(key);
+    chunk.orig_offset = job.offsets[i + 1];
+    chunks->push_back(chunk);
+    first = i + 1;
+  }
+}
+
+ChunkCache::ChunkCache(const char* dir)
+  : dir_(dir),
+    num_hits_(0),
+    num_misses_(0) {
+  if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+    err(1, "mkdir failed: %s", dir);
+  pthread_mutex_init(&mu_, NULL);
+}
+
+ChunkCache::~ChunkCache() {
+  pthread_mutex_destroy(&mu_);
+}
+
+string ChunkCache::path(const ChunkKey& key) const {
+  char name[40];
+  snprintf(name, sizeof(name), "/%016lx%016lx", key.hash[0], key.hash[1]);
+  return dir_ + name;
+}
+
+// Reads the whole file |fd| into |data|.
+static bool readFile(int fd, vector<uint8_t>* data) {
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+    return false;
+  data->resize(st.st_size);
+  size_t done = 0;
+  while (done < data->size()) {
+    ssize_t r = read(fd, &(*data)[done], data->size() - done);
+    if (r <= 0)
+      return false;
+    done += r;
+  }
+  return true;
+}
+
+bool ChunkCache::get(const ChunkKey& key, vector<uint8_t>* buf) {
+  vector<uint8_t> data;
+  int fd = open(path(key).c_str(), O_RDONLY);
+  bool hit = fd >= 0 && readFile(fd, &data);
+  if (fd >= 0)
+    close(fd);
+
+  // Entries of another size are broken ones, which are replaced.
+  ChunkCacheHeader header;
+  if (hit && data.size() >= sizeof(header)) {
+    memcpy(&header, &data[0], sizeof(header));
+    hit = data.size() == sizeof(header) + header.zip_size;
+  } else {
+    hit = false;
+  }
+  if (hit)
+    buf->insert(buf->end(), data.begin() + sizeof(header), data.end());
+
+  pthread_mutex_lock(&mu_);
+  if (hit)
+    num_hits_++;
+  else
+    num_misses_++;
+  pthread_mutex_unlock(&mu_);
+  return hit;
+}
+
+void ChunkCache::put(const ChunkKey& key, const uint8_t* p, size_t size) {
+  ChunkCacheHeader header;
+  header.zip_size = size;
+  vector<uint8_t> data((const uint8_t*)&header,
+                       (const uint8_t*)(&header + 1));
+  data.insert(data.end(), p, p + size);
+
+  // The cache only saves time, so failing to add to it isn't an error.
+  string tmp = dir_ + "/tmp.XXXXXX";
+  vector<char> name(tmp.begin(), tmp.end());
+  name.push_back('\0');
+  int fd = mkstemp(&name[0]);
+  if (fd < 0) {
+    warn("mkstemp failed: %s", &name[0]);
+    return;
+  }
+  bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size();
+  ok = !fchmod(fd, 0644) && ok;
+  ok = !close(fd) && ok;
+  if (!ok || rename(&name[0], path(key).c_str()) < 0) {
+    warn("write failed: %s", &name[0]);
+    unlink(&name[0]);
+  }
+}
+
+void ChunkCache::encode(const ChunkKey& key, Binary* binary, uint32_t flags,
+                        uint64_t begin, uint64_t end, bool verbose,
+                        vector<uint8_t>* buf, vector<UnitAddrs>* units) {
+  UnitBases bases;
+  size_t size;
+  const uint8_t* delta = deltaChunk(binary, flags, begin, end, verbose,
+                                    &bases, units, &size);
+  buf->clear();
+  bases.write(buf);
+  size_t side_size = buf->size();
+  if (get(key, buf))
+    return;
+  codeDelta(binary, flags, delta, size, &bases, buf);
+  put(key, &(*buf)[side_size], buf->size() - side_size);
+}
@@ -0,0 +1,95 @@
+#ifndef CHUNKCACHE_H_
+#define CHUNKCACHE_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+class Binary;
+struct UnitAddrs;
+struct ZipChunk;
+
+// Between two builds of a binary most CUs don't change, and neither do
+// the compressed bytes of chunks of such CUs. A chunk cache keeps the
+// coded CUs of chunks in a directory, each in a file named by the hash of
+// everything their bytes depend on: the delta coded bytes of the CUs and
+// their abbrev tables, the flags and the dictionary. Coded CUs whose key
+// is cached are copied instead of entropy coded, which is most of the
+// time of encoding.
+//
+// A relink moves the CUs after a change, and their strings, line
+// programs and code. Cached chunks have ZIP_REBASED, which keeps those
+// bases in side data apart from the coded CUs (see rebase.h), so moved
+// CUs still hit. The side data and the unit DIEs of -a come from a delta
+// coding of each chunk, which is fast, and aren't cached.
+//
+// Each chunk starts its models afresh, so any run of CUs can be one. With
+// the cache, a chunk ends after a CU whose hash says so, with a chance of
+// the size of the CU in the chunk size, so chunks after a changed CU end
+// where they did before. The output doesn't depend on what is cached.
+//
+// Pooled strings, copies of templates and abbrev ranks are numbered
+// across the whole binary, so chunks with ZIP_STRINGS, ZIP_SUBTREES or
+// ZIP_ABBREVS can't be cached.
+struct ChunkKey {
+  uint64_t hash[2];
+};
+
+// Groups CUs of a raw binary into chunks of about |chunk_size| bytes by
+// their hashes, or a chunk per CU if |chunk_size| is 0, and appends
+// num_chunks + 1 entries to |chunks| like splitChunks(). Sets the key of
+// each chunk coded with |flags|, which have ZIP_REBASED, in |keys|. CUs
+// are hashed with |num_threads| threads.
+void splitKeyedChunks(Binary* binary, uint32_t flags,
+                      size_t chunk_size, int num_threads,
+                      std::vector<ZipChunk>* chunks,
+                      std::vector<ChunkKey>* keys);
+
+// An entry is a ChunkCacheHeader followed by the coded CUs of the chunk.
+struct ChunkCacheHeader {
+  uint64_t zip_size;
+};
+
+class ChunkCache {
+public:
+  // Keeps entries in |dir|, which is created if it doesn't exist.
+  explicit ChunkCache(const char* dir);
+  ~ChunkCache();
+
+  // Encodes CUs in [begin, end) of a raw binary into |buf| like
+  // encodeChunk() with |flags|, which have ZIP_REBASED, but copies the
+  // coded CUs if |key| is cached, and adds them otherwise. May be called
+  // from multiple threads.
+  void encode(const ChunkKey& key, Binary* binary, uint32_t flags,
+              uint64_t begin, uint64_t end, bool verbose,
+              std::vector<uint8_t>* buf, std::vector<UnitAddrs>* units);
+
+  size_t num_hits() const {
+    return num_hits_;
+  }
+
+  size_t num_misses() const {
+    return num_misses_;
+  }
+
+private:
+  std::string path(const ChunkKey& key) const;
+
+  // Appends the coded CUs of |key| to |buf|. Returns false if they
+  // aren't cached.
+  bool get(const ChunkKey& key, std::vector<uint8_t>* buf);
+
+  // Adds |size| bytes of coded CUs at |p|. Entries are written to
+  // temporary files and renamed, so readers never see partial ones.
+  void put(const ChunkKey& key, const uint8_t* p, size_t size);
+
+  std::string dir_;
+  pthread_mutex_t mu_;
+  size_t num_hits_;
+  size_t num_misses_;
+};
+
+#endif  // CHUNKCACHE_H_
@@ -0,0 +1,80 @@
+#include "cucache.h"
+
+#include <err.h>
+
+#include <algorithm>
+
+#include "scanner.h"
+#include "zipscanner.h"
+
+using namespace std;
+
+static bool compareOrigOffset(uint64_t offset, const ZipChunk& chunk) {
+  return offset < chunk.orig_offset;
+}
+
+CUCache::CUCache(Binary* binary, size_t capacity)
+  : binary_(binary),
+    capacity_(capacity ? capacity : 1),
+    num_decoded_(0) {
+  if (binary->is_zipped) {
+    chunks_ = binary->zip_chunks;
+    num_chunks_ = binary->num_zip_chunks;
+  } else {
+    splitChunks(binary, 0, &raw_chunks_);
+    chunks_ = &raw_chunks_[0];
+    num_chunks_ = raw_chunks_.size() - 1;
+  }
+}
+
+const uint8_t* CUCache::getCU(uint64_t offset, uint64_t* cu_offset,
+                              size_t* len) {
+  if (offset >= chunks_[num_chunks_].orig_offset)
+    return NULL;
+  const ZipChunk* found = upper_bound(chunks_, chunks_ + num_chunks_ + 1,
+                                      offset, compareOrigOffset);
+  size_t index = found - chunks_ - 1;
+
+  const uint8_t* p = getChunk(index);
+  uint64_t start = chunks_[index].orig_offset;
+  while (true) {
+    size_t cu_len = cuSize(p);
+    if (offset < start + cu_len) {
+      *cu_offset = start;
+      *len = cu_len;
+      return p;
+    }
+    start += cu_len;
+    p += cu_len;
+  }
+}
+
+const uint8_t* CUCache::getChunk(size_t index) {
+  if (!binary_->is_zipped)
+    return (const uint8_t*)binary_->debug_info + chunks_[index].orig_offset;
+
+  map<size_t, list<Entry>::iterator>::iterator found = cache_.find(index);
+  if (found != cache_.end()) {
+    lru_.splice(lru_.begin(), lru_, found->second);
+    return &lru_.front().buf[0];
+  }
+
+  if (lru_.size() >= capacity_) {
+    cache_.erase(lru_.back().index);
+    lru_.pop_back();
+  }
+
+  const ZipChunk& chunk = chunks_[index];
+  const ZipChunk& next = chunks_[index + 1];
+  lru_.push_front(Entry());
+  Entry* entry = &lru_.front();
+  entry->index = index;
+  entry->buf.resize(next.orig_offset - chunk.orig_offset);
+  cache_[index] = lru_.begin();
+
+  uint8_t* out = &entry->buf[0];
+  if (decodeChunk(binary_, index, false, out) != out + entry->buf.size())
+    errx(1, "broken chunk: %zu", index);
+  num_decoded_++;
+  return out;
+}
@@ -0,0 +1,50 @@
+#ifndef CUCACHE_H_
+#define CUCACHE_H_
+
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include "binary.h"
+
+// Gives random access to the original bytes of CUs without decompressing
+// the whole binary. For a zipped binary, only the chunk which contains the
+// requested CU is decoded and the recently used chunks are kept up to
+// |capacity|. Binaries compressed with -i have a chunk for each CU. Raw
+// binaries are also accepted and no decoding happens for them.
+class CUCache {
+public:
+  CUCache(Binary* binary, size_t capacity);
+
+  // Returns the original bytes of the CU which contains |offset| of
+  // .debug_info, and sets the offset and the length of the CU. Returns
+  // NULL if |offset| is out of .debug_info. The returned bytes may be
+  // freed by later calls.
+  const uint8_t* getCU(uint64_t offset, uint64_t* cu_offset, size_t* len);
+
+  size_t num_decoded() const {
+    return num_decoded_;
+  }
+
+private:
+  struct Entry {
+    size_t index;
+    std::vector<uint8_t> buf;
+  };
+
+  const uint8_t* getChunk(size_t index);
+
+  Binary* binary_;
+  size_t capacity_;
+  std::vector<ZipChunk> raw_chunks_;
+  const ZipChunk* chunks_;
+  size_t num_chunks_;
+  size_t num_decoded_;
+  // The most recently used chunk comes first.
+  std::list<Entry> lru_;
+  std::map<size_t, std::list<Entry>::iterator> cache_;
+};
+
+#endif  // CUCACHE_H_
@@ -0,0 +1,78 @@
+#ifndef DELTA_H_
+#define DELTA_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+// The contexts of delta predictors, stored in the flags of ZipHeader.
+enum DeltaContext {
+  // The attribute name.
+  DELTA_CONTEXT_ATTR = 0,
+  // The tag of the DIE and the attribute name.
+  DELTA_CONTEXT_TAG = 1,
+  // The abbrev number of the DIE and the attribute name.
+  DELTA_CONTEXT_ABBREV = 2,
+  NUM_DELTA_CONTEXTS
+};
+
+// The last values of delta coded attributes in a CU. Each context has a
+// slot in a flat table. DW_AT values fit in the table, so attribute
+// contexts never collide. Other contexts are hashed, and a collision only
+// makes a worse prediction. Slots of older CUs are invalidated by bumping
+// the epoch instead of clearing the table.
+class DeltaTable {
+public:
+  explicit DeltaTable(int context)
+    : context_(context),
+      die_(0),
+      epoch_(1),
+      slots_(TABLE_SIZE) {
+  }
+
+  int context() const {
+    return context_;
+  }
+
+  void reset() {
+    epoch_++;
+  }
+
+  void setDIE(uint64_t number, uint16_t tag) {
+    if (context_ == DELTA_CONTEXT_TAG)
+      die_ = tag;
+    else if (context_ == DELTA_CONTEXT_ABBREV)
+      die_ = number;
+  }
+
+  // Returns the last value for |name| in the current DIE context, which is
+  // 0 if there was no value in this CU.
+  uint64_t& get(uint16_t name) {
+    uint32_t index = name;
+    if (context_ != DELTA_CONTEXT_ATTR)
+      index ^= die_ * 0x9e3779b1;
+    Slot& slot = slots_[index & (TABLE_SIZE - 1)];
+    if (slot.epoch != epoch_) {
+      slot.epoch = epoch_;
+      slot.value = 0;
+    }
+    return slot.value;
+  }
+
+private:
+  static const uint32_t TABLE_SIZE = 0x4000;
+
+  struct Slot {
+    Slot() : value(0), epoch(0) {}
+
+    uint64_t value;
+    uint32_t epoch;
+  };
+
+  int context_;
+  uint32_t die_;
+  uint32_t epoch_;
+  std::vector<Slot> slots_;
+};
+
+#endif  // DELTA_H_
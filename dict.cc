@@ -0,0 +1,211 @@
+#include "dict.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "binary.h"
+#include "hash.h"
+#include "rans.h"
+
+using namespace std;
+
+static const char DICT_MAGIC[] = "\xdf" "DIC";
+
+// Models which coded fewer bytes than this aren't trained, as a few
+// samples say little about other binaries.
+static const uint32_t MIN_TRAINED_BYTES = 16;
+
+// The flags of ZipHeader which change the fields models see: the
+// DeltaContext, ZIP_STRINGS and ZIP_PREDICT.
+static const uint32_t FIELD_FLAGS = 3 | ZIP_STRINGS | ZIP_PREDICT;
+
+// Trained probabilities stay this far from certainty.
+static const uint16_t MIN_PROB = 32;
+static const uint16_t MAX_PROB = (1 << EntropyModels::PROB_BITS) - MIN_PROB;
+
+// The probability of a one bit at each node of the tree of bits of the
+// 256 bytes, smoothed for rare nodes.
+static void trainProbs(const uint32_t* bytes, uint16_t* probs) {
+  uint64_t ones[512] = {}, totals[512] = {};
+  for (int b = 0; b < 256; b++) {
+    for (int m = 256 + b; m > 1; m /= 2) {
+      ones[m / 2] += (m & 1) * (uint64_t)bytes[b];
+      totals[m / 2] += bytes[b];
+    }
+  }
+  probs[0] = 0;
+  for (int m = 1; m < 256; m++) {
+    uint64_t prob = ((ones[m] * 2 + 1) << EntropyModels::PROB_BITS) /
+        (totals[m] * 2 + 2);
+    probs[m] = max<uint64_t>(MIN_PROB, min<uint64_t>(prob, MAX_PROB));
+  }
+}
+
+template <class T>
+static void append(vector<uint8_t>* out, const T& v) {
+  out->insert(out->end(), (const uint8_t*)&v, (const uint8_t*)&v + sizeof(v));
+}
+
+Dictionary* Dictionary::train(const ModelCounts* counts, uint32_t flags) {
+  Dictionary* dict = new Dictionary();
+  dict->flags_ = flags;
+  for (int k = 0; k < NUM_DICT_MODELS; k++) {
+    const ModelCounts& c = counts[k];
+    ModelPriors& priors = dict->priors_[k];
+    priors.freqs.assign(EntropyModels::NUM_MODELS * 256, 0);
+    priors.probs.assign(EntropyModels::NUM_MODELS * 256, 0);
+    priors.trained.assign(EntropyModels::NUM_MODELS, false);
+    for (size_t i = 0; i < EntropyModels::NUM_MODELS; i++) {
+      const uint32_t* bytes = &c.bytes[i * 256];
+      uint64_t total = 0;
+      for (int b = 0; b < 256; b++)
+        total += bytes[b];
+      if (total < MIN_TRAINED_BYTES)
+        continue;
+      priors.trained[i] = true;
+      RansModels::normalize(bytes, &priors.freqs[i * 256]);
+      trainProbs(bytes, &priors.probs[i * 256]);
+    }
+  }
+  dict->serialize(&dict->data_);
+  return dict;
+}
+
+bool Dictionary::fits(uint32_t flags) const {
+  return (flags & FIELD_FLAGS) == (flags_ & FIELD_FLAGS);
+}
+
+void Dictionary::serialize(vector<uint8_t>* out) {
+  out->clear();
+  for (int k = 0; k < NUM_DICT_MODELS; k++) {
+    const ModelPriors& priors = priors_[k];
+    uint64_t num_trained = 0;
+    for (size_t i = 0; i < EntropyModels::NUM_MODELS; i++)
+      num_trained += priors.trained[i];
+    append(out, num_trained);
+    for (size_t i = 0; i < EntropyModels::NUM_MODELS; i++) {
+      if (!priors.trained[i])
+        continue;
+      append(out, (uint16_t)i);
+      const uint16_t* freqs = &priors.freqs[i * 256];
+      out->insert(out->end(), (const uint8_t*)freqs,
+                  (const uint8_t*)(freqs + 256));
+      const uint16_t* probs = &priors.probs[i * 256];
+      out->insert(out->end(), (const uint8_t*)(probs + 1),
+                  (const uint8_t*)(probs + 256));
+    }
+  }
+  id_ = hashBytes(&(*out)[0], out->size());
+}
+
+Dictionary* Dictionary::read(const char* filename) {
+  FILE* fp = fopen(filename, "rb");
+  if (!fp)
+    err(1, "open failed: %s", filename);
+  vector<uint8_t> bytes;
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    bytes.insert(bytes.end(), buf, buf + n);
+  if (ferror(fp))
+    err(1, "read failed: %s", filename);
+  fclose(fp);
+
+  DictionaryHeader header;
+  size_t magic_size = sizeof(DICT_MAGIC) - 1;
+  if (bytes.size() < magic_size + sizeof(header) ||
+      memcmp(&bytes[0], DICT_MAGIC, magic_size))
+    errx(1, "not a dictionary: %s", filename);
+  memcpy(&header, &bytes[magic_size], sizeof(header));
+  if (header.num_models != NUM_DICT_MODELS)
+    errx(1, "unknown dictionary: %s", filename);
+
+  Dictionary* dict = new Dictionary();
+  dict->flags_ = header.flags;
+  dict->data_.assign(bytes.begin() + magic_size + sizeof(header),
+                     bytes.end());
+  if (dict->data_.empty())
+    errx(1, "broken dictionary: %s", filename);
+  const uint8_t* p = &dict->data_[0];
+  const uint8_t* end = p + dict->data_.size();
+  size_t model_size = sizeof(uint16_t) * (1 + 256 + 255);
+  for (int k = 0; k < NUM_DICT_MODELS; k++) {
+    ModelPriors& priors = dict->priors_[k];
+    priors.freqs.assign(EntropyModels::NUM_MODELS * 256, 0);
+    priors.probs.assign(EntropyModels::NUM_MODELS * 256, 0);
+    priors.trained.assign(EntropyModels::NUM_MODELS, false);
+    uint64_t num_trained;
+    if ((size_t)(end - p) < sizeof(num_trained))
+      errx(1, "broken dictionary: %s", filename);
+    memcpy(&num_trained, p, sizeof(num_trained));
+    p += sizeof(num_trained);
+    if (num_trained > (uint64_t)(end - p) / model_size)
+      errx(1, "broken dictionary: %s", filename);
+    for (uint64_t j = 0; j < num_trained; j++) {
+      uint16_t i;
+      memcpy(&i, p, sizeof(i));
+      if (i >= EntropyModels::NUM_MODELS)
+        errx(1, "broken dictionary: %s", filename);
+      priors.trained[i] = true;
+      uint16_t* freqs = &priors.freqs[i * 256];
+      memcpy(freqs, p + sizeof(i), 256 * sizeof(*freqs));
+      uint32_t sum = 0;
+      for (int b = 0; b < 256; b++)
+        sum += freqs[b];
+      if (sum != RansModels::FREQ_TOTAL)
+        errx(1, "broken dictionary: %s", filename);
+      uint16_t* probs = &priors.probs[i * 256];
+      memcpy(probs + 1, p + sizeof(i) + 256 * sizeof(*freqs),
+             255 * sizeof(*probs));
+      for (int m = 1; m < 256; m++) {
+        if (probs[m] < MIN_PROB || probs[m] > MAX_PROB)
+          errx(1, "broken dictionary: %s", filename);
+      }
+      p += model_size;
+    }
+  }
+  if (p != end)
+    errx(1, "broken dictionary: %s", filename);
+  dict->id_ = hashBytes(&dict->data_[0], dict->data_.size());
+  if (dict->id_ != header.id)
+    errx(1, "broken dictionary: %s", filename);
+  return dict;
+}
+
+void Dictionary::write(const char* filename) const {
+  DictionaryHeader header;
+  header.id = id_;
+  header.flags = flags_;
+  header.num_models = NUM_DICT_MODELS;
+  FILE* fp = fopen(filename, "wb");
+  if (!fp)
+    err(1, "open failed: %s", filename);
+  fwrite(DICT_MAGIC, 1, sizeof(DICT_MAGIC) - 1, fp);
+  fwrite(&header, sizeof(header), 1, fp);
+  fwrite(&data_[0], 1, data_.size(), fp);
+  if (fclose(fp))
+    err(1, "write failed: %s", filename);
+}
+
+void useDictionary(Binary* binary, const Dictionary* dict) {
+  if (binary->is_zipped) {
+    // Binaries coded without a dictionary don't need one.
+    if (!(binary->zip_flags & ZIP_DICT))
+      return;
+    if (binary->dict_id != dict->id())
+      errx(1, "coded with another dictionary");
+  }
+  binary->dictionary = dict;
+}
+
+const ModelPriors* dictPriors(const Binary* binary, DictModels models) {
+  if (binary->is_zipped && (binary->zip_flags & ZIP_DICT) &&
+      !binary->dictionary)
+    errx(1, "coded with a dictionary, which isn't given");
+  if (!binary->dictionary)
+    return NULL;
+  return binary->dictionary->priors(models);
+}
@@ -0,0 +1,95 @@
+#ifndef DICT_H_
+#define DICT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "entropy.h"
+
+class Binary;
+
+// Binaries built by the same toolchain code much the same fields, but
+// entropy coding learns the models of each chunk from scratch, or writes
+// their frequencies with ZIP_STATIC, which costs the most for small
+// binaries. A dictionary is trained by dwarfzip --train on a sample of
+// such binaries and holds the models which coded enough bytes there,
+// which chunks start from or use instead of their own where they fit.
+// Binaries coded with one have ZIP_DICT and need the same dictionary to
+// be decoded. A dictionary only fits options which give the fields it was
+// trained on (see Dictionary::fits). It is laid out as
+//
+//   "\xdfDIC"
+//   DictionaryHeader
+//   for each DictModels
+//     uint64_t number of trained models
+//     for each trained model, uint16_t index, uint16_t frequencies of
+//     the 256 bytes and uint16_t probabilities of the nodes 1 to 255
+struct DictionaryHeader {
+  // A hash of the rest of the dictionary, which zipped binaries keep.
+  uint64_t id;
+  // The flags of ZipHeader the dictionary was trained with.
+  uint32_t flags;
+  uint32_t num_models;
+};
+
+// The sets of models in a dictionary.
+enum DictModels {
+  // Fields of delta coded CUs.
+  DICT_MODELS_INFO,
+  // Fields of line programs.
+  DICT_MODELS_LINES,
+  NUM_DICT_MODELS
+};
+
+class Dictionary {
+public:
+  // Trains a dictionary from |counts| of each DictModels.
+  static Dictionary* train(const ModelCounts* counts, uint32_t flags);
+
+  // Reads a dictionary written by write(). Exits if it's broken.
+  static Dictionary* read(const char* filename);
+
+  void write(const char* filename) const;
+
+  uint64_t id() const {
+    return id_;
+  }
+
+  uint32_t flags() const {
+    return flags_;
+  }
+
+  // Whether chunks coded with |flags| have the fields the dictionary was
+  // trained on, which other contexts, pooled strings or predicted refs
+  // change.
+  bool fits(uint32_t flags) const;
+
+  const ModelPriors* priors(DictModels models) const {
+    return &priors_[models];
+  }
+
+private:
+  Dictionary() : id_(0), flags_(0) {}
+
+  // Serializes the models and sets id_.
+  void serialize(std::vector<uint8_t>* out);
+
+  uint64_t id_;
+  uint32_t flags_;
+  ModelPriors priors_[NUM_DICT_MODELS];
+  // The bytes after the header.
+  std::vector<uint8_t> data_;
+};
+
+// Makes |binary| coded with |dict|. Exits if |binary| was zipped with
+// another dictionary.
+void useDictionary(Binary* binary, const Dictionary* dict);
+
+// Returns the priors of |models| for coding |binary|, or NULL if it has
+// no dictionary. Exits if |binary| is zipped with a dictionary and none
+// is given.
+const ModelPriors* dictPriors(const Binary* binary, DictModels models);
+
+#endif  // DICT_H_
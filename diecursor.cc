@@ -0,0 +1,301 @@
+#include "diecursor.h"
+
+#include <dwarf.h>
+#include <string.h>
+
+#include "leb128.h"
+#include "strpool.h"
+
+using namespace std;
+
+DIECursor::DIECursor(Binary* binary)
+  : binary_(binary),
+    cache_(binary, 1),
+    cu_offset_(0),
+    cu_begin_(NULL),
+    cu_end_(NULL),
+    abbrevs_(NULL),
+    die_(NULL),
+    attrs_(NULL),
+    attrs_end_(NULL),
+    abbrev_(NULL),
+    depth_(0) {
+}
+
+bool DIECursor::nextCU() {
+  return seekCU(cu_begin_ ? cu_offset_ + (cu_end_ - cu_begin_) : 0);
+}
+
+bool DIECursor::seekCU(uint64_t offset) {
+  size_t len;
+  cu_begin_ = cache_.getCU(offset, &cu_offset_, &len);
+  if (!cu_begin_) {
+    die_ = NULL;
+    return false;
+  }
+  cu_end_ = cu_begin_ + len;
+  readCU(cu_begin_, &cu_);
+  abbrevs_ = binary_->abbrev_cache->get(cu_.abbrev_offset);
+  return moveTo(cu_begin_ + cu_.header_size, 0);
+}
+
+bool DIECursor::moveTo(const uint8_t* p, int depth) {
+  while (p < cu_end_) {
+    const uint8_t* die = p;
+    uint64_t number = uleb128(p);
+    if (!number) {
+      // The siblings end, and the unit DIE has none.
+      if (--depth <= 0)
+        break;
+      continue;
+    }
+    if (number >= abbrevs_->num_abbrevs)
+      bug("Unknown abbrev number: %" PRIu64 "\n", number);
+    die_ = die;
+    attrs_ = p;
+    attrs_end_ = NULL;
+    abbrev_ = &abbrevs_->abbrevs[number];
+    depth_ = depth;
+    return true;
+  }
+  die_ = NULL;
+  return false;
+}
+
+bool DIECursor::next() {
+  int depth = depth_ + (abbrev_->has_children ? 1 : 0);
+  // A unit DIE without children is the whole CU.
+  if (!depth) {
+    die_ = NULL;
+    return false;
+  }
+  return moveTo(attrsEnd(), depth);
+}
+
+bool DIECursor::skipSubtree() {
+  // The unit DIE has no siblings.
+  if (!depth_) {
+    die_ = NULL;
+    return false;
+  }
+  if (!abbrev_->has_children)
+    return next();
+
+  // Only references within the CU forward are followed.
+  AttrValue sibling;
+  if (findAttr(DW_AT_sibling, &sibling) &&
+      attrStream(sibling.form) == STREAM_REF &&
+      sibling.value < (uint64_t)(cu_end_ - cu_begin_) &&
+      cu_begin_ + sibling.value > die_)
+    return moveTo(cu_begin_ + sibling.value, depth_);
+
+  const uint8_t* p = attrsEnd();
+  for (int depth = 1; depth > 0 && p < cu_end_;) {
+    uint64_t number = uleb128(p);
+    if (!number) {
+      depth--;
+      continue;
+    }
+    if (number >= abbrevs_->num_abbrevs)
+      bug("Unknown abbrev number: %" PRIu64 "\n", number);
+    const Abbrev& abbrev = abbrevs_->abbrevs[number];
+    for (size_t i = 0; i < abbrev.num_ops; i++) {
+      const Op& op = abbrev.plan[i];
+      p = op.form ? skipValue(op.form, p) : p + op.size;
+    }
+    if (abbrev.has_children)
+      depth++;
+  }
+  return moveTo(p, depth_);
+}
+
+const uint8_t* DIECursor::attrsEnd() {
+  if (!attrs_end_) {
+    const uint8_t* p = attrs_;
+    for (size_t i = 0; i < abbrev_->num_ops; i++) {
+      const Op& op = abbrev_->plan[i];
+      p = op.form ? skipValue(op.form, p) : p + op.size;
+    }
+    attrs_end_ = p;
+  }
+  return attrs_end_;
+}
+
+bool DIECursor::findAttr(uint16_t name, AttrValue* value) {
+  const uint8_t* p = attrs_;
+  for (size_t i = 0; i < abbrev_->num_attrs; i++) {
+    const Attr& attr = abbrev_->attrs[i];
+    if (attr.name != name) {
+      p = skipValue(attr.form, p);
+      continue;
+    }
+    value->name = name;
+    if (attr.form == DW_FORM_implicit_const) {
+      value->form = attr.form;
+      value->value = attr.implicit_const;
+      value->data = NULL;
+      value->size = 0;
+    } else {
+      readValue(attr.form, p, value);
+    }
+    return true;
+  }
+  attrs_end_ = p;
+  return false;
+}
+
+void DIECursor::readAttrs(vector<AttrValue>* values) {
+  values->resize(abbrev_->num_attrs);
+  const uint8_t* p = attrs_;
+  for (size_t i = 0; i < abbrev_->num_attrs; i++) {
+    const Attr& attr = abbrev_->attrs[i];
+    AttrValue* value = &(*values)[i];
+    value->name = attr.name;
+    if (attr.form == DW_FORM_implicit_const) {
+      value->form = attr.form;
+      value->value = attr.implicit_const;
+      value->data = NULL;
+      value->size = 0;
+    } else {
+      p = readValue(attr.form, p, value);
+    }
+  }
+  attrs_end_ = p;
+}
+
+const char* DIECursor::string(const AttrValue& value) const {
+  if (value.form == DW_FORM_string)
+    return (const char*)value.data;
+  if (value.form != DW_FORM_strp)
+    return NULL;
+  if (binary_->string_pool)
+    return binary_->string_pool->stringAt(value.value);
+  if (value.value >= binary_->debug_str_len)
+    return NULL;
+  return binary_->debug_str + value.value;
+}
+
+const uint8_t* DIECursor::skipValue(uint16_t form, const uint8_t* p) const {
+  int size = fixedFormSize(form);
+  if (size >= 0)
+    return p + size;
+  switch (form) {
+  case DW_FORM_addr:
+    return p + cu_.ptrsize;
+  case DW_FORM_ref_addr:
+    return p + (cu_.version <= 2 ? cu_.ptrsize : cu_.offset_size);
+  case DW_FORM_strp:
+  case DW_FORM_line_strp:
+  case DW_FORM_strp_sup:
+  case DW_FORM_sec_offset:
+  case DW_FORM_GNU_strp_alt:
+  case DW_FORM_GNU_ref_alt:
+    return p + cu_.offset_size;
+  case DW_FORM_data4:
+  case DW_FORM_ref4:
+    return p + 4;
+  case DW_FORM_ref8:
+    return p + 8;
+  case DW_FORM_strx1:
+  case DW_FORM_strx2:
+  case DW_FORM_strx3:
+  case DW_FORM_strx4:
+  case DW_FORM_addrx1:
+  case DW_FORM_addrx2:
+  case DW_FORM_addrx3:
+  case DW_FORM_addrx4:
+    return p + indexSize(form);
+  case DW_FORM_block1:
+    return p + 1 + *p;
+  case DW_FORM_block2:
+    return p + 2 + readFixed(p, 2);
+  case DW_FORM_block4:
+    return p + 4 + readFixed(p, 4);
+  case DW_FORM_block:
+  case DW_FORM_exprloc: {
+    uint64_t len = uleb128(p);
+    return p + len;
+  }
+  case DW_FORM_string:
+    return p + strlen((const char*)p) + 1;
+  case DW_FORM_sdata:
+  case DW_FORM_udata:
+  case DW_FORM_ref_udata:
+  case DW_FORM_strx:
+  case DW_FORM_addrx:
+  case DW_FORM_loclistx:
+  case DW_FORM_rnglistx:
+  case DW_FORM_GNU_str_index:
+  case DW_FORM_GNU_addr_index:
+    // The last byte of a LEB128 has the top bit clear either way.
+    while (*p++ & 0x80) {}
+    return p;
+  case DW_FORM_indirect: {
+    uint16_t actual = uleb128(p);
+    if (actual == DW_FORM_indirect || actual == DW_FORM_implicit_const)
+      bug("Bad indirect DW_FORM: %x\n", actual);
+    return skipValue(actual, p);
+  }
+  default:
+    bug("Unknown DW_FORM: %x\n", form);
+  }
+}
+
+const uint8_t* DIECursor::readValue(uint16_t form, const uint8_t* p,
+                                    AttrValue* value) const {
+  value->form = form;
+  value->value = 0;
+  value->data = NULL;
+  value->size = 0;
+  switch (form) {
+  case DW_FORM_flag_present:
+    value->value = 1;
+    return p;
+  case DW_FORM_block1:
+  case DW_FORM_block2:
+  case DW_FORM_block4: {
+    int size = form == DW_FORM_block1 ? 1 : form == DW_FORM_block2 ? 2 : 4;
+    value->size = readFixed(p, size);
+    value->data = p + size;
+    return value->data + value->size;
+  }
+  case DW_FORM_block:
+  case DW_FORM_exprloc:
+    value->size = uleb128(p);
+    value->data = p;
+    return p + value->size;
+  case DW_FORM_data16:
+    value->data = p;
+    value->size = 16;
+    return p + 16;
+  case DW_FORM_string:
+    value->data = p;
+    value->size = strlen((const char*)p);
+    return p + value->size + 1;
+  case DW_FORM_sdata:
+    value->value = sleb128(p);
+    return p;
+  case DW_FORM_udata:
+  case DW_FORM_ref_udata:
+  case DW_FORM_strx:
+  case DW_FORM_addrx:
+  case DW_FORM_loclistx:
+  case DW_FORM_rnglistx:
+  case DW_FORM_GNU_str_index:
+  case DW_FORM_GNU_addr_index:
+    value->value = uleb128(p);
+    return p;
+  case DW_FORM_indirect: {
+    uint16_t actual = uleb128(p);
+    if (actual == DW_FORM_indirect || actual == DW_FORM_implicit_const)
+      bug("Bad indirect DW_FORM: %x\n", actual);
+    return readValue(actual, p, value);
+  }
+  default: {
+    // The rest are fixed-size numbers.
+    const uint8_t* end = skipValue(form, p);
+    value->value = readFixed(p, end - p);
+    return end;
+  }
+  }
+}
@@ -0,0 +1,131 @@
+#ifndef DIECURSOR_H_
+#define DIECURSOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "cucache.h"
+#include "scanner.h"
+
+// A value of an attribute as it is in the original .debug_info. |value|
+// is the number of constants, addresses, offsets, indexes and references,
+// which are relative to the CU for DW_FORM_ref1 to DW_FORM_ref_udata.
+// Blocks, DW_FORM_exprloc, DW_FORM_data16 and DW_FORM_string have their
+// bytes in |data| and |size|, without the NUL of strings.
+struct AttrValue {
+  uint16_t name;
+  uint16_t form;
+  uint64_t value;
+  const uint8_t* data;
+  uint64_t size;
+};
+
+// Walks the DIEs of raw or zipped .debug_info one at a time, for tools
+// which only look at some of them. Unlike Scanner, which calls back for
+// every attribute, a cursor reads attributes only when they're asked for
+// and skips the rest by their sizes, and skipSubtree() passes over the
+// children of a DIE without reading them. Zipped CUs are decoded a chunk
+// at a time through a CUCache.
+//
+//   DIECursor cursor(binary);
+//   while (cursor.nextCU()) {
+//     for (bool ok = cursor.next(); ok; ok = cursor.skipSubtree()) {
+//       ... DIEs at depth 1 ...
+//     }
+//   }
+class DIECursor {
+public:
+  explicit DIECursor(Binary* binary);
+
+  // Moves to the unit DIE of the first CU, or of the CU after the current
+  // one. Returns false after the last CU.
+  bool nextCU();
+
+  // Moves to the unit DIE of the CU which contains |offset| of
+  // .debug_info. Returns false if |offset| is out of .debug_info.
+  bool seekCU(uint64_t offset);
+
+  // Moves to the next DIE of the CU in the order of .debug_info, which is
+  // the first child of the current DIE if it has any. Returns false after
+  // the last DIE of the CU.
+  bool next();
+
+  // Moves to the next DIE which isn't a descendant of the current one. It
+  // jumps by DW_AT_sibling if the DIE has one, and otherwise walks the
+  // descendants reading only the sizes of their attributes. Returns false
+  // after the last DIE of the CU.
+  bool skipSubtree();
+
+  // Reads attribute |name| of the current DIE into |value|. Attributes
+  // before it are skipped by their sizes. Returns false if the DIE
+  // doesn't have it.
+  bool findAttr(uint16_t name, AttrValue* value);
+
+  // Reads all attributes of the current DIE into |values|.
+  void readAttrs(std::vector<AttrValue>* values);
+
+  // Returns the string of DW_FORM_string or DW_FORM_strp, or NULL if
+  // |value| has another form or its string isn't in the binary.
+  const char* string(const AttrValue& value) const;
+
+  const CU& cu() const {
+    return cu_;
+  }
+
+  uint64_t cu_offset() const {
+    return cu_offset_;
+  }
+
+  // The offset of the current DIE in .debug_info.
+  uint64_t offset() const {
+    return cu_offset_ + (die_ - cu_begin_);
+  }
+
+  // The unit DIE is at depth 0.
+  int depth() const {
+    return depth_;
+  }
+
+  uint16_t tag() const {
+    return abbrev_->tag;
+  }
+
+  bool has_children() const {
+    return abbrev_->has_children;
+  }
+
+private:
+  // Moves to the DIE at |p|, which is at |depth| unless null entries end
+  // its siblings first.
+  bool moveTo(const uint8_t* p, int depth);
+
+  // Returns the end of the attributes of the current DIE.
+  const uint8_t* attrsEnd();
+
+  // Returns the end of the value of |form| at |p|.
+  const uint8_t* skipValue(uint16_t form, const uint8_t* p) const;
+
+  // Reads the value of |form| at |p| into |value| and returns its end.
+  const uint8_t* readValue(uint16_t form, const uint8_t* p,
+                           AttrValue* value) const;
+
+  Binary* binary_;
+  CUCache cache_;
+  CU cu_;
+  uint64_t cu_offset_;
+  // The bytes of the current CU.
+  const uint8_t* cu_begin_;
+  const uint8_t* cu_end_;
+  const AbbrevTable* abbrevs_;
+  // The current DIE, where its attributes start, and where they end,
+  // which is NULL until it's needed.
+  const uint8_t* die_;
+  const uint8_t* attrs_;
+  const uint8_t* attrs_end_;
+  const Abbrev* abbrev_;
+  int depth_;
+};
+
+#endif  // DIECURSOR_H_
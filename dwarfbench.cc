@@ -0,0 +1,387 @@
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "abbrevorder.h"
+#include "binary.h"
+#include "parallel.h"
+#include "scanner.h"
+#include "subtree.h"
+#include "synth.h"
+#include "zipscanner.h"
+
+using namespace std;
+
+// The chunks of dwarfzip, so the work of each thread is the same.
+static const size_t CHUNK_SIZE = 1024 * 1024;
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Only counts DIEs, which is the cost of walking .debug_info.
+class DIECounter : public Scanner<DIECounter> {
+public:
+  explicit DIECounter(Binary* binary)
+    : Scanner<DIECounter>(binary),
+      num_dies_(0) {
+  }
+
+  uint64_t num_dies() const {
+    return num_dies_;
+  }
+
+private:
+  friend class Scanner<DIECounter>;
+
+  static const bool kMergeRuns = true;
+
+  void onCU(const CU*, uint64_t) {}
+
+  void onAbbrev(uint64_t, const Abbrev* abbrev, uint64_t) {
+    if (abbrev)
+      num_dies_++;
+  }
+
+  template <bool kZipped, int kPtrSize, int kOffsetSize>
+  void onAttr(uint16_t, uint16_t, uint64_t, uint64_t) {}
+  void onRun(uint64_t) {}
+
+  uint64_t num_dies_;
+};
+
+struct BenchJob {
+  Binary* binary;
+  uint32_t flags;
+  vector<ZipChunk> chunks;
+  vector<uint64_t> dies;
+  vector<vector<uint8_t> > bufs;
+  vector<vector<uint8_t> > deltas;
+  vector<uint8_t> out;
+};
+
+static void scanChunk(void* arg, size_t i) {
+  BenchJob* job = static_cast<BenchJob*>(arg);
+  DIECounter counter(job->binary);
+  counter.run(job->chunks[i].orig_offset, job->chunks[i + 1].orig_offset);
+  job->dies[i] = counter.num_dies();
+}
+
+static void zipChunk(void* arg, size_t i) {
+  BenchJob* job = static_cast<BenchJob*>(arg);
+  encodeChunk(job->binary, job->flags, job->chunks[i].orig_offset,
+              job->chunks[i + 1].orig_offset, false, &job->bufs[i], NULL);
+}
+
+static void unzipChunk(void* arg, size_t i) {
+  BenchJob* job = static_cast<BenchJob*>(arg);
+  const ZipChunk& chunk = job->chunks[i];
+  const ZipChunk& next = job->chunks[i + 1];
+  uint8_t* out = decodeChunkData(job->binary, job->flags, &job->bufs[i][0],
+                                 job->bufs[i].size(), false,
+                                 &job->out[chunk.orig_offset]);
+  if (out != &job->out[next.orig_offset])
+    errx(1, "broken chunk: %zu", i);
+}
+
+static void unzipDeltaChunk(void* arg, size_t i) {
+  BenchJob* job = static_cast<BenchJob*>(arg);
+  job->deltas[i].clear();
+  decodeDeltaData(job->binary, job->flags, &job->bufs[i][0],
+                  job->bufs[i].size(), &job->deltas[i]);
+}
+
+static string flagNames(uint32_t flags) {
+  string names;
+  if (flags & ZIP_STATIC)
+    names += " -E";
+  else if (flags & ZIP_ENTROPY)
+    names += " -e";
+  if (flags & ZIP_STREAMS)
+    names += " -s";
+  if (flags & ZIP_SUBTREES)
+    names += " -t";
+  if (flags & ZIP_PREDICT)
+    names += " -R";
+  if (flags & ZIP_ABBREVS)
+    names += " -b";
+  return names.empty() ? names : names.substr(1);
+}
+
+// Times scanning, compressing and decompressing .debug_info of |filename|
+// and writes a JSON object on a line to |out|. Each is the best of
+// |repeats| runs. Compression includes finding subtrees with
+// ZIP_SUBTREES and ranking abbrevs with ZIP_ABBREVS, and its size counts
+// ZipHeader, the chunk table, the templates and the orders like dwarfzip.
+// Decompression decodes the chunks of the last compression in memory, so
+// neither of them measures file I/O. Decoding the delta coded CUs alone
+// is timed too, which is the entropy or stream stage of decompression.
+static void benchFile(const char* filename, uint32_t flags, int num_threads,
+                      int repeats, FILE* out) {
+  const char* error;
+  auto_ptr<Binary> binary(tryReadBinary(filename, &error));
+  if (!binary.get())
+    errx(1, "%s: %s", filename, error);
+  if (binary->is_zipped)
+    errx(1, "%s: already compressed", filename);
+
+  BenchJob job;
+  job.binary = binary.get();
+  splitChunks(binary.get(), CHUNK_SIZE, &job.chunks);
+  size_t num_chunks = job.chunks.size() - 1;
+  job.dies.resize(num_chunks);
+  job.bufs.resize(num_chunks);
+  job.deltas.resize(num_chunks);
+  job.out.resize(binary->debug_info_len);
+
+  double scan_time = 0, zip_time = 0, unzip_time = 0, delta_time = 0;
+  uint64_t zip_size = 0;
+  for (int r = 0; r < repeats; r++) {
+    double start = now();
+    parallelFor(num_threads, num_chunks, scanChunk, &job);
+    double elapsed = now() - start;
+    if (!r || elapsed < scan_time)
+      scan_time = elapsed;
+
+    start = now();
+    job.flags = flags & ~(ZIP_SUBTREES | ZIP_ABBREVS);
+    delete binary->subtrees;
+    binary->subtrees = NULL;
+    delete binary->abbrev_order;
+    binary->abbrev_order = NULL;
+    // Templates are coded with the ranks.
+    vector<uint8_t> orders;
+    if (flags & ZIP_ABBREVS) {
+      binary->abbrev_order = AbbrevOrder::build(binary.get(), num_threads);
+      if (binary->abbrev_order) {
+        job.flags |= ZIP_ABBREVS;
+        binary->abbrev_order->write(&orders);
+      }
+    }
+    vector<uint8_t> templates;
+    if (flags & ZIP_SUBTREES) {
+      binary->subtrees = SubtreeTable::build(binary.get(), num_threads);
+      if (binary->subtrees) {
+        job.flags |= ZIP_SUBTREES;
+        binary->subtrees->write(binary.get(), job.flags, &templates);
+      }
+    }
+    parallelFor(num_threads, num_chunks, zipChunk, &job);
+    elapsed = now() - start;
+    if (!r || elapsed < zip_time)
+      zip_time = elapsed;
+
+    start = now();
+    parallelFor(num_threads, num_chunks, unzipChunk, &job);
+    elapsed = now() - start;
+    if (!r || elapsed < unzip_time)
+      unzip_time = elapsed;
+    if (memcmp(&job.out[0], binary->debug_info, binary->debug_info_len))
+      errx(1, "%s: decompressed .debug_info differs", filename);
+
+    start = now();
+    parallelFor(num_threads, num_chunks, unzipDeltaChunk, &job);
+    elapsed = now() - start;
+    if (!r || elapsed < delta_time)
+      delta_time = elapsed;
+
+    zip_size = sizeof(ZipHeader) + sizeof(ZipChunk) * (num_chunks + 1) +
+        templates.size() + orders.size();
+    for (size_t i = 0; i < num_chunks; i++)
+      zip_size += job.bufs[i].size();
+  }
+
+  uint64_t num_dies = 0;
+  for (size_t i = 0; i < num_chunks; i++)
+    num_dies += job.dies[i];
+  double mb = binary->debug_info_len / 1e6;
+  // The peak of the process so far, which is of this file if it's the
+  // first or the biggest one.
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  fprintf(out, "{\"file\": \"%s\", \"flags\": \"%s\", \"threads\": %d, "
+          "\"repeats\": %d, \"size\": %lu, \"dies\": %lu, "
+          "\"zip_size\": %lu, \"ratio\": %.4f, "
+          "\"scan_mb_s\": %.1f, \"scan_dies_s\": %.0f, "
+          "\"zip_mb_s\": %.1f, \"zip_dies_s\": %.0f, "
+          "\"unzip_mb_s\": %.1f, \"unzip_dies_s\": %.0f, "
+          "\"delta_unzip_mb_s\": %.1f, "
+          "\"peak_rss_kb\": %ld}\n",
+          filename, flagNames(flags).c_str(), num_threads, repeats,
+          binary->debug_info_len, num_dies, zip_size,
+          (double)zip_size / binary->debug_info_len,
+          mb / scan_time, num_dies / scan_time,
+          mb / zip_time, num_dies / zip_time,
+          mb / unzip_time, num_dies / unzip_time, mb / delta_time,
+          usage.ru_maxrss);
+  fflush(out);
+}
+
+// Parses a size with an optional K, M or G suffix.
+static uint64_t parseSize(const char* s) {
+  char* end;
+  uint64_t size = strtoull(s, &end, 10);
+  switch (*end) {
+  case 'K':
+    return size << 10;
+  case 'M':
+    return size << 20;
+  case 'G':
+    return size << 30;
+  case '\0':
+    return size;
+  default:
+    fprintf(stderr, "Bad size: %s\n", s);
+    exit(1);
+  }
+}
+
+// Parses weights of SynthKind separated by colons.
+static void parseWeights(const char* s, uint32_t* weights) {
+  for (int i = 0; i < NUM_SYNTH_KINDS; i++) {
+    char* end;
+    weights[i] = strtoul(s, &end, 10);
+    if (end == s || *end != (i + 1 < NUM_SYNTH_KINDS ? ':' : '\0')) {
+      fprintf(stderr, "Bad mix: %s\n", s);
+      exit(1);
+    }
+    s = end + 1;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const char* argv0 = argv[0];
+  bool opt_e = false;
+  bool opt_E = false;
+  bool opt_s = false;
+  bool opt_t = false;
+  bool opt_R = false;
+  bool opt_b = false;
+  int num_threads = 1;
+  int repeats = 3;
+  const char* out_path = NULL;
+  const char* gen_path = NULL;
+  SynthOptions synth;
+  initSynthOptions(&synth);
+
+  while (argc > 1 && argv[1][0] == '-') {
+    bool has_value = argc > 2;
+    if (!strcmp(argv[1], "-e")) {
+      opt_e = true;
+    } else if (!strcmp(argv[1], "-E")) {
+      opt_E = true;
+    } else if (!strcmp(argv[1], "-s")) {
+      opt_s = true;
+    } else if (!strcmp(argv[1], "-t")) {
+      opt_t = true;
+    } else if (!strcmp(argv[1], "-R")) {
+      opt_R = true;
+    } else if (!strcmp(argv[1], "-b")) {
+      opt_b = true;
+    } else if (!strcmp(argv[1], "-n") && has_value) {
+      repeats = atoi(argv[2]);
+      if (repeats <= 0)
+        repeats = 1;
+      argc--;
+      argv++;
+    } else if (!strcmp(argv[1], "-o") && has_value) {
+      out_path = argv[2];
+      argc--;
+      argv++;
+    } else if (!strcmp(argv[1], "--gen") && has_value) {
+      gen_path = argv[2];
+      argc--;
+      argv++;
+    } else if (!strcmp(argv[1], "-S") && has_value) {
+      synth.size = parseSize(argv[2]);
+      argc--;
+      argv++;
+    } else if (!strcmp(argv[1], "-c") && has_value) {
+      synth.num_cus = atoi(argv[2]);
+      argc--;
+      argv++;
+    } else if (!strcmp(argv[1], "-m") && has_value) {
+      parseWeights(argv[2], synth.weights);
+      argc--;
+      argv++;
+    } else if (!strcmp(argv[1], "-u") && has_value) {
+      synth.shared_percent = atoi(argv[2]);
+      argc--;
+      argv++;
+    } else if (!strcmp(argv[1], "-a") && has_value) {
+      synth.num_unused_abbrevs = atoi(argv[2]);
+      argc--;
+      argv++;
+    } else if (!strcmp(argv[1], "-L") && has_value) {
+      synth.dwarf64_offset = parseSize(argv[2]);
+      argc--;
+      argv++;
+    } else if (!strcmp(argv[1], "-r") && has_value) {
+      synth.seed = strtoull(argv[2], NULL, 10);
+      argc--;
+      argv++;
+    } else if (!strncmp(argv[1], "-j", 2)) {
+      const char* n = argv[1] + 2;
+      if (!*n && argc > 2) {
+        n = argv[2];
+        argc--;
+        argv++;
+      }
+      num_threads = atoi(n);
+      if (num_threads <= 0)
+        num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    } else {
+      fprintf(stderr, "Unknown option: %s\n", argv[1]);
+    }
+    argc--;
+    argv++;
+  }
+
+  if (gen_path) {
+    uint64_t num_dies;
+    uint64_t size = writeSynthBinary(gen_path, synth, &num_dies);
+    printf("%s: %lu bytes of .debug_info in %u CUs, %lu DIEs\n",
+           gen_path, size, synth.num_cus, num_dies);
+    return 0;
+  }
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s [-e|-E|-s] [-t] [-R] [-b] [-j threads] "
+            "[-n repeats] [-o results.json] binary...\n"
+            "       %s --gen output [-S size[K|M|G]] [-c cus] "
+            "[-m struct:func:var:enum] [-u shared%%] [-a unused_abbrevs] "
+            "[-L dwarf64_line_offset[K|M|G]] [-r seed]\n",
+            argv0, argv0);
+    exit(1);
+  }
+  if ((opt_e || opt_E) && opt_s) {
+    fprintf(stderr, "-e or -E and -s can't be used together\n");
+    exit(1);
+  }
+  uint32_t flags = (opt_e || opt_E ? ZIP_ENTROPY : 0) |
+      (opt_E ? ZIP_STATIC : 0) | (opt_s ? ZIP_STREAMS : 0) |
+      (opt_t ? ZIP_SUBTREES : 0) | (opt_R ? ZIP_PREDICT : 0) |
+      (opt_b ? ZIP_ABBREVS : 0);
+
+  // Results are appended, so runs with other options add up to one file.
+  FILE* out = stdout;
+  if (out_path) {
+    out = fopen(out_path, "a");
+    if (!out)
+      err(1, "open failed: %s", out_path);
+  }
+  for (int i = 1; i < argc; i++)
+    benchFile(argv[i], flags, num_threads, repeats, out);
+  if (out != stdout && fclose(out))
+    err(1, "write failed: %s", out_path);
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+
+#include "addrindex.h"
+#include "binary.h"
+#include "cucache.h"
+#include "dict.h"
+
+using namespace std;
+
+// Writes the original bytes of CUs to stdout. This works as an example
+// and a test of random access to zipped binaries. With -a, CUs are those
+// which contain the addresses, found by the address index.
+int main(int argc, char* argv[]) {
+  const char* argv0 = argv[0];
+  auto_ptr<Dictionary> dict;
+  bool opt_a = false;
+  while (argc > 1 && argv[1][0] == '-') {
+    if (!strcmp(argv[1], "-D") && argc > 2) {
+      dict.reset(Dictionary::read(argv[2]));
+      argc--;
+      argv++;
+    } else if (!strcmp(argv[1], "-a")) {
+      opt_a = true;
+    } else {
+      fprintf(stderr, "Unknown option: %s\n", argv[1]);
+    }
+    argc--;
+    argv++;
+  }
+  if (argc < (opt_a ? 3 : 2)) {
+    fprintf(stderr, "Usage: %s [-D dict] binary [offset...]\n"
+            "       %s [-D dict] -a binary address...\n", argv0, argv0);
+    exit(1);
+  }
+
+  auto_ptr<Binary> binary(readBinary(argv[1]));
+  if (dict.get())
+    useDictionary(binary.get(), dict.get());
+  CUCache cache(binary.get(), 16);
+  if (opt_a && !binary->addr_index) {
+    fprintf(stderr, "%s: no address index\n", argv[1]);
+    exit(1);
+  }
+
+  uint64_t cu_offset;
+  size_t len;
+  if (argc == 2) {
+    for (uint64_t offset = 0;; offset = cu_offset + len) {
+      const uint8_t* cu = cache.getCU(offset, &cu_offset, &len);
+      if (!cu)
+        break;
+      fwrite(cu, 1, len, stdout);
+    }
+  } else {
+    for (int i = 2; i < argc; i++) {
+      uint64_t offset = strtoull(argv[i], NULL, 0);
+      if (opt_a) {
+        const AddrRange* range = binary->addr_index->find(offset);
+        if (!range) {
+          fprintf(stderr, "no CU contains the address: %s\n", argv[i]);
+          exit(1);
+        }
+        offset = range->cu_offset;
+      }
+      const uint8_t* cu = cache.getCU(offset, &cu_offset, &len);
+      if (!cu) {
+        fprintf(stderr, "out of .debug_info: %s\n", argv[i]);
+        exit(1);
+      }
+      fwrite(cu, 1, len, stdout);
+    }
+  }
+
+  fprintf(stderr, "%zu chunks decoded\n", cache.num_decoded());
+}
@@ -0,0 +1,63 @@
+#include <dwarf.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+
+#include "binary.h"
+#include "dict.h"
+#include "diecursor.h"
+#include "dwarfstr.h"
+
+using namespace std;
+
+// Prints the offset, the tag and the name of the DIEs at depth 1 of each
+// CU, which are what name indexes and symbolizers look up. Their subtrees
+// are skipped, so this works as an example and a test of DIECursor. With
+// -r, all DIEs are printed with their depths.
+int main(int argc, char* argv[]) {
+  const char* argv0 = argv[0];
+  auto_ptr<Dictionary> dict;
+  bool opt_r = false;
+  while (argc > 1 && argv[1][0] == '-') {
+    if (!strcmp(argv[1], "-D") && argc > 2) {
+      dict.reset(Dictionary::read(argv[2]));
+      argc--;
+      argv++;
+    } else if (!strcmp(argv[1], "-r")) {
+      opt_r = true;
+    } else {
+      fprintf(stderr, "Unknown option: %s\n", argv[1]);
+    }
+    argc--;
+    argv++;
+  }
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s [-D dict] [-r] binary\n", argv0);
+    exit(1);
+  }
+
+  initDwarfStr();
+  auto_ptr<Binary> binary(readBinary(argv[1]));
+  if (dict.get())
+    useDictionary(binary.get(), dict.get());
+
+  DIECursor cursor(binary.get());
+  AttrValue name;
+  while (cursor.nextCU()) {
+    // The unit DIE is only printed with -r.
+    bool ok = opt_r ? true : cursor.next();
+    while (ok) {
+      const char* s = NULL;
+      if (cursor.findAttr(DW_AT_name, &name))
+        s = cursor.string(name);
+      if (opt_r)
+        printf("%d ", cursor.depth());
+      printf("0x%" PRIx64 " %s %s\n", cursor.offset(),
+             DW_TAG_STR(cursor.tag()), s ? s : "-");
+      ok = opt_r ? cursor.next() : cursor.skipSubtree();
+    }
+  }
+}
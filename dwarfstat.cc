@@ -1,50 +1,112 @@
 #include <dwarf.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <algorithm>
+#include <map>
 #include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "binary.h"
+#include "delta.h"
+#include "dict.h"
 #include "dwarfstr.h"
+#include "hash.h"
+#include "leb128.h"
 #include "scanner.h"
+#include "zipscanner.h"
 
 using namespace std;
 
-static void uleb128o(uint64_t v, uint8_t*& p) {
-  do {
-    uint8_t b = v & 0x7f;
-    v >>= 7;
-    if (v)
-      b |= 0x80;
-    *p++ = b;
-  } while (v);
-}
+// Counts of values, from which the bits of coding them with their
+// empirical probabilities follow. That's what an ideal static order-0
+// coder would take, without the cost of its model.
+class Histogram {
+public:
+  Histogram() : total_(0) {}
 
-static void sleb128o(int64_t v, uint8_t*& p) {
-  bool done = false;
-  while (!done) {
-    uint8_t b = v & 0x7f;
-    v >>= 7;
-    if ((v == 0 && (b & 0x40) == 0) || (v == -1 && (b & 0x40))) {
-      done = true;
-    } else {
-      b |= 0x80;
-    }
-    *p++ = b;
+  void add(uint64_t value) {
+    counts_[value]++;
+    total_++;
   }
-}
 
-class StatScanner : public Scanner {
+  uint64_t total() const {
+    return total_;
+  }
+
+  double bits() const {
+    double bits = 0;
+    for (unordered_map<uint64_t, uint64_t>::const_iterator it =
+           counts_.begin(); it != counts_.end(); ++it)
+      bits += it->second * log2((double)total_ / it->second);
+    return bits;
+  }
+
+private:
+  unordered_map<uint64_t, uint64_t> counts_;
+  uint64_t total_;
+};
+
+// A histogram for each context, whose bits are those of the values
+// conditioned on their contexts.
+class ContextHistogram {
 public:
-  explicit StatScanner(Binary* binary)
-    : Scanner(binary),
+  void add(uint64_t context, uint64_t value) {
+    histograms_[context].add(value);
+  }
+
+  double bits() const {
+    double bits = 0;
+    for (unordered_map<uint64_t, Histogram>::const_iterator it =
+           histograms_.begin(); it != histograms_.end(); ++it)
+      bits += it->second.bits();
+    return bits;
+  }
+
+private:
+  unordered_map<uint64_t, Histogram> histograms_;
+};
+
+// What attribute values are replaced with before entropy coding. The
+// delta predictors are those of dwarfzip -c, and only replace the values
+// of forms it delta codes.
+enum Predictor {
+  PREDICT_VALUE,
+  PREDICT_DELTA_ATTR,
+  PREDICT_DELTA_TAG,
+  PREDICT_DELTA_ABBREV,
+  NUM_PREDICTORS
+};
+
+static const char* PREDICTOR_NAMES[NUM_PREDICTORS] = {
+  "value", "delta_attr", "delta_tag", "delta_abbrev"
+};
+
+class StatScanner : public Scanner<StatScanner> {
+public:
+  // The entropy of the values of each attribute is only modeled with
+  // |model_values|, as its histograms take much more time and memory than
+  // the counts.
+  StatScanner(Binary* binary, bool model_values)
+    : Scanner<StatScanner>(binary),
+      model_values_(model_values),
       names_(0x4000),
-      forms_(256),
+      forms_(0x2000),
+      tags_(0x10000),
       ref4_names_(0x4000),
       ref4_sdata_names_(0x4000),
       ref4_udata_names_(0x4000),
+      delta_names_(NUM_DELTA_CONTEXTS, vector<Stat>(0x4000)),
+      delta_raw_names_(0x4000),
+      die_abbrev_(NULL),
+      tag_(0),
       last_offset_(0) {
+    for (int i = 0; i < NUM_DELTA_CONTEXTS; i++)
+      deltas_.push_back(DeltaTable(i));
   }
 
   void show() const {
@@ -63,6 +125,11 @@ public:
         printf("%s: %d %lu\n",
                DW_FORM_STR(i), forms_[i].cnt, forms_[i].size);
     }
+    // The sizes of DIEs by tag, which don't include their children.
+    for (size_t i = 0; i < tags_.size(); i++) {
+      if (tags_[i].cnt)
+        printf("%s: %d %lu\n", tagName(i), tags_[i].cnt, tags_[i].size);
+    }
 
     for (size_t i = 0; i < ref4_names_.size(); i++) {
       if (ref4_names_[i].cnt) {
@@ -76,9 +143,121 @@ public:
                ref4_udata_names_[i].cnt, ref4_udata_names_[i].size);
       }
     }
+
+    // The sizes of delta coded attributes with each context of dwarfzip -c.
+    static const char* CONTEXT_NAMES[] = { "attr", "tag", "abbrev" };
+    for (int c = 0; c < NUM_DELTA_CONTEXTS; c++) {
+      const vector<Stat>& stats = delta_names_[c];
+      Stat total;
+      for (size_t i = 0; i < stats.size(); i++) {
+        total.cnt += stats[i].cnt;
+        total.size += stats[i].size;
+      }
+      if (!total.cnt)
+        continue;
+      printf("delta_%s: %d %lu\n", CONTEXT_NAMES[c], total.cnt, total.size);
+      for (size_t i = 0; i < stats.size(); i++) {
+        if (stats[i].cnt)
+          printf("delta_%s_%s: %d %lu\n",
+                 CONTEXT_NAMES[c], DW_AT_STR(i), stats[i].cnt, stats[i].size);
+      }
+    }
+  }
+
+  // Shows the stats as a JSON object, with the sizes of each CU, and the
+  // entropy of the values of each attribute under each predictor, both
+  // order-0 and conditioned on the abbrev of the DIE. Zipped binaries
+  // only have the value predictor, as their values are delta coded.
+  void showJSON() const {
+    printf("{\n  \"size\": %lu,\n", last_offset_);
+    printf("  \"cu\": %s,\n", statJSON(cu_).c_str());
+    printf("  \"abbrev\": %s,\n", statJSON(abbrev_).c_str());
+    printf("  \"attr\": %s,\n", statJSON(attr_).c_str());
+
+    printf("  \"tags\": {");
+    const char* sep = "\n";
+    for (size_t i = 0; i < tags_.size(); i++) {
+      if (tags_[i].cnt) {
+        printf("%s    \"%s\": %s", sep, tagName(i),
+               statJSON(tags_[i]).c_str());
+        sep = ",\n";
+      }
+    }
+    printf("\n  },\n");
+
+    printf("  \"forms\": {");
+    sep = "\n";
+    for (size_t i = 0; i < forms_.size(); i++) {
+      if (forms_[i].cnt) {
+        printf("%s    \"%s\": %s", sep, DW_FORM_STR(i),
+               statJSON(forms_[i]).c_str());
+        sep = ",\n";
+      }
+    }
+    printf("\n  },\n");
+
+    printf("  \"cus\": [");
+    sep = "\n";
+    for (size_t i = 0; i < cus_.size(); i++) {
+      const CUStat& cu = cus_[i];
+      printf("%s    {\"offset\": %lu, \"size\": %lu, \"version\": %u, "
+             "\"dies\": %lu, \"attrs\": %lu}",
+             sep, cu.offset, cu.size, cu.version, cu.dies, cu.attrs);
+      sep = ",\n";
+    }
+    printf("\n  ],\n");
+
+    // Totals of each predictor, and of the best predictor and model of
+    // each attribute.
+    double coded[NUM_PREDICTORS] = {};
+    double order0[NUM_PREDICTORS] = {};
+    double by_abbrev[NUM_PREDICTORS] = {};
+    double best = 0;
+    printf("  \"attrs\": {");
+    sep = "\n";
+    for (map<uint16_t, AttrModel>::const_iterator it = models_.begin();
+         it != models_.end(); ++it) {
+      uint16_t name = it->first;
+      const AttrModel& model = it->second;
+      printf("%s    \"%s\": {\"count\": %d, \"size\": %lu, "
+             "\"predictors\": {", sep, DW_AT_STR(name), names_[name].cnt,
+             names_[name].size);
+      double attr_best = names_[name].size;
+      for (int p = 0; p < num_predictors(); p++) {
+        double c = codedSize(name, p);
+        double o = model.order0[p].bits() / 8;
+        double a = model.by_abbrev[p].bits() / 8;
+        uint64_t n = model.order0[p].total();
+        printf("%s\n      \"%s\": {\"h0\": %.3f, \"h_abbrev\": %.3f, "
+               "\"bytes\": %.0f, \"order0_bytes\": %.0f, "
+               "\"abbrev_bytes\": %.0f}",
+               p ? "," : "", PREDICTOR_NAMES[p], n ? o * 8 / n : 0,
+               n ? a * 8 / n : 0, c, o, a);
+        coded[p] += c;
+        order0[p] += o;
+        by_abbrev[p] += a;
+        attr_best = min(attr_best, min(c, min(o, a)));
+      }
+      best += attr_best;
+      printf("}}");
+      sep = ",\n";
+    }
+    printf("\n  },\n");
+
+    printf("  \"predictors\": {");
+    for (int p = 0; p < num_predictors(); p++) {
+      printf("%s\n    \"%s\": {\"bytes\": %.0f, \"order0_bytes\": %.0f, "
+             "\"abbrev_bytes\": %.0f}", p ? "," : "", PREDICTOR_NAMES[p],
+             coded[p], order0[p], by_abbrev[p]);
+    }
+    printf(",\n    \"best\": {\"bytes\": %.0f}\n  }\n}\n", best);
   }
 
 private:
+  friend class Scanner<StatScanner>;
+
+  static const bool kMergeRuns = false;
+
   struct Stat {
     int cnt;
     size_t size;
@@ -91,27 +270,117 @@ private:
     }
   };
 
-  virtual void onCU(CU* cu, uint64_t offset) {
-    fprintf(stderr, "CU: %d @0x%lx len=%x version=%x ptrsize=%x\n",
+  struct CUStat {
+    // The offset in .debug_info, or in the delta coded CUs of a zipped
+    // binary.
+    uint64_t offset;
+    uint64_t size;
+    uint16_t version;
+    uint64_t dies;
+    uint64_t attrs;
+  };
+
+  // The values each predictor replaces attributes with.
+  struct AttrModel {
+    Histogram order0[NUM_PREDICTORS];
+    ContextHistogram by_abbrev[NUM_PREDICTORS];
+  };
+
+  static string statJSON(const Stat& stat) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "{\"count\": %d, \"size\": %lu}",
+             stat.cnt, stat.size);
+    return buf;
+  }
+
+  // Tag 0 has the null entries which end siblings.
+  static const char* tagName(uint16_t tag) {
+    return tag ? DW_TAG_STR(tag) : "null";
+  }
+
+  int num_predictors() const {
+    return binary_->is_zipped ? 1 : NUM_PREDICTORS;
+  }
+
+  // The size of attribute |name| with predictor |p| before entropy
+  // coding, where delta coded values are SLEB128.
+  double codedSize(uint16_t name, int p) const {
+    if (p == PREDICT_VALUE)
+      return names_[name].size;
+    return names_[name].size - delta_raw_names_[name].size +
+        delta_names_[p - PREDICT_DELTA_ATTR][name].size;
+  }
+
+  // Values of forms which point to their bytes are counted by the bytes.
+  template <bool kZipped>
+  uint64_t valueKey(uint16_t form, uint64_t value) const {
+    const uint8_t* p = (const uint8_t*)value;
+    switch (form) {
+    case DW_FORM_string:
+      if (kZipped && binary_->string_pool)
+        return value;
+      return hashBytes(p, strlen((const char*)p));
+    case DW_FORM_block1:
+      return hashBytes(p, 1 + *p);
+    case DW_FORM_block2:
+      return hashBytes(p, 2 + *(const uint16_t*)p);
+    case DW_FORM_block4:
+      return hashBytes(p, 4 + *(const uint32_t*)p);
+    case DW_FORM_block:
+    case DW_FORM_exprloc: {
+      const uint8_t* q = p;
+      uint64_t size = uleb128(q);
+      return hashBytes(p, q - p + size);
+    }
+    case DW_FORM_data16:
+      return hashBytes(p, 16);
+    default:
+      return value;
+    }
+  }
+
+  void onCU(const CU* cu, uint64_t offset) {
+    fprintf(stderr, "CU: %d @0x%lx len=%lx version=%x ptrsize=%x\n",
             cu_.cnt, last_offset_, cu->length, cu->version, cu->ptrsize);
 
     cu_.add(offset - last_offset_);
+    CUStat stat;
+    stat.offset = last_offset_;
+    stat.size = cu->length + (cu->offset_size == 8 ? 12 : 4);
+    stat.version = cu->version;
+    stat.dies = 0;
+    stat.attrs = 0;
+    cus_.push_back(stat);
     last_offset_ = offset;
+
+    for (size_t i = 0; i < deltas_.size(); i++)
+      deltas_[i].reset();
   }
 
-  virtual void onAbbrev(uint64_t, uint64_t offset) {
+  void onAbbrev(uint64_t number, const Abbrev* abbrev, uint64_t offset) {
+    if (abbrev) {
+      for (size_t i = 0; i < deltas_.size(); i++)
+        deltas_[i].setDIE(number, abbrev->tag);
+      cus_.back().dies++;
+    }
+    die_abbrev_ = abbrev;
+    tag_ = abbrev ? abbrev->tag : 0;
+
     //fprintf(stderr, "abbr %lu @%lx\n", number, last_offset_);
     abbrev_.add(offset - last_offset_);
+    tags_[tag_].add(offset - last_offset_);
     last_offset_ = offset;
   }
 
-  virtual void onAttr(uint16_t name, uint8_t form,
-                      uint64_t value, uint64_t offset) {
+  template <bool kZipped, int kPtrSize, int kOffsetSize>
+  void onAttr(uint16_t name, uint16_t form, uint64_t value, uint64_t offset) {
     //fprintf(stderr, "attr %d %d @%lx\n", name, form, last_offset_);
     int64_t size = offset - last_offset_;
     attr_.add(size);
     names_[name].add(size);
     forms_[form].add(size);
+    tags_[tag_].size += size;
+    cus_.back().attrs++;
 
     if (form == DW_FORM_ref4) {
       ref4_names_[name].add(size);
@@ -127,32 +396,120 @@ private:
       ref4_udata_names_[name].add(p - buf);
     }
 
+    AttrModel* model = NULL;
+    uint64_t key = 0;
+    uint64_t context = (uint64_t)die_abbrev_;
+    if (model_values_) {
+      model = &models_[name];
+      key = valueKey<kZipped>(form, value);
+      model->order0[PREDICT_VALUE].add(key);
+      model->by_abbrev[PREDICT_VALUE].add(context, key);
+    }
+
+    // Same as ZipScanner, for each context.
+    int delta_size = deltaSize<kPtrSize, kOffsetSize>(form, cu_version_);
+    if (!kZipped && delta_size >= 4) {
+      delta_raw_names_[name].add(size);
+      for (size_t i = 0; i < deltas_.size(); i++) {
+        uint64_t& last = deltas_[i].get(name);
+        int64_t diff;
+        if (delta_size == 8) {
+          diff = value - last;
+          last = value;
+        } else {
+          int32_t v = static_cast<int32_t>(value);
+          diff = static_cast<int32_t>(v - static_cast<int32_t>(last));
+          last = v;
+        }
+        uint8_t buf[10];
+        uint8_t* p = buf;
+        sleb128o(diff, p);
+        delta_names_[i][name].add(p - buf);
+        if (model) {
+          model->order0[PREDICT_DELTA_ATTR + i].add(diff);
+          model->by_abbrev[PREDICT_DELTA_ATTR + i].add(context, diff);
+        }
+      }
+    } else if (!kZipped && model) {
+      for (int p = PREDICT_DELTA_ATTR; p < NUM_PREDICTORS; p++) {
+        model->order0[p].add(key);
+        model->by_abbrev[p].add(context, key);
+      }
+    }
+
     last_offset_ = offset;
   }
 
+  void onRun(uint64_t) {
+  }
+
+  // Whether models_ are filled, which only -J shows.
+  bool model_values_;
   Stat cu_;
   Stat abbrev_;
   Stat attr_;
   vector<Stat> names_;
   vector<Stat> forms_;
+  // The count of DIEs of each tag and the size of their abbrev numbers
+  // and attributes.
+  vector<Stat> tags_;
+  vector<CUStat> cus_;
   vector<Stat> ref4_names_;
   vector<Stat> ref4_sdata_names_;
   vector<Stat> ref4_udata_names_;
+  vector<DeltaTable> deltas_;
+  vector<vector<Stat> > delta_names_;
+  // The original sizes of delta coded attributes.
+  vector<Stat> delta_raw_names_;
+  map<uint16_t, AttrModel> models_;
+  // The abbrev and the tag of the current DIE.
+  const Abbrev* die_abbrev_;
+  uint16_t tag_;
 
   uint64_t last_offset_;
 };
 
 int main(int argc, char* argv[]) {
+  const char* argv0 = argv[0];
+  auto_ptr<Dictionary> dict;
+  bool opt_json = false;
+  while (argc > 1 && argv[1][0] == '-') {
+    if (!strcmp(argv[1], "-D") && argc > 3) {
+      dict.reset(Dictionary::read(argv[2]));
+      argc--;
+      argv++;
+    } else if (!strcmp(argv[1], "-J")) {
+      opt_json = true;
+    } else {
+      fprintf(stderr, "Unknown option: %s\n", argv[1]);
+    }
+    argc--;
+    argv++;
+  }
   if (argc < 2) {
-    fprintf(stderr, "Usage: %s binary\n", argv[0]);
+    fprintf(stderr, "Usage: %s [-D dict] [-J] binary\n", argv0);
     exit(1);
   }
 
   initDwarfStr();
 
   auto_ptr<Binary> binary(readBinary(argv[1]));
-  StatScanner stat(binary.get());
-  stat.run();
+  if (dict.get())
+    useDictionary(binary.get(), dict.get());
+  StatScanner stat(binary.get(), opt_json);
+  if (binary->is_zipped) {
+    // Zipped binaries are measured by their delta coded CUs.
+    vector<uint8_t> delta;
+    for (size_t i = 0; i < binary->num_zip_chunks; i++)
+      readDeltaChunk(binary.get(), i, &delta);
+    MemoryInput in(&delta[0], 0);
+    stat.scan<true>(&in, delta.size());
+  } else {
+    stat.run();
+  }
   fflush(stderr);
-  stat.show();
+  if (opt_json)
+    stat.showJSON();
+  else
+    stat.show();
 }
@@ -7,6 +7,7 @@ using namespace std;
 
 static vector<const char*> g_dw_at_str;
 static vector<const char*> g_dw_form_str;
+static vector<const char*> g_dw_tag_str;
 
 #define DEFINE_DW_AT(x) do {                    \
     if (g_dw_at_str.size() <= x)                \
@@ -26,6 +27,18 @@ static vector<const char*> g_dw_form_str;
     g_dw_form_str[x] = #x;                        \
   } while (0)
 
+#define DEFINE_DW_TAG(x) do {                     \
+    if (g_dw_tag_str.size() <= x)                 \
+      g_dw_tag_str.resize(x + 1);                 \
+    g_dw_tag_str[x] = #x;                         \
+  } while (0)
+
+#define DEFINE_DW_TAG_EXT(x,v) do {               \
+    if (g_dw_tag_str.size() <= v)                 \
+      g_dw_tag_str.resize(v + 1);                 \
+    g_dw_tag_str[v] = #x;                         \
+  } while (0)
+
 void initDwarfStr() {
 #include "dwarf.tab"
 }
@@ -44,3 +57,12 @@ const char* DW_FORM_STR(int value) {
     return "***ERROR***";
   return g_dw_form_str[value];
 }
+
+const char* DW_TAG_STR(int value) {
+  if (value < 0 || value >= (int)g_dw_tag_str.size() || !g_dw_tag_str[value]) {
+    static char buf[256];
+    sprintf(buf, "DW_TAG_%#x", value);
+    return buf;
+  }
+  return g_dw_tag_str[value];
+}
@@ -5,5 +5,6 @@ void initDwarfStr();
 
 const char* DW_AT_STR(int value);
 const char* DW_FORM_STR(int value);
+const char* DW_TAG_STR(int value);
 
 #endif  // DWARFSTR_H_
@@ -1,236 +1,1141 @@
-#include <dwarf.h>
+#include <dirent.h>
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#include <map>
+#include <algorithm>
 #include <memory>
+#include <string>
 #include <vector>
 
+#include "abbrev.h"
+#include "abbrevorder.h"
+#include "abbrevtables.h"
+#include "addrindex.h"
 #include "binary.h"
-#include "scanner.h"
+#include "chunkcache.h"
+#include "dict.h"
+#include "entropy.h"
+#include "lines.h"
+#include "parallel.h"
+#include "strpool.h"
+#include "subtree.h"
+#include "zipscanner.h"
 
 using namespace std;
 
-static void uleb128o(uint64_t v, uint8_t*& p) {
-  do {
-    uint8_t b = v & 0x7f;
-    v >>= 7;
-    if (v)
-      b |= 0x80;
-    *p++ = b;
-  } while (v);
-}
-
-static void sleb128o(int64_t v, uint8_t*& p) {
-  bool done = false;
-  while (!done) {
-    uint8_t b = v & 0x7f;
-    v >>= 7;
-    if ((v == 0 && (b & 0x40) == 0) || (v == -1 && (b & 0x40))) {
-      done = true;
-    } else {
-      b |= 0x80;
+static bool opt_d = false;
+static bool opt_i = false;
+static bool opt_e = false;
+// Entropy coding with static frequencies, which implies opt_e.
+static bool opt_E = false;
+static bool opt_s = false;
+static bool opt_p = false;
+static bool opt_l = false;
+static bool opt_t = false;
+static bool opt_a = false;
+static bool opt_R = false;
+static bool opt_b = false;
+// Whether files are processed with --batch, where CUs aren't reported.
+static bool opt_batch = false;
+// The dictionary given by -D.
+static Dictionary* dict = NULL;
+// The chunk cache given by --cache.
+static ChunkCache* cache = NULL;
+
+// CUs are grouped into chunks of about this many bytes of the original
+// .debug_info. This must not depend on the number of threads so the
+// output stays the same.
+static const size_t CHUNK_SIZE = 1024 * 1024;
+
+// When writing to a pipe, each thread encodes or decodes about this many
+// bytes of the original .debug_info at once, which bounds the memory.
+static const size_t BATCH_SIZE = 4 * CHUNK_SIZE;
+
+static const size_t COPY_SIZE = 1024 * 1024;
+
+static void xwrite(int fd, const void* p, size_t size) {
+  const char* b = static_cast<const char*>(p);
+  while (size) {
+    ssize_t r = write(fd, b, size);
+    if (r < 0)
+      err(1, "write failed");
+    b += r;
+    size -= r;
+  }
+}
+
+// Reads exactly |size| bytes.
+static void xread(int fd, void* p, size_t size) {
+  char* b = static_cast<char*>(p);
+  while (size) {
+    ssize_t r = read(fd, b, size);
+    if (r < 0)
+      err(1, "read failed");
+    if (r == 0)
+      errx(1, "unexpected end of input");
+    b += r;
+    size -= r;
+  }
+}
+
+// Bytes of the input which went to the output unchanged, by
+// copy_file_range(), where the kernel shares or copies them without user
+// memory, and by write().
+static size_t copied_size = 0;
+static size_t written_size = 0;
+
+// Copies up to |size| bytes from |*offset| of |in|, or its file offset if
+// |offset| is NULL, to the file offset of |out| with copy_file_range().
+// Returns the number of copied bytes, which is less than |size| at EOF or
+// if the files don't support it, as with pipes or different file systems.
+static size_t copyRange(int in, off_t* offset, int out, size_t size) {
+  size_t copied = 0;
+  while (copied < size) {
+    size_t n = min((size_t)1 << 30, size - copied);
+    ssize_t r = copy_file_range(in, offset, out, NULL, n, 0);
+    if (r < 0 && errno != EINVAL && errno != EXDEV && errno != ENOSYS &&
+        errno != EOPNOTSUPP && errno != EBADF)
+      err(1, "copy_file_range failed");
+    if (r <= 0)
+      break;
+    copied += r;
+  }
+  return copied;
+}
+
+// Copies |size| bytes, or all bytes until EOF if |size| is -1, in the
+// kernel if possible and otherwise through a fixed buffer. The bytes are
+// counted as passed through if |passthrough|. Returns the number of
+// copied bytes.
+static size_t copyFd(int in, int out, size_t size, bool passthrough) {
+  size_t copied = copyRange(in, NULL, out, size);
+  size_t in_kernel = copied;
+  vector<char> buf(copied == size ? 0 : COPY_SIZE);
+  while (copied < size) {
+    size_t n = min(COPY_SIZE, size - copied);
+    ssize_t r = read(in, buf.data(), n);
+    if (r < 0)
+      err(1, "read failed");
+    if (r == 0) {
+      if (size != (size_t)-1)
+        errx(1, "unexpected end of input");
+      break;
     }
-    *p++ = b;
+    xwrite(out, buf.data(), r);
+    copied += r;
+  }
+  if (passthrough) {
+    __sync_fetch_and_add(&copied_size, in_kernel);
+    __sync_fetch_and_add(&written_size, copied - in_kernel);
   }
+  return copied;
 }
 
-static bool opt_d = false;
+// Lets the kernel drop the pages of the mapped input in [p, p + size),
+// so streaming doesn't keep the whole input resident.
+static void dropPages(const void* p, size_t size) {
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = ((uintptr_t)p + page - 1) & ~(page - 1);
+  uintptr_t end = ((uintptr_t)p + size) & ~(page - 1);
+  if (begin < end)
+    madvise((void*)begin, end - begin, MADV_DONTNEED);
+}
+
+// Writes |size| bytes of |binary| at |p| to |fd|. They're copied from
+// the file of |binary| in the kernel if possible, and otherwise written
+// from the mapping in pieces whose pages are dropped.
+static size_t writeMapped(const Binary* binary, int fd, const void* p,
+                          size_t size) {
+  const char* b = static_cast<const char*>(p);
+  off_t offset = b - binary->mapped_head;
+  size_t copied = copyRange(binary->fd(), &offset, fd, size);
+  for (size_t off = copied; off < size; off += COPY_SIZE) {
+    size_t n = min(COPY_SIZE, size - off);
+    xwrite(fd, b + off, n);
+    dropPages(b + off, n);
+  }
+  __sync_fetch_and_add(&copied_size, copied);
+  __sync_fetch_and_add(&written_size, size - copied);
+  return size;
+}
+
+// A section in the rest of the binary which is written as |bytes|.
+struct Replacement {
+  const char* pos;
+  size_t size;
+  vector<uint8_t> bytes;
+};
+
+static bool replacementLess(const Replacement& a, const Replacement& b) {
+  return a.pos < b.pos;
+}
+
+// Writes the rest of the binary after .debug_info, with |replacements|
+// in the order of their positions.
+static size_t writeRest(const Binary* binary, int fd, const char* rest,
+                        size_t rest_size,
+                        const vector<Replacement>& replacements) {
+  size_t size = 0;
+  const char* p = rest;
+  for (size_t i = 0; i < replacements.size(); i++) {
+    const Replacement& r = replacements[i];
+    size += writeMapped(binary, fd, p, r.pos - p);
+    xwrite(fd, r.bytes.data(), r.bytes.size());
+    size += r.bytes.size();
+    p = r.pos + r.size;
+  }
+  return size + writeMapped(binary, fd, p, rest + rest_size - p);
+}
+
+// Binaries are parsed with random access, so a binary from a pipe is
+// copied to an unlinked temporary file first. |head| is what was already
+// read from stdin.
+static int spoolStdin(const void* head, size_t head_size) {
+  const char* dir = getenv("TMPDIR");
+  string path = string(dir ? dir : "/tmp") + "/dwarfzip.XXXXXX";
+  vector<char> name(path.begin(), path.end());
+  name.push_back('\0');
+  int fd = mkstemp(&name[0]);
+  if (fd < 0)
+    err(1, "mkstemp failed: %s", &name[0]);
+  unlink(&name[0]);
+  xwrite(fd, head, head_size);
+  copyFd(STDIN_FILENO, fd, -1, false);
+  return fd;
+}
+
+struct ZipJob {
+  Binary* binary;
+  uint32_t flags;
+  const ZipChunk* chunks;
+  // The cache keys of chunks with --cache.
+  const ChunkKey* keys;
+  // Used for compression as the size of the output isn't known.
+  vector<vector<uint8_t> > bufs;
+  // The unit DIEs of each chunk, collected for the address index.
+  vector<vector<UnitAddrs> > units;
+  // Used for decompression.
+  uint8_t* out;
+};
+
+struct PoolJob {
+  Binary* binary;
+  const vector<bool>* starts;
+  const ZipChunk* chunks;
+  vector<vector<uint64_t> > strps;
+  vector<vector<const char*> > strings;
+};
+
+static void collectChunk(void* arg, size_t i) {
+  PoolJob* job = static_cast<PoolJob*>(arg);
+  collectStrings(job->binary, *job->starts, job->chunks[i].orig_offset,
+                 job->chunks[i + 1].orig_offset, &job->strps[i],
+                 &job->strings[i]);
+}
+
+// Builds the string pool of a raw binary from the strings of its CUs and
+// writes it to |out|. Returns false if the strings can't be pooled.
+static bool poolStrings(Binary* binary, const char* name, int num_threads,
+                        vector<uint8_t>* out) {
+  // The pool is in the rest of the binary, which readers find by the
+  // offset and the size of compressed .debug_info.
+  if (binary->debug_str < binary->debug_info + binary->debug_info_len) {
+    fprintf(stderr, "%s: .debug_str is before .debug_info, not pooled\n",
+            name);
+    return false;
+  }
+
+  vector<bool> starts;
+  if (!findStringStarts(binary, &starts)) {
+    fprintf(stderr, "%s: broken .debug_str, not pooled\n", name);
+    return false;
+  }
 
-class ZipScanner : public Scanner {
+  vector<ZipChunk> chunks;
+  splitChunks(binary, CHUNK_SIZE, &chunks);
+  size_t num_chunks = chunks.size() - 1;
+  PoolJob job;
+  job.binary = binary;
+  job.starts = &starts;
+  job.chunks = &chunks[0];
+  job.strps.resize(num_chunks);
+  job.strings.resize(num_chunks);
+  parallelFor(num_threads, num_chunks, collectChunk, &job);
+
+  vector<uint64_t> strps;
+  vector<const char*> strings;
+  for (size_t i = 0; i < num_chunks; i++) {
+    strps.insert(strps.end(), job.strps[i].begin(), job.strps[i].end());
+    strings.insert(strings.end(), job.strings[i].begin(),
+                   job.strings[i].end());
+  }
+  StringPool* pool = StringPool::build(binary, starts, strps, strings);
+  if (!pool) {
+    fprintf(stderr, "%s: broken DW_FORM_strp, not pooled\n", name);
+    return false;
+  }
+  binary->string_pool = pool;
+  pool->write(out);
+  return true;
+}
+
+// Codes the line programs of a raw binary into |out|. Returns false if
+// they can't be coded.
+static bool codeLines(Binary* binary, const char* name, uint32_t flags,
+                      int num_threads, vector<uint8_t>* out) {
+  if (!binary->debug_line_len) {
+    fprintf(stderr, "%s: no .debug_line, not coded\n", name);
+    return false;
+  }
+  // Like the pool, coded line programs are in the rest of the binary.
+  if (binary->debug_line < binary->debug_info + binary->debug_info_len) {
+    fprintf(stderr, "%s: .debug_line is before .debug_info, not coded\n",
+            name);
+    return false;
+  }
+  if (!encodeLines(binary, flags, num_threads, out)) {
+    fprintf(stderr, "%s: broken .debug_line, not coded\n", name);
+    return false;
+  }
+  return true;
+}
+
+// Codes the distinct abbrev tables of a raw binary into |out|. Returns
+// false if they don't replace .debug_abbrev.
+static bool codeAbbrevTables(const Binary* binary, const char* name,
+                             vector<uint8_t>* out) {
+  // Like the pool, the tables are in the rest of the binary.
+  if (binary->debug_abbrev < binary->debug_info + binary->debug_info_len) {
+    fprintf(stderr, "%s: .debug_abbrev is before .debug_info, not "
+            "deduplicated\n", name);
+    return false;
+  }
+  return encodeAbbrevTables(binary, out);
+}
+
+// Has only .debug_abbrev, which is enough to decode chunks read from a
+// pipe.
+class AbbrevBinary : public Binary {
 public:
-  ZipScanner(Binary* binary, uint8_t* out)
-    : Scanner(binary),
-      p_(out),
-      last_offset_(0),
-      cu_(NULL),
-      cu_cnt_(0) {
+  AbbrevBinary(const vector<char>& debug_abbrev, uint32_t flags)
+    : Binary(-1, NULL, 0, 0) {
+    this->debug_abbrev = debug_abbrev.data();
+    debug_abbrev_len = debug_abbrev.size();
+    is_zipped = true;
+    zip_flags = flags;
   }
+};
+
+// Decodes a batch of chunks which are written in order.
+struct UnzipJob {
+  Binary* binary;
+  uint32_t flags;
+  vector<const uint8_t*> ins;
+  vector<size_t> in_sizes;
+  vector<vector<uint8_t> > outs;
+};
+
+static void unzipChunk(void* arg, size_t i) {
+  UnzipJob* job = static_cast<UnzipJob*>(arg);
+  vector<uint8_t>& out = job->outs[i];
+  uint8_t* end = decodeChunkData(job->binary, job->flags, job->ins[i],
+                                 job->in_sizes[i], true, out.data());
+  if (end != out.data() + out.size())
+    errx(1, "broken chunk");
+}
 
-  const uint8_t* cur() const {
-    return p_;
+static size_t runUnzipJob(UnzipJob* job, int fd, int num_threads) {
+  parallelFor(num_threads, job->outs.size(), unzipChunk, job);
+  size_t out_size = 0;
+  for (size_t i = 0; i < job->outs.size(); i++) {
+    xwrite(fd, job->outs[i].data(), job->outs[i].size());
+    out_size += job->outs[i].size();
   }
+  job->ins.clear();
+  job->in_sizes.clear();
+  job->outs.clear();
+  return out_size;
+}
 
-private:
-  virtual void onCU(CU* cu, uint64_t offset) {
-    fprintf(stderr, "CU: %d @0x%lx len=%x version=%x ptrsize=%x\n",
-            cu_cnt_, last_offset_, cu->length, cu->version, cu->ptrsize);
+static void zipChunk(void* arg, size_t i) {
+  ZipJob* job = static_cast<ZipJob*>(arg);
+  const ZipChunk& chunk = job->chunks[i];
+  const ZipChunk& next = job->chunks[i + 1];
+  if (opt_d) {
+    uint8_t* out = decodeChunk(job->binary, i, !opt_batch,
+                               job->out + chunk.orig_offset);
+    if (out != job->out + next.orig_offset)
+      errx(1, "broken chunk: %zu", i);
+  } else if (job->keys) {
+    cache->encode(job->keys[i], job->binary, job->flags, chunk.orig_offset,
+                  next.orig_offset, !opt_batch, &job->bufs[i],
+                  job->units.empty() ? NULL : &job->units[i]);
+  } else {
+    encodeChunk(job->binary, job->flags, chunk.orig_offset,
+                next.orig_offset, !opt_batch, &job->bufs[i],
+                job->units.empty() ? NULL : &job->units[i]);
+  }
+}
+
+// Writes ZipHeader, followed by the id of the dictionary with ZIP_DICT.
+// Returns the written size.
+static size_t writeZipHeader(int fd, uint32_t flags, uint32_t num_chunks) {
+  ZipHeader header;
+  header.flags = flags;
+  header.num_chunks = num_chunks;
+  xwrite(fd, &header, sizeof(header));
+  if (!(flags & ZIP_DICT))
+    return sizeof(header);
+  uint64_t id = dict->id();
+  xwrite(fd, &id, sizeof(id));
+  return sizeof(header) + sizeof(id);
+}
 
-    memcpy(p_, cu, sizeof(CU));
-    p_ += sizeof(CU);
+// Compresses into a pipe. Chunks are encoded in batches and framed, so
+// nothing needs to be back-patched. Returns the size of the output before
+// the rest of the binary.
+static size_t zipToPipe(Binary* binary, uint32_t flags, int fd,
+                        int num_threads) {
+  ZipStreamHeader stream_header;
+  stream_header.head_size = binary->debug_info_offset;
+  stream_header.debug_abbrev_size = binary->debug_abbrev_len;
+  xwrite(fd, "\xdfZIP", 4);
+  xwrite(fd, &ZIP_STREAMED, sizeof(ZIP_STREAMED));
+  xwrite(fd, &stream_header, sizeof(stream_header));
+  xwrite(fd, binary->debug_abbrev, binary->debug_abbrev_len);
+  writeMapped(binary, fd, binary->head, binary->debug_info_offset);
+  size_t out_size = ZIP_FILE_HEADER_SIZE + sizeof(stream_header) +
+      binary->debug_abbrev_len + binary->debug_info_offset +
+      writeZipHeader(fd, flags, 0);
 
-    last_values_.clear();
+  ZipJob job;
+  job.binary = binary;
+  job.flags = flags;
+  job.keys = NULL;
+  job.out = NULL;
+  vector<ZipChunk> chunks(1);
+  for (bool more = true; more;) {
+    // Walk CU headers a batch at a time to keep the mapped input small.
+    chunks.erase(chunks.begin(), chunks.end() - 1);
+    more = splitMoreChunks(binary, opt_i ? 0 : CHUNK_SIZE,
+                           BATCH_SIZE * num_threads, &chunks);
+    size_t num_chunks = chunks.size() - 1;
+    job.chunks = &chunks[0];
+    job.bufs.assign(num_chunks, vector<uint8_t>());
+    parallelFor(num_threads, num_chunks, zipChunk, &job);
 
-    cu_ = cu;
-    cu_cnt_++;
-    last_offset_ = offset;
+    for (size_t i = 0; i < num_chunks; i++) {
+      const vector<uint8_t>& buf = job.bufs[i];
+      ZipFrame frame;
+      frame.orig_size = chunks[i + 1].orig_offset - chunks[i].orig_offset;
+      frame.zip_size = buf.size();
+      xwrite(fd, &frame, sizeof(frame));
+      xwrite(fd, buf.data(), buf.size());
+      out_size += sizeof(frame) + buf.size();
+    }
+    dropPages(binary->debug_info + chunks[0].orig_offset,
+              chunks[num_chunks].orig_offset - chunks[0].orig_offset);
   }
 
-  virtual void onAbbrev(uint64_t number, uint64_t offset) {
-    uleb128o(number, p_);
+  ZipFrame frame = { 0, 0 };
+  xwrite(fd, &frame, sizeof(frame));
+  return out_size + sizeof(frame);
+}
 
-    //fprintf(stderr, "abbr %lu @%lx\n", number, last_offset_);
-    last_offset_ = offset;
+// Decompresses a zipped file into a pipe in batches. Returns the size of
+// the output before the rest of the binary.
+static size_t unzipToPipe(Binary* binary, int fd, int num_threads) {
+  size_t out_size = writeMapped(binary, fd, binary->head,
+                               binary->debug_info_offset);
+  // Walking frames of a streamed binary may have mapped all of them.
+  dropPages(binary->debug_info, binary->debug_info_len);
+  UnzipJob job;
+  job.binary = binary;
+  job.flags = binary->zip_flags;
+  const ZipChunk* chunks = binary->zip_chunks;
+  size_t batch_size = BATCH_SIZE * num_threads;
+  for (size_t i = 0; i < binary->num_zip_chunks; i++) {
+    size_t size;
+    job.ins.push_back(binary->zipChunk(i, &size));
+    job.in_sizes.push_back(size);
+    job.outs.push_back(vector<uint8_t>(chunks[i + 1].orig_offset -
+                                       chunks[i].orig_offset));
+    if (chunks[i + 1].orig_offset - chunks[i + 1 - job.outs.size()].orig_offset
+        >= batch_size || i + 1 == binary->num_zip_chunks) {
+      const uint8_t* begin = job.ins[0];
+      const uint8_t* end = job.ins.back() + job.in_sizes.back();
+      out_size += runUnzipJob(&job, fd, num_threads);
+      dropPages(begin, end - begin);
+    }
   }
+  return out_size;
+}
 
-  virtual void onAttr(uint16_t name, uint8_t form, uint64_t value,
-                      uint64_t offset) {
-    switch (form) {
-    case DW_FORM_addr:
-    case DW_FORM_ref_addr: {
-      if (cu_->ptrsize != 8)
-        break;
+// Decompresses a streamed binary from a pipe, whose first
+// ZIP_FILE_HEADER_SIZE bytes were already read. Only a batch of frames is
+// in memory at once.
+static void unzipStream(int in, int out, int num_threads,
+                        size_t* in_size, size_t* out_size) {
+  ZipStreamHeader stream_header;
+  xread(in, &stream_header, sizeof(stream_header));
+  vector<char> debug_abbrev(stream_header.debug_abbrev_size);
+  xread(in, debug_abbrev.data(), debug_abbrev.size());
+  copyFd(in, out, stream_header.head_size, true);
+  ZipHeader header;
+  xread(in, &header, sizeof(header));
+  *in_size = ZIP_FILE_HEADER_SIZE + sizeof(stream_header) +
+      debug_abbrev.size() + stream_header.head_size + sizeof(header);
+  *out_size = stream_header.head_size;
 
-      if (opt_d) {
-        map<int, uint64_t>::iterator iter =
-          last_values_.insert(make_pair(name, 0)).first;
-        int64_t v = iter->second + value;
-        int64_t* op = (int64_t*)p_;
-        *op = v;
-        p_ += 8;
-        iter->second = v;
-      } else {
-        map<int, uint64_t>::iterator iter =
-          last_values_.insert(make_pair(name, 0)).first;
-        int64_t diff = value - iter->second;
-        sleb128o(diff, p_);
-        iter->second = value;
+  AbbrevBinary binary(debug_abbrev, header.flags);
+  if (header.flags & ZIP_DICT) {
+    xread(in, &binary.dict_id, sizeof(binary.dict_id));
+    *in_size += sizeof(binary.dict_id);
+  }
+  if (dict)
+    useDictionary(&binary, dict);
+  UnzipJob job;
+  job.binary = &binary;
+  job.flags = header.flags;
+  vector<vector<uint8_t> > bufs;
+  size_t batch_size = BATCH_SIZE * num_threads;
+  size_t batch_orig_size = 0;
+  for (;;) {
+    ZipFrame frame;
+    xread(in, &frame, sizeof(frame));
+    *in_size += sizeof(frame) + frame.zip_size;
+    if (frame.orig_size) {
+      bufs.push_back(vector<uint8_t>(frame.zip_size));
+      xread(in, bufs.back().data(), frame.zip_size);
+      job.outs.push_back(vector<uint8_t>(frame.orig_size));
+      batch_orig_size += frame.orig_size;
+    }
+    if (!frame.orig_size || batch_orig_size >= batch_size) {
+      for (size_t i = 0; i < bufs.size(); i++) {
+        job.ins.push_back(bufs[i].data());
+        job.in_sizes.push_back(bufs[i].size());
       }
+      *out_size += runUnzipJob(&job, out, num_threads);
+      bufs.clear();
+      batch_orig_size = 0;
+    }
+    if (!frame.orig_size)
       break;
+  }
+
+  size_t rest_size = copyFd(in, out, -1, true);
+  *in_size += rest_size;
+  *out_size += rest_size;
+}
+
+// Compresses or decompresses |binary| named |name| into |fd|, which is a
+// pipe if |out_pipe|. Returns the size of the output.
+static size_t zipFile(Binary* binary, const char* name, int fd,
+                      bool out_pipe, uint32_t flags, int num_threads) {
+  if (dict)
+    useDictionary(binary, dict);
+  // The string pool replaces .debug_str, coded line programs replace
+  // .debug_line, and distinct abbrev tables replace .debug_abbrev.
+  // Decompression restores them.
+  vector<Replacement> replacements;
+  Replacement str;
+  str.pos = binary->debug_str;
+  str.size = binary->debug_str_len;
+  Replacement line;
+  line.pos = binary->debug_line;
+  line.size = binary->debug_line_len;
+  Replacement abbrev;
+  abbrev.pos = binary->debug_abbrev;
+  abbrev.size = binary->debug_abbrev_len;
+  if (opt_d) {
+    if (binary->string_pool) {
+      binary->string_pool->writeDebugStr(&str.bytes);
+      replacements.push_back(str);
+    }
+    if (binary->zip_flags & ZIP_LINES) {
+      decodeLines(binary, num_threads, &line.bytes);
+      replacements.push_back(line);
+    }
+    if (binary->zip_flags & ZIP_ABBREV_TABLES) {
+      abbrev.pos = binary->abbrev_tables;
+      abbrev.size = binary->abbrev_tables_len;
+      abbrev.bytes.assign(binary->debug_abbrev,
+                          binary->debug_abbrev + binary->debug_abbrev_len);
+      replacements.push_back(abbrev);
+    }
+  } else {
+    if (opt_p && poolStrings(binary, name, num_threads, &str.bytes)) {
+      replacements.push_back(str);
+      flags |= ZIP_STRINGS;
+    }
+    if (opt_l && codeLines(binary, name, flags, num_threads, &line.bytes)) {
+      replacements.push_back(line);
+      flags |= ZIP_LINES;
+    }
+    if (opt_t) {
+      binary->subtrees = SubtreeTable::build(binary, num_threads);
+      if (binary->subtrees)
+        flags |= ZIP_SUBTREES;
+    }
+    if (opt_b) {
+      binary->abbrev_order = AbbrevOrder::build(binary, num_threads);
+      if (binary->abbrev_order)
+        flags |= ZIP_ABBREVS;
+      if (codeAbbrevTables(binary, name, &abbrev.bytes)) {
+        replacements.push_back(abbrev);
+        flags |= ZIP_ABBREV_TABLES;
+      }
+    }
+  }
+  sort(replacements.begin(), replacements.end(), replacementLess);
+  const char* rest = binary->debug_info + binary->debug_info_len;
+  size_t rest_size = binary->size - (rest - binary->mapped_head);
+  size_t debug_info_offset = binary->debug_info_offset;
+  size_t out_size;
+  if (out_pipe) {
+    if (opt_d)
+      out_size = unzipToPipe(binary, fd, num_threads);
+    else
+      out_size = zipToPipe(binary, flags, fd, num_threads);
+    fflush(stderr);
+  } else {
+    // The header of a binary with replaced sections has their places, and
+    // reduced_size is its first field.
+    size_t header_size = ZIP_FILE_HEADER_SIZE;
+    off_t reduced_size_offset = 4;
+    if (!opt_d && !replacements.empty()) {
+      ZipSectionsHeader sections_header;
+      sections_header.reduced_size = 0;
+      sections_header.num_sections = replacements.size();
+      xwrite(fd, "\xdfZIP", 4);
+      xwrite(fd, &ZIP_REPLACED, sizeof(ZIP_REPLACED));
+      xwrite(fd, &sections_header, sizeof(sections_header));
+      for (size_t i = 0; i < replacements.size(); i++) {
+        const Replacement& r = replacements[i];
+        ZipSection section;
+        section.offset = r.pos - binary->head;
+        section.orig_size = r.size;
+        section.size = r.bytes.size();
+        xwrite(fd, &section, sizeof(section));
+      }
+      header_size += sizeof(sections_header) +
+          sizeof(ZipSection) * replacements.size();
+      reduced_size_offset = ZIP_FILE_HEADER_SIZE;
+    } else if (!opt_d) {
+      xwrite(fd, "\xdfZIP\0\0\0\0\0\0\0\0", ZIP_FILE_HEADER_SIZE);
     }
+    writeMapped(binary, fd, binary->head, debug_info_offset);
+
+    ZipJob job;
+    job.binary = binary;
+    job.keys = NULL;
+    job.out = NULL;
+    if (opt_d) {
+      job.flags = binary->zip_flags;
+      job.chunks = binary->zip_chunks;
+      size_t num_chunks = binary->num_zip_chunks;
+      out_size = debug_info_offset + job.chunks[num_chunks].orig_offset;
+      if (ftruncate(fd, out_size) < 0)
+        err(1, "ftruncate failed");
+      uint8_t* p = (uint8_t*)mmap(NULL, out_size,
+                                  PROT_READ | PROT_WRITE, MAP_SHARED,
+                                  fd, 0);
+      if (p == MAP_FAILED)
+        err(1, "mmap failed");
+      job.out = p + debug_info_offset;
+
+      parallelFor(num_threads, num_chunks, zipChunk, &job);
 
-    case DW_FORM_strp:
-    case DW_FORM_data4:
-    case DW_FORM_ref4: {
-      if (opt_d) {
-        map<int, uint64_t>::iterator iter =
-          last_values_.insert(make_pair(name, 0)).first;
-        int32_t v = (static_cast<int32_t>(iter->second) +
-                     static_cast<int32_t>(value));
-        int32_t* op = (int32_t*)p_;
-        *op = v;
-        p_ += 4;
-        iter->second = v;
+      munmap(p, out_size);
+      if (lseek(fd, out_size, SEEK_SET) < 0)
+        err(1, "lseek failed");
+    } else {
+      vector<ZipChunk> chunks;
+      vector<ChunkKey> keys;
+      // With -i, each CU gets its own chunk so the chunk table works as a
+      // CU index for random access. Cached chunks end where the hashes of
+      // CUs say.
+      if (cache) {
+        splitKeyedChunks(binary, flags, opt_i ? 0 : CHUNK_SIZE, num_threads,
+                         &chunks, &keys);
+        job.keys = keys.empty() ? NULL : &keys[0];
       } else {
-        int32_t v = static_cast<int32_t>(value);
-        map<int, uint64_t>::iterator iter =
-          last_values_.insert(make_pair(name, 0)).first;
-        int32_t diff = v - static_cast<int32_t>(iter->second);
-        sleb128o(diff, p_);
-        iter->second = v;
+        splitChunks(binary, opt_i ? 0 : CHUNK_SIZE, &chunks);
       }
-      break;
+      size_t num_chunks = chunks.size() - 1;
+      job.flags = flags;
+      job.chunks = &chunks[0];
+      job.bufs.resize(num_chunks);
+      if (opt_a)
+        job.units.resize(num_chunks);
+
+      parallelFor(num_threads, num_chunks, zipChunk, &job);
+
+      for (size_t i = 0; i < num_chunks; i++) {
+        chunks[i + 1].zip_offset = chunks[i].zip_offset + job.bufs[i].size();
+      }
+      if (opt_a) {
+        vector<UnitAddrs> units;
+        for (size_t i = 0; i < num_chunks; i++)
+          units.insert(units.end(), job.units[i].begin(), job.units[i].end());
+        binary->addr_index = AddrIndex::build(binary, units);
+        if (binary->addr_index)
+          job.flags |= ZIP_ADDRS;
+        else
+          fprintf(stderr, "%s: no addresses, not indexed\n", name);
+      }
+      size_t zip_size = writeZipHeader(fd, job.flags, num_chunks);
+      if (binary->subtrees) {
+        vector<uint8_t> templates;
+        binary->subtrees->write(binary, flags, &templates);
+        xwrite(fd, templates.data(), templates.size());
+        zip_size += templates.size();
+      }
+      if (binary->addr_index) {
+        vector<uint8_t> index;
+        binary->addr_index->write(&index);
+        xwrite(fd, index.data(), index.size());
+        zip_size += index.size();
+      }
+      if (binary->abbrev_order) {
+        vector<uint8_t> orders;
+        binary->abbrev_order->write(&orders);
+        xwrite(fd, orders.data(), orders.size());
+        zip_size += orders.size();
+      }
+      xwrite(fd, &chunks[0], sizeof(ZipChunk) * chunks.size());
+      for (size_t i = 0; i < num_chunks; i++) {
+        xwrite(fd, job.bufs[i].data(), job.bufs[i].size());
+      }
+      zip_size += sizeof(ZipChunk) * chunks.size() +
+          chunks[num_chunks].zip_offset;
+      uint64_t reduced_size = binary->debug_info_len - zip_size;
+      if (pwrite(fd, &reduced_size, sizeof(reduced_size),
+                 reduced_size_offset) < 0)
+        err(1, "pwrite failed");
+      out_size = header_size + debug_info_offset + zip_size;
     }
+    fflush(stderr);
+  }
+  out_size += writeRest(binary, fd, rest, rest_size, replacements);
+
+  return out_size;
+}
+
+// A file of --batch.
+struct BatchFile {
+  string in;
+  string out;
+  // The size of the input, by which the biggest files are started first.
+  size_t in_size;
+  size_t out_size;
+  // Why the file was skipped, or NULL.
+  const char* error;
+};
 
-    default: {
-      size_t sz = offset - last_offset_;
-      memcpy(p_, binary_->debug_info + last_offset_, sz);
-      p_ += sz;
+struct BatchJob {
+  vector<BatchFile> files;
+  // The files in the order they are started.
+  vector<BatchFile*> order;
+  uint32_t flags;
+  int num_threads;
+};
+
+static bool biggerFile(const BatchFile* a, const BatchFile* b) {
+  return a->in_size > b->in_size;
+}
+
+static void zipBatchFile(void* arg, size_t i) {
+  BatchJob* job = static_cast<BatchJob*>(arg);
+  BatchFile& file = *job->order[i];
+  auto_ptr<Binary> binary(tryReadBinary(file.in.c_str(), &file.error));
+  if (!binary.get())
+    return;
+  if (opt_d && !binary->is_zipped) {
+    file.error = "not compressed";
+    return;
+  } else if (!opt_d && binary->is_zipped) {
+    file.error = "already compressed";
+    return;
+  }
+  int fd = open(file.out.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    err(1, "open failed: %s", file.out.c_str());
+  file.in_size = binary->size;
+  file.out_size = zipFile(binary.get(), file.in.c_str(), fd, false,
+                          job->flags, job->num_threads);
+  close(fd);
+}
+
+// Adds the pairs of input and output files in |list|, one pair separated
+// by whitespace per line.
+static void readBatchList(FILE* list, vector<BatchFile>* files) {
+  char line[4096];
+  while (fgets(line, sizeof(line), list)) {
+    char in[4096], out[4096];
+    int n = sscanf(line, "%4095s %4095s", in, out);
+    if (n <= 0)
+      continue;
+    if (n != 2)
+      errx(1, "no output for %s", in);
+    BatchFile file = { in, out, 0, 0, NULL };
+    files->push_back(file);
+  }
+}
+
+// Adds the regular files under |in| with the same paths under |out|, and
+// creates the directories of |out|. |skip| is the directory of the
+// output, which isn't walked if it's under |in|.
+static void walkBatchDir(const string& in, const string& out,
+                         const struct stat& skip, vector<BatchFile>* files) {
+  if (mkdir(out.c_str(), 0755) < 0 && errno != EEXIST)
+    err(1, "mkdir failed: %s", out.c_str());
+  DIR* dir = opendir(in.c_str());
+  if (!dir)
+    err(1, "opendir failed: %s", in.c_str());
+  while (struct dirent* ent = readdir(dir)) {
+    if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+      continue;
+    string in_path = in + "/" + ent->d_name;
+    string out_path = out + "/" + ent->d_name;
+    struct stat st;
+    if (lstat(in_path.c_str(), &st) < 0)
+      err(1, "stat failed: %s", in_path.c_str());
+    if (S_ISDIR(st.st_mode)) {
+      if (st.st_dev != skip.st_dev || st.st_ino != skip.st_ino)
+        walkBatchDir(in_path, out_path, skip, files);
+    } else if (S_ISREG(st.st_mode)) {
+      BatchFile file = { in_path, out_path, (size_t)st.st_size, 0, NULL };
+      files->push_back(file);
     }
+  }
+  closedir(dir);
+}
+
+static double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Compresses or decompresses the files of a list, or of a directory tree
+// if |out_dir| isn't NULL, in one process. Files and their chunks run on
+// one thread pool, so a few big files don't leave threads idle.
+static void runBatch(const char* in, const char* out_dir, uint32_t flags,
+                     int num_threads) {
+  BatchJob job;
+  job.flags = flags;
+  job.num_threads = num_threads;
+  if (out_dir) {
+    if (mkdir(out_dir, 0755) < 0 && errno != EEXIST)
+      err(1, "mkdir failed: %s", out_dir);
+    struct stat skip;
+    if (stat(out_dir, &skip) < 0)
+      err(1, "stat failed: %s", out_dir);
+    walkBatchDir(in, out_dir, skip, &job.files);
+  } else {
+    FILE* list = strcmp(in, "-") ? fopen(in, "r") : stdin;
+    if (!list)
+      err(1, "open failed: %s", in);
+    readBatchList(list, &job.files);
+    if (list != stdin)
+      fclose(list);
+    for (size_t i = 0; i < job.files.size(); i++) {
+      struct stat st;
+      if (!stat(job.files[i].in.c_str(), &st))
+        job.files[i].in_size = st.st_size;
     }
+  }
 
-    //fprintf(stderr, "attr %d %d @%lx\n", name, form, last_offset_);
+  // Starting the biggest files first leaves the small ones to fill in
+  // at the end.
+  for (size_t i = 0; i < job.files.size(); i++)
+    job.order.push_back(&job.files[i]);
+  stable_sort(job.order.begin(), job.order.end(), biggerFile);
 
-    last_offset_ = offset;
+  // Abbrev tables of objects linked into several binaries are parsed once.
+  shareAbbrevTables();
+  double start = now();
+  startThreadPool(num_threads);
+  parallelFor(num_threads, job.order.size(), zipBatchFile, &job);
+  stopThreadPool();
+  double elapsed = now() - start;
+
+  size_t num_files = 0, in_size = 0, out_size = 0;
+  for (size_t i = 0; i < job.files.size(); i++) {
+    const BatchFile& file = job.files[i];
+    // Directories have all kinds of files, so only listed ones which
+    // can't be processed are worth a note.
+    if (file.error) {
+      if (!out_dir)
+        fprintf(stderr, "%s: %s, skipped\n", file.in.c_str(), file.error);
+      continue;
+    }
+    printf("%s: %lu => %lu (%.2f%%)\n", file.in.c_str(), file.in_size,
+           file.out_size, ((float)file.out_size / file.in_size) * 100);
+    num_files++;
+    in_size += file.in_size;
+    out_size += file.out_size;
   }
+  printf("%zu files, %lu => %lu (%.2f%%), %.2f s, %.2f MB/s\n",
+         num_files, in_size, out_size,
+         in_size ? ((float)out_size / in_size) * 100 : 0.0, elapsed,
+         elapsed > 0 ? in_size / elapsed / 1e6 : 0.0);
+}
 
-  uint8_t* p_;
-  uint64_t last_offset_;
-  CU* cu_;
-  int cu_cnt_;
-  map<int, uint64_t> last_values_;
-};
+// Reports how the unchanged bytes were copied, and how many chunks
+// --cache had.
+static void reportCopies() {
+  fprintf(stderr, "passthrough: %zu bytes copied in the kernel, "
+          "%zu bytes written\n", copied_size, written_size);
+  if (!cache)
+    return;
+  fprintf(stderr, "cache: %zu hits, %zu misses\n", cache->num_hits(),
+          cache->num_misses());
+}
+
+// Trains a dictionary on the binaries |files| with the options of
+// compression and writes it to |path|. Training runs on one thread.
+static void trainDictionary(const char* path, char** files, int num_files,
+                            uint32_t flags) {
+  vector<ModelCounts> counts(NUM_DICT_MODELS);
+  size_t num_trained = 0, trained_size = 0;
+  for (int i = 0; i < num_files; i++) {
+    const char* error;
+    auto_ptr<Binary> binary(tryReadBinary(files[i], &error));
+    if (!binary.get()) {
+      fprintf(stderr, "%s: %s, skipped\n", files[i], error);
+      continue;
+    }
+    if (binary->is_zipped) {
+      fprintf(stderr, "%s: already compressed, skipped\n", files[i]);
+      continue;
+    }
+    // Pooled strings change the fields of CUs, so they are trained as
+    // they would be coded.
+    uint32_t file_flags = flags & ~ZIP_STRINGS;
+    vector<uint8_t> pool;
+    if (opt_p && poolStrings(binary.get(), files[i], 1, &pool))
+      file_flags |= ZIP_STRINGS;
+    vector<ZipChunk> chunks;
+    splitChunks(binary.get(), opt_i ? 0 : CHUNK_SIZE, &chunks);
+    for (size_t j = 0; j + 1 < chunks.size(); j++) {
+      countChunkModels(binary.get(), file_flags, chunks[j].orig_offset,
+                       chunks[j + 1].orig_offset,
+                       &counts[DICT_MODELS_INFO]);
+    }
+    if (opt_l && binary->debug_line_len &&
+        !countLineModels(binary.get(), &counts[DICT_MODELS_LINES]))
+      fprintf(stderr, "%s: broken .debug_line, not trained\n", files[i]);
+    num_trained++;
+    trained_size += binary->size;
+  }
+  if (!num_trained)
+    errx(1, "no binaries to train");
 
-static const int HEADER_SIZE = 8;
+  auto_ptr<Dictionary> trained(Dictionary::train(&counts[0], flags));
+  trained->write(path);
+  printf("%zu files, %zu bytes => %s\n", num_trained, trained_size, path);
+}
 
 int main(int argc, char* argv[]) {
   const char* argv0 = argv[0];
-  for (int i = 1; i < argc; i++) {
-    if (argv[i][0] != '-') {
-      continue;
-    }
-    if (!strcmp(argv[i], "-d")) {
+  const char* train_path = NULL;
+  const char* cache_dir = NULL;
+  int num_threads = 1;
+  int context = DELTA_CONTEXT_ATTR;
+  while (argc > 1 && argv[1][0] == '-' && argv[1][1]) {
+    if (!strcmp(argv[1], "-d")) {
       opt_d = true;
+    } else if (!strcmp(argv[1], "-i")) {
+      opt_i = true;
+    } else if (!strcmp(argv[1], "-e")) {
+      opt_e = true;
+    } else if (!strcmp(argv[1], "-E")) {
+      opt_e = true;
+      opt_E = true;
+    } else if (!strcmp(argv[1], "-s")) {
+      opt_s = true;
+    } else if (!strcmp(argv[1], "-p")) {
+      opt_p = true;
+    } else if (!strcmp(argv[1], "-l")) {
+      opt_l = true;
+    } else if (!strcmp(argv[1], "-t")) {
+      opt_t = true;
+    } else if (!strcmp(argv[1], "-a")) {
+      opt_a = true;
+    } else if (!strcmp(argv[1], "-R")) {
+      opt_R = true;
+    } else if (!strcmp(argv[1], "-b")) {
+      opt_b = true;
+    } else if (!strcmp(argv[1], "--batch")) {
+      opt_batch = true;
+    } else if (!strcmp(argv[1], "--train") && argc > 2) {
+      train_path = argv[2];
+      argc--;
+      argv++;
+    } else if (!strcmp(argv[1], "--cache") && argc > 2) {
+      cache_dir = argv[2];
+      argc--;
+      argv++;
+    } else if (!strcmp(argv[1], "-D") && argc > 2) {
+      dict = Dictionary::read(argv[2]);
+      argc--;
+      argv++;
+    } else if (!strcmp(argv[1], "-c") && argc > 2) {
+      if (!strcmp(argv[2], "attr")) {
+        context = DELTA_CONTEXT_ATTR;
+      } else if (!strcmp(argv[2], "tag")) {
+        context = DELTA_CONTEXT_TAG;
+      } else if (!strcmp(argv[2], "abbrev")) {
+        context = DELTA_CONTEXT_ABBREV;
+      } else {
+        fprintf(stderr, "Unknown context: %s\n", argv[2]);
+        exit(1);
+      }
+      argc--;
+      argv++;
+    } else if (!strncmp(argv[1], "-j", 2)) {
+      const char* n = argv[1] + 2;
+      if (!*n && argc > 2) {
+        n = argv[2];
+        argc--;
+        argv++;
+      }
+      num_threads = atoi(n);
+      if (num_threads <= 0)
+        num_threads = sysconf(_SC_NPROCESSORS_ONLN);
     } else {
-      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      fprintf(stderr, "Unknown option: %s\n", argv[1]);
     }
     argc--;
     argv++;
   }
 
-  if (argc < 3) {
-    fprintf(stderr, "Usage: %s [-d] binary output\n", argv0);
+  if (argc < (opt_batch || train_path ? 2 : 3)) {
+    fprintf(stderr, "Usage: %s [-d] [-i] [-e|-E|-s] [-p] [-l] [-t] [-a] "
+            "[-R] [-b] "
+            "[-c attr|tag|abbrev] "
+            "[-D dict] [-j threads] [--cache dir] "
+            "binary|- output|-\n"
+            "       %s [options] --batch list|-\n"
+            "       %s [options] --batch dir output_dir\n"
+            "       %s [options] --train dict binary...\n",
+            argv0, argv0, argv0, argv0);
     exit(1);
   }
-
-  auto_ptr<Binary> binary(readBinary(argv[1]));
-
-  if (opt_d && !binary->is_zipped) {
-    fprintf(stderr, "%s is not compressed\n", argv[1]);
-    exit(1);
-  } else if (!opt_d && binary->is_zipped) {
-    fprintf(stderr, "%s is already compressed\n", argv[1]);
+  // Models see the same values for each context whatever the order of
+  // fields is, so splitting doesn't help entropy coding.
+  if (opt_e && opt_s) {
+    fprintf(stderr, "-e or -E and -s can't be used together\n");
     exit(1);
   }
-
-  int fd = open(argv[2], O_RDWR | O_CREAT | O_TRUNC, 0644);
-  if (fd < 0)
-    err(1, "open failed: %s", argv[1]);
-
-  if (!opt_d) {
-    if (write(fd, "\xdfZIP\0\0\0\0", HEADER_SIZE) < 0)
-      err(1, "write failed");
+  uint32_t flags = context | (opt_e ? ZIP_ENTROPY : 0) |
+      (opt_E ? ZIP_STATIC : 0) |
+      (opt_s ? ZIP_STREAMS : 0) | (opt_R ? ZIP_PREDICT : 0);
+  // A dictionary has models of entropy coding.
+  if (train_path) {
+    trainDictionary(train_path, argv + 1, argc - 1,
+                    flags | ZIP_ENTROPY | (opt_p ? ZIP_STRINGS : 0));
+    return 0;
+  }
+  if (dict && !opt_d) {
+    if (!opt_e) {
+      fprintf(stderr, "-D can only be used with -e or -E\n");
+      exit(1);
+    }
+    // Models of other fields would code worse than none.
+    if (!dict->fits(flags | (opt_p ? ZIP_STRINGS : 0))) {
+      fprintf(stderr, "-D dictionary was trained with other -c, -p or -R\n");
+      exit(1);
+    }
+    flags |= ZIP_DICT;
   }
 
-  size_t debug_info_offset = binary->debug_info - binary->head;
-  if (write(fd, binary->head, debug_info_offset) < 0)
-    err(1, "write failed");
-
-  if (pwrite(fd, "", 1, binary->size + binary->reduced_size - 1) < 0)
-    err(1, "pwrite failed");
-
-  uint8_t* p = (uint8_t*)mmap(NULL, binary->mapped_size,
-                              PROT_READ | PROT_WRITE, MAP_SHARED,
-                              fd, 0);
-  if (p == MAP_FAILED)
-    err(1, "mmap failed");
+  // Pooled strings, copies of templates and ranks of abbrevs are numbered
+  // across the whole binary, so their chunks can't be cached.
+  if (cache_dir) {
+    if (opt_p || opt_t || opt_b || opt_d) {
+      fprintf(stderr, "--cache can't be used with -p, -t, -b or -d\n");
+      exit(1);
+    }
+    cache = new ChunkCache(cache_dir);
+    flags |= ZIP_REBASED;
+  }
 
-  ZipScanner zip(binary.get(),
-                 p + debug_info_offset + (opt_d ? 0 : HEADER_SIZE));
-  zip.run();
-  fflush(stderr);
+  // With --batch, argv[1] is a list of files, or a directory whose tree
+  // is mirrored to argv[2].
+  if (opt_batch) {
+    runBatch(argv[1], argc > 2 ? argv[2] : NULL, flags, num_threads);
+    reportCopies();
+    return 0;
+  }
 
-  size_t out_size = zip.cur() - p;
-  if (lseek(fd, out_size, SEEK_SET) < 0)
-    err(1, "lseek failed");
+  // "-" reads stdin or writes stdout.
+  bool in_pipe = !strcmp(argv[1], "-");
+  bool out_pipe = !strcmp(argv[2], "-");
+  // Streamed binaries have no table of replaced sections, and their
+  // chunks are decoded before the rest, which has the pool. Templates of
+  // subtrees are found in the whole binary before any chunk is written,
+  // and so is the address index.
+  if ((opt_p || opt_l || opt_t || opt_a || opt_b || cache) && out_pipe &&
+      !opt_d) {
+    fprintf(stderr, "-p, -l, -t, -a, -b and --cache can't be used when "
+            "writing to a pipe\n");
+    exit(1);
+  }
+  // Keep stdout for the output.
+  FILE* report = out_pipe ? stderr : stdout;
 
-  const char* rest = binary->debug_info + binary->debug_info_len;
-  size_t rest_size = binary->size - (rest - binary->head);
-  if (write(fd, rest, rest_size) < 0)
-    err(1, "write failed");
+  int fd = STDOUT_FILENO;
+  if (!out_pipe) {
+    fd = open(argv[2], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      err(1, "open failed: %s", argv[2]);
+  }
 
-  out_size += rest_size;
-  if (opt_d)
-    out_size -= HEADER_SIZE;
-  if (ftruncate(fd, out_size) < 0)
-    err(1, "ftruncate failed");
+  auto_ptr<Binary> binary;
+  if (in_pipe) {
+    char header[ZIP_FILE_HEADER_SIZE];
+    xread(STDIN_FILENO, header, sizeof(header));
+    if (opt_d && !memcmp(header, "\xdfZIP", 4) &&
+        *(uint64_t*)(header + 4) == ZIP_STREAMED) {
+      size_t in_size, out_size;
+      unzipStream(STDIN_FILENO, fd, num_threads, &in_size, &out_size);
+      close(fd);
+      reportCopies();
+      fprintf(report, "%lu => %lu (%.2f%%)\n",
+              in_size, out_size, ((float)out_size / in_size) * 100);
+      return 0;
+    }
+    binary.reset(readBinaryFd(spoolStdin(header, sizeof(header)), "-"));
+  } else {
+    binary.reset(readBinary(argv[1]));
+  }
 
-  if (!opt_d) {
-    uint32_t* offset_outp = (uint32_t*)(p + 4);
-    *offset_outp = binary->size - out_size + HEADER_SIZE;
+  if (opt_d && !binary->is_zipped) {
+    fprintf(stderr, "%s is not compressed\n", argv[1]);
+    exit(1);
+  } else if (!opt_d && binary->is_zipped) {
+    fprintf(stderr, "%s is already compressed\n", argv[1]);
+    exit(1);
   }
 
-  munmap(p, binary->size);
+  size_t out_size = zipFile(binary.get(), argv[1], fd, out_pipe, flags,
+                            num_threads);
   close(fd);
+  reportCopies();
 
-  printf("%lu => %lu (%.2f%%)\n",
-         binary->size, out_size,
-         ((float)out_size / binary->size) * 100);
+  fprintf(report, "%lu => %lu (%.2f%%)\n",
+          binary->size, out_size,
+          ((float)out_size / binary->size) * 100);
 }
@@ -0,0 +1,397 @@
+#include "entropy.h"
+
+#include "binary.h"
+#include "dict.h"
+#include "rans.h"
+
+using namespace std;
+
+ModelCounts::ModelCounts()
+  : bytes(EntropyModels::NUM_MODELS * 256) {
+}
+
+// The logistic function and its inverse on integers, with probabilities
+// in PROB_BITS and their logits in 8 fractional bits in [-2047, 2047]:
+// squash(d) = 4096 / (1 + e^(-d / 256)). squash interpolates 33 points,
+// so the tables are the same anywhere.
+class Logistic {
+public:
+  Logistic() {
+    static const int points[33] = {
+      1, 2, 3, 6, 10, 16, 27, 45, 73, 120, 194, 310, 488, 747, 1101, 1546,
+      2047, 2549, 2994, 3348, 3607, 3785, 3901, 3975, 4022, 4050, 4068,
+      4079, 4085, 4089, 4092, 4093, 4094
+    };
+    for (int d = -2047; d <= 2047; d++) {
+      int w = d & 127;
+      int i = (d >> 7) + 16;
+      squash_[d + 2048] = (points[i] * (128 - w) + points[i + 1] * w + 64) >>
+          7;
+    }
+    squash_[0] = 1;
+    int p = 0;
+    for (int d = -2047; d <= 2047; d++) {
+      int v = squash_[d + 2048];
+      for (; p <= v; p++)
+        stretch_[p] = d;
+    }
+    for (; p < 4096; p++)
+      stretch_[p] = 2047;
+  }
+
+  int squash(int d) const {
+    if (d > 2047)
+      d = 2047;
+    if (d < -2047)
+      d = -2047;
+    return squash_[d + 2048];
+  }
+
+  int stretch(int p) const {
+    return stretch_[p];
+  }
+
+private:
+  uint16_t squash_[4096];
+  int16_t stretch_[4096];
+};
+
+static const Logistic logistic;
+
+// Counters move to a bit by 1 / (n + 1.5) of the way after n updates, up
+// to MAX_COUNT, so they learn fast at first and stay stable later.
+static const int MAX_COUNT = 14;
+// Order-0 models of dictionaries start as if they had seen a few bits.
+static const int PRIOR_COUNT = 4;
+static const uint16_t COUNTER_INIT = 2048 << 4;
+
+class CounterRates {
+public:
+  CounterRates() {
+    for (int n = 0; n < 16; n++)
+      rates_[n] = 131072 / (2 * n + 3);
+  }
+
+  int operator[](int n) const {
+    return rates_[n];
+  }
+
+private:
+  int rates_[16];
+};
+
+static const CounterRates counter_rates;
+
+static inline int counterProb(uint16_t c) {
+  return c >> 4;
+}
+
+static inline void updateCounter(uint16_t* c, int bit) {
+  int n = *c & 15;
+  int p = *c >> 4;
+  p += ((bit ? 4095 : 0) - p) * counter_rates[n] >> 16;
+  if (n < MAX_COUNT)
+    n++;
+  *c = p << 4 | n;
+}
+
+static inline uint32_t hash2(uint32_t a, uint32_t b) {
+  uint32_t h = ((a + 0x9e3779b9) * 0x85ebca6b) ^ b;
+  h *= 0xc2b2ae35;
+  return h ^ (h >> 15);
+}
+
+// Hashed models have up to 2^MAX_HASH_BITS counters, and about 16 for
+// each byte of the chunk.
+static const int MIN_HASH_BITS = 12;
+static const int MAX_HASH_BITS = 22;
+// The weights of the mixer are in 16 fractional bits, and it learns at
+// MIXER_RATE.
+static const int MIXER_RATE = 2;
+static const int APM_RATE = 7;
+
+EntropyModels::EntropyModels(const ModelPriors* priors,
+                             const uint8_t* history, size_t size)
+  : priors_(priors),
+    history_(history),
+    pos_in_chunk_(0),
+    ctx_(0),
+    pos_(0),
+    c0_(1),
+    bit_(7),
+    order0_(new uint16_t[NUM_MODELS * 256]),
+    model_(NULL),
+    slot_(0),
+    field_hash_(0),
+    prev_field_hash_(0),
+    last_field_hash_(0),
+    prev_ctx_(0),
+    last_fields_(1 << 16),
+    match_ptr_(0),
+    match_len_(0),
+    expected_(-1),
+    match_counter_(NULL),
+    weights_(NUM_WEIGHT_SETS * NUM_INPUTS, 65536 / 4),
+    weight_set_(NULL),
+    mixed_(2048),
+    apm_(8 * 256 * 33),
+    apm_index_(0) {
+  memset(used_, 0, sizeof(used_));
+  int bits = MAX_HASH_BITS;
+  while (bits > MIN_HASH_BITS && ((size_t)1 << bits) > size * 16)
+    bits--;
+  hashed_.assign((size_t)NUM_HASHED << bits, COUNTER_INIT);
+  hash_mask_ = (1 << bits) - 1;
+  match_bits_ = bits - 2;
+  matches_.resize((size_t)1 << match_bits_);
+  for (size_t i = 0; i < 256; i++)
+    match_counters_[i] = COUNTER_INIT;
+  const Logistic& l = logistic;
+  for (size_t i = 0; i < apm_.size(); i++)
+    apm_[i] = l.squash(((int)(i % 33) - 16) * 128) * 16;
+}
+
+void EntropyModels::startField(uint32_t ctx) {
+  if (pos_in_chunk_) {
+    prev_field_hash_ = field_hash_;
+    last_fields_[(prev_ctx_ * 0x9e3779b1) >> 16] = field_hash_;
+  }
+  field_hash_ = 0;
+  last_field_hash_ = last_fields_[(ctx * 0x9e3779b1) >> 16];
+  prev_ctx_ = ctx;
+}
+
+void EntropyModels::startByte(uint32_t ctx, size_t pos) {
+  if (!pos)
+    startField(ctx);
+  if (pos > MAX_POS)
+    pos = MAX_POS;
+  ctx_ = ctx;
+  pos_ = pos;
+  c0_ = 1;
+  bit_ = 7;
+
+  size_t i = index(ctx, pos);
+  model_ = order0_ + i * 256;
+  // Models are initialized on first use, as a chunk only touches a few.
+  if (!used_[i]) {
+    used_[i] = true;
+    if (priors_ && priors_->trained[i]) {
+      const uint16_t* probs = &priors_->probs[i * 256];
+      for (int j = 0; j < 256; j++)
+        model_[j] = probs[j] << 4 | PRIOR_COUNT;
+    } else {
+      for (int j = 0; j < 256; j++)
+        model_[j] = COUNTER_INIT;
+    }
+  }
+  hashes_[0] = hash2(ctx, pos + 16 * field_hash_);
+  hashes_[1] = hash2(ctx * 3 + pos, last_field_hash_);
+  hashes_[2] = hash2(ctx * 5 + pos, prev_field_hash_);
+  expected_ = match_len_ ? history_[match_ptr_] : -1;
+  weight_set_ = &weights_[((ctx & 7) * (MAX_POS + 1) + pos) * NUM_INPUTS];
+}
+
+inline int EntropyModels::predict() {
+  const Logistic& l = logistic;
+  // Buckets hold the nodes of a nibble, and are found again by the first
+  // nibble for the second one.
+  if (bit_ == 7 || bit_ == 3) {
+    for (int m = 0; m < NUM_HASHED; m++) {
+      uint32_t h = bit_ == 7 ? hashes_[m] : hash2(hashes_[m], c0_);
+      buckets_[m] = &hashed_[m * ((size_t)hash_mask_ + 1) +
+                             (h & hash_mask_ & ~15u)];
+    }
+  }
+  if (bit_ >= 4) {
+    slot_ = c0_;
+  } else {
+    int n = 3 - bit_;
+    slot_ = (1 << n) | (c0_ & ((1 << n) - 1));
+  }
+
+  int* x = inputs_;
+  x[0] = l.stretch(counterProb(model_[c0_]));
+  for (int m = 0; m < NUM_HASHED; m++)
+    x[m + 1] = l.stretch(counterProb(buckets_[m][slot_]));
+  match_counter_ = NULL;
+  if (expected_ >= 0 && ((expected_ | 256) >> (bit_ + 1)) == (int)c0_) {
+    int bit = (expected_ >> bit_) & 1;
+    int len = match_len_ > 15 ? 15 : match_len_;
+    match_counter_ = &match_counters_[(len * 2 + bit) * 8 + (ctx_ & 7)];
+    x[NUM_HASHED + 1] = l.stretch(counterProb(*match_counter_));
+    x[NUM_HASHED + 2] = bit ? len * 64 : -len * 64;
+  } else {
+    x[NUM_HASHED + 1] = 0;
+    x[NUM_HASHED + 2] = 0;
+  }
+  x[NUM_HASHED + 3] = 256;
+  int64_t dot = 0;
+  for (int i = 0; i < NUM_INPUTS; i++)
+    dot += (int64_t)x[i] * weight_set_[i];
+  mixed_ = l.squash(dot >> 16);
+
+  int s = l.stretch(mixed_) + 2048;
+  int w = s & 127;
+  apm_index_ = ((ctx_ & 7) * 256 + c0_) * 33 + (s >> 7);
+  int refined = (apm_[apm_index_] * (128 - w) +
+                 apm_[apm_index_ + 1] * w) >> 11;
+  int p = (mixed_ + 3 * refined) >> 2;
+  if (p < 1)
+    p = 1;
+  if (p > 4095)
+    p = 4095;
+  return p;
+}
+
+inline void EntropyModels::update(int bit) {
+  int err = ((bit << 12) - mixed_) * MIXER_RATE;
+  for (int i = 0; i < NUM_INPUTS; i++)
+    weight_set_[i] += (inputs_[i] * err) >> 10;
+  int g = (bit << 16) + (bit << APM_RATE) - bit - bit;
+  apm_[apm_index_] += (g - apm_[apm_index_]) >> APM_RATE;
+  apm_[apm_index_ + 1] += (g - apm_[apm_index_ + 1]) >> APM_RATE;
+  updateCounter(&model_[c0_], bit);
+  for (int m = 0; m < NUM_HASHED; m++)
+    updateCounter(&buckets_[m][slot_], bit);
+  if (match_counter_)
+    updateCounter(match_counter_, bit);
+  c0_ = c0_ * 2 + bit;
+  bit_--;
+}
+
+void EntropyModels::endByte() {
+  size_t i = pos_in_chunk_++;
+  uint8_t b = history_[i];
+  field_hash_ = hash2(field_hash_ + 1, b) | 1;
+  if (match_len_ && expected_ == b) {
+    match_len_++;
+    match_ptr_++;
+  } else {
+    match_len_ = 0;
+  }
+  if (i + 1 < (size_t)MIN_MATCH)
+    return;
+  uint32_t h = 0;
+  for (int j = 0; j < MIN_MATCH; j++)
+    h = (h + history_[i - j] + 1) * 0x2f0b4f27;
+  h >>= 32 - match_bits_;
+  uint32_t candidate = matches_[h];
+  if (!match_len_ && candidate) {
+    uint32_t len = 0;
+    while (len < MAX_MATCH && len < candidate &&
+           history_[candidate - 1 - len] == history_[i - len])
+      len++;
+    if (len >= (uint32_t)MIN_MATCH) {
+      match_ptr_ = candidate;
+      match_len_ = len;
+    }
+  }
+  matches_[h] = i + 1;
+}
+
+void EntropyEncoder::encodeByte(uint32_t ctx, size_t pos, uint8_t b) {
+  models_.startByte(ctx, pos);
+  for (int i = 7; i >= 0; i--) {
+    uint32_t bit = (b >> i) & 1;
+    uint32_t p0 = (1 << EntropyModels::PROB_BITS) - models_.predict();
+    uint32_t bound = (range_ >> EntropyModels::PROB_BITS) * p0;
+    if (!bit) {
+      range_ = bound;
+    } else {
+      low_ += bound;
+      range_ -= bound;
+    }
+    while (range_ < (1 << 24)) {
+      range_ <<= 8;
+      shiftLow();
+    }
+    models_.update(bit);
+  }
+  models_.endByte();
+}
+
+void EntropyEncoder::shiftLow() {
+  if ((uint32_t)low_ < 0xff000000 || (low_ >> 32)) {
+    uint8_t carry = low_ >> 32;
+    uint8_t temp = cache_;
+    do {
+      out_->push_back(temp + carry);
+      temp = 0xff;
+    } while (--cache_size_);
+    cache_ = (low_ >> 24) & 0xff;
+  }
+  cache_size_++;
+  low_ = (low_ & 0x00ffffff) << 8;
+}
+
+void EntropyEncoder::flush() {
+  for (int i = 0; i < 5; i++)
+    shiftLow();
+}
+
+uint8_t EntropyDecoder::decodeByte(uint32_t ctx, size_t pos) {
+  models_.startByte(ctx, pos);
+  uint32_t m = 1;
+  for (int i = 0; i < 8; i++) {
+    uint32_t p0 = (1 << EntropyModels::PROB_BITS) - models_.predict();
+    uint32_t bound = (range_ >> EntropyModels::PROB_BITS) * p0;
+    uint32_t bit;
+    if (code_ < bound) {
+      range_ = bound;
+      bit = 0;
+    } else {
+      code_ -= bound;
+      range_ -= bound;
+      bit = 1;
+    }
+    while (range_ < (1 << 24)) {
+      range_ <<= 8;
+      code_ = (code_ << 8) | nextByte();
+    }
+    models_.update(bit);
+    m = m * 2 + bit;
+  }
+  *p_++ = m;
+  models_.endByte();
+  return m;
+}
+
+void entropyEncode(Binary* binary, uint32_t flags, const uint8_t* in,
+                   size_t size, const vector<uint64_t>* abbrev_offsets,
+                   vector<uint8_t>* out) {
+  const ModelPriors* priors = dictPriors(binary, DICT_MODELS_INFO);
+  FieldScanner scanner(binary);
+  scanner.set_abbrev_offsets(abbrev_offsets);
+  if (flags & ZIP_STATIC) {
+    RansEncoder enc(in, out, priors);
+    scanner.scan<true>(&enc, size);
+    enc.flush();
+  } else {
+    EntropyEncoder enc(in, size, out, priors);
+    scanner.scan<true>(&enc, size);
+    enc.flush();
+  }
+}
+
+void entropyDecode(Binary* binary, uint32_t flags, const uint8_t* in,
+                   size_t in_size, const vector<uint64_t>* abbrev_offsets,
+                   uint8_t* out, size_t size) {
+  const ModelPriors* priors = dictPriors(binary, DICT_MODELS_INFO);
+  FieldScanner scanner(binary);
+  scanner.set_abbrev_offsets(abbrev_offsets);
+  if (flags & ZIP_STATIC) {
+    RansDecoder dec(in, in_size, out, priors);
+    scanner.scan<true>(&dec, size);
+  } else {
+    EntropyDecoder dec(in, in_size, out, size, priors);
+    scanner.scan<true>(&dec, size);
+  }
+}
+
+void countModels(Binary* binary, const uint8_t* in, size_t size,
+                 ModelCounts* counts) {
+  ModelCounter counter(in, counts);
+  FieldScanner scanner(binary);
+  scanner.scan<true>(&counter, size);
+}
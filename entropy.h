@@ -0,0 +1,382 @@
+#ifndef ENTROPY_H_
+#define ENTROPY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "scanner.h"
+
+class Binary;
+
+// The models of dictionaries trained on a corpus (see dict.h), which
+// chunks start from instead of knowing nothing. Indexed like
+// EntropyModels.
+struct ModelPriors {
+  // The frequencies of the bytes of each model, for RansEncoder.
+  std::vector<uint16_t> freqs;
+  // The probabilities of a one bit at each node of the tree of bits of
+  // each model, in PROB_BITS, for EntropyEncoder. The first one is unused.
+  std::vector<uint16_t> probs;
+  std::vector<bool> trained;
+};
+
+// The number of each byte coded by each model, indexed like
+// EntropyModels.
+struct ModelCounts {
+  ModelCounts();
+
+  std::vector<uint32_t> bytes;
+};
+
+// Predicts the bits of the bytes of fields for context mixing. A byte is
+// coded as 8 binary decisions, and each decision is predicted by
+//
+//   - an order-0 model chosen by index() from the context the scanner
+//     gives for the field and the position of the byte in the field,
+//   - hashed models of the context and position together with the bytes
+//     of the field so far, with the last value of a field of the same
+//     context, and with the value of the previous field,
+//   - a match model, which predicts the byte after the last occurrence
+//     of the last MIN_MATCH bytes of the chunk,
+//
+// which a neural network mixes with weights chosen by the context and
+// position, and an APM refines by the context and the bits of the byte
+// so far. Predictions are integers, so both sides compute the same ones
+// anywhere. Models learn from the bytes of the chunk as they're coded,
+// which |history| has up to the current byte. Hashed models have tables
+// sized by the size of the chunk.
+class EntropyModels {
+public:
+  // Probabilities are in PROB_BITS.
+  static const int PROB_BITS = 12;
+  static const int MODEL_BITS = 12;
+  static const size_t NUM_MODELS = 1 << MODEL_BITS;
+
+  // Order-0 models start from |priors| if not NULL.
+  EntropyModels(const ModelPriors* priors, const uint8_t* history,
+                size_t size);
+
+  ~EntropyModels() {
+    delete[] order0_;
+  }
+
+  static size_t index(uint32_t ctx, size_t pos) {
+    if (pos > MAX_POS)
+      pos = MAX_POS;
+    uint32_t h = (ctx + static_cast<uint32_t>(pos)) * 0x9e3779b1;
+    return h >> (32 - MODEL_BITS);
+  }
+
+  // Starts the byte at |pos| of a field of |ctx|.
+  void startByte(uint32_t ctx, size_t pos);
+
+  // The probability of the next bit being one.
+  int predict();
+
+  void update(int bit);
+
+  // Ends the byte, which |history| has now.
+  void endByte();
+
+private:
+  // Bytes after this position in a field share models.
+  static const size_t MAX_POS = 15;
+  static const int NUM_HASHED = 3;
+  // The order-0 model, the hashed models, the prediction and length of
+  // the match model, and a bias.
+  static const int NUM_INPUTS = NUM_HASHED + 4;
+  static const int NUM_WEIGHT_SETS = 8 * (MAX_POS + 1);
+  static const int MIN_MATCH = 5;
+  static const int MAX_MATCH = 32;
+
+  void startField(uint32_t ctx);
+
+  const ModelPriors* priors_;
+  const uint8_t* history_;
+  // The offset of the current byte in |history|.
+  size_t pos_in_chunk_;
+  // The current byte: its context, position in its field, the bits so
+  // far with a leading one, and the index of the next bit.
+  uint32_t ctx_;
+  uint32_t pos_;
+  uint32_t c0_;
+  int bit_;
+
+  // Counters of the 256 nodes of each order-0 model, which are
+  // initialized on first use. A counter has a probability in PROB_BITS
+  // over a count of its updates in the lowest 4 bits.
+  uint16_t* order0_;
+  bool used_[NUM_MODELS];
+  uint16_t* model_;
+
+  // The tables of hashed models, in buckets of 16 counters for the nodes
+  // of a nibble.
+  std::vector<uint16_t> hashed_;
+  uint32_t hash_mask_;
+  uint32_t hashes_[NUM_HASHED];
+  uint16_t* buckets_[NUM_HASHED];
+  int slot_;
+  // The hash of the bytes of the current field, of the previous field,
+  // and of the last field with the context of the current one. The last
+  // fields of contexts are kept in last_fields_ by a hash of the context.
+  uint32_t field_hash_;
+  uint32_t prev_field_hash_;
+  uint32_t last_field_hash_;
+  uint32_t prev_ctx_;
+  std::vector<uint32_t> last_fields_;
+
+  // The positions + 1 after the last occurrences of hashes of MIN_MATCH
+  // bytes, the position of the predicted byte, and the length of the
+  // match, or 0 if there is none.
+  std::vector<uint32_t> matches_;
+  int match_bits_;
+  size_t match_ptr_;
+  uint32_t match_len_;
+  int expected_;
+  uint16_t match_counters_[256];
+  uint16_t* match_counter_;
+
+  int inputs_[NUM_INPUTS];
+  std::vector<int> weights_;
+  int* weight_set_;
+  // The mixed probability, and the APM with 33 buckets of stretched
+  // probabilities for each context.
+  int mixed_;
+  std::vector<uint16_t> apm_;
+  uint32_t apm_index_;
+};
+
+// Counts the bytes of each model, from which a dictionary trains
+// ModelPriors. Reads fields from memory like EntropyEncoder.
+class ModelCounter {
+public:
+  ModelCounter(const uint8_t* base, ModelCounts* counts)
+    : base_(base),
+      p_(base),
+      counts_(counts) {
+  }
+
+  const uint8_t* base() const {
+    return base_;
+  }
+
+  uint64_t offset() const {
+    return p_ - base_;
+  }
+
+  const uint8_t* read(size_t size, uint32_t ctx) {
+    const uint8_t* r = p_;
+    for (size_t i = 0; i < size; i++)
+      countByte(ctx, i, *p_++);
+    return r;
+  }
+
+  uint64_t uleb(uint32_t ctx) {
+    const uint8_t* r = p_;
+    uint64_t v = uleb128(p_);
+    countBytes(ctx, r);
+    return v;
+  }
+
+  int64_t sleb(uint32_t ctx) {
+    const uint8_t* r = p_;
+    int64_t v = sleb128(p_);
+    countBytes(ctx, r);
+    return v;
+  }
+
+  const uint8_t* string(uint32_t ctx) {
+    const uint8_t* r = p_;
+    p_ += strlen((const char*)p_) + 1;
+    countBytes(ctx, r);
+    return r;
+  }
+
+private:
+  void countBytes(uint32_t ctx, const uint8_t* p) {
+    for (size_t i = 0; p + i < p_; i++)
+      countByte(ctx, i, p[i]);
+  }
+
+  void countByte(uint32_t ctx, size_t pos, uint8_t b) {
+    counts_->bytes[EntropyModels::index(ctx, pos) * 256 + b]++;
+  }
+
+  const uint8_t* base_;
+  const uint8_t* p_;
+  ModelCounts* counts_;
+};
+
+// Reads fields from memory and codes each byte into |out| with a binary
+// range coder in the style of LZMA, by the predictions of EntropyModels.
+// |size| is the size of the fields, which the decoder must be given too.
+class EntropyEncoder {
+public:
+  EntropyEncoder(const uint8_t* base, size_t size, std::vector<uint8_t>* out,
+                 const ModelPriors* priors)
+    : base_(base),
+      p_(base),
+      out_(out),
+      low_(0),
+      range_(0xffffffff),
+      cache_(0),
+      cache_size_(1),
+      models_(priors, base, size) {
+  }
+
+  const uint8_t* base() const {
+    return base_;
+  }
+
+  uint64_t offset() const {
+    return p_ - base_;
+  }
+
+  const uint8_t* read(size_t size, uint32_t ctx) {
+    const uint8_t* r = p_;
+    p_ += size;
+    encodeBytes(ctx, r);
+    return r;
+  }
+
+  uint64_t uleb(uint32_t ctx) {
+    const uint8_t* r = p_;
+    uint64_t v = uleb128(p_);
+    encodeBytes(ctx, r);
+    return v;
+  }
+
+  int64_t sleb(uint32_t ctx) {
+    const uint8_t* r = p_;
+    int64_t v = sleb128(p_);
+    encodeBytes(ctx, r);
+    return v;
+  }
+
+  const uint8_t* string(uint32_t ctx) {
+    const uint8_t* r = p_;
+    p_ += strlen((const char*)p_) + 1;
+    encodeBytes(ctx, r);
+    return r;
+  }
+
+  // Writes the pending bytes. Must be called at the end.
+  void flush();
+
+private:
+  void encodeBytes(uint32_t ctx, const uint8_t* p) {
+    for (size_t i = 0; p + i < p_; i++)
+      encodeByte(ctx, i, p[i]);
+  }
+
+  void encodeByte(uint32_t ctx, size_t pos, uint8_t b);
+
+  void shiftLow();
+
+  const uint8_t* base_;
+  const uint8_t* p_;
+  std::vector<uint8_t>* out_;
+  uint64_t low_;
+  uint32_t range_;
+  uint8_t cache_;
+  uint64_t cache_size_;
+  EntropyModels models_;
+};
+
+// Decodes |size| bytes of fields from |in| into |out|. Offsets are
+// relative to |out|. |priors| must be the ones of the encoder.
+class EntropyDecoder {
+public:
+  EntropyDecoder(const uint8_t* in, size_t in_size, uint8_t* out,
+                 size_t size, const ModelPriors* priors)
+    : in_(in),
+      in_end_(in + in_size),
+      base_(out),
+      p_(out),
+      range_(0xffffffff),
+      code_(0),
+      models_(priors, out, size) {
+    for (int i = 0; i < 5; i++)
+      code_ = (code_ << 8) | nextByte();
+  }
+
+  const uint8_t* base() const {
+    return base_;
+  }
+
+  uint64_t offset() const {
+    return p_ - base_;
+  }
+
+  const uint8_t* read(size_t size, uint32_t ctx) {
+    const uint8_t* r = p_;
+    for (size_t i = 0; i < size; i++)
+      decodeByte(ctx, i);
+    return r;
+  }
+
+  uint64_t uleb(uint32_t ctx) {
+    const uint8_t* r = p_;
+    decodeUntil(ctx, 0x80);
+    return uleb128(r);
+  }
+
+  int64_t sleb(uint32_t ctx) {
+    const uint8_t* r = p_;
+    decodeUntil(ctx, 0x80);
+    return sleb128(r);
+  }
+
+  const uint8_t* string(uint32_t ctx) {
+    const uint8_t* r = p_;
+    decodeUntil(ctx, 1);
+    return r;
+  }
+
+private:
+  // Decodes bytes until one is less than |limit|.
+  void decodeUntil(uint32_t ctx, uint8_t limit) {
+    size_t i = 0;
+    while (decodeByte(ctx, i++) >= limit) {
+    }
+  }
+
+  // Decodes a byte to p_ and moves past it.
+  uint8_t decodeByte(uint32_t ctx, size_t pos);
+
+  uint8_t nextByte() {
+    return in_ < in_end_ ? *in_++ : 0;
+  }
+
+  const uint8_t* in_;
+  const uint8_t* in_end_;
+  uint8_t* base_;
+  uint8_t* p_;
+  uint32_t range_;
+  uint32_t code_;
+  EntropyModels models_;
+};
+
+// Entropy codes |size| bytes of delta coded CUs into |out|, with
+// RansEncoder if |flags| has ZIP_STATIC. Models start from the dictionary
+// of the binary if it has one. |abbrev_offsets| are those of CUs with
+// ZIP_REBASED, or NULL.
+void entropyEncode(Binary* binary, uint32_t flags, const uint8_t* in,
+                   size_t size, const std::vector<uint64_t>* abbrev_offsets,
+                   std::vector<uint8_t>* out);
+
+// Restores |size| bytes of delta coded CUs from the output of
+// entropyEncode with |flags| and |abbrev_offsets|.
+void entropyDecode(Binary* binary, uint32_t flags, const uint8_t* in,
+                   size_t in_size,
+                   const std::vector<uint64_t>* abbrev_offsets,
+                   uint8_t* out, size_t size);
+
+// Adds the bytes |size| bytes of delta coded CUs would code to |counts|.
+void countModels(Binary* binary, const uint8_t* in, size_t size,
+                 ModelCounts* counts);
+
+#endif  // ENTROPY_H_
@@ -1,6 +1,6 @@
 File.open('dwarf.tab', 'w') do |of|
   lines = File.popen('cpp -dM /usr/include/dwarf.h', &:readlines)
-  ['DW_AT', 'DW_FORM'].each do |type|
+  ['DW_AT', 'DW_FORM', 'DW_TAG'].each do |type|
     m = {}
     lines.each do |line|
       if /^#define (#{type}_\S+) (.*)/ =~ line
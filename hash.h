@@ -0,0 +1,39 @@
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Mixes |size| bytes at |p| into the two lanes of |h|, a word at a time.
+// The lanes have their own multipliers and shifts, so |h| is a 128-bit
+// hash, and more bytes can be mixed into it.
+inline void hashBytes(const uint8_t* p, size_t size, uint64_t* h) {
+  uint64_t a = h[0];
+  uint64_t b = h[1];
+  uint64_t w;
+  for (; size >= 8; p += 8, size -= 8) {
+    memcpy(&w, p, 8);
+    a = (a ^ w) * 0x9e3779b97f4a7c15ull;
+    a ^= a >> 32;
+    b = (b ^ w) * 0xc2b2ae3d27d4eb4full;
+    b ^= b >> 29;
+  }
+  w = (uint64_t)size << 56;
+  memcpy(&w, p, size);
+  a = (a ^ w) * 0x9e3779b97f4a7c15ull;
+  a ^= a >> 32;
+  b = (b ^ w) * 0xc2b2ae3d27d4eb4full;
+  b ^= b >> 29;
+  h[0] = a;
+  h[1] = b;
+}
+
+// A 64-bit hash of |size| bytes at |p|.
+inline uint64_t hashBytes(const uint8_t* p, size_t size) {
+  uint64_t h[2] = { 0, size };
+  hashBytes(p, size, h);
+  return h[0] ^ h[1];
+}
+
+#endif  // HASH_H_
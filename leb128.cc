@@ -0,0 +1,239 @@
+#include "leb128.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LEB128_X86 1
+#endif
+
+template <class T>
+static const uint8_t* decodeScalar(const uint8_t* p, size_t n, T* out);
+
+template <>
+const uint8_t* decodeScalar(const uint8_t* p, size_t n, uint64_t* out) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = uleb128(p);
+  return p;
+}
+
+template <>
+const uint8_t* decodeScalar(const uint8_t* p, size_t n, int64_t* out) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = sleb128(p);
+  return p;
+}
+
+#ifdef LEB128_X86
+
+static const uint64_t kPayloadBits = 0x7f7f7f7f7f7f7f7full;
+
+// Packs the 7-bit groups of the first |len| (1 to 8) bytes of |x|.
+static inline uint64_t pack7(uint64_t x, int len) {
+  x &= kPayloadBits >> (64 - 8 * len);
+  x = ((x & 0x7f007f007f007f00ull) >> 1) | (x & 0x007f007f007f007full);
+  x = ((x & 0x3fff00003fff0000ull) >> 2) | (x & 0x00003fff00003fffull);
+  x = ((x & 0x0fffffff00000000ull) >> 4) | (x & 0x000000000fffffffull);
+  return x;
+}
+
+__attribute__((target("bmi2")))
+static inline uint64_t pext7(uint64_t x, int len) {
+  return _pext_u64(x, kPayloadBits >> (64 - 8 * len));
+}
+
+static inline uint64_t finish(uint64_t x, int, uint64_t*) {
+  return x;
+}
+
+static inline int64_t finish(uint64_t x, int len, int64_t*) {
+  int shift = 64 - 7 * len;
+  return static_cast<int64_t>(x << shift) >> shift;
+}
+
+// Decodes the values which end in the |width| bytes at |p|, whose
+// continuation bits are |cont|. Returns the number of bytes consumed.
+// At least |width| + 8 bytes must be readable.
+template <bool kPext, class T>
+__attribute__((always_inline))
+static inline int decodeBlock(const uint8_t* p, uint32_t cont, int width,
+                              T*& o, T* oend) {
+  uint32_t term = ~cont;
+  if (width < 32)
+    term &= (1u << width) - 1;
+  int start = 0;
+  while (term && o < oend) {
+    int len = __builtin_ctz(term) + 1 - start;
+    if (len > 8) {
+      decodeScalar(p + start, 1, o);
+      o++;
+    } else {
+      uint64_t x;
+      memcpy(&x, p + start, 8);
+      x = kPext ? pext7(x, len) : pack7(x, len);
+      *o = finish(x, len, o);
+      o++;
+    }
+    start += len;
+    term &= term - 1;
+  }
+  if (!start) {
+    // A value longer than the block.
+    const uint8_t* q = decodeScalar(p, 1, o);
+    o++;
+    start = q - p;
+  }
+  return start;
+}
+
+// Widens 4 bytes at |kOffset| of |v| to values.
+template <int kOffset>
+__attribute__((target("sse4.1")))
+static inline void widen2(__m128i v, uint64_t* o) {
+  _mm_storeu_si128((__m128i*)o,
+                   _mm_cvtepu8_epi64(_mm_srli_si128(v, kOffset)));
+  _mm_storeu_si128((__m128i*)(o + 2),
+                   _mm_cvtepu8_epi64(_mm_srli_si128(v, kOffset + 2)));
+}
+
+// |v| has one-byte values shifted left by one bit.
+template <int kOffset>
+__attribute__((target("sse4.1")))
+static inline void widen2(__m128i v, int64_t* o) {
+  __m128i d = _mm_srai_epi32(_mm_cvtepi8_epi32(_mm_srli_si128(v, kOffset)),
+                             1);
+  _mm_storeu_si128((__m128i*)o, _mm_cvtepi32_epi64(d));
+  _mm_storeu_si128((__m128i*)(o + 2),
+                   _mm_cvtepi32_epi64(_mm_srli_si128(d, 8)));
+}
+
+template <int kOffset>
+__attribute__((target("avx2")))
+static inline void widen4(__m128i v, uint64_t* o) {
+  _mm256_storeu_si256((__m256i*)o,
+                      _mm256_cvtepu8_epi64(_mm_srli_si128(v, kOffset)));
+}
+
+template <int kOffset>
+__attribute__((target("avx2")))
+static inline void widen4(__m128i v, int64_t* o) {
+  __m128i d = _mm_srai_epi32(_mm_cvtepi8_epi32(_mm_srli_si128(v, kOffset)),
+                             1);
+  _mm256_storeu_si256((__m256i*)o, _mm256_cvtepi32_epi64(d));
+}
+
+// Sign extension of one-byte SLEB128 values starts from bit 6, so the
+// widening of them needs the bytes shifted left by one.
+__attribute__((target("sse4.1")))
+static inline __m128i prepare(__m128i v, uint64_t*) {
+  return v;
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i prepare(__m128i v, int64_t*) {
+  return _mm_add_epi8(v, v);
+}
+
+template <class T>
+__attribute__((target("sse4.1")))
+static const uint8_t* decodeSse(const uint8_t* p, const uint8_t* end,
+                                size_t n, T* out) {
+  T* o = out;
+  T* oend = out + n;
+  while (o < oend && end - p >= 32) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    uint32_t cont = _mm_movemask_epi8(v);
+    if (!cont && oend - o >= 16) {
+      v = prepare(v, o);
+      widen2<0>(v, o);
+      widen2<4>(v, o + 4);
+      widen2<8>(v, o + 8);
+      widen2<12>(v, o + 12);
+      p += 16;
+      o += 16;
+      continue;
+    }
+    p += decodeBlock<false>(p, cont, 16, o, oend);
+  }
+  return decodeScalar(p, oend - o, o);
+}
+
+template <class T>
+__attribute__((target("avx2,bmi2")))
+static const uint8_t* decodeAvx2(const uint8_t* p, const uint8_t* end,
+                                 size_t n, T* out) {
+  T* o = out;
+  T* oend = out + n;
+  while (o < oend && end - p >= 48) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    uint32_t cont = _mm256_movemask_epi8(v);
+    if (!(cont & 0xffff) && oend - o >= 16) {
+      __m128i lo = prepare(_mm256_castsi256_si128(v), o);
+      widen4<0>(lo, o);
+      widen4<4>(lo, o + 4);
+      widen4<8>(lo, o + 8);
+      widen4<12>(lo, o + 12);
+      p += 16;
+      o += 16;
+      continue;
+    }
+    p += decodeBlock<true>(p, cont, 32, o, oend);
+  }
+  return decodeScalar(p, oend - o, o);
+}
+
+#endif  // LEB128_X86
+
+bool leb128Supported(Leb128Impl impl) {
+  switch (impl) {
+  case LEB128_SCALAR:
+    return true;
+#ifdef LEB128_X86
+  case LEB128_SSE:
+    return __builtin_cpu_supports("sse4.1");
+  case LEB128_AVX2:
+    return (__builtin_cpu_supports("avx2") &&
+            __builtin_cpu_supports("bmi2"));
+#endif
+  default:
+    return false;
+  }
+}
+
+Leb128Impl leb128Best() {
+  static const Leb128Impl best =
+    (leb128Supported(LEB128_AVX2) ? LEB128_AVX2 :
+     leb128Supported(LEB128_SSE) ? LEB128_SSE :
+     LEB128_SCALAR);
+  return best;
+}
+
+const char* leb128Name(Leb128Impl impl) {
+  static const char* names[NUM_LEB128_IMPLS] = { "scalar", "sse4.1", "avx2" };
+  return names[impl];
+}
+
+template <class T>
+static const uint8_t* decode(Leb128Impl impl, const uint8_t* p,
+                             const uint8_t* end, size_t n, T* out) {
+  switch (impl) {
+#ifdef LEB128_X86
+  case LEB128_SSE:
+    return decodeSse(p, end, n, out);
+  case LEB128_AVX2:
+    return decodeAvx2(p, end, n, out);
+#endif
+  default:
+    return decodeScalar(p, n, out);
+  }
+}
+
+const uint8_t* decodeUleb128s(Leb128Impl impl, const uint8_t* p,
+                              const uint8_t* end, size_t n, uint64_t* out) {
+  return decode(impl, p, end, n, out);
+}
+
+const uint8_t* decodeSleb128s(Leb128Impl impl, const uint8_t* p,
+                              const uint8_t* end, size_t n, int64_t* out) {
+  return decode(impl, p, end, n, out);
+}
@@ -0,0 +1,115 @@
+#ifndef LEB128_H_
+#define LEB128_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Scalar LEB128 codecs, used for single values.
+
+inline uint64_t uleb128(const uint8_t*& p) {
+  uint64_t r = 0;
+  int s = 0;
+  do {
+    r |= (uint64_t)(*p & 0x7f) << s;
+    s += 7;
+  } while (*p++ >= 0x80);
+  return r;
+}
+
+inline int64_t sleb128(const uint8_t*& p) {
+  uint64_t r = 0;
+  int s = 0;
+  for (;;) {
+    uint8_t b = *p++;
+    r |= (uint64_t)(b & 0x7f) << s;
+    s += 7;
+    if (b < 0x80) {
+      if ((b & 0x40) && s < 64)
+        r |= ~(uint64_t)0 << s;
+      break;
+    }
+  }
+  return r;
+}
+
+inline void uleb128o(uint64_t v, uint8_t*& p) {
+  do {
+    uint8_t b = v & 0x7f;
+    v >>= 7;
+    if (v)
+      b |= 0x80;
+    *p++ = b;
+  } while (v);
+}
+
+inline void sleb128o(int64_t v, uint8_t*& p) {
+  bool done = false;
+  while (!done) {
+    uint8_t b = v & 0x7f;
+    v >>= 7;
+    if ((v == 0 && (b & 0x40) == 0) || (v == -1 && (b & 0x40))) {
+      done = true;
+    } else {
+      b |= 0x80;
+    }
+    *p++ = b;
+  }
+}
+
+// The sizes of values in ULEB128 and SLEB128.
+inline int ulebSize(uint64_t v) {
+  int size = 1;
+  while (v >>= 7)
+    size++;
+  return size;
+}
+
+inline int slebSize(int64_t v) {
+  uint64_t u = v < 0 ? ~v : v;
+  // The significant bits and the sign, 7 to a byte.
+  return (64 - __builtin_clzll(u | 1) + 7) / 7;
+}
+
+// Bulk decoders for runs of LEB128 values. They decode |n| values from
+// [p, end) into |out| and return the end of the last value. The SIMD ones
+// look at 16 or 32 bytes at once: a block of one-byte values is widened
+// in a few instructions, and other values get their length from the mask
+// of continuation bits instead of a loop over bytes.
+//
+// The scanners don't use them: StreamMerger copies each byte of a value
+// to the delta buffer anyway, and decoding the value there was faster
+// than counting the values of a stream and decoding them in bulk.
+// leb128bench checks them against the scalar codecs and measures both.
+enum Leb128Impl {
+  LEB128_SCALAR,
+  // SSE4.1.
+  LEB128_SSE,
+  // AVX2 and BMI2.
+  LEB128_AVX2,
+  NUM_LEB128_IMPLS
+};
+
+// Whether the CPU can run |impl|, detected at runtime.
+bool leb128Supported(Leb128Impl impl);
+
+// The best implementation the CPU supports.
+Leb128Impl leb128Best();
+
+const char* leb128Name(Leb128Impl impl);
+
+const uint8_t* decodeUleb128s(Leb128Impl impl, const uint8_t* p,
+                              const uint8_t* end, size_t n, uint64_t* out);
+const uint8_t* decodeSleb128s(Leb128Impl impl, const uint8_t* p,
+                              const uint8_t* end, size_t n, int64_t* out);
+
+inline const uint8_t* decodeUleb128s(const uint8_t* p, const uint8_t* end,
+                                     size_t n, uint64_t* out) {
+  return decodeUleb128s(leb128Best(), p, end, n, out);
+}
+
+inline const uint8_t* decodeSleb128s(const uint8_t* p, const uint8_t* end,
+                                     size_t n, int64_t* out) {
+  return decodeSleb128s(leb128Best(), p, end, n, out);
+}
+
+#endif  // LEB128_H_
@@ -0,0 +1,166 @@
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <memory>
+#include <vector>
+
+#include "binary.h"
+#include "leb128.h"
+#include "scanner.h"
+#include "zipscanner.h"
+
+using namespace std;
+
+// Reads fields from memory and keeps the LEB128 ones, which are the
+// values bulk decoders would see on the zipped path.
+class LebCollector {
+public:
+  explicit LebCollector(const uint8_t* base)
+    : in_(base, 0) {
+  }
+
+  const uint8_t* base() const {
+    return in_.base();
+  }
+
+  uint64_t offset() const {
+    return in_.offset();
+  }
+
+  const uint8_t* read(size_t size, uint32_t ctx) {
+    return in_.read(size, ctx);
+  }
+
+  uint64_t uleb(uint32_t ctx) {
+    const uint8_t* p = cur();
+    uint64_t v = in_.uleb(ctx);
+    ulebs.insert(ulebs.end(), p, cur());
+    uleb_values.push_back(v);
+    return v;
+  }
+
+  int64_t sleb(uint32_t ctx) {
+    const uint8_t* p = cur();
+    int64_t v = in_.sleb(ctx);
+    slebs.insert(slebs.end(), p, cur());
+    sleb_values.push_back(v);
+    return v;
+  }
+
+  const uint8_t* string(uint32_t ctx) {
+    return in_.string(ctx);
+  }
+
+  void addUleb(uint64_t v) {
+    uint8_t buf[16];
+    uint8_t* p = buf;
+    uleb128o(v, p);
+    ulebs.insert(ulebs.end(), buf, p);
+    uleb_values.push_back(v);
+  }
+
+  void addSleb(int64_t v) {
+    uint8_t buf[16];
+    uint8_t* p = buf;
+    sleb128o(v, p);
+    slebs.insert(slebs.end(), buf, p);
+    sleb_values.push_back(v);
+  }
+
+  vector<uint8_t> ulebs;
+  vector<uint8_t> slebs;
+  vector<uint64_t> uleb_values;
+  vector<int64_t> sleb_values;
+
+private:
+  const uint8_t* cur() const {
+    return in_.base() + in_.offset();
+  }
+
+  MemoryInput in_;
+};
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+template <class T>
+static void bench(const char* kind, const vector<uint8_t>& in,
+                  const vector<T>& expected,
+                  const uint8_t* (*decode)(Leb128Impl, const uint8_t*,
+                                           const uint8_t*, size_t, T*)) {
+  size_t n = expected.size();
+  vector<T> out(n);
+  const uint8_t* begin = &in[0];
+  const uint8_t* end = begin + in.size();
+  for (int i = 0; i < NUM_LEB128_IMPLS; i++) {
+    Leb128Impl impl = static_cast<Leb128Impl>(i);
+    if (!leb128Supported(impl)) {
+      printf("%s %s: unsupported\n", kind, leb128Name(impl));
+      continue;
+    }
+
+    if (decode(impl, begin, end, n, &out[0]) != end || out != expected)
+      errx(1, "%s %s: wrong values", kind, leb128Name(impl));
+
+    double best = 1e9;
+    for (int r = 0; r < 5; r++) {
+      double start = now();
+      int loops = 0;
+      do {
+        decode(impl, begin, end, n, &out[0]);
+        loops++;
+      } while (now() - start < 0.05);
+      double t = (now() - start) / loops;
+      if (t < best)
+        best = t;
+    }
+    printf("%s %s: %.1f Mvalues/s %.1f MB/s\n", kind, leb128Name(impl),
+           n / best / 1e6, in.size() / best / 1e6);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s binary\n", argv[0]);
+    exit(1);
+  }
+
+  auto_ptr<Binary> binary(readBinary(argv[1]));
+
+  vector<uint8_t> delta;
+  if (binary->is_zipped) {
+    for (size_t i = 0; i < binary->num_zip_chunks; i++)
+      readDeltaChunk(binary.get(), i, &delta);
+  } else {
+    encodeChunk(binary.get(), 0, 0, binary->debug_info_len, false, &delta,
+                NULL);
+  }
+
+  LebCollector collector(&delta[0]);
+  FieldScanner scanner(binary.get());
+  scanner.scan<true>(&collector, delta.size());
+
+  // Values which real CUs rarely have, to check all paths.
+  static const uint64_t edges[] = {
+    0, 0x3f, 0x40, 0x7f, 0x80, 0x3fff, 0x4000, 0xffffffff,
+    0x00ffffffffffffffull, 0x0100000000000000ull, 0x7fffffffffffffffull,
+    0x8000000000000000ull, 0xffffffffffffffffull
+  };
+  for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+    collector.addUleb(edges[i]);
+    collector.addSleb(edges[i]);
+    collector.addSleb(-edges[i]);
+  }
+
+  printf("%zu ULEB128 values in %zu bytes, "
+         "%zu SLEB128 values in %zu bytes\n",
+         collector.uleb_values.size(), collector.ulebs.size(),
+         collector.sleb_values.size(), collector.slebs.size());
+  bench("uleb128", collector.ulebs, collector.uleb_values, decodeUleb128s);
+  bench("sleb128", collector.slebs, collector.sleb_values, decodeSleb128s);
+}
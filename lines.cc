@@ -0,0 +1,479 @@
+#include "lines.h"
+
+#include <dwarf.h>
+#include <err.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "binary.h"
+#include "dict.h"
+#include "entropy.h"
+#include "leb128.h"
+#include "parallel.h"
+#include "rans.h"
+#include "scanner.h"
+#include "streams.h"
+
+using namespace std;
+
+// Line programs are grouped into chunks of about this many bytes of the
+// original .debug_line. This must not depend on the number of threads so
+// the output stays the same.
+static const size_t LINE_CHUNK_SIZE = 256 * 1024;
+
+static uint32_t lineContext(LineStream stream, uint32_t a, uint32_t b) {
+  return makeContext(static_cast<Stream>(stream), a, b);
+}
+
+// The context of the operand of DW_LNE_set_address, which is delta coded.
+static uint32_t addressContext(size_t size) {
+  return lineContext(LINE_STREAM_ADDRESS, DW_LNE_set_address, size);
+}
+
+// Returns the size of a field of a DWARF 5 entry format, or -1 if it's a
+// LEB128 or a string, or 0 if the form is unknown.
+static int formSize(uint64_t form, int offset_size) {
+  switch (form) {
+  case DW_FORM_data1:
+  case DW_FORM_strx1:
+    return 1;
+  case DW_FORM_data2:
+  case DW_FORM_strx2:
+    return 2;
+  case DW_FORM_strx3:
+    return 3;
+  case DW_FORM_data4:
+  case DW_FORM_strx4:
+    return 4;
+  case DW_FORM_data8:
+    return 8;
+  case DW_FORM_data16:
+    return 16;
+  case DW_FORM_strp:
+  case DW_FORM_line_strp:
+  case DW_FORM_strp_sup:
+    return offset_size;
+  case DW_FORM_string:
+  case DW_FORM_udata:
+  case DW_FORM_sdata:
+  case DW_FORM_strx:
+  case DW_FORM_block:
+  case DW_FORM_block1:
+  case DW_FORM_block2:
+  case DW_FORM_block4:
+    return -1;
+  default:
+    return 0;
+  }
+}
+
+// Reads a field of a DWARF 5 entry. Returns false if the form is unknown.
+template <class Input>
+static bool readForm(Input* in, uint64_t form, int offset_size,
+                     uint32_t ctx) {
+  int size = formSize(form, offset_size);
+  if (size > 0) {
+    in->read(size, ctx);
+    return true;
+  }
+  switch (form) {
+  case DW_FORM_string:
+    in->string(lineContext(LINE_STREAM_NAME, form, 0));
+    return true;
+  case DW_FORM_udata:
+  case DW_FORM_strx:
+    in->uleb(ctx);
+    return true;
+  case DW_FORM_sdata:
+    in->sleb(ctx);
+    return true;
+  case DW_FORM_block:
+    in->read(in->uleb(ctx), ctx);
+    return true;
+  case DW_FORM_block1:
+    in->read(*in->read(1, ctx), ctx);
+    return true;
+  case DW_FORM_block2:
+    in->read(readFixed(in->read(2, ctx), 2), ctx);
+    return true;
+  case DW_FORM_block4:
+    in->read(readFixed(in->read(4, ctx), 4), ctx);
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Reads the directory or the file name table of a DWARF 5 header. Returns
+// false if a form is unknown.
+template <class Input>
+static bool readEntries(Input* in, int offset_size, uint64_t end,
+                        uint32_t kind) {
+  uint32_t ctx = lineContext(LINE_STREAM_HEADER, kind, 0);
+  uint8_t num_formats = *in->read(1, ctx);
+  uint64_t formats[256 * 2];
+  for (int i = 0; i < num_formats; i++) {
+    formats[i * 2] = in->uleb(ctx);
+    formats[i * 2 + 1] = in->uleb(ctx);
+  }
+  uint64_t num_entries = in->uleb(ctx);
+  if (!num_formats)
+    return true;
+  for (uint64_t i = 0; i < num_entries && in->offset() < end; i++) {
+    for (int j = 0; j < num_formats; j++) {
+      uint32_t field_ctx = lineContext(LINE_STREAM_HEADER, kind,
+                                       formats[j * 2]);
+      if (!readForm(in, formats[j * 2 + 1], offset_size, field_ctx))
+        return false;
+    }
+  }
+  return true;
+}
+
+// Reads the fields of a line program. Which fields there are only depends
+// on the values of fields before them, which coding keeps, so all inputs
+// see the same fields. Fields the scanner doesn't know are read as blocks.
+template <class Input>
+static void scanLineProgram(Input* in) {
+  uint32_t ctx = lineContext(LINE_STREAM_HEADER, 0, 0);
+  uint64_t length = readFixed(in->read(4, ctx), 4);
+  int offset_size = 4;
+  if (length == 0xffffffff) {
+    length = readFixed(in->read(8, ctx), 8);
+    offset_size = 8;
+  }
+  uint64_t end = in->offset() + length;
+  uint16_t version = readFixed(in->read(2, ctx), 2);
+  if (version < 2 || version > 5) {
+    if (in->offset() < end)
+      in->read(end - in->offset(), ctx);
+    return;
+  }
+
+  // address_size and segment_selector_size.
+  if (version >= 5)
+    in->read(2, ctx);
+  uint64_t header_length = readFixed(in->read(offset_size, ctx),
+                                     offset_size);
+  uint64_t program = in->offset() + header_length;
+  // minimum_instruction_length and maximum_operations_per_instruction.
+  in->read(version >= 4 ? 2 : 1, ctx);
+  // default_is_stmt, line_base, line_range and opcode_base.
+  int opcode_base = in->read(4, ctx)[3];
+  uint8_t opcode_lengths[256] = {};
+  if (opcode_base > 1)
+    memcpy(opcode_lengths, in->read(opcode_base - 1, ctx), opcode_base - 1);
+
+  if (version >= 5) {
+    if (readEntries(in, offset_size, end, 1))
+      readEntries(in, offset_size, end, 2);
+  } else {
+    uint32_t dir_ctx = lineContext(LINE_STREAM_NAME, 1, 0);
+    while (*in->string(dir_ctx))
+      continue;
+    uint32_t file_ctx = lineContext(LINE_STREAM_NAME, 2, 0);
+    uint32_t file_attr_ctx = lineContext(LINE_STREAM_HEADER, 2, 0);
+    while (*in->string(file_ctx)) {
+      // The directory, the modification time and the size.
+      for (int i = 0; i < 3; i++)
+        in->uleb(file_attr_ctx);
+    }
+  }
+  if (in->offset() < program)
+    in->read(program - in->offset(), ctx);
+
+  // The context of an opcode is the previous one, and extended ones are
+  // 256 + their sub-opcodes. A line advance depends on the opcode before
+  // it, and a column on the previous column.
+  uint32_t prev = 0;
+  uint32_t before = 0;
+  uint64_t column = 0;
+  while (in->offset() < end) {
+    uint8_t op = *in->read(1, lineContext(LINE_STREAM_OPCODE, prev, 0));
+    before = prev;
+    prev = op;
+    if (op >= opcode_base)
+      continue;
+
+    if (op == 0) {
+      uint64_t len = in->uleb(lineContext(LINE_STREAM_OPERAND, 0, 0));
+      if (!len)
+        continue;
+      uint8_t sub = *in->read(1, lineContext(LINE_STREAM_OPCODE, len, 1));
+      prev = 256 + sub;
+      uint64_t size = len - 1;
+      if (sub == DW_LNE_set_address && (size == 4 || size == 8))
+        in->read(size, addressContext(size));
+      else
+        in->read(size, lineContext(LINE_STREAM_OPERAND, prev, 0));
+      continue;
+    }
+
+    int num_operands = opcode_lengths[op - 1];
+    if (num_operands == 1) {
+      switch (op) {
+      case DW_LNS_advance_pc:
+        in->uleb(lineContext(LINE_STREAM_ADDRESS, op, 0));
+        continue;
+      case DW_LNS_fixed_advance_pc:
+        in->read(2, lineContext(LINE_STREAM_ADDRESS, op, 0));
+        continue;
+      case DW_LNS_advance_line:
+        in->sleb(lineContext(LINE_STREAM_LINE, op, before));
+        continue;
+      case DW_LNS_set_file:
+        in->uleb(lineContext(LINE_STREAM_FILE, op, 0));
+        continue;
+      case DW_LNS_set_column:
+        column = in->uleb(lineContext(LINE_STREAM_COLUMN, op,
+                                      min<uint64_t>(column, 255)));
+        continue;
+      }
+    }
+    for (int i = 0; i < num_operands; i++)
+      in->uleb(lineContext(LINE_STREAM_OPERAND, op, i));
+  }
+}
+
+template <class Input>
+static void scanLines(Input* in, uint64_t size) {
+  while (in->offset() < size)
+    scanLineProgram(in);
+}
+
+// Reads the fields of line programs in place, and replaces the operands
+// of DW_LNE_set_address by their differences from the previous ones, or
+// restores them from the differences if kDecode. A field past the end
+// makes the input broken, after which its offset is past every end, so
+// the scanner stops.
+template <bool kDecode>
+class AddressCoder {
+public:
+  AddressCoder(uint8_t* base, uint64_t size)
+    : base_(base),
+      size_(size),
+      pos_(0),
+      last_(0),
+      broken_(false) {
+  }
+
+  bool broken() const {
+    return broken_;
+  }
+
+  uint64_t offset() const {
+    return broken_ ? ~0ull : pos_;
+  }
+
+  const uint8_t* read(size_t size, uint32_t ctx) {
+    if (broken_ || size > size_ - pos_)
+      return fail();
+    uint8_t* r = base_ + pos_;
+    pos_ += size;
+    if (ctx == addressContext(size)) {
+      uint64_t v = readFixed(r, size);
+      uint64_t coded = kDecode ? v + last_ : v - last_;
+      memcpy(r, &coded, size);
+      last_ = kDecode ? readFixed(r, size) : v;
+    }
+    return r;
+  }
+
+  uint64_t uleb(uint32_t) {
+    const uint8_t* p = leb();
+    return p ? uleb128(p) : 0;
+  }
+
+  int64_t sleb(uint32_t) {
+    const uint8_t* p = leb();
+    return p ? sleb128(p) : 0;
+  }
+
+  const uint8_t* string(uint32_t) {
+    const uint8_t* r = base_ + pos_;
+    const void* nul = broken_ ? NULL : memchr(r, 0, size_ - pos_);
+    if (!nul)
+      return fail();
+    pos_ = (const uint8_t*)nul + 1 - base_;
+    return r;
+  }
+
+private:
+  // Returns the LEB128 at the current position.
+  const uint8_t* leb() {
+    if (broken_)
+      return NULL;
+    uint64_t start = pos_;
+    do {
+      if (pos_ == size_) {
+        fail();
+        return NULL;
+      }
+    } while (base_[pos_++] & 0x80);
+    return base_ + start;
+  }
+
+  const uint8_t* fail() {
+    static const uint8_t zeros[256] = {};
+    broken_ = true;
+    return zeros;
+  }
+
+  uint8_t* base_;
+  uint64_t size_;
+  uint64_t pos_;
+  uint64_t last_;
+  bool broken_;
+};
+
+// Groups the line programs of |size| bytes at |p| into chunks by their
+// unit_length and appends num_chunks + 1 entries to |chunks|.
+static void splitLineChunks(const uint8_t* p, uint64_t size,
+                            vector<ZipChunk>* chunks) {
+  ZipChunk chunk = { 0, 0 };
+  chunks->push_back(chunk);
+  uint64_t offset = 0;
+  while (offset < size) {
+    uint64_t unit_size = size - offset;
+    if (unit_size >= 4) {
+      uint64_t length = readFixed(p + offset, 4);
+      if (length != 0xffffffff)
+        unit_size = min(unit_size, 4 + length);
+      else if (unit_size >= 12)
+        unit_size = min(unit_size - 12, readFixed(p + offset + 4, 8)) + 12;
+    }
+    offset += unit_size;
+    if (offset - chunks->back().orig_offset >= LINE_CHUNK_SIZE ||
+        offset == size) {
+      chunk.orig_offset = offset;
+      chunks->push_back(chunk);
+    }
+  }
+}
+
+struct LinesJob {
+  const uint8_t* in;
+  uint32_t flags;
+  const ModelPriors* priors;
+  const ZipChunk* chunks;
+  vector<vector<uint8_t> > bufs;
+  uint8_t* out;
+};
+
+static void encodeLineChunk(void* arg, size_t i) {
+  LinesJob* job = static_cast<LinesJob*>(arg);
+  uint64_t begin = job->chunks[i].orig_offset;
+  uint64_t size = job->chunks[i + 1].orig_offset - begin;
+  vector<uint8_t> delta(job->in + begin, job->in + begin + size);
+  AddressCoder<false> coder(&delta[0], size);
+  scanLines(&coder, size);
+  // Broken chunks are left empty.
+  if (coder.broken())
+    return;
+
+  vector<uint8_t>* buf = &job->bufs[i];
+  if (job->flags & ZIP_STATIC) {
+    RansEncoder enc(&delta[0], buf, job->priors);
+    scanLines(&enc, size);
+    enc.flush();
+  } else if (job->flags & ZIP_ENTROPY) {
+    EntropyEncoder enc(&delta[0], size, buf, job->priors);
+    scanLines(&enc, size);
+    enc.flush();
+  } else {
+    StreamSplitter splitter(&delta[0]);
+    scanLines(&splitter, size);
+    splitter.write(buf);
+  }
+}
+
+static void decodeLineChunk(void* arg, size_t i) {
+  LinesJob* job = static_cast<LinesJob*>(arg);
+  const ZipChunk& chunk = job->chunks[i];
+  const ZipChunk& next = job->chunks[i + 1];
+  uint64_t size = next.orig_offset - chunk.orig_offset;
+  uint8_t* out = job->out + chunk.orig_offset;
+  const uint8_t* in = job->in + chunk.zip_offset;
+  size_t in_size = next.zip_offset - chunk.zip_offset;
+  if (job->flags & ZIP_STATIC) {
+    RansDecoder dec(in, in_size, out, job->priors);
+    scanLines(&dec, size);
+  } else if (job->flags & ZIP_ENTROPY) {
+    EntropyDecoder dec(in, in_size, out, size, job->priors);
+    scanLines(&dec, size);
+  } else {
+    StreamMerger merger(in, out);
+    scanLines(&merger, size);
+  }
+  AddressCoder<true> coder(out, size);
+  scanLines(&coder, size);
+  if (coder.broken())
+    errx(1, "broken line chunk: %zu", i);
+}
+
+bool encodeLines(const Binary* binary, uint32_t flags, int num_threads,
+                 vector<uint8_t>* out) {
+  const uint8_t* debug_line = (const uint8_t*)binary->debug_line;
+  vector<ZipChunk> chunks;
+  splitLineChunks(debug_line, binary->debug_line_len, &chunks);
+  size_t num_chunks = chunks.size() - 1;
+
+  LinesJob job;
+  job.in = debug_line;
+  job.flags = flags;
+  job.priors = dictPriors(binary, DICT_MODELS_LINES);
+  job.chunks = &chunks[0];
+  job.bufs.resize(num_chunks);
+  job.out = NULL;
+  parallelFor(num_threads, num_chunks, encodeLineChunk, &job);
+
+  for (size_t i = 0; i < num_chunks; i++) {
+    if (job.bufs[i].empty())
+      return false;
+    chunks[i + 1].zip_offset = chunks[i].zip_offset + job.bufs[i].size();
+  }
+  LinesHeader header;
+  header.debug_line_size = binary->debug_line_len;
+  header.num_chunks = num_chunks;
+  out->insert(out->end(), (const uint8_t*)&header,
+              (const uint8_t*)&header + sizeof(header));
+  out->insert(out->end(), (const uint8_t*)&chunks[0],
+              (const uint8_t*)&chunks[0] + sizeof(ZipChunk) * chunks.size());
+  for (size_t i = 0; i < num_chunks; i++)
+    out->insert(out->end(), job.bufs[i].begin(), job.bufs[i].end());
+  return true;
+}
+
+void decodeLines(const Binary* binary, int num_threads,
+                 vector<uint8_t>* out) {
+  const LinesHeader* header = (const LinesHeader*)binary->debug_line;
+  const ZipChunk* chunks = (const ZipChunk*)(header + 1);
+  out->resize(header->debug_line_size);
+
+  LinesJob job;
+  job.in = (const uint8_t*)(chunks + header->num_chunks + 1);
+  job.flags = binary->zip_flags;
+  job.priors = dictPriors(binary, DICT_MODELS_LINES);
+  job.chunks = chunks;
+  job.out = &(*out)[0];
+  parallelFor(num_threads, header->num_chunks, decodeLineChunk, &job);
+}
+
+bool countLineModels(const Binary* binary, ModelCounts* counts) {
+  const uint8_t* debug_line = (const uint8_t*)binary->debug_line;
+  vector<ZipChunk> chunks;
+  splitLineChunks(debug_line, binary->debug_line_len, &chunks);
+  for (size_t i = 0; i + 1 < chunks.size(); i++) {
+    uint64_t begin = chunks[i].orig_offset;
+    uint64_t size = chunks[i + 1].orig_offset - begin;
+    vector<uint8_t> delta(debug_line + begin, debug_line + begin + size);
+    AddressCoder<false> coder(&delta[0], size);
+    scanLines(&coder, size);
+    if (coder.broken())
+      return false;
+    ModelCounter counter(&delta[0], counts);
+    scanLines(&counter, size);
+  }
+  return true;
+}
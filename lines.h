@@ -0,0 +1,68 @@
+#ifndef LINES_H_
+#define LINES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+class Binary;
+struct ModelCounts;
+
+// A line program of .debug_line is a byte coded state machine, whose
+// operands mix address advances, line advances, and file and column
+// changes. Zipped binaries with ZIP_LINES keep coded line programs in
+// place of .debug_line, laid out as
+//
+//   LinesHeader
+//   num_chunks + 1 ZipChunk, with orig_offset in .debug_line
+//   chunks
+//
+// A chunk is a run of line programs coded independently. The fields of
+// a chunk are entropy coded (see entropy.h) if ZIP_ENTROPY is set, and
+// split into streams by LineStream (see streams.h) otherwise, so each
+// kind of field is modeled on its own. Before that, the operands of
+// DW_LNE_set_address are replaced by their differences from the previous
+// ones. Everything else is kept, so decoding restores the original bytes.
+struct LinesHeader {
+  uint64_t debug_line_size;
+  uint64_t num_chunks;
+};
+
+// The stream of each field of line programs, which is in the lowest bits
+// of its context like Stream.
+enum LineStream {
+  LINE_STREAM_HEADER,
+  // Strings of headers, such as directory and file names.
+  LINE_STREAM_NAME,
+  // Opcodes, including special ones and sub-opcodes of extended ones.
+  LINE_STREAM_OPCODE,
+  // Operands of DW_LNS_advance_pc, DW_LNS_fixed_advance_pc and
+  // DW_LNE_set_address.
+  LINE_STREAM_ADDRESS,
+  // Operands of DW_LNS_advance_line.
+  LINE_STREAM_LINE,
+  // Operands of DW_LNS_set_file.
+  LINE_STREAM_FILE,
+  // Operands of DW_LNS_set_column.
+  LINE_STREAM_COLUMN,
+  // Lengths of extended opcodes and the other operands.
+  LINE_STREAM_OPERAND,
+  NUM_LINE_STREAMS
+};
+
+// Codes .debug_line of a raw binary into |out| with |num_threads|
+// threads. |flags| are the ones of ZipHeader. Returns false if a line
+// program runs past the end of .debug_line.
+bool encodeLines(const Binary* binary, uint32_t flags, int num_threads,
+                 std::vector<uint8_t>* out);
+
+// Restores .debug_line of a zipped binary with ZIP_LINES into |out|.
+void decodeLines(const Binary* binary, int num_threads,
+                 std::vector<uint8_t>* out);
+
+// Adds the bits the line programs of a raw binary would code with
+// ZIP_ENTROPY to |counts|. Returns false if they can't be coded.
+bool countLineModels(const Binary* binary, ModelCounts* counts);
+
+#endif  // LINES_H_
@@ -0,0 +1,177 @@
+#include "parallel.h"
+
+#include <err.h>
+#include <pthread.h>
+
+#include <vector>
+
+using namespace std;
+
+struct Job {
+  void (*func)(void* arg, size_t i);
+  void* arg;
+  size_t n;
+  size_t next;
+  // The number of finished indices, only used by the pool.
+  size_t done;
+};
+
+static void* worker(void* p) {
+  Job* job = static_cast<Job*>(p);
+  while (true) {
+    size_t i = __sync_fetch_and_add(&job->next, 1);
+    if (i >= job->n)
+      break;
+    job->func(job->arg, i);
+  }
+  return NULL;
+}
+
+// The running thread pool. Jobs are on the stacks of the threads which
+// started them, and an index of a job on a stack is only claimed with mu
+// held, so a job is never claimed after its thread took it off the stack.
+struct Pool {
+  pthread_mutex_t mu;
+  // Signaled when a job is pushed, a job is done, or the pool stops.
+  pthread_cond_t cond;
+  vector<vector<Job*> > stacks;
+  vector<pthread_t> threads;
+  bool stopping;
+};
+
+static Pool* pool;
+static __thread int pool_id = -1;
+
+// Claims an index of the oldest job of another thread which has one left.
+// Must be called with mu held.
+static Job* steal(int id, size_t* index) {
+  size_t num_threads = pool->stacks.size();
+  for (size_t k = 1; k < num_threads; k++) {
+    vector<Job*>& stack = pool->stacks[(id + k) % num_threads];
+    for (size_t j = 0; j < stack.size(); j++) {
+      Job* job = stack[j];
+      size_t i = __sync_fetch_and_add(&job->next, 1);
+      if (i < job->n) {
+        *index = i;
+        return job;
+      }
+    }
+  }
+  return NULL;
+}
+
+static void runIndex(Job* job, size_t i) {
+  job->func(job->arg, i);
+  if (__sync_add_and_fetch(&job->done, 1) == job->n) {
+    pthread_mutex_lock(&pool->mu);
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mu);
+  }
+}
+
+static void* poolWorker(void* p) {
+  pool_id = (int)(size_t)p;
+  pthread_mutex_lock(&pool->mu);
+  while (!pool->stopping) {
+    size_t i;
+    Job* job = steal(pool_id, &i);
+    if (!job) {
+      pthread_cond_wait(&pool->cond, &pool->mu);
+      continue;
+    }
+    pthread_mutex_unlock(&pool->mu);
+    runIndex(job, i);
+    pthread_mutex_lock(&pool->mu);
+  }
+  pthread_mutex_unlock(&pool->mu);
+  return NULL;
+}
+
+// Runs a job on the pool. The calling thread claims indices without the
+// lock, which only keeps stealing threads from claiming indices of a job
+// after it's off the stack.
+static void poolFor(Job* job) {
+  vector<Job*>& stack = pool->stacks[pool_id];
+  pthread_mutex_lock(&pool->mu);
+  stack.push_back(job);
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->mu);
+
+  while (true) {
+    size_t i = __sync_fetch_and_add(&job->next, 1);
+    if (i >= job->n)
+      break;
+    runIndex(job, i);
+  }
+
+  // Nested jobs are off the stack by now, so this one is on the top.
+  // Helping others while the stolen indices finish could start a whole
+  // file, so the thread only waits.
+  pthread_mutex_lock(&pool->mu);
+  stack.pop_back();
+  while (__atomic_load_n(&job->done, __ATOMIC_ACQUIRE) < job->n)
+    pthread_cond_wait(&pool->cond, &pool->mu);
+  pthread_mutex_unlock(&pool->mu);
+}
+
+void parallelFor(int num_threads, size_t n,
+                 void (*func)(void* arg, size_t i), void* arg) {
+  Job job;
+  job.func = func;
+  job.arg = arg;
+  job.n = n;
+  job.next = 0;
+  job.done = 0;
+
+  if (pool && pool_id >= 0) {
+    if (n)
+      poolFor(&job);
+    return;
+  }
+
+  if (num_threads > (int)n)
+    num_threads = n;
+  if (num_threads <= 1) {
+    worker(&job);
+    return;
+  }
+
+  // The calling thread works as one of the workers.
+  vector<pthread_t> threads(num_threads - 1);
+  for (size_t i = 0; i < threads.size(); i++) {
+    if (pthread_create(&threads[i], NULL, worker, &job))
+      err(1, "pthread_create failed");
+  }
+  worker(&job);
+  for (size_t i = 0; i < threads.size(); i++)
+    pthread_join(threads[i], NULL);
+}
+
+void startThreadPool(int num_threads) {
+  pool = new Pool();
+  pthread_mutex_init(&pool->mu, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  pool->stacks.resize(num_threads > 1 ? num_threads : 1);
+  pool->stopping = false;
+  pool_id = 0;
+  pool->threads.resize(pool->stacks.size() - 1);
+  for (size_t i = 0; i < pool->threads.size(); i++) {
+    if (pthread_create(&pool->threads[i], NULL, poolWorker,
+                       (void*)(i + 1)))
+      err(1, "pthread_create failed");
+  }
+}
+
+void stopThreadPool() {
+  pthread_mutex_lock(&pool->mu);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->mu);
+  for (size_t i = 0; i < pool->threads.size(); i++)
+    pthread_join(pool->threads[i], NULL);
+  pthread_mutex_destroy(&pool->mu);
+  pthread_cond_destroy(&pool->cond);
+  delete pool;
+  pool = NULL;
+  pool_id = -1;
+}
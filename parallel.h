@@ -0,0 +1,22 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <stddef.h>
+
+// Calls func(arg, i) for each i in [0, n) using num_threads threads.
+// Indices are handed out in increasing order, but may finish in any order.
+// Calls from the threads of a running thread pool use the threads of the
+// pool instead, whatever num_threads is.
+void parallelFor(int num_threads, size_t n,
+                 void (*func)(void* arg, size_t i), void* arg);
+
+// Starts a pool of num_threads threads, one of which is the calling
+// thread, for parallelFor() calls until stopThreadPool(). Calls may be
+// nested, and each pushes its indices on a stack of the calling thread.
+// Idle threads steal from the oldest calls of other threads first, so
+// they take coarse work, such as a whole file of a batch, before helping
+// with the chunks of a file another thread is working on.
+void startThreadPool(int num_threads);
+void stopThreadPool();
+
+#endif  // PARALLEL_H_
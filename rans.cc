@@ -0,0 +1,346 @@
+#include "rans.h"
+
+#include <err.h>
+#include <math.h>
+
+using namespace std;
+
+const uint32_t RansModels::FREQ_TOTAL;
+const uint32_t RansModels::STATE_LOW;
+
+void RansModels::normalize(const uint32_t* counts, uint16_t* freqs) {
+  uint64_t total = 0;
+  int largest = 0;
+  for (int b = 0; b < 256; b++) {
+    total += counts[b];
+    if (counts[b] > counts[largest])
+      largest = b;
+  }
+  uint32_t sum = 0;
+  for (int b = 0; b < 256; b++) {
+    freqs[b] = 0;
+    if (!counts[b])
+      continue;
+    uint64_t f = (counts[b] * (uint64_t)FREQ_TOTAL + total / 2) / total;
+    freqs[b] = f ? f : 1;
+    sum += freqs[b];
+  }
+  // Rounding is off by less than one for each byte, which the most common
+  // byte makes up if it can.
+  if (sum <= FREQ_TOTAL) {
+    freqs[largest] += FREQ_TOTAL - sum;
+    return;
+  }
+  uint32_t excess = sum - FREQ_TOTAL;
+  if (freqs[largest] > excess) {
+    freqs[largest] -= excess;
+    return;
+  }
+  while (excess) {
+    for (int b = 0; b < 256 && excess; b++) {
+      if (freqs[b] > 1) {
+        freqs[b]--;
+        excess--;
+      }
+    }
+  }
+}
+
+void RansTable::set(const uint16_t* f) {
+  uint32_t start = 0;
+  for (int b = 0; b < 256; b++) {
+    freqs[b] = f[b];
+    starts[b] = start;
+    memset(bytes + start, b, f[b]);
+    start += f[b];
+  }
+}
+
+static void appendUleb(uint64_t v, vector<uint8_t>* out) {
+  uint8_t buf[10];
+  uint8_t* p = buf;
+  uleb128o(v, p);
+  out->insert(out->end(), buf, p);
+}
+
+// Scales |counts| down to add up to about FREQ_TOTAL at most, which is
+// all the precision frequencies have. Counted bytes keep a count.
+static void scaleCounts(const uint32_t* counts, uint32_t* scaled) {
+  uint64_t total = 0;
+  for (int b = 0; b < 256; b++)
+    total += counts[b];
+  for (int b = 0; b < 256; b++) {
+    scaled[b] = counts[b];
+    if (counts[b] && total > RansModels::FREQ_TOTAL) {
+      scaled[b] = counts[b] * (uint64_t)RansModels::FREQ_TOTAL / total;
+      if (!scaled[b])
+        scaled[b] = 1;
+    }
+  }
+}
+
+// Counts of more bytes than this list the bytes with a bitmap rather
+// than with gaps between them.
+static const int MAX_GAP_COUNTS = 32;
+
+static void appendCounts(const uint32_t* counts, vector<uint8_t>* out) {
+  int num_counts = 0;
+  for (int b = 0; b < 256; b++)
+    num_counts += counts[b] != 0;
+  appendUleb(num_counts, out);
+  if (num_counts > MAX_GAP_COUNTS) {
+    uint8_t bitmap[32] = {};
+    for (int b = 0; b < 256; b++) {
+      if (counts[b])
+        bitmap[b / 8] |= 1 << (b % 8);
+    }
+    out->insert(out->end(), bitmap, bitmap + sizeof(bitmap));
+  }
+  int last = -1;
+  for (int b = 0; b < 256; b++) {
+    if (!counts[b])
+      continue;
+    if (num_counts <= MAX_GAP_COUNTS)
+      appendUleb(b - last - 1, out);
+    appendUleb(counts[b] - 1, out);
+    last = b;
+  }
+}
+
+// Reads counts written by appendCounts into |counts|. Returns false if
+// they are broken.
+static bool readCounts(const uint8_t*& p, const uint8_t* end,
+                       uint64_t num_counts, uint32_t* counts) {
+  memset(counts, 0, sizeof(*counts) * 256);
+  if (num_counts > 256)
+    return false;
+  if (num_counts > MAX_GAP_COUNTS) {
+    if (p > end || end - p < 32)
+      return false;
+    const uint8_t* bitmap = p;
+    p += 32;
+    uint64_t num_bytes = 0;
+    for (int b = 0; b < 256; b++) {
+      if (!(bitmap[b / 8] >> (b % 8) & 1))
+        continue;
+      uint64_t count = uleb128(p) + 1;
+      if (count > RansModels::FREQ_TOTAL)
+        return false;
+      counts[b] = count;
+      num_bytes++;
+    }
+    return num_bytes == num_counts;
+  }
+  uint64_t b = -1;
+  for (uint64_t j = 0; j < num_counts; j++) {
+    b += uleb128(p) + 1;
+    uint64_t count = uleb128(p) + 1;
+    if (b >= 256 || count > RansModels::FREQ_TOTAL)
+      return false;
+    counts[b] = count;
+  }
+  return true;
+}
+
+// The bits of coding |counts| with |freqs|, or infinity if a counted byte
+// has no frequency.
+static double codeBits(const uint32_t* counts, const uint16_t* freqs) {
+  double bits = 0;
+  for (int b = 0; b < 256; b++) {
+    if (!counts[b])
+      continue;
+    if (!freqs[b])
+      return HUGE_VAL;
+    bits += counts[b] * log2((double)RansModels::FREQ_TOTAL / freqs[b]);
+  }
+  return bits;
+}
+
+// How a model of a chunk is coded.
+struct ModelChoice {
+  // The bits of the bytes and the table if the model has its own table
+  // or the one of the dictionary, whichever is fewer.
+  double bits;
+  bool trained;
+  std::vector<uint8_t> counts;
+  uint16_t freqs[256];
+};
+
+// Models of fewer bytes than this start in the rest table.
+static const uint32_t MAX_REST_BYTES = 64;
+
+void RansEncoder::flush() {
+  // Models get tables in the order they are first used, and the bytes
+  // refer to the tables from here on.
+  vector<int> tables_of(EntropyModels::NUM_MODELS, -1);
+  vector<uint32_t> counts;
+  vector<uint16_t> models;
+  size_t n = models_.size();
+  for (size_t i = 0; i < n; i++) {
+    int& t = tables_of[models_[i]];
+    if (t < 0) {
+      t = counts.size() / 256;
+      counts.resize(counts.size() + 256);
+      models.push_back(models_[i]);
+    }
+    counts[t * 256 + base_[i]]++;
+    models_[i] = t;
+  }
+
+  size_t num_tables = models.size();
+  vector<ModelChoice> choices(num_tables);
+  uint32_t rest[256] = {};
+  for (size_t t = 0; t < num_tables; t++) {
+    const uint32_t* c = &counts[t * 256];
+    ModelChoice& choice = choices[t];
+    uint32_t scaled[256];
+    scaleCounts(c, scaled);
+    RansModels::normalize(scaled, choice.freqs);
+    appendCounts(scaled, &choice.counts);
+    // The index costs about a byte.
+    choice.bits = codeBits(c, choice.freqs) + 8 * (choice.counts.size() + 1);
+    choice.trained = false;
+    size_t m = models[t];
+    if (priors_ && priors_->trained[m]) {
+      const uint16_t* trained = &priors_->freqs[m * 256];
+      double bits = codeBits(c, trained) + 16;
+      if (bits < choice.bits) {
+        choice.bits = bits;
+        choice.trained = true;
+        memcpy(choice.freqs, trained, sizeof(choice.freqs));
+      }
+    }
+    uint64_t total = 0;
+    for (int b = 0; b < 256; b++)
+      total += c[b];
+    if (total < MAX_REST_BYTES) {
+      for (int b = 0; b < 256; b++)
+        rest[b] += c[b];
+    }
+  }
+
+  // Models join the rest table if it codes them in fewer bits, and the
+  // table is counted again from the ones which did.
+  uint32_t scaled[256];
+  uint16_t freqs[256];
+  scaleCounts(rest, scaled);
+  RansModels::normalize(scaled, freqs);
+  vector<bool> in_rest(num_tables);
+  memset(rest, 0, sizeof(rest));
+  size_t num_own = 0;
+  for (size_t t = 0; t < num_tables; t++) {
+    const uint32_t* c = &counts[t * 256];
+    in_rest[t] = codeBits(c, freqs) < choices[t].bits;
+    if (in_rest[t]) {
+      for (int b = 0; b < 256; b++)
+        rest[b] += c[b];
+    } else {
+      num_own++;
+    }
+  }
+
+  vector<RansTable> tables(num_tables + 1);
+  appendUleb(num_own, out_);
+  scaleCounts(rest, scaled);
+  appendCounts(scaled, out_);
+  if (num_own < num_tables) {
+    RansModels::normalize(scaled, freqs);
+    tables[num_tables].set(freqs);
+  }
+  int last = -1;
+  for (size_t m = 0; m < EntropyModels::NUM_MODELS; m++) {
+    int t = tables_of[m];
+    if (t < 0)
+      continue;
+    if (in_rest[t]) {
+      tables_of[m] = num_tables;
+      continue;
+    }
+    const ModelChoice& choice = choices[t];
+    appendUleb(m - last - 1, out_);
+    last = m;
+    if (choice.trained)
+      appendUleb(0, out_);
+    else
+      out_->insert(out_->end(), choice.counts.begin(), choice.counts.end());
+    tables[t].set(choice.freqs);
+  }
+
+  // rANS codes the bytes backwards, so that the decoder reads them
+  // forwards. A byte writes at most one uint16_t.
+  vector<uint8_t> coded(n * 2 + sizeof(uint32_t) * RansModels::NUM_STATES);
+  uint8_t* end = coded.data() + coded.size();
+  uint8_t* p = end;
+  uint32_t states[RansModels::NUM_STATES];
+  for (int i = 0; i < RansModels::NUM_STATES; i++)
+    states[i] = RansModels::STATE_LOW;
+  for (size_t i = n; i-- > 0;) {
+    int t = models_[i];
+    const RansTable& table = tables[in_rest[t] ? num_tables : t];
+    uint32_t& state = states[i % RansModels::NUM_STATES];
+    uint8_t b = base_[i];
+    uint32_t freq = table.freqs[b];
+    uint64_t max = (uint64_t)((RansModels::STATE_LOW >>
+                               RansModels::FREQ_BITS) << 16) * freq;
+    if (state >= max) {
+      p -= 2;
+      p[0] = state;
+      p[1] = state >> 8;
+      state >>= 16;
+    }
+    state = ((state / freq) << RansModels::FREQ_BITS) + state % freq +
+        table.starts[b];
+  }
+  for (int i = RansModels::NUM_STATES; i-- > 0;) {
+    p -= sizeof(states[i]);
+    memcpy(p, &states[i], sizeof(states[i]));
+  }
+  out_->insert(out_->end(), p, end);
+}
+
+RansDecoder::RansDecoder(const uint8_t* in, size_t size, uint8_t* out,
+                               const ModelPriors* priors)
+  : in_(in),
+    in_end_(in + size),
+    base_(out),
+    p_(out),
+    next_state_(0) {
+  uint64_t num_tables = uleb128(in_);
+  if (num_tables > EntropyModels::NUM_MODELS)
+    errx(1, "broken entropy coded chunk");
+  tables_.resize(num_tables + 1);
+  uint32_t counts[256];
+  uint16_t freqs[256];
+  uint64_t num_counts = uleb128(in_);
+  if (!readCounts(in_, in_end_, num_counts, counts))
+    errx(1, "broken entropy coded chunk");
+  if (!num_counts)
+    counts[0] = 1;
+  RansModels::normalize(counts, freqs);
+  tables_[0].set(freqs);
+  for (size_t m = 0; m < EntropyModels::NUM_MODELS; m++)
+    models_[m] = &tables_[0];
+
+  uint64_t m = -1;
+  for (size_t t = 1; t <= num_tables; t++) {
+    m += uleb128(in_) + 1;
+    if (m >= EntropyModels::NUM_MODELS)
+      errx(1, "broken entropy coded chunk");
+    models_[m] = &tables_[t];
+    num_counts = uleb128(in_);
+    if (!num_counts) {
+      if (!priors || !priors->trained[m])
+        errx(1, "broken entropy coded chunk");
+      tables_[t].set(&priors->freqs[m * 256]);
+      continue;
+    }
+    if (!readCounts(in_, in_end_, num_counts, counts))
+      errx(1, "broken entropy coded chunk");
+    RansModels::normalize(counts, freqs);
+    tables_[t].set(freqs);
+  }
+  if (in_ > in_end_ || (size_t)(in_end_ - in_) < sizeof(states_))
+    errx(1, "broken entropy coded chunk");
+  memcpy(states_, in_, sizeof(states_));
+  in_ += sizeof(states_);
+}
@@ -0,0 +1,211 @@
+#ifndef RANS_H_
+#define RANS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "entropy.h"
+
+// Static range coder in the style of rANS, which ZIP_STATIC chooses over
+// the context mixing of EntropyEncoder: it codes several times larger but
+// decodes an order of magnitude faster. A byte is coded by the
+// frequencies of the model EntropyModels::index() gives for the context
+// of the field and the position of the byte in the field. The encoder
+// counts the bytes of each model over the whole chunk and writes the
+// counts before the coded bytes, so the decoder gets each byte from a
+// table.
+//
+// Counts are scaled down to the precision of frequencies, and both sides
+// normalize them the same way. Models which code too few bytes to pay for
+// their counts share the rest table, and those whose bytes the dictionary
+// codes as well use its frequencies. Bytes are coded by two states in
+// turn, so that the decoder can work on the next byte before the last one
+// is done. A chunk is laid out as
+//
+//   ULEB128 number of models with their own tables
+//   counts of the rest table
+//   for each model with its own table, in the order of indexes
+//     ULEB128 number of indexes skipped since the previous model
+//     counts, or 0 if the model has the frequencies of the dictionary
+//   uint32_t states of the encoder at the end
+//   coded bytes, in uint16_t
+//
+// where counts are the ULEB128 number of counted bytes, then a bitmap of
+// 32 bytes if there are more than 32 of them, and for each of them the
+// ULEB128 number of bytes skipped since the previous one unless there is a
+// bitmap, and the ULEB128 count - 1.
+class RansModels {
+public:
+  // Frequencies of a model add up to FREQ_TOTAL.
+  static const int FREQ_BITS = 12;
+  static const uint32_t FREQ_TOTAL = 1 << FREQ_BITS;
+  // A state stays in [STATE_LOW, STATE_LOW << 16) between bytes, so a
+  // decoded byte reads at most one uint16_t.
+  static const uint32_t STATE_LOW = 1 << 16;
+  static const int NUM_STATES = 2;
+
+  // Scales |counts| of the 256 bytes to |freqs| which add up to
+  // FREQ_TOTAL. Bytes with counts keep a frequency.
+  static void normalize(const uint32_t* counts, uint16_t* freqs);
+};
+
+// The frequencies of a model, where they start among FREQ_TOTAL slots and
+// the byte of each slot.
+struct RansTable {
+  void set(const uint16_t* f);
+
+  uint16_t freqs[256];
+  uint16_t starts[256];
+  uint8_t bytes[RansModels::FREQ_TOTAL];
+};
+
+// Reads fields from memory and codes them into |out| on flush(), when the
+// frequencies of the chunk are known.
+class RansEncoder {
+public:
+  RansEncoder(const uint8_t* base, std::vector<uint8_t>* out,
+              const ModelPriors* priors)
+    : base_(base),
+      p_(base),
+      out_(out),
+      priors_(priors) {
+  }
+
+  const uint8_t* base() const {
+    return base_;
+  }
+
+  uint64_t offset() const {
+    return p_ - base_;
+  }
+
+  const uint8_t* read(size_t size, uint32_t ctx) {
+    const uint8_t* r = p_;
+    p_ += size;
+    addModels(ctx, r);
+    return r;
+  }
+
+  uint64_t uleb(uint32_t ctx) {
+    const uint8_t* r = p_;
+    uint64_t v = uleb128(p_);
+    addModels(ctx, r);
+    return v;
+  }
+
+  int64_t sleb(uint32_t ctx) {
+    const uint8_t* r = p_;
+    int64_t v = sleb128(p_);
+    addModels(ctx, r);
+    return v;
+  }
+
+  const uint8_t* string(uint32_t ctx) {
+    const uint8_t* r = p_;
+    p_ += strlen((const char*)p_) + 1;
+    addModels(ctx, r);
+    return r;
+  }
+
+  // Codes the fields read so far. Must be called at the end.
+  void flush();
+
+private:
+  void addModels(uint32_t ctx, const uint8_t* p) {
+    for (size_t i = 0; p + i < p_; i++)
+      models_.push_back(EntropyModels::index(ctx, i));
+  }
+
+  const uint8_t* base_;
+  const uint8_t* p_;
+  std::vector<uint8_t>* out_;
+  const ModelPriors* priors_;
+  // The model of each byte from base_.
+  std::vector<uint16_t> models_;
+};
+
+// Decodes fields from |in| into |out|, which must have room for all of
+// them. Offsets are relative to |out|. |priors| must be the ones of the
+// encoder. Exits if the frequencies are broken.
+class RansDecoder {
+public:
+  RansDecoder(const uint8_t* in, size_t size, uint8_t* out,
+              const ModelPriors* priors);
+
+  const uint8_t* base() const {
+    return base_;
+  }
+
+  uint64_t offset() const {
+    return p_ - base_;
+  }
+
+  const uint8_t* read(size_t size, uint32_t ctx) {
+    const uint8_t* r = p_;
+    for (size_t i = 0; i < size; i++)
+      *p_++ = decodeByte(ctx, i);
+    return r;
+  }
+
+  uint64_t uleb(uint32_t ctx) {
+    const uint8_t* r = p_;
+    decodeUntil(ctx, 0x80);
+    return uleb128(r);
+  }
+
+  int64_t sleb(uint32_t ctx) {
+    const uint8_t* r = p_;
+    decodeUntil(ctx, 0x80);
+    return sleb128(r);
+  }
+
+  const uint8_t* string(uint32_t ctx) {
+    const uint8_t* r = p_;
+    decodeUntil(ctx, 1);
+    return r;
+  }
+
+private:
+  // Decodes bytes until one is less than |limit|.
+  void decodeUntil(uint32_t ctx, uint8_t limit) {
+    size_t i = 0;
+    uint8_t b;
+    do {
+      b = decodeByte(ctx, i++);
+      *p_++ = b;
+    } while (b >= limit);
+  }
+
+  // Renormalizes without a branch, as whether a byte needs it is random.
+  uint8_t decodeByte(uint32_t ctx, size_t pos) {
+    const RansTable* t = models_[EntropyModels::index(ctx, pos)];
+    uint32_t& state = states_[next_state_];
+    next_state_ ^= 1;
+    uint32_t slot = state & (RansModels::FREQ_TOTAL - 1);
+    uint8_t b = t->bytes[slot];
+    uint32_t s = t->freqs[b] * (state >> RansModels::FREQ_BITS) + slot -
+        t->starts[b];
+    bool more = in_end_ - in_ >= 2;
+    uint32_t w = more ? in_[0] | in_[1] << 8 : 0;
+    bool renormalize = s < RansModels::STATE_LOW;
+    state = renormalize ? (s << 16) | w : s;
+    in_ += (renormalize & more) * 2;
+    return b;
+  }
+
+  const uint8_t* in_;
+  const uint8_t* in_end_;
+  uint8_t* base_;
+  uint8_t* p_;
+  uint32_t states_[RansModels::NUM_STATES];
+  int next_state_;
+  // The tables of the models of the chunk. The first one is the rest
+  // table, or codes only zeros if the chunk has none.
+  std::vector<RansTable> tables_;
+  const RansTable* models_[EntropyModels::NUM_MODELS];
+};
+
+#endif  // RANS_H_
@@ -0,0 +1,123 @@
+#include "rebase.h"
+
+#include <dwarf.h>
+#include <err.h>
+#include <inttypes.h>
+
+#include "leb128.h"
+
+using namespace std;
+
+static void appendUleb(vector<uint8_t>* out, uint64_t v) {
+  uint8_t buf[16];
+  uint8_t* p = buf;
+  uleb128o(v, p);
+  out->insert(out->end(), buf, p);
+}
+
+static void appendSleb(vector<uint8_t>* out, int64_t v) {
+  uint8_t buf[16];
+  uint8_t* p = buf;
+  sleb128o(v, p);
+  out->insert(out->end(), buf, p);
+}
+
+UnitBases::UnitBases()
+  : next_value_(NULL),
+    values_end_(NULL) {
+}
+
+void UnitBases::startCU() {
+  for (int i = 0; i < 2; i++) {
+    strings_[i].clear();
+    indexes_[i].clear();
+  }
+  bases_.clear();
+}
+
+void UnitBases::addCU(uint64_t abbrev_offset) {
+  abbrev_offsets_.push_back(abbrev_offset);
+  startCU();
+}
+
+uint64_t UnitBases::addString(uint16_t form, uint64_t offset) {
+  int kind = form == DW_FORM_line_strp;
+  vector<uint64_t>& strings = strings_[kind];
+  pair<map<uint64_t, uint64_t>::iterator, bool> added =
+    indexes_[kind].insert(make_pair(offset, strings.size()));
+  if (added.second) {
+    appendSleb(&values_, offset - (strings.empty() ? 0 : strings.back()));
+    strings.push_back(offset);
+  }
+  return added.first->second;
+}
+
+uint64_t UnitBases::addBase(uint16_t name, uint64_t value) {
+  for (size_t i = 0; i < bases_.size(); i++) {
+    if (bases_[i].first == name)
+      return bases_[i].second;
+  }
+  bases_.push_back(make_pair(name, value));
+  appendSleb(&values_, value);
+  return value;
+}
+
+void UnitBases::write(vector<uint8_t>* out) const {
+  vector<uint8_t> side;
+  appendUleb(&side, abbrev_offsets_.size());
+  for (size_t i = 0; i < abbrev_offsets_.size(); i++)
+    appendUleb(&side, abbrev_offsets_[i]);
+  side.insert(side.end(), values_.begin(), values_.end());
+  appendUleb(out, side.size());
+  out->insert(out->end(), side.begin(), side.end());
+}
+
+// LEB128 values are read up to 10 bytes past the end, so they are only
+// read from side data which end before the coded CUs, or checked after.
+size_t UnitBases::read(const uint8_t* p, size_t size) {
+  const uint8_t* start = p;
+  const uint8_t* end = p + size;
+  uint64_t side_size = uleb128(p);
+  if (p > end || side_size > (uint64_t)(end - p))
+    errx(1, "broken side data of a chunk");
+  end = p + side_size;
+  uint64_t num_cus = uleb128(p);
+  for (uint64_t i = 0; i < num_cus && p < end; i++)
+    abbrev_offsets_.push_back(uleb128(p));
+  if (p > end || abbrev_offsets_.size() != num_cus)
+    errx(1, "broken side data of a chunk");
+  next_value_ = p;
+  values_end_ = end;
+  return end - start;
+}
+
+void UnitBases::nextCU() {
+  startCU();
+}
+
+int64_t UnitBases::readValue() {
+  if (next_value_ >= values_end_)
+    errx(1, "broken side data of a chunk");
+  int64_t v = sleb128(next_value_);
+  if (next_value_ > values_end_)
+    errx(1, "broken side data of a chunk");
+  return v;
+}
+
+uint64_t UnitBases::string(uint16_t form, uint64_t index) {
+  vector<uint64_t>& strings = strings_[form == DW_FORM_line_strp];
+  if (index == strings.size())
+    strings.push_back((strings.empty() ? 0 : strings.back()) + readValue());
+  else if (index > strings.size())
+    errx(1, "broken string index of a rebased CU: %" PRIu64, index);
+  return strings[index];
+}
+
+uint64_t UnitBases::base(uint16_t name) {
+  for (size_t i = 0; i < bases_.size(); i++) {
+    if (bases_[i].first == name)
+      return bases_[i].second;
+  }
+  bases_.push_back(make_pair(name, (uint64_t)readValue()));
+  return bases_.back().second;
+}
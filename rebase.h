@@ -0,0 +1,83 @@
+#ifndef REBASE_H_
+#define REBASE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <utility>
+#include <vector>
+
+// When a binary is relinked after a change, the CUs linked after it move:
+// their abbrev tables, strings, line programs and code all get other
+// offsets, while the CUs stay the same relative to them. Chunks with
+// ZIP_REBASED keep those bases in side data before the coded CUs, so an
+// unchanged CU codes to the same bytes. The side data are
+//
+//   ULEB128 size of the rest
+//   ULEB128 number of CUs, and the abbrev offset of each
+//   SLEB128 values in the order the CUs first use them
+//
+// and the CU headers have abbrev offset 0. A CU codes each
+// DW_FORM_strp and DW_FORM_line_strp value as the index of the offset
+// among the distinct ones of its form in the CU, a new one of which has
+// the value of its offset minus the last new one. Each DW_FORM_addr,
+// DW_FORM_ref_addr and DW_FORM_sec_offset value is coded minus the first
+// one of its attribute in the CU, which has its value.
+//
+// Only the values of attributes are rebased. Addresses in expressions,
+// such as DW_OP_addr of a global variable, and in other sections stay as
+// they are, so such CUs still code to other bytes once they move.
+class UnitBases {
+public:
+  UnitBases();
+
+  // Starts a CU of a raw scan with |abbrev_offset|.
+  void addCU(uint64_t abbrev_offset);
+
+  // Returns the index of the string at |offset| of |form| in the CU.
+  uint64_t addString(uint16_t form, uint64_t offset);
+
+  // Returns the base of attribute |name| in the CU, which is |value| if
+  // it's the first one.
+  uint64_t addBase(uint16_t name, uint64_t value);
+
+  // Appends the side data of a raw scan to |out|.
+  void write(std::vector<uint8_t>* out) const;
+
+  // Reads the side data at the start of |size| bytes of a chunk at |p|.
+  // Returns their size.
+  size_t read(const uint8_t* p, size_t size);
+
+  // The abbrev offsets of the CUs which were read.
+  const std::vector<uint64_t>& abbrev_offsets() const {
+    return abbrev_offsets_;
+  }
+
+  // Starts the next CU which was read.
+  void nextCU();
+
+  // Returns the offset of the string of |index| of |form| in the CU.
+  uint64_t string(uint16_t form, uint64_t index);
+
+  // Returns the base of attribute |name| in the CU.
+  uint64_t base(uint16_t name);
+
+private:
+  void startCU();
+  int64_t readValue();
+
+  std::vector<uint64_t> abbrev_offsets_;
+  // The values of raw scans, and the next one of read side data.
+  std::vector<uint8_t> values_;
+  const uint8_t* next_value_;
+  const uint8_t* values_end_;
+  // The offsets of the strings of the CU by DW_FORM_strp and
+  // DW_FORM_line_strp, and their indexes in raw scans.
+  std::vector<uint64_t> strings_[2];
+  std::map<uint64_t, uint64_t> indexes_[2];
+  // The bases of the attributes of the CU, which has a few.
+  std::vector<std::pair<uint16_t, uint64_t> > bases_;
+};
+
+#endif  // REBASE_H_
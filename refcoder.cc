@@ -0,0 +1,157 @@
+#include "refcoder.h"
+
+#include <string.h>
+
+#include "leb128.h"
+
+using namespace std;
+
+// Misses of the cache keep the sign of the difference in the lowest bit,
+// so they stay non-negative after the indexes.
+static int64_t zigzag(int64_t v) {
+  return v < 0 ? (~v << 1) | 1 : v << 1;
+}
+
+static int64_t unzigzag(int64_t v) {
+  return v & 1 ? ~(v >> 1) : v >> 1;
+}
+
+RefCoder::RefCoder()
+  : epoch_(1),
+    slots_(TABLE_SIZE) {
+}
+
+void RefCoder::reset() {
+  epoch_++;
+  names_.clear();
+  fields_.clear();
+}
+
+RefCoder::Name* RefCoder::findName(uint16_t name, bool* first) {
+  Slot& slot = slots_[name & (TABLE_SIZE - 1)];
+  *first = slot.epoch != epoch_;
+  if (*first) {
+    slot.epoch = epoch_;
+    slot.index = names_.size();
+    names_.resize(names_.size() + 1);
+    memset(&names_.back(), 0, sizeof(Name));
+  }
+  return &names_[slot.index];
+}
+
+int RefCoder::touchRecent(Name* n, uint32_t value) {
+  int i = 0;
+  while (i < n->num_recent && n->recent[i] != value)
+    i++;
+  int found = i < n->num_recent ? i : -1;
+  if (i == NUM_RECENT_REFS)
+    i--;
+  else if (i == n->num_recent)
+    n->num_recent++;
+  for (; i > 0; i--)
+    n->recent[i] = n->recent[i - 1];
+  n->recent[0] = value;
+  return found;
+}
+
+void RefCoder::encode(uint16_t name, uint32_t value, int32_t last_diff,
+                      uint32_t die, uint32_t parent, const uint8_t* cu,
+                      uint8_t*& p) {
+  Field field;
+  Name* n = findName(name, &field.first);
+  field.pos = p - cu;
+  field.name = n - &names_[0];
+  field.recent = touchRecent(n, value);
+  field.last_diff = last_diff;
+  field.value = value;
+  field.die = die;
+  field.parent = parent;
+  int64_t recent = field.recent >= 0 ? field.recent :
+                   NUM_RECENT_REFS + zigzag(last_diff);
+  n->sizes[REF_LAST] += slebSize(last_diff);
+  n->sizes[REF_DIE] += slebSize((int64_t)value - die);
+  n->sizes[REF_PARENT] += slebSize((int64_t)value - parent);
+  n->sizes[REF_RECENT] += slebSize(recent);
+
+  sleb128o(last_diff, p);
+  field.len = p - cu - field.pos;
+  fields_.push_back(field);
+}
+
+uint8_t* RefCoder::finish(uint8_t* cu, uint8_t* end) {
+  if (fields_.empty())
+    return end;
+  // Ties go to the earlier predictor, so REF_LAST is kept unless another
+  // one is better.
+  for (size_t i = 0; i < names_.size(); i++) {
+    Name& n = names_[i];
+    n.predictor = REF_LAST;
+    for (int j = 1; j < NUM_REF_PREDICTORS; j++) {
+      if (n.sizes[j] < n.sizes[n.predictor])
+        n.predictor = j;
+    }
+  }
+
+  // A value was written in at least a byte.
+  buf_.resize((end - cu) + fields_.size() * 5);
+  uint8_t* out = &buf_[0];
+  const uint8_t* in = cu;
+  for (size_t i = 0; i < fields_.size(); i++) {
+    const Field& field = fields_[i];
+    memcpy(out, in, cu + field.pos - in);
+    out += cu + field.pos - in;
+    int predictor = names_[field.name].predictor;
+    int64_t v;
+    switch (predictor) {
+    case REF_LAST:
+      v = field.last_diff;
+      break;
+    case REF_DIE:
+      v = (int64_t)field.value - field.die;
+      break;
+    case REF_PARENT:
+      v = (int64_t)field.value - field.parent;
+      break;
+    default:
+      v = field.recent >= 0 ? field.recent :
+          NUM_RECENT_REFS + zigzag(field.last_diff);
+    }
+    if (field.first)
+      v = v * NUM_REF_PREDICTORS + predictor;
+    sleb128o(v, out);
+    in = cu + field.pos + field.len;
+  }
+  memcpy(out, in, end - in);
+  out += end - in;
+  fields_.clear();
+  memcpy(cu, &buf_[0], out - &buf_[0]);
+  return cu + (out - &buf_[0]);
+}
+
+// Only the attributes coded by REF_RECENT keep their caches.
+uint32_t RefCoder::decode(uint16_t name, int64_t coded, uint32_t last,
+                          uint32_t die, uint32_t parent) {
+  bool first;
+  Name* n = findName(name, &first);
+  if (first) {
+    n->predictor = coded & (NUM_REF_PREDICTORS - 1);
+    coded = (coded - n->predictor) / NUM_REF_PREDICTORS;
+  }
+  switch (n->predictor) {
+  case REF_LAST:
+    return last + coded;
+  case REF_DIE:
+    return die + coded;
+  case REF_PARENT:
+    return parent + coded;
+  default: {
+    uint32_t value;
+    if (coded >= 0 && coded < n->num_recent)
+      value = n->recent[coded];
+    else
+      value = last + unzigzag(coded - NUM_RECENT_REFS);
+    touchRecent(n, value);
+    return value;
+  }
+  }
+}
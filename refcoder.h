@@ -0,0 +1,106 @@
+#ifndef REFCODER_H_
+#define REFCODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// The predictors of DW_FORM_ref4 values with ZIP_PREDICT. Each is chosen
+// per attribute name and CU.
+enum RefPredictor {
+  // The last value of the attribute, as other delta coded forms.
+  REF_LAST = 0,
+  // The offset of the DIE which has the attribute.
+  REF_DIE = 1,
+  // The offset of the parent of the DIE.
+  REF_PARENT = 2,
+  // The index in a move-to-front cache of the recent values of the
+  // attribute. Misses are NUM_RECENT_REFS plus the zigzag coded REF_LAST
+  // difference.
+  REF_RECENT = 3,
+  NUM_REF_PREDICTORS
+};
+
+static const int NUM_RECENT_REFS = 8;
+
+// Codes the DW_FORM_ref4 values of a CU. All offsets are relative to the
+// CU. The first value of each attribute name in a CU is coded as
+// value * NUM_REF_PREDICTORS + predictor, so the selector costs at most a
+// byte per name and CU.
+//
+// The encoder writes the REF_LAST difference of each value, and records
+// where it's written and what the predictors need. finish() chooses the
+// predictor of each name whose SLEB128 values are smallest in the CU and
+// rewrites the values with it.
+class RefCoder {
+public:
+  RefCoder();
+
+  // Starts a CU.
+  void reset();
+
+  // Writes the REF_LAST difference |last_diff| of |value| of attribute
+  // |name| at |p| and advances it. |cu| is the start of the coded CU.
+  void encode(uint16_t name, uint32_t value, int32_t last_diff,
+              uint32_t die, uint32_t parent, const uint8_t* cu,
+              uint8_t*& p);
+
+  // Rewrites the values of the CU at |cu|, whose coded bytes end at |end|,
+  // with the chosen predictors. Returns the new end. A value takes at most
+  // 6 bytes, less than twice its DW_FORM_ref4 (see maxDeltaSize).
+  uint8_t* finish(uint8_t* cu, uint8_t* end);
+
+  // Returns the value of attribute |name| whose SLEB128 is |coded|, where
+  // |last| is the last value of the attribute.
+  uint32_t decode(uint16_t name, int64_t coded, uint32_t last,
+                  uint32_t die, uint32_t parent);
+
+private:
+  static const uint32_t TABLE_SIZE = 0x4000;
+
+  struct Slot {
+    Slot() : epoch(0), index(0) {}
+
+    uint32_t epoch;
+    // The entry of |names_|.
+    uint32_t index;
+  };
+
+  // The predictor of an attribute name in the CU and its cache of recent
+  // values. The encoder also sums the coded sizes by each predictor.
+  struct Name {
+    uint32_t recent[NUM_RECENT_REFS];
+    int num_recent;
+    int predictor;
+    uint32_t sizes[NUM_REF_PREDICTORS];
+  };
+
+  // A value written by the encoder, and its REF_RECENT index or -1.
+  struct Field {
+    uint32_t pos;
+    uint16_t name;
+    uint8_t len;
+    int8_t recent;
+    bool first;
+    int32_t last_diff;
+    uint32_t value;
+    uint32_t die;
+    uint32_t parent;
+  };
+
+  // Returns the entry of |name|, and sets |first| if it's new in the CU.
+  Name* findName(uint16_t name, bool* first);
+
+  // Returns the index of |value| in the cache of |n|, or -1, and moves it
+  // to the front.
+  static int touchRecent(Name* n, uint32_t value);
+
+  uint32_t epoch_;
+  std::vector<Slot> slots_;
+  std::vector<Name> names_;
+  std::vector<Field> fields_;
+  std::vector<uint8_t> buf_;
+};
+
+#endif  // REFCODER_H_
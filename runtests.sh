@@ -4,12 +4,14 @@ set -e
 
 echo "Check dwarfstat for normal binary"
 ./dwarfstat dwarfzip > /dev/null
+./dwarfstat -J dwarfzip | python3 -m json.tool > /dev/null
 
 echo "Check dwarfzip for normal binary"
 ./dwarfzip dwarfzip /tmp/dwarfzip.dz
 
 echo "Check dwarfstat for compressed binary"
 ./dwarfstat /tmp/dwarfzip.dz > /dev/null
+./dwarfstat -J /tmp/dwarfzip.dz | python3 -m json.tool > /dev/null
 
 echo "Check dwarfzip for compressed binary"
 ./dwarfzip -d /tmp/dwarfzip.dz /tmp/dwarfzip.orig
@@ -17,7 +19,401 @@ echo "Check dwarfzip for compressed binary"
 echo "Check the integrity"
 cmp dwarfzip /tmp/dwarfzip.orig
 
-rm -f /tmp/dwarfzip.dz /tmp/dwarfzip.orig
+echo "Check dwarfzip with threads"
+./dwarfzip -j4 dwarfzip /tmp/dwarfzip.dz4
+cmp /tmp/dwarfzip.dz /tmp/dwarfzip.dz4
+./dwarfzip -d -j4 /tmp/dwarfzip.dz4 /tmp/dwarfzip.orig
+cmp dwarfzip /tmp/dwarfzip.orig
+
+echo "Check delta contexts"
+for c in tag abbrev; do
+  ./dwarfzip -c $c dwarfzip /tmp/dwarfzip.dz
+  ./dwarfzip -d /tmp/dwarfzip.dz /tmp/dwarfzip.orig
+  cmp dwarfzip /tmp/dwarfzip.orig
+done
+
+echo "Check entropy coding"
+./dwarfzip -e dwarfzip /tmp/dwarfzip.dz
+./dwarfstat /tmp/dwarfzip.dz > /dev/null
+./dwarfzip -d -j4 /tmp/dwarfzip.dz /tmp/dwarfzip.orig
+cmp dwarfzip /tmp/dwarfzip.orig
+./dwarfzip -e -i dwarfzip /tmp/dwarfzip.dz
+./dwarfcu /tmp/dwarfzip.dz 100000 0 > /tmp/dwarfzip.cu2
+./dwarfcu dwarfzip 100000 0 > /tmp/dwarfzip.cu
+cmp /tmp/dwarfzip.cu /tmp/dwarfzip.cu2
+
+echo "Check static entropy coding"
+for o in -j1 "-l -p" "-t -j4"; do
+  ./dwarfzip -E $o dwarfzip /tmp/dwarfzip.dz > /dev/null
+  ./dwarfstat /tmp/dwarfzip.dz > /dev/null
+  ./dwarfzip -d -j4 /tmp/dwarfzip.dz /tmp/dwarfzip.orig
+  cmp dwarfzip /tmp/dwarfzip.orig
+done
+./dwarfzip -E -i dwarfzip /tmp/dwarfzip.dz
+./dwarfcu /tmp/dwarfzip.dz 100000 0 > /tmp/dwarfzip.cu2
+cmp /tmp/dwarfzip.cu /tmp/dwarfzip.cu2
+
+echo "Check split streams"
+./dwarfzip -s dwarfzip /tmp/dwarfzip.dz
+./dwarfstat /tmp/dwarfzip.dz > /dev/null
+./dwarfzip -d -j4 /tmp/dwarfzip.dz /tmp/dwarfzip.orig
+cmp dwarfzip /tmp/dwarfzip.orig
+./dwarfzip -s -i dwarfzip /tmp/dwarfzip.dz
+./dwarfcu /tmp/dwarfzip.dz 100000 0 > /tmp/dwarfzip.cu2
+cmp /tmp/dwarfzip.cu /tmp/dwarfzip.cu2
+
+echo "Check string pool"
+for o in -j1 -e -s; do
+  ./dwarfzip -p $o dwarfzip /tmp/dwarfzip.dz
+  ./dwarfstat /tmp/dwarfzip.dz > /dev/null
+  ./dwarfzip -d -j4 /tmp/dwarfzip.dz /tmp/dwarfzip.orig
+  cmp dwarfzip /tmp/dwarfzip.orig
+done
+./dwarfzip -d /tmp/dwarfzip.dz - 2> /dev/null | cmp - dwarfzip
+./dwarfzip -p -i dwarfzip /tmp/dwarfzip.dz
+./dwarfcu /tmp/dwarfzip.dz 100000 0 > /tmp/dwarfzip.cu2
+cmp /tmp/dwarfzip.cu /tmp/dwarfzip.cu2
+
+echo "Check line programs"
+for o in -j1 -e -s "-e -p"; do
+  ./dwarfzip -l $o dwarfzip /tmp/dwarfzip.dz
+  ./dwarfstat /tmp/dwarfzip.dz > /dev/null
+  ./dwarfzip -d -j4 /tmp/dwarfzip.dz /tmp/dwarfzip.orig
+  cmp dwarfzip /tmp/dwarfzip.orig
+done
+./dwarfzip -d /tmp/dwarfzip.dz - 2> /dev/null | cmp - dwarfzip
+
+echo "Check Mach-O"
+# The DWARF sections of dwarfzip in a 64-bit Mach-O, where __debug_line
+# and __debug_str follow __debug_info and move when it's zipped.
+python3 - dwarfzip /tmp/macho.o <<'EOF'
+import struct, sys
+elf = open(sys.argv[1], 'rb').read()
+shoff, = struct.unpack_from('<Q', elf, 0x28)
+shnum, shstrndx = struct.unpack_from('<HH', elf, 0x3c)
+shdrs = [struct.unpack_from('<IIQQQQIIQQ', elf, shoff + i * 64)
+         for i in range(shnum)]
+def name(sh):
+    n = elf[shdrs[shstrndx][4] + sh[0]:]
+    return n[:n.index(b'\0')].decode()
+sections = dict((name(sh), elf[sh[4]:sh[4] + sh[5]]) for sh in shdrs)
+names = ['abbrev', 'info', 'line', 'str']
+offset = 32 + 72 + 80 * len(names)
+cmds = struct.pack('<II16sQQQQiiII', 0x19, 72 + 80 * len(names),
+                   b'__DWARF', 0, 0, offset, 0, 7, 7, len(names), 0)
+data = b''
+for n in names:
+    s = sections['.debug_' + n]
+    cmds += struct.pack('<16s16sQQIIIIIIII', ('__debug_' + n).encode(),
+                        b'__DWARF', 0, len(s), offset + len(data),
+                        0, 0, 0, 0, 0, 0, 0)
+    data += s
+header = struct.pack('<IiiIIIII', 0xfeedfacf, 0x1000007, 3, 10, 1,
+                     len(cmds), 0, 0)
+open(sys.argv[2], 'wb').write(header + cmds + data)
+EOF
+for o in -j1 "-e -p -l" "-s -l -t"; do
+  ./dwarfzip $o /tmp/macho.o /tmp/dwarfzip.dz > /dev/null 2>&1
+  ./dwarfstat /tmp/dwarfzip.dz > /dev/null 2>&1
+  ./dwarfzip -d /tmp/dwarfzip.dz /tmp/dwarfzip.orig > /dev/null 2>&1
+  cmp /tmp/macho.o /tmp/dwarfzip.orig
+done
+rm -f /tmp/macho.o
+
+echo "Check LEB128 decoders"
+./leb128bench dwarfzip > /dev/null
+
+echo "Check streaming over pipes"
+cat dwarfzip | ./dwarfzip -j4 - - > /tmp/dwarfzip.dz 2> /dev/null
+./dwarfzip -d - - < /tmp/dwarfzip.dz 2> /dev/null | cmp - dwarfzip
+./dwarfzip -d /tmp/dwarfzip.dz /tmp/dwarfzip.orig
+cmp dwarfzip /tmp/dwarfzip.orig
+./dwarfstat /tmp/dwarfzip.dz > /dev/null
+./dwarfcu /tmp/dwarfzip.dz 100000 0 > /tmp/dwarfzip.cu2
+cmp /tmp/dwarfzip.cu /tmp/dwarfzip.cu2
+./dwarfzip -e -i dwarfzip - > /tmp/dwarfzip.dz 2> /dev/null
+cat /tmp/dwarfzip.dz | ./dwarfzip -d -j4 - - 2> /dev/null | cmp - dwarfzip
+./dwarfzip -s dwarfzip /tmp/dwarfzip.dz
+./dwarfzip -d -j4 /tmp/dwarfzip.dz - 2> /dev/null | cmp - dwarfzip
+(./dwarfzip -d /tmp/dwarfzip.dz - | cat > /dev/null) 2>&1 |
+  grep -q " 0 bytes copied in the kernel"
+cat /tmp/dwarfzip.dz | ./dwarfzip -d - /tmp/dwarfzip.orig
+cmp dwarfzip /tmp/dwarfzip.orig
+
+echo "Check 32-bit and 64-bit DWARF 4"
+for f in 32 64; do
+  ${CXX:-c++} -gdwarf-4 -gdwarf$f -O -c -o /tmp/dwarf$f.o parallel.cc
+  for o in -j1 -e -s "-e -l"; do
+    ./dwarfzip $o /tmp/dwarf$f.o /tmp/dwarfzip.dz
+    ./dwarfzip -d /tmp/dwarfzip.dz /tmp/dwarfzip.orig
+    cmp /tmp/dwarf$f.o /tmp/dwarfzip.orig
+  done
+  ./dwarfstat /tmp/dwarfzip.dz > /dev/null
+done
+
+echo "Check DWARF 5 and split DWARF"
+${CXX:-c++} -gdwarf-5 -O -c -o /tmp/dwarf5.o parallel.cc
+${CXX:-c++} -gdwarf-5 -gsplit-dwarf -O -c -o /tmp/split5.o parallel.cc
+for f in /tmp/dwarf5.o /tmp/split5.o /tmp/split5.dwo; do
+  for o in -j1 -e -s -p "-e -l"; do
+    ./dwarfzip $o $f /tmp/dwarfzip.dz
+    ./dwarfzip -d /tmp/dwarfzip.dz /tmp/dwarfzip.orig
+    cmp $f /tmp/dwarfzip.orig
+  done
+  ./dwarfstat /tmp/dwarfzip.dz > /dev/null
+done
+# Type units in COMDAT groups have a .debug_info section each, which are
+# refused rather than zipped into something which can't be unzipped.
+printf 'struct A { int a; };\nstruct B { A* a; };\nB b;\n' > /tmp/types5.cc
+${CXX:-c++} -gdwarf-5 -fdebug-types-section -c -o /tmp/types5.o /tmp/types5.cc
+readelf -S /tmp/types5.o | grep -c ' \.debug_info ' | grep -qvx 1
+if ./dwarfzip /tmp/types5.o /tmp/dwarfzip.dz 2> /tmp/dwarfzip.err; then
+  exit 1
+fi
+grep -q "more than one .debug_info section" /tmp/dwarfzip.err
+rm -f /tmp/types5.cc /tmp/types5.o /tmp/dwarfzip.err
+
+echo "Check duplicate subtrees"
+for o in -j1 -e -s "-e -p -l"; do
+  ./dwarfzip -t $o dwarfzip /tmp/dwarfzip.dz
+  ./dwarfstat /tmp/dwarfzip.dz > /dev/null
+  ./dwarfzip -d -j4 /tmp/dwarfzip.dz /tmp/dwarfzip.orig
+  cmp dwarfzip /tmp/dwarfzip.orig
+done
+./dwarfzip -d /tmp/dwarfzip.dz - 2> /dev/null | cmp - dwarfzip
+./dwarfzip -t -e -j4 dwarfzip /tmp/dwarfzip.dz4
+./dwarfzip -t -e dwarfzip /tmp/dwarfzip.dz
+cmp /tmp/dwarfzip.dz /tmp/dwarfzip.dz4
+./dwarfzip -t -e -i dwarfzip /tmp/dwarfzip.dz
+./dwarfcu /tmp/dwarfzip.dz 100000 0 > /tmp/dwarfzip.cu2
+cmp /tmp/dwarfzip.cu /tmp/dwarfzip.cu2
+for f in /tmp/dwarf64.o /tmp/dwarf5.o /tmp/split5.dwo; do
+  ./dwarfzip -t -e $f /tmp/dwarfzip.dz
+  ./dwarfzip -d /tmp/dwarfzip.dz /tmp/dwarfzip.orig
+  cmp $f /tmp/dwarfzip.orig
+done
+
+echo "Check random access to CUs"
+./dwarfzip -i dwarfzip /tmp/dwarfzip.dz
+./dwarfcu dwarfzip > /tmp/dwarfzip.cu
+./dwarfcu /tmp/dwarfzip.dz > /tmp/dwarfzip.cu2
+cmp /tmp/dwarfzip.cu /tmp/dwarfzip.cu2
+./dwarfcu dwarfzip 100000 0 > /tmp/dwarfzip.cu
+./dwarfcu /tmp/dwarfzip.dz 100000 0 > /tmp/dwarfzip.cu2
+cmp /tmp/dwarfzip.cu /tmp/dwarfzip.cu2
+./dwarfzip -d -j4 /tmp/dwarfzip.dz /tmp/dwarfzip.orig
+cmp dwarfzip /tmp/dwarfzip.orig
+
+echo "Check batch mode"
+rm -rf /tmp/dwarfzip.in /tmp/dwarfzip.out /tmp/dwarfzip.back
+mkdir -p /tmp/dwarfzip.in/sub
+cp dwarfzip /tmp/dwarf5.o /tmp/dwarfzip.in
+cp dwarfstat Makefile /tmp/split5.dwo /tmp/dwarfzip.in/sub
+./dwarfzip -e -l -j4 --batch /tmp/dwarfzip.in /tmp/dwarfzip.out > /dev/null
+./dwarfzip -e -l dwarfzip /tmp/dwarfzip.dz > /dev/null 2>&1
+cmp /tmp/dwarfzip.dz /tmp/dwarfzip.out/dwarfzip
+test ! -e /tmp/dwarfzip.out/sub/Makefile
+./dwarfzip -d -j4 --batch /tmp/dwarfzip.out /tmp/dwarfzip.back > /dev/null
+for f in dwarfzip dwarf5.o sub/dwarfstat sub/split5.dwo; do
+  cmp /tmp/dwarfzip.in/$f /tmp/dwarfzip.back/$f
+done
+echo "/tmp/dwarfzip.out/sub/dwarfstat /tmp/dwarfzip.orig" |
+  ./dwarfzip -d --batch - > /dev/null
+cmp dwarfstat /tmp/dwarfzip.orig
+rm -rf /tmp/dwarfzip.in /tmp/dwarfzip.out /tmp/dwarfzip.back
+
+echo "Check dictionaries"
+./dwarfzip -e -l --train /tmp/dwarfzip.dict dwarfstat dwarfcu /tmp/dwarf5.o \
+  > /dev/null
+./dwarfzip -e -l -D /tmp/dwarfzip.dict dwarfzip /tmp/dwarfzip.dz
+./dwarfstat -D /tmp/dwarfzip.dict /tmp/dwarfzip.dz > /dev/null
+./dwarfcu dwarfzip 100000 0 > /tmp/dwarfzip.cu
+./dwarfcu -D /tmp/dwarfzip.dict /tmp/dwarfzip.dz 100000 0 > /tmp/dwarfzip.cu2
+cmp /tmp/dwarfzip.cu /tmp/dwarfzip.cu2
+./dwarfzip -d -j4 -D /tmp/dwarfzip.dict /tmp/dwarfzip.dz /tmp/dwarfzip.orig
+cmp dwarfzip /tmp/dwarfzip.orig
+if ./dwarfzip -d /tmp/dwarfzip.dz /tmp/dwarfzip.orig 2> /dev/null; then
+  echo "decoded without the dictionary"
+  exit 1
+fi
+./dwarfzip -e -D /tmp/dwarfzip.dict dwarfzip - 2> /dev/null |
+  ./dwarfzip -d -D /tmp/dwarfzip.dict - - 2> /dev/null | cmp - dwarfzip
+./dwarfzip -E -l -D /tmp/dwarfzip.dict dwarfzip /tmp/dwarfzip.dz > /dev/null
+./dwarfzip -d -D /tmp/dwarfzip.dict /tmp/dwarfzip.dz /tmp/dwarfzip.orig
+cmp dwarfzip /tmp/dwarfzip.orig
+for o in "-e -R" "-e -p" "-c tag -E"; do
+  if ./dwarfzip $o -D /tmp/dwarfzip.dict dwarfzip /tmp/dwarfzip.dz \
+      2> /dev/null; then
+    echo "coded with a dictionary trained without $o"
+    exit 1
+  fi
+done
+rm -f /tmp/dwarfzip.dict
+
+echo "Check the address index"
+./dwarfzip -e -a dwarfzip /tmp/dwarfzip.dz > /dev/null
+./dwarfzip -d /tmp/dwarfzip.dz /tmp/dwarfzip.orig > /dev/null
+cmp dwarfzip /tmp/dwarfzip.orig
+readelf --debug-dump=info --dwarf-depth=1 dwarfzip |
+  awk '/Compilation Unit @ offset/ { off = $NF; sub(":", "", off); seen = 0 }
+       /DW_AT_name/ && !seen { seen = 1; print $NF, off }' > /tmp/dwarfzip.cus
+for f in main:dwarfzip.cc _Z10readBinaryPKc:binary.cc; do
+  pc=0x$(nm dwarfzip | awk -v s=${f%%:*} '$3 == s { print $1 }')
+  off=$(awk -v n=${f#*:} '$1 == n { print $2 }' /tmp/dwarfzip.cus)
+  ./dwarfcu -a /tmp/dwarfzip.dz $pc > /tmp/dwarfzip.cu 2> /dev/null
+  ./dwarfcu dwarfzip $off > /tmp/dwarfzip.cu2 2> /dev/null
+  cmp /tmp/dwarfzip.cu /tmp/dwarfzip.cu2
+done
+if ./dwarfcu -a /tmp/dwarfzip.dz 0 > /dev/null 2>&1; then
+  echo "found a CU of address 0"
+  exit 1
+fi
+rm -f /tmp/dwarfzip.cus
+
+echo "Check the chunk cache"
+rm -rf /tmp/dwarfzip.cache
+for o in "-e -a -l" "-i -s"; do
+  ./dwarfzip $o --cache /tmp/dwarfzip.cache dwarfzip /tmp/dwarfzip.dz \
+    > /dev/null 2>&1
+  ./dwarfzip $o -j4 --cache /tmp/dwarfzip.cache dwarfzip /tmp/dwarfzip.dz4 \
+    2>&1 > /dev/null | grep -q " 0 misses"
+  cmp /tmp/dwarfzip.dz /tmp/dwarfzip.dz4
+  ./dwarfzip -d /tmp/dwarfzip.dz4 /tmp/dwarfzip.orig > /dev/null
+  cmp dwarfzip /tmp/dwarfzip.orig
+done
+rm -rf /tmp/dwarfzip.cache
+# Relinking after a change moves the CUs linked after it, which still hit.
+for i in 1 2 3 4; do
+  cat > /tmp/relink$i.cc << EOF
+#include <string>
+static int calls$i;
+std::string f$i(const std::string& s, int n) {
+  calls$i++;
+  return s + std::to_string(n + $i);
+}
+EOF
+done
+echo "int main() { return 0; }" >> /tmp/relink1.cc
+relink() {
+  ${CXX:-c++} -g -O -o /tmp/relink /tmp/relink1.cc /tmp/relink2.cc \
+    /tmp/relink3.cc /tmp/relink4.cc
+}
+relink
+./dwarfzip -e -i --cache /tmp/dwarfzip.cache /tmp/relink /tmp/dwarfzip.dz \
+  2>&1 > /dev/null | grep -q " 0 hits, 4 misses"
+echo "int g2(int n) { return n * 2; }" >> /tmp/relink2.cc
+relink
+./dwarfzip -e -i --cache /tmp/dwarfzip.cache /tmp/relink /tmp/dwarfzip.dz \
+  2>&1 > /dev/null | grep -q " 3 hits, 1 misses"
+./dwarfzip -d /tmp/dwarfzip.dz /tmp/dwarfzip.orig > /dev/null
+cmp /tmp/relink /tmp/dwarfzip.orig
+./dwarfstat /tmp/dwarfzip.dz > /dev/null
+rm -rf /tmp/dwarfzip.cache /tmp/relink /tmp/relink?.cc
+
+echo "Check the DIE cursor"
+readelf --debug-dump=info --dwarf-depth=2 dwarfzip |
+  awk '/^ <1>/ && !/Abbrev Number: 0/ { o = $1; sub(".*<1><", "", o);
+                                       sub(">:", "", o); print "0x" o }' \
+  > /tmp/dwarfzip.dies
+./dwarfnames dwarfzip > /tmp/dwarfzip.names
+awk '{ print $1 }' /tmp/dwarfzip.names | cmp - /tmp/dwarfzip.dies
+./dwarfnames -r dwarfzip | awk '$1 == 1 { $1 = ""; print substr($0, 2) }' |
+  cmp - /tmp/dwarfzip.names
+for o in "-e -p -t" "-s -i"; do
+  ./dwarfzip $o dwarfzip /tmp/dwarfzip.dz > /dev/null
+  ./dwarfnames /tmp/dwarfzip.dz | cmp - /tmp/dwarfzip.names
+done
+rm -f /tmp/dwarfzip.dies /tmp/dwarfzip.names
+
+echo "Check reference predictors"
+for o in -j1 "-e -t -p -j4" -s "-c abbrev -e -l"; do
+  ./dwarfzip -R $o dwarfzip /tmp/dwarfzip.dz > /dev/null
+  ./dwarfstat /tmp/dwarfzip.dz > /dev/null
+  ./dwarfzip -d -j4 /tmp/dwarfzip.dz /tmp/dwarfzip.orig > /dev/null
+  cmp dwarfzip /tmp/dwarfzip.orig
+done
+./dwarfzip -R -e -i dwarfzip /tmp/dwarfzip.dz > /dev/null
+./dwarfcu dwarfzip 100000 0 > /tmp/dwarfzip.cu
+./dwarfcu /tmp/dwarfzip.dz 100000 0 > /tmp/dwarfzip.cu2
+cmp /tmp/dwarfzip.cu /tmp/dwarfzip.cu2
+cat dwarfzip | ./dwarfzip -R -e - - 2> /dev/null |
+  ./dwarfzip -d - - 2> /dev/null | cmp - dwarfzip
+./dwarfzip -e dwarfzip /tmp/dwarfzip.dz > /dev/null
+./dwarfzip -e -R dwarfzip /tmp/dwarfzip.dz4 > /dev/null
+test $(stat -c %s /tmp/dwarfzip.dz4) -lt $(stat -c %s /tmp/dwarfzip.dz)
+
+echo "Check abbrev ranks"
+# The compiler numbers common abbrevs first, so -b must not cost bytes.
+./dwarfzip -e dwarfzip /tmp/dwarfzip.dz > /dev/null
+./dwarfzip -e -b dwarfzip /tmp/dwarfzip.dz4 > /dev/null
+test $(stat -c %s /tmp/dwarfzip.dz4) -le $(stat -c %s /tmp/dwarfzip.dz)
+# CUs of similar code have abbrev tables with the same bytes, which -b
+# keeps once.
+for i in 1 2 3; do
+  cat > /tmp/abbrevs$i.cc << EOF
+#include <string>
+std::string f$i(const std::string& s, int n) {
+  return s + std::to_string(n + $i);
+}
+EOF
+done
+echo "int main() { return 0; }" >> /tmp/abbrevs1.cc
+${CXX:-c++} -g -O -o /tmp/abbrevs /tmp/abbrevs1.cc /tmp/abbrevs2.cc \
+  /tmp/abbrevs3.cc
+./dwarfzip -e /tmp/abbrevs /tmp/dwarfzip.dz > /dev/null 2>&1
+./dwarfzip -e -b /tmp/abbrevs /tmp/dwarfzip.dz4 > /dev/null 2>&1
+test $(stat -c %s /tmp/dwarfzip.dz4) -lt $(stat -c %s /tmp/dwarfzip.dz)
+./dwarfcu /tmp/abbrevs 20000 0 > /tmp/dwarfzip.cu
+./dwarfcu /tmp/dwarfzip.dz4 20000 0 > /tmp/dwarfzip.cu2
+cmp /tmp/dwarfzip.cu /tmp/dwarfzip.cu2
+./dwarfzip -d /tmp/dwarfzip.dz4 /tmp/dwarfzip.orig > /dev/null
+cmp /tmp/abbrevs /tmp/dwarfzip.orig
+rm -f /tmp/abbrevs /tmp/abbrevs?.cc
+./dwarfbench --gen /tmp/synth.o -S 2M -c 16 -a 200 > /dev/null
+for o in -j1 "-e -t -p -j4" -s "-R -e -l" "-e -i"; do
+  ./dwarfzip -b $o /tmp/synth.o /tmp/dwarfzip.dz > /dev/null 2>&1
+  ./dwarfstat /tmp/dwarfzip.dz > /dev/null
+  ./dwarfzip -d /tmp/dwarfzip.dz /tmp/dwarfzip.orig > /dev/null 2>&1
+  cmp /tmp/synth.o /tmp/dwarfzip.orig
+done
+./dwarfcu /tmp/synth.o 100000 0 > /tmp/dwarfzip.cu
+./dwarfcu /tmp/dwarfzip.dz 100000 0 > /tmp/dwarfzip.cu2
+cmp /tmp/dwarfzip.cu /tmp/dwarfzip.cu2
+./dwarfnames -r /tmp/synth.o > /tmp/dwarfzip.names
+./dwarfnames -r /tmp/dwarfzip.dz | cmp - /tmp/dwarfzip.names
+./dwarfzip -d /tmp/dwarfzip.dz - 2> /dev/null | cmp - /tmp/synth.o
+./dwarfzip /tmp/synth.o /tmp/dwarfzip.dz > /dev/null 2>&1
+./dwarfzip -b /tmp/synth.o /tmp/dwarfzip.dz4 > /dev/null 2>&1
+test $(stat -c %s /tmp/dwarfzip.dz4) -lt $(stat -c %s /tmp/dwarfzip.dz)
+./dwarfbench -b -n 1 /tmp/synth.o | grep -q '"flags": "-b"'
+rm -f /tmp/synth.o /tmp/dwarfzip.names
+
+echo "Check the benchmark"
+./dwarfbench --gen /tmp/synth.o -S 2M -c 16 > /dev/null
+./dwarfbench --gen /tmp/synth2.o -S 2M -c 16 > /dev/null
+cmp /tmp/synth.o /tmp/synth2.o
+for o in "-e -p -l -t" "-s -j4"; do
+  ./dwarfzip $o /tmp/synth.o /tmp/dwarfzip.dz > /dev/null 2>&1
+  ./dwarfzip -d /tmp/dwarfzip.dz /tmp/dwarfzip.orig > /dev/null 2>&1
+  cmp /tmp/synth.o /tmp/dwarfzip.orig
+done
+./dwarfbench -e -t -j4 -n 1 /tmp/synth.o dwarfzip | grep -c '"ratio"' |
+  grep -qx 2
+./dwarfbench -E -n 1 /tmp/synth.o | grep -q '"delta_unzip_mb_s"'
+# Past -L, as past 4 GiB of .debug_line, CUs and line programs are 64-bit.
+./dwarfbench --gen /tmp/synth.o -S 2M -c 16 -L 100K > /dev/null
+readelf --debug-dump=info /tmp/synth.o | grep -q 'Length:.*(32-bit)'
+readelf --debug-dump=info /tmp/synth.o | grep -q 'Length:.*(64-bit)'
+for o in "-e -p -l -t" "-s -j4" "-E -i -b"; do
+  ./dwarfzip $o /tmp/synth.o /tmp/dwarfzip.dz > /dev/null 2>&1
+  ./dwarfzip -d /tmp/dwarfzip.dz /tmp/dwarfzip.orig > /dev/null 2>&1
+  cmp /tmp/synth.o /tmp/dwarfzip.orig
+done
+rm -f /tmp/synth.o /tmp/synth2.o
+
+rm -f /tmp/dwarfzip.dz /tmp/dwarfzip.dz4 /tmp/dwarfzip.orig
+rm -f /tmp/dwarfzip.cu /tmp/dwarfzip.cu2 /tmp/dwarf32.o /tmp/dwarf64.o
+rm -f /tmp/dwarf5.o /tmp/split5.o /tmp/split5.dwo
 
 echo
 echo "PASS"
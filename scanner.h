@@ -1,30 +1,792 @@
 #ifndef SCANNER_H_
 #define SCANNER_H_
 
+#include <assert.h>
+#include <dwarf.h>
 #include <inttypes.h>
+#include <string.h>
 
-class Binary;
+#include <vector>
 
+#include "abbrev.h"
+#include "abbrevorder.h"
+#include "binary.h"
+#include "leb128.h"
+#include "subtree.h"
+
+// The header of a CU in the 32-bit or the 64-bit DWARF format. A 64-bit
+// header starts with 0xffffffff and has 8-byte length and offsets. Since
+// DWARF 5, the header also has the unit type, and the address size comes
+// before the abbrev offset.
 struct CU {
-  uint32_t length;
+  // The size of the CU after the length field.
+  uint64_t length;
   uint16_t version;
-  uint32_t abbrev_offset;
+  // DW_UT_compile for CUs before DWARF 5.
+  uint8_t unit_type;
+  uint64_t abbrev_offset;
   uint8_t ptrsize;
-} __attribute__((packed));
+  // The size of offsets to other sections: 4 or 8.
+  uint8_t offset_size;
+  // The size of the header in .debug_info.
+  uint8_t header_size;
+};
+
+// The size of the smallest CU header.
+static const size_t CU_HEADER_SIZE = 11;
+
+// Whether the CU header at |p| is of the 64-bit format.
+inline bool isDwarf64(const uint8_t* p) {
+  return *(const uint32_t*)p == 0xffffffff;
+}
+
+// Returns the size of the CU at |p| including its header.
+inline uint64_t cuSize(const uint8_t* p) {
+  if (isDwarf64(p))
+    return *(const uint64_t*)(p + 4) + 12;
+  return *(const uint32_t*)p + 4;
+}
+
+// Returns the size of the CU header at |p|, which is known from its bytes
+// up to the unit type.
+inline size_t cuHeaderSize(const uint8_t* p) {
+  size_t offset_size = isDwarf64(p) ? 8 : 4;
+  const uint8_t* q = p + (offset_size == 8 ? 12 : 4);
+  size_t size = q - p + 2 + offset_size + 1;
+  if (*(const uint16_t*)q < 5)
+    return size;
+  size++;
+  switch (q[2]) {
+  case DW_UT_skeleton:
+  case DW_UT_split_compile:
+    // The DWO ID.
+    return size + 8;
+  case DW_UT_type:
+  case DW_UT_split_type:
+    // The type signature and the offset of the type.
+    return size + 8 + offset_size;
+  default:
+    return size;
+  }
+}
+
+// Decodes the CU header at |p|.
+inline void readCU(const uint8_t* p, CU* cu) {
+  cu->offset_size = isDwarf64(p) ? 8 : 4;
+  cu->header_size = cuHeaderSize(p);
+  cu->length = cuSize(p) - (cu->offset_size == 8 ? 12 : 4);
+  const uint8_t* q = p + (cu->offset_size == 8 ? 12 : 4);
+  cu->version = *(const uint16_t*)q;
+  q += 2;
+  if (cu->version >= 5) {
+    cu->unit_type = q[0];
+    cu->ptrsize = q[1];
+    q += 2;
+  } else {
+    cu->unit_type = DW_UT_compile;
+    cu->ptrsize = q[cu->offset_size];
+  }
+  cu->abbrev_offset = (cu->offset_size == 8 ? *(const uint64_t*)q :
+                       *(const uint32_t*)q);
+}
+
+// Writes |abbrev_offset| into the header of |cu| at |p|.
+inline void writeAbbrevOffset(uint8_t* p, const CU& cu,
+                              uint64_t abbrev_offset) {
+  size_t pos = (cu.offset_size == 8 ? 12 : 4) + (cu.version >= 5 ? 4 : 2);
+  memcpy(p + pos, &abbrev_offset, cu.offset_size);
+}
+
+void bug(const char* fmt, ...)
+  __attribute__((noreturn, format(printf, 1, 2)));
+
+// The scanner reads fields through an input and tells it the context of
+// each field. Inputs coding the bytes with models (see entropy.h)
+// choose the model by the context, and inputs splitting the fields into
+// streams (see streams.h) choose the stream by it. The context of an
+// abbrev number is the previous abbrev number, that of an attribute value
+// is the tag, the name and the form, and that of the payload of a block
+// or a string is the form. A run of fixed-size attributes is a field with
+// the name of its first attribute and form 0.
+enum Stream {
+  STREAM_CU,
+  STREAM_ABBREV,
+  // DW_FORM_addr and DW_FORM_ref_addr.
+  STREAM_ADDR,
+  // References to DIEs in the same CU.
+  STREAM_REF,
+  // Offsets to other sections, such as DW_FORM_strp, and references to
+  // pooled strings.
+  STREAM_OFFSET,
+  // Other values, including the sizes of blocks and runs.
+  STREAM_DATA,
+  STREAM_BLOCK,
+  STREAM_STRING,
+  NUM_STREAMS
+};
+
+inline Stream attrStream(uint16_t form) {
+  switch (form) {
+  case DW_FORM_addr:
+  case DW_FORM_ref_addr:
+  case DW_FORM_addrx:
+  case DW_FORM_addrx1:
+  case DW_FORM_addrx2:
+  case DW_FORM_addrx3:
+  case DW_FORM_addrx4:
+  case DW_FORM_GNU_addr_index:
+    return STREAM_ADDR;
+  case DW_FORM_ref1:
+  case DW_FORM_ref2:
+  case DW_FORM_ref4:
+  case DW_FORM_ref8:
+  case DW_FORM_ref_udata:
+    return STREAM_REF;
+  case DW_FORM_string:
+  case DW_FORM_strp:
+  case DW_FORM_line_strp:
+  case DW_FORM_strp_sup:
+  case DW_FORM_sec_offset:
+  case DW_FORM_strx:
+  case DW_FORM_strx1:
+  case DW_FORM_strx2:
+  case DW_FORM_strx3:
+  case DW_FORM_strx4:
+  case DW_FORM_loclistx:
+  case DW_FORM_rnglistx:
+  case DW_FORM_GNU_str_index:
+  case DW_FORM_GNU_strp_alt:
+  case DW_FORM_GNU_ref_alt:
+    return STREAM_OFFSET;
+  default:
+    return STREAM_DATA;
+  }
+}
+
+// Returns the size of a value of |form| which zipped CUs delta code as
+// SLEB128, or 0 for other forms. These are addresses, offsets to other
+// sections, 4-byte data and references. DW_FORM_ref_addr is an address in
+// DWARF 2 and an offset since DWARF 3. 2-byte addresses are copied as is.
+template <int kPtrSize, int kOffsetSize>
+inline int deltaSize(uint16_t form, uint16_t version) {
+  switch (form) {
+  case DW_FORM_ref_addr:
+    if (version >= 3)
+      return kOffsetSize;
+    // Fall through.
+  case DW_FORM_addr:
+    return kPtrSize == 2 ? 0 : kPtrSize;
+  case DW_FORM_strp:
+  case DW_FORM_line_strp:
+  case DW_FORM_strp_sup:
+  case DW_FORM_sec_offset:
+  case DW_FORM_GNU_strp_alt:
+  case DW_FORM_GNU_ref_alt:
+    return kOffsetSize;
+  case DW_FORM_data4:
+  case DW_FORM_ref4:
+    return 4;
+  case DW_FORM_ref8:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+// Indexes of DWARF 5 to the tables of a CU, such as .debug_str_offsets.
+// Compilers add entries in the order of their first uses, so an index is
+// often the last one of its kind plus one, and zipped CUs delta code it as
+// SLEB128 from the last index of the same kind.
+enum IndexKind {
+  INDEX_STR,
+  INDEX_ADDR,
+  INDEX_LOCLIST,
+  INDEX_RNGLIST,
+  NUM_INDEX_KINDS
+};
+
+// Returns the kind of an index form, or -1 for other forms.
+inline int indexKind(uint16_t form) {
+  switch (form) {
+  case DW_FORM_strx:
+  case DW_FORM_strx1:
+  case DW_FORM_strx2:
+  case DW_FORM_strx3:
+  case DW_FORM_strx4:
+  case DW_FORM_GNU_str_index:
+    return INDEX_STR;
+  case DW_FORM_addrx:
+  case DW_FORM_addrx1:
+  case DW_FORM_addrx2:
+  case DW_FORM_addrx3:
+  case DW_FORM_addrx4:
+  case DW_FORM_GNU_addr_index:
+    return INDEX_ADDR;
+  case DW_FORM_loclistx:
+    return INDEX_LOCLIST;
+  case DW_FORM_rnglistx:
+    return INDEX_RNGLIST;
+  default:
+    return -1;
+  }
+}
+
+// Returns the size of an index form, or 0 for ULEB128 ones.
+inline int indexSize(uint16_t form) {
+  switch (form) {
+  case DW_FORM_strx1:
+  case DW_FORM_addrx1:
+    return 1;
+  case DW_FORM_strx2:
+  case DW_FORM_addrx2:
+    return 2;
+  case DW_FORM_strx3:
+  case DW_FORM_addrx3:
+    return 3;
+  case DW_FORM_strx4:
+  case DW_FORM_addrx4:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+// Reads a little-endian value of |size| bytes.
+inline uint64_t readFixed(const uint8_t* p, int size) {
+  uint64_t v = 0;
+  memcpy(&v, p, size);
+  return v;
+}
+
+// Contexts are hashed by the models, so they only need to differ.
+inline uint32_t makeContext(Stream stream, uint32_t a, uint32_t b) {
+  return (a * 0x9e3779b1 ^ b) << 3 | stream;
+}
+
+// Holes of copies have their own contexts, as their values are coded
+// unlike those of the attributes.
+inline uint32_t holeContext(const Hole& hole) {
+  return makeContext(attrStream(hole.form), hole.tag | 0x10000,
+                     hole.name << 16 | hole.form);
+}
+
+inline Stream contextStream(uint32_t ctx) {
+  return static_cast<Stream>(ctx & 7);
+}
 
+// Reads fields from memory. This is what the scanner uses unless another
+// input is passed to scan(), and other inputs have the same methods.
+class MemoryInput {
+public:
+  MemoryInput(const uint8_t* base, uint64_t offset)
+    : base_(base), p_(base + offset) {
+  }
+
+  // Offsets passed to the callbacks are relative to base().
+  const uint8_t* base() const {
+    return base_;
+  }
+
+  uint64_t offset() const {
+    return p_ - base_;
+  }
+
+  const uint8_t* read(size_t size, uint32_t) {
+    const uint8_t* r = p_;
+    p_ += size;
+    return r;
+  }
+
+  uint64_t uleb(uint32_t) {
+    return uleb128(p_);
+  }
+
+  int64_t sleb(uint32_t) {
+    return sleb128(p_);
+  }
+
+  const uint8_t* string(uint32_t) {
+    const uint8_t* r = p_;
+    p_ += strlen((const char*)p_) + 1;
+    return r;
+  }
+
+private:
+  const uint8_t* base_;
+  const uint8_t* p_;
+};
+
+// Walks .debug_info and calls the callbacks of Derived, which are bound
+// at compile time:
+//
+//   void onCU(const CU* cu, uint64_t offset);
+//   void onAbbrev(uint64_t number, const Abbrev* abbrev, uint64_t offset);
+//   template <bool kZipped, int kPtrSize, int kOffsetSize>
+//   void onAttr(uint16_t name, uint16_t form,
+//               uint64_t value, uint64_t offset);
+//   void onRun(uint64_t offset);
+//
+// and, for binaries with ZIP_SUBTREES, these ones, which do nothing
+// unless Derived has them:
+//
+//   uint64_t findCopy(uint64_t offset, const AbbrevTable* abbrevs);
+//   void onCopy(size_t index, const AbbrevTable* abbrevs,
+//               const int64_t* holes, uint64_t offset);
+//
+// The DIE loop is instantiated for each input encoding, pointer size and
+// offset size, which are also passed to onAttr, so none of them is
+// checked per attribute.
+// If Derived::kMergeRuns is true, the scanner follows the plan of each
+// abbrev and calls onRun once for a run of fixed-size attributes instead
+// of calling onAttr for each of them.
+template <class Derived>
 class Scanner {
 public:
-  explicit Scanner(Binary* binary);
+  explicit Scanner(Binary* binary)
+    : binary_(binary),
+      input_(NULL),
+      cu_version_(0),
+      last_template_(-1),
+      abbrev_numbers_(NULL),
+      abbrev_offsets_(NULL),
+      next_abbrev_offset_(0) {
+  }
 
-  void run();
+  // Makes scans of delta coded CUs take the abbrev offsets of the CUs
+  // from |offsets| in order, as chunks with ZIP_REBASED keep them out of
+  // the CU headers (see rebase.h).
+  void set_abbrev_offsets(const std::vector<uint64_t>* offsets) {
+    abbrev_offsets_ = offsets;
+    next_abbrev_offset_ = 0;
+  }
+
+  void run() {
+    run(0, binary_->debug_info_len);
+  }
+
+  // Scans CUs in [begin, end) of .debug_info. The offsets passed to the
+  // callbacks are still relative to the start of .debug_info.
+  void run(uint64_t begin, uint64_t end);
+
+  // Scans CUs read from |in| until its offset reaches |end|. |kZipped|
+  // tells whether the CUs are delta coded. Abbrevs come from the binary.
+  template <bool kZipped, class Input>
+  void scan(Input* in, uint64_t end);
+
+  // Scans the DIE at the offset of |in| and its children, which are in a
+  // CU of |cu| with |abbrevs|, without calling onCU.
+  template <bool kZipped, class Input>
+  void scanSubtree(Input* in, const CU& cu, const AbbrevTable* abbrevs);
 
 protected:
-  virtual void onCU(CU* cu, uint64_t offset) = 0;
-  virtual void onAbbrev(uint64_t number, uint64_t offset) = 0;
-  virtual void onAttr(uint16_t name, uint8_t form,
-                      uint64_t value, uint64_t offset) = 0;
+  // Called before each DIE of raw CUs. Returns the end of the subtree at
+  // |offset| if it's coded as a copy, which the walk skips, or 0.
+  uint64_t findCopy(uint64_t, const AbbrevTable*) {
+    return 0;
+  }
+
+  // Called for a copy of template |index| in delta coded CUs with the
+  // coded values of its holes. |offset| is after the copy.
+  void onCopy(size_t, const AbbrevTable*, const int64_t*, uint64_t) {}
 
   Binary* binary_;
+  // The base of the offsets passed to the callbacks.
+  const uint8_t* input_;
+  // The DWARF version of the current CU.
+  uint16_t cu_version_;
+  // The template of the last copy of the CU, or -1.
+  int64_t last_template_;
+  // The abbrev numbers of the ranks of the CU in delta coded CUs with
+  // ZIP_ABBREVS, or NULL.
+  const uint32_t* abbrev_numbers_;
+  // The abbrev offsets of delta coded CUs with ZIP_REBASED, or NULL, and
+  // the one of the next CU.
+  const std::vector<uint64_t>* abbrev_offsets_;
+  size_t next_abbrev_offset_;
+
+private:
+  template <class Input>
+  void readCopy(Input* in, const AbbrevTable* abbrevs);
+
+  template <bool kZipped, int kOffsetSize, class Input>
+  void scanCU(Input* in, const CU& cu, uint64_t cu_end,
+              const AbbrevTable* abbrevs);
+
+  template <bool kZipped, int kPtrSize, int kOffsetSize, class Input>
+  void scanDIEs(Input* in, uint64_t cu_end, const AbbrevTable* abbrevs);
+
+  template <bool kZipped, int kPtrSize, int kOffsetSize, class Input>
+  uint64_t readAttr(uint16_t form, uint32_t ctx, Input* in);
+
+  Derived* self() {
+    return static_cast<Derived*>(this);
+  }
+
+  std::vector<int64_t> copy_holes_;
+};
+
+template <class Derived>
+void Scanner<Derived>::run(uint64_t begin, uint64_t end) {
+  MemoryInput in((const uint8_t*)binary_->debug_info, begin);
+  if (binary_->is_zipped)
+    scan<true>(&in, end);
+  else
+    scan<false>(&in, end);
+}
+
+template <class Derived>
+template <bool kZipped, class Input>
+void Scanner<Derived>::scan(Input* in, uint64_t end) {
+  input_ = in->base();
+
+  while (in->offset() + CU_HEADER_SIZE < end) {
+    uint64_t cu_offset = in->offset();
+    uint32_t ctx = makeContext(STREAM_CU, 0, 0);
+    // Inputs return contiguous bytes, so the header can be read in parts.
+    const uint8_t* p = in->read(4, ctx);
+    uint32_t length = *(const uint32_t*)p;
+    if (length == 0 || (length >= 0xfffffff0 && length != 0xffffffff)) {
+      bug("unknown cu length: %x\n", length);
+    }
+    size_t length_size = isDwarf64(p) ? 12 : 4;
+    if (length_size == 12)
+      in->read(8, ctx);
+    // The version and the unit type tell the size of the rest.
+    in->read(3, ctx);
+    in->read(cuHeaderSize(p) - length_size - 3, ctx);
+    CU cu;
+    readCU(p, &cu);
+    if (kZipped && abbrev_offsets_) {
+      if (next_abbrev_offset_ >= abbrev_offsets_->size())
+        bug("No abbrev offset for CU at %" PRIu64 "\n", cu_offset);
+      cu.abbrev_offset = (*abbrev_offsets_)[next_abbrev_offset_++];
+    }
+
+    uint64_t cu_end = cu_offset + cuSize(p);
+    cu_version_ = cu.version;
+    last_template_ = -1;
+    abbrev_numbers_ = kZipped && binary_->abbrev_order ?
+      binary_->abbrev_order->numbers(cu.abbrev_offset) : NULL;
+
+    self()->onCU(&cu, in->offset());
+
+    const AbbrevTable* abbrevs =
+      binary_->abbrev_cache->get(cu.abbrev_offset);
+    //printf("COME abbrevs=%d abbrev_offset=%d\n",
+    //       (int)abbrevs->num_abbrevs, (int)cu.abbrev_offset);
+
+    if (cu.offset_size == 8)
+      scanCU<kZipped, 8>(in, cu, cu_end, abbrevs);
+    else
+      scanCU<kZipped, 4>(in, cu, cu_end, abbrevs);
+
+    if (!kZipped)
+      assert(in->offset() == cu_end);
+  }
+
+  assert(in->offset() == end);
+}
+
+template <class Derived>
+template <bool kZipped, class Input>
+void Scanner<Derived>::scanSubtree(Input* in, const CU& cu,
+                                   const AbbrevTable* abbrevs) {
+  input_ = in->base();
+  cu_version_ = cu.version;
+  // The subtree ends before the end of any CU.
+  uint64_t end = -1;
+  if (cu.offset_size == 8)
+    scanCU<kZipped, 8>(in, cu, end, abbrevs);
+  else
+    scanCU<kZipped, 4>(in, cu, end, abbrevs);
+}
+
+template <class Derived>
+template <bool kZipped, int kOffsetSize, class Input>
+void Scanner<Derived>::scanCU(Input* in, const CU& cu, uint64_t cu_end,
+                              const AbbrevTable* abbrevs) {
+  switch (cu.ptrsize) {
+  case 8:
+    scanDIEs<kZipped, 8, kOffsetSize>(in, cu_end, abbrevs);
+    break;
+  case 4:
+    scanDIEs<kZipped, 4, kOffsetSize>(in, cu_end, abbrevs);
+    break;
+  case 2:
+    scanDIEs<kZipped, 2, kOffsetSize>(in, cu_end, abbrevs);
+    break;
+  default:
+    bug("Unknown ptrsize: %d\n", cu.ptrsize);
+  }
+}
+
+template <class Derived>
+template <bool kZipped, int kPtrSize, int kOffsetSize, class Input>
+void Scanner<Derived>::scanDIEs(Input* in, uint64_t cu_end,
+                                const AbbrevTable* abbrevs) {
+  int depth = 0;
+  uint64_t prev_number = 0;
+
+  while (in->offset() < cu_end) {
+    // A copy of a template is coded as the abbrev number one past the last
+    // of the CU.
+    if (!kZipped) {
+      uint64_t copy_end = self()->findCopy(in->offset(), abbrevs);
+      if (copy_end) {
+        in->read(copy_end - in->offset(), 0);
+        prev_number = abbrevs->num_abbrevs;
+        continue;
+      }
+    }
+    uint64_t abbrev_number =
+      in->uleb(makeContext(STREAM_ABBREV, prev_number, 0));
+    //printf("abbrev_number: %d\n", (int)abbrev_number);
+    if (kZipped && abbrev_number == abbrevs->num_abbrevs &&
+        binary_->subtrees) {
+      readCopy(in, abbrevs);
+      prev_number = abbrev_number;
+      continue;
+    }
+    assert(abbrev_number < abbrevs->num_abbrevs);
+    if (kZipped && abbrev_numbers_)
+      abbrev_number = abbrev_numbers_[abbrev_number];
+    prev_number = abbrev_number;
+    if (abbrev_number == 0) {
+      self()->onAbbrev(abbrev_number, NULL, in->offset());
+      depth--;
+      if (depth == 0)
+        break;
+      continue;
+    }
+
+    assert(in->offset() < cu_end);
+
+    const Abbrev& abbrev = abbrevs->abbrevs[abbrev_number];
+    self()->onAbbrev(abbrev_number, &abbrev, in->offset());
+    if (abbrev.has_children)
+      depth++;
+
+    if (Derived::kMergeRuns) {
+      for (size_t i = 0; i < abbrev.num_ops; i++) {
+        const Op& op = abbrev.plan[i];
+        uint32_t ctx = makeContext(attrStream(op.form), abbrev.tag,
+                                   op.name << 16 | op.form);
+        if (!op.form) {
+          in->read(op.size, ctx);
+          self()->onRun(in->offset());
+        } else {
+          uint64_t value =
+            readAttr<kZipped, kPtrSize, kOffsetSize>(op.form, ctx, in);
+          self()->template onAttr<kZipped, kPtrSize, kOffsetSize>(
+            op.name, op.form, value, in->offset());
+        }
+      }
+    } else {
+      for (size_t i = 0; i < abbrev.num_attrs; i++) {
+        const Attr attr = abbrev.attrs[i];
+        uint32_t ctx = makeContext(attrStream(attr.form), abbrev.tag,
+                                   attr.name << 16 | attr.form);
+        //printf("name=%x form=%x\n", attr.name, attr.form);
+        uint64_t value = attr.implicit_const;
+        if (attr.form != DW_FORM_implicit_const) {
+          value = readAttr<kZipped, kPtrSize, kOffsetSize>(
+            attr.form, ctx, in);
+        }
+        self()->template onAttr<kZipped, kPtrSize, kOffsetSize>(
+          attr.name, attr.form, value, in->offset());
+      }
+    }
+    // A unit DIE without children, like that of a skeleton CU, is the
+    // whole CU.
+    if (depth == 0)
+      break;
+  }
+}
+
+// A copy is followed by the SLEB128 difference of its template from the
+// last template of the CU plus one, and the SLEB128 coded values of its
+// holes (see ZipScanner::findCopy).
+template <class Derived>
+template <class Input>
+void Scanner<Derived>::readCopy(Input* in, const AbbrevTable* abbrevs) {
+  const SubtreeTable* subtrees = binary_->subtrees;
+  uint64_t index =
+    last_template_ + 1 + in->sleb(makeContext(STREAM_ABBREV, 0, 1));
+  if (index >= subtrees->num_templates())
+    bug("Unknown template: %" PRIu64 "\n", index);
+  last_template_ = index;
+  const std::vector<Hole>& holes = subtrees->holes(index);
+  copy_holes_.resize(holes.size() + 1);
+  for (size_t i = 0; i < holes.size(); i++)
+    copy_holes_[i] = in->sleb(holeContext(holes[i]));
+  self()->onCopy(index, abbrevs, &copy_holes_[0], in->offset());
+}
+
+template <class Derived>
+template <bool kZipped, int kPtrSize, int kOffsetSize, class Input>
+uint64_t Scanner<Derived>::readAttr(uint16_t form, uint32_t ctx, Input* in) {
+  uint64_t value = 0xffffffffffffffff;
+  uint32_t data_ctx = makeContext(
+    form == DW_FORM_string ? STREAM_STRING : STREAM_BLOCK, form, 0);
+  switch (form) {
+  case DW_FORM_addr:
+  case DW_FORM_ref_addr:
+  case DW_FORM_strp:
+  case DW_FORM_line_strp:
+  case DW_FORM_strp_sup:
+  case DW_FORM_sec_offset:
+  case DW_FORM_GNU_strp_alt:
+  case DW_FORM_GNU_ref_alt:
+  case DW_FORM_data4:
+  case DW_FORM_ref4:
+  case DW_FORM_ref8: {
+    int size = deltaSize<kPtrSize, kOffsetSize>(form, cu_version_);
+    if (kZipped && size) {
+      value = in->sleb(ctx);
+    } else if (size == 8) {
+      value = *(uint64_t*)in->read(8, ctx);
+    } else if (size == 4) {
+      value = *(uint32_t*)in->read(4, ctx);
+    } else {
+      value = *(uint16_t*)in->read(2, ctx);
+    }
+    break;
+  }
+
+  case DW_FORM_block1: {
+    const uint8_t* p = in->read(1, ctx);
+    value = (uint64_t)p;
+    in->read(*p, data_ctx);
+    break;
+  }
+
+  case DW_FORM_block2: {
+    const uint8_t* p = in->read(2, ctx);
+    value = (uint64_t)p;
+    in->read(*(uint16_t*)p, data_ctx);
+    break;
+  }
+
+  case DW_FORM_block4: {
+    const uint8_t* p = in->read(4, ctx);
+    value = (uint64_t)p;
+    in->read(*(uint32_t*)p, data_ctx);
+    break;
+  }
+
+  case DW_FORM_block:
+  case DW_FORM_exprloc: {
+    value = (uint64_t)(in->base() + in->offset());
+    uint64_t size = in->uleb(ctx);
+    in->read(size, data_ctx);
+    break;
+  }
+
+  case DW_FORM_data1:
+  case DW_FORM_ref1:
+  case DW_FORM_flag:
+    value = *in->read(1, ctx);
+    break;
+
+  case DW_FORM_data2:
+  case DW_FORM_ref2:
+    value = *(uint16_t*)in->read(2, ctx);
+    break;
+
+  case DW_FORM_strx:
+  case DW_FORM_strx1:
+  case DW_FORM_strx2:
+  case DW_FORM_strx3:
+  case DW_FORM_strx4:
+  case DW_FORM_addrx:
+  case DW_FORM_addrx1:
+  case DW_FORM_addrx2:
+  case DW_FORM_addrx3:
+  case DW_FORM_addrx4:
+  case DW_FORM_loclistx:
+  case DW_FORM_rnglistx:
+  case DW_FORM_GNU_str_index:
+  case DW_FORM_GNU_addr_index: {
+    int size = indexSize(form);
+    if (kZipped) {
+      value = in->sleb(ctx);
+    } else if (size) {
+      value = readFixed(in->read(size, ctx), size);
+    } else {
+      value = in->uleb(ctx);
+    }
+    break;
+  }
+
+  case DW_FORM_ref_sup4:
+    value = *(uint32_t*)in->read(4, ctx);
+    break;
+
+  case DW_FORM_data8:
+  case DW_FORM_ref_sig8:
+  case DW_FORM_ref_sup8:
+    value = *(uint64_t*)in->read(8, ctx);
+    break;
+
+  case DW_FORM_data16:
+    value = (uint64_t)in->read(16, ctx);
+    break;
+
+  case DW_FORM_string:
+    // Zipped CUs with a string pool refer to its entries instead.
+    if (kZipped && binary_->string_pool)
+      value = in->sleb(ctx);
+    else
+      value = (uint64_t)in->string(data_ctx);
+    break;
+
+  case DW_FORM_sdata:
+    value = (uint64_t)in->sleb(ctx);
+    break;
+
+  case DW_FORM_udata:
+  case DW_FORM_ref_udata:
+    value = (uint64_t)in->uleb(ctx);
+    break;
+
+  case DW_FORM_flag_present:
+    break;
+
+  case DW_FORM_indirect: {
+    // The value of the actual form is never delta coded, since the
+    // scanner callbacks only see DW_FORM_indirect.
+    uint16_t actual = in->uleb(ctx);
+    if (actual == DW_FORM_indirect || actual == DW_FORM_implicit_const)
+      bug("Bad indirect DW_FORM: %x\n", actual);
+    value = readAttr<false, kPtrSize, kOffsetSize>(actual, ctx, in);
+    break;
+  }
+
+  default:
+    bug("Unknown DW_FORM: %x\n", form);
+  }
+  return value;
+}
+
+// Only walks delta coded CUs so that an input sees their fields. Runs are
+// merged as in ZipScanner, so inputs coding fields can be decoded in the
+// walk of ZipScanner.
+class FieldScanner : public Scanner<FieldScanner> {
+public:
+  explicit FieldScanner(Binary* binary)
+    : Scanner<FieldScanner>(binary) {
+  }
+
+private:
+  friend class Scanner<FieldScanner>;
+
+  static const bool kMergeRuns = true;
+
+  void onCU(const CU*, uint64_t) {}
+  void onAbbrev(uint64_t, const Abbrev*, uint64_t) {}
+  template <bool kZipped, int kPtrSize, int kOffsetSize>
+  void onAttr(uint16_t, uint16_t, uint64_t, uint64_t) {}
+  void onRun(uint64_t) {}
 };
 
 #endif  // SCANNER_H_
@@ -0,0 +1,34 @@
+#include "streams.h"
+
+#include "binary.h"
+
+using namespace std;
+
+void StreamSplitter::write(vector<uint8_t>* out) const {
+  StreamHeader header;
+  header.size = offset();
+  for (int i = 0; i < NUM_STREAMS; i++)
+    header.sizes[i] = streams_[i].size();
+  out->insert(out->end(), (const uint8_t*)&header,
+              (const uint8_t*)&header + sizeof(header));
+  for (int i = 0; i < NUM_STREAMS; i++)
+    out->insert(out->end(), streams_[i].begin(), streams_[i].end());
+}
+
+void splitStreams(Binary* binary, const uint8_t* in, size_t size,
+                  const vector<uint64_t>* abbrev_offsets,
+                  vector<uint8_t>* out) {
+  StreamSplitter splitter(in);
+  FieldScanner scanner(binary);
+  scanner.set_abbrev_offsets(abbrev_offsets);
+  scanner.scan<true>(&splitter, size);
+  splitter.write(out);
+}
+
+void mergeStreams(Binary* binary, const uint8_t* in,
+                  const vector<uint64_t>* abbrev_offsets, uint8_t* out) {
+  StreamMerger merger(in, out);
+  FieldScanner scanner(binary);
+  scanner.set_abbrev_offsets(abbrev_offsets);
+  scanner.scan<true>(&merger, ((const StreamHeader*)in)->size);
+}
@@ -0,0 +1,170 @@
+#ifndef STREAMS_H_
+#define STREAMS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include "scanner.h"
+
+class Binary;
+
+// Split chunks keep the fields of delta coded CUs in a stream for each
+// kind of value (see Stream in scanner.h) instead of in DIE order. A
+// split chunk is laid out as
+//
+//   uint64_t size;                  // of the delta coded CUs
+//   uint64_t sizes[NUM_STREAMS];
+//   streams, in the order of Stream
+//
+// Uniform streams compress better with generic compressors, and readers
+// which don't need a stream only skip its bytes. Coded line programs (see
+// lines.h) are split the same way, by LineStream.
+struct StreamHeader {
+  uint64_t size;
+  uint64_t sizes[NUM_STREAMS];
+};
+
+// Reads fields from memory and appends each of them to its stream.
+class StreamSplitter {
+public:
+  explicit StreamSplitter(const uint8_t* base)
+    : base_(base),
+      p_(base) {
+  }
+
+  const uint8_t* base() const {
+    return base_;
+  }
+
+  uint64_t offset() const {
+    return p_ - base_;
+  }
+
+  const uint8_t* read(size_t size, uint32_t ctx) {
+    const uint8_t* r = p_;
+    p_ += size;
+    append(ctx, r);
+    return r;
+  }
+
+  uint64_t uleb(uint32_t ctx) {
+    const uint8_t* r = p_;
+    uint64_t v = uleb128(p_);
+    append(ctx, r);
+    return v;
+  }
+
+  int64_t sleb(uint32_t ctx) {
+    const uint8_t* r = p_;
+    int64_t v = sleb128(p_);
+    append(ctx, r);
+    return v;
+  }
+
+  const uint8_t* string(uint32_t ctx) {
+    const uint8_t* r = p_;
+    p_ += strlen((const char*)p_) + 1;
+    append(ctx, r);
+    return r;
+  }
+
+  const std::vector<uint8_t>& stream(int i) const {
+    return streams_[i];
+  }
+
+  // Appends the split chunk of the fields read so far to |out|.
+  void write(std::vector<uint8_t>* out) const;
+
+private:
+  void append(uint32_t ctx, const uint8_t* p) {
+    std::vector<uint8_t>& s = streams_[contextStream(ctx)];
+    s.insert(s.end(), p, p_);
+  }
+
+  const uint8_t* base_;
+  const uint8_t* p_;
+  std::vector<uint8_t> streams_[NUM_STREAMS];
+};
+
+// Merges the streams of a split chunk back into |out| in DIE order.
+// Offsets are relative to |out|.
+class StreamMerger {
+public:
+  StreamMerger(const uint8_t* in, uint8_t* out)
+    : base_(out),
+      p_(out) {
+    const StreamHeader* header = (const StreamHeader*)in;
+    const uint8_t* s = in + sizeof(StreamHeader);
+    for (int i = 0; i < NUM_STREAMS; i++) {
+      streams_[i] = s;
+      s += header->sizes[i];
+    }
+  }
+
+  const uint8_t* base() const {
+    return base_;
+  }
+
+  uint64_t offset() const {
+    return p_ - base_;
+  }
+
+  const uint8_t* read(size_t size, uint32_t ctx) {
+    const uint8_t*& s = streams_[contextStream(ctx)];
+    uint8_t* r = p_;
+    memcpy(p_, s, size);
+    s += size;
+    p_ += size;
+    return r;
+  }
+
+  uint64_t uleb(uint32_t ctx) {
+    const uint8_t* r = p_;
+    copyUntil(ctx, 0x80);
+    return uleb128(r);
+  }
+
+  int64_t sleb(uint32_t ctx) {
+    const uint8_t* r = p_;
+    copyUntil(ctx, 0x80);
+    return sleb128(r);
+  }
+
+  const uint8_t* string(uint32_t ctx) {
+    const uint8_t* r = p_;
+    copyUntil(ctx, 1);
+    return r;
+  }
+
+private:
+  // Copies bytes until one is less than |limit|.
+  void copyUntil(uint32_t ctx, uint8_t limit) {
+    const uint8_t*& s = streams_[contextStream(ctx)];
+    uint8_t b;
+    do {
+      b = *s++;
+      *p_++ = b;
+    } while (b >= limit);
+  }
+
+  uint8_t* base_;
+  uint8_t* p_;
+  const uint8_t* streams_[NUM_STREAMS];
+};
+
+// Splits |size| bytes of delta coded CUs into a split chunk in |out|.
+// |abbrev_offsets| are those of CUs with ZIP_REBASED, or NULL.
+void splitStreams(Binary* binary, const uint8_t* in, size_t size,
+                  const std::vector<uint64_t>* abbrev_offsets,
+                  std::vector<uint8_t>* out);
+
+// Restores the delta coded CUs of a split chunk into |out|, which must
+// have room for StreamHeader::size bytes.
+void mergeStreams(Binary* binary, const uint8_t* in,
+                  const std::vector<uint64_t>* abbrev_offsets,
+                  uint8_t* out);
+
+#endif  // STREAMS_H_
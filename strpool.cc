@@ -0,0 +1,343 @@
+#include "strpool.h"
+
+#include <dwarf.h>
+#include <err.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "binary.h"
+#include "leb128.h"
+#include "scanner.h"
+
+using namespace std;
+
+static const uint32_t NO_ENTRY = 0xffffffff;
+
+// findOffset() starts from the first entry in the bucket of 64 bytes of
+// .debug_str, so it looks at only a few entries.
+static const int BUCKET_BITS = 6;
+
+struct StringLess {
+  bool operator()(const char* a, const char* b) const {
+    return strcmp(a, b) < 0;
+  }
+};
+
+struct StringEqual {
+  bool operator()(const char* a, const char* b) const {
+    return !strcmp(a, b);
+  }
+};
+
+// Orders strings by their bytes from the end, so a string is followed by
+// the strings it is a suffix of.
+class ReverseLess {
+public:
+  ReverseLess(const vector<const char*>& strings, const vector<size_t>& lens)
+    : strings_(strings), lens_(lens) {
+  }
+
+  bool operator()(uint32_t a, uint32_t b) const {
+    const uint8_t* p = (const uint8_t*)strings_[a] + lens_[a];
+    const uint8_t* q = (const uint8_t*)strings_[b] + lens_[b];
+    size_t n = min(lens_[a], lens_[b]);
+    for (size_t i = 0; i < n; i++) {
+      p--;
+      q--;
+      if (*p != *q)
+        return *p < *q;
+    }
+    return lens_[a] < lens_[b];
+  }
+
+private:
+  const vector<const char*>& strings_;
+  const vector<size_t>& lens_;
+};
+
+static void appendUleb(uint64_t v, vector<uint8_t>* out) {
+  uint8_t buf[16];
+  uint8_t* p = buf;
+  uleb128o(v, p);
+  out->insert(out->end(), buf, p);
+}
+
+bool findStringStarts(const Binary* binary, vector<bool>* starts) {
+  const char* str = binary->debug_str;
+  size_t size = binary->debug_str_len;
+  if (!size || str[size - 1])
+    return false;
+  starts->assign(size, false);
+  for (uint64_t start = 0; start < size; start += strlen(str + start) + 1)
+    (*starts)[start] = true;
+  return true;
+}
+
+StringPool* StringPool::build(const Binary* binary,
+                              const vector<bool>& starts,
+                              const vector<uint64_t>& strps,
+                              const vector<const char*>& strings) {
+  const char* str = binary->debug_str;
+  size_t size = starts.size();
+  vector<uint64_t> mids(strps);
+  sort(mids.begin(), mids.end());
+  mids.erase(unique(mids.begin(), mids.end()), mids.end());
+  if (!mids.empty() && mids.back() >= size)
+    return NULL;
+
+  StringPool* pool = new StringPool();
+  pool->debug_str_size_ = size;
+
+  // The entries are the string starts and the referenced offsets in the
+  // middle of a string.
+  vector<uint64_t>& offsets = pool->offsets_;
+  size_t m = 0;
+  for (uint64_t i = 0; i < size; i++) {
+    if (m < mids.size() && mids[m] == i) {
+      offsets.push_back(i);
+      m++;
+    } else if (starts[i]) {
+      offsets.push_back(i);
+    }
+  }
+
+  vector<uint32_t>& buckets = pool->buckets_;
+  buckets.resize(((size - 1) >> BUCKET_BITS) + 1);
+  for (size_t i = offsets.size(); i-- > 0;)
+    buckets[offsets[i] >> BUCKET_BITS] = i;
+
+  vector<const char*>& sorted = pool->strings_;
+  sorted.reserve(offsets.size() + strings.size());
+  for (size_t i = 0; i < offsets.size(); i++)
+    sorted.push_back(str + offsets[i]);
+  sorted.insert(sorted.end(), strings.begin(), strings.end());
+  sort(sorted.begin(), sorted.end(), StringLess());
+  sorted.erase(unique(sorted.begin(), sorted.end(), StringEqual()),
+               sorted.end());
+
+  pool->entries_.resize(offsets.size());
+  pool->string_entries_.assign(sorted.size(), NO_ENTRY);
+  for (size_t i = 0; i < offsets.size(); i++) {
+    uint32_t s = lower_bound(sorted.begin(), sorted.end(), str + offsets[i],
+                             StringLess()) - sorted.begin();
+    pool->entries_[i] = s;
+    if (pool->string_entries_[s] == NO_ENTRY)
+      pool->string_entries_[s] = i;
+  }
+  // The rest are only inline.
+  for (size_t s = 0; s < sorted.size(); s++) {
+    if (pool->string_entries_[s] == NO_ENTRY) {
+      pool->string_entries_[s] = pool->entries_.size();
+      pool->entries_.push_back(s);
+    }
+  }
+  return pool;
+}
+
+StringPool* StringPool::read(const uint8_t* p, size_t size) {
+  const uint8_t* end = p + size;
+  const StringPoolHeader* header = (const StringPoolHeader*)p;
+  p += sizeof(*header);
+  StringPool* pool = new StringPool();
+  pool->debug_str_size_ = header->debug_str_size;
+
+  // Strings are kept as offsets into data_ until all of them are read, as
+  // data_ grows. A suffix keeps its skip and the longer string.
+  size_t n = header->num_strings;
+  vector<uint64_t> starts(n);
+  vector<uint32_t> longer(n, NO_ENTRY);
+  vector<char>& data = pool->data_;
+  uint64_t last = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t v = uleb128(p);
+    if (v & 1) {
+      starts[i] = v >> 1;
+      longer[i] = uleb128(p);
+      continue;
+    }
+    size_t prefix = v >> 1;
+    starts[i] = data.size();
+    data.resize(data.size() + prefix);
+    memcpy(&data[starts[i]], &data[last], prefix);
+    size_t len = strlen((const char*)p) + 1;
+    data.insert(data.end(), p, p + len);
+    p += len;
+    last = starts[i];
+  }
+
+  pool->strings_.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    if (longer[i] == NO_ENTRY)
+      pool->strings_[i] = &data[starts[i]];
+    else
+      pool->strings_[i] = &data[starts[longer[i]] + starts[i]];
+  }
+
+  pool->entries_.resize(header->num_entries);
+  pool->offsets_.resize(header->num_str_entries);
+  uint64_t str_end = 0;
+  for (size_t i = 0; i < header->num_entries; i++) {
+    uint64_t v = uleb128(p);
+    pool->entries_[i] = v >> 1;
+    if (i >= header->num_str_entries)
+      continue;
+    size_t len = strlen(pool->strings_[v >> 1]) + 1;
+    if (v & 1) {
+      pool->offsets_[i] = str_end - len;
+    } else {
+      pool->offsets_[i] = str_end;
+      str_end += len;
+    }
+  }
+  if (p != end || str_end != pool->debug_str_size_)
+    errx(1, "broken string pool");
+  return pool;
+}
+
+void StringPool::write(vector<uint8_t>* out) const {
+  StringPoolHeader header;
+  header.debug_str_size = debug_str_size_;
+  header.num_strings = strings_.size();
+  header.num_entries = entries_.size();
+  header.num_str_entries = offsets_.size();
+  out->insert(out->end(), (const uint8_t*)&header,
+              (const uint8_t*)&header + sizeof(header));
+
+  size_t n = strings_.size();
+  vector<size_t> lens(n);
+  vector<uint32_t> order(n);
+  for (size_t i = 0; i < n; i++) {
+    lens[i] = strlen(strings_[i]);
+    order[i] = i;
+  }
+
+  // The longest string each string is a suffix of.
+  sort(order.begin(), order.end(), ReverseLess(strings_, lens));
+  vector<uint32_t> longer(n);
+  for (size_t k = n; k-- > 0;) {
+    uint32_t i = order[k];
+    longer[i] = i;
+    if (k + 1 == n)
+      continue;
+    uint32_t next = order[k + 1];
+    if (lens[i] < lens[next] &&
+        !memcmp(strings_[i], strings_[next] + lens[next] - lens[i], lens[i]))
+      longer[i] = longer[next];
+  }
+
+  const char* last = "";
+  for (size_t i = 0; i < n; i++) {
+    const char* s = strings_[i];
+    size_t prefix = 0;
+    while (s[prefix] && s[prefix] == last[prefix])
+      prefix++;
+    size_t front_size = ulebSize(prefix << 1) + lens[i] - prefix + 1;
+    uint32_t l = longer[i];
+    if (l != i) {
+      uint64_t skip = lens[l] - lens[i];
+      if ((size_t)(ulebSize(skip << 1 | 1) + ulebSize(l)) < front_size) {
+        appendUleb(skip << 1 | 1, out);
+        appendUleb(l, out);
+        continue;
+      }
+    }
+    appendUleb(prefix << 1, out);
+    out->insert(out->end(), s + prefix, s + lens[i] + 1);
+    last = s;
+  }
+
+  // The next string starts at |str_end|, and other offsets are in the
+  // middle of the last string.
+  uint64_t str_end = 0;
+  for (size_t i = 0; i < entries_.size(); i++) {
+    bool mid = false;
+    if (i < offsets_.size()) {
+      mid = offsets_[i] != str_end;
+      if (!mid)
+        str_end += lens[entries_[i]] + 1;
+    }
+    appendUleb((uint64_t)entries_[i] << 1 | mid, out);
+  }
+}
+
+void StringPool::writeDebugStr(vector<uint8_t>* out) const {
+  out->reserve(out->size() + debug_str_size_);
+  uint64_t str_end = 0;
+  for (size_t i = 0; i < offsets_.size(); i++) {
+    if (offsets_[i] != str_end)
+      continue;
+    const char* s = entryString(i);
+    size_t len = strlen(s) + 1;
+    out->insert(out->end(), s, s + len);
+    str_end += len;
+  }
+}
+
+uint64_t StringPool::findOffset(uint64_t offset) const {
+  uint64_t i = buckets_[offset >> BUCKET_BITS];
+  while (offsets_[i] < offset)
+    i++;
+  return i;
+}
+
+uint64_t StringPool::findString(const char* s) const {
+  size_t i = lower_bound(strings_.begin(), strings_.end(), s, StringLess()) -
+      strings_.begin();
+  return string_entries_[i];
+}
+
+const char* StringPool::stringAt(uint64_t offset) const {
+  vector<uint64_t>::const_iterator found =
+    lower_bound(offsets_.begin(), offsets_.end(), offset);
+  if (found == offsets_.end() || *found != offset)
+    return NULL;
+  return entryString(found - offsets_.begin());
+}
+
+// Only keeps the values of string forms.
+class StringCollector : public Scanner<StringCollector> {
+public:
+  StringCollector(Binary* binary, const vector<bool>& starts,
+                  vector<uint64_t>* strps, vector<const char*>* strings)
+    : Scanner<StringCollector>(binary),
+      starts_(starts),
+      strps_(strps),
+      strings_(strings) {
+  }
+
+private:
+  friend class Scanner<StringCollector>;
+
+  static const bool kMergeRuns = true;
+
+  void onCU(const CU*, uint64_t) {}
+  void onAbbrev(uint64_t, const Abbrev*, uint64_t) {}
+
+  template <bool kZipped, int kPtrSize, int kOffsetSize>
+  void onAttr(uint16_t, uint16_t form, uint64_t value, uint64_t) {
+    if (form == DW_FORM_strp && (value >= starts_.size() || !starts_[value]))
+      strps_->push_back(value);
+    else if (form == DW_FORM_string)
+      strings_->push_back((const char*)value);
+  }
+
+  void onRun(uint64_t) {}
+
+  const vector<bool>& starts_;
+  vector<uint64_t>* strps_;
+  vector<const char*>* strings_;
+};
+
+void collectStrings(Binary* binary, const vector<bool>& starts,
+                    uint64_t begin, uint64_t end, vector<uint64_t>* strps,
+                    vector<const char*>* strings) {
+  size_t num_strings = strings->size();
+  StringCollector collector(binary, starts, strps, strings);
+  collector.run(begin, end);
+  // Inline strings repeat a lot, so only distinct ones are kept.
+  sort(strings->begin() + num_strings, strings->end(), StringLess());
+  strings->erase(unique(strings->begin() + num_strings, strings->end(),
+                        StringEqual()),
+                 strings->end());
+}
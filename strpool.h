@@ -0,0 +1,109 @@
+#ifndef STRPOOL_H_
+#define STRPOOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+class Binary;
+
+// The strings of .debug_str and of DW_FORM_string, which zipped binaries
+// with ZIP_STRINGS keep in a pool in place of .debug_str. Each distinct
+// string is stored once, either front coded against the previous one in
+// sorted order, or as a suffix of a longer string when that is shorter.
+//
+// DIEs refer to strings by entries. The entries of .debug_str are its
+// string starts and the offsets DW_FORM_strp points to, in the order of
+// offsets, so .debug_str is restored byte for byte. Strings which are only
+// inline get entries after them. Entry indexes are denser than offsets,
+// so their deltas are smaller. The pool is laid out as
+//
+//   StringPoolHeader
+//   for each string in sorted order, ULEB128 of either
+//     prefix << 1, followed by the rest of the string after the prefix
+//       it shares with the last front coded string, NUL terminated, or
+//     skip << 1 | 1, followed by ULEB128 of the longer string
+//   for each entry, ULEB128 of its string << 1, | 1 if the entry is in
+//   the middle of a string of .debug_str
+struct StringPoolHeader {
+  uint64_t debug_str_size;
+  uint64_t num_strings;
+  uint64_t num_entries;
+  // The entries of .debug_str, which come first.
+  uint64_t num_str_entries;
+};
+
+class StringPool {
+public:
+  // Builds the pool of a raw binary from the string starts of .debug_str
+  // (see findStringStarts()), the other offsets |strps| of DW_FORM_strp,
+  // and the values |strings| of DW_FORM_string. Returns NULL if an offset
+  // is out of .debug_str.
+  static StringPool* build(const Binary* binary,
+                           const std::vector<bool>& starts,
+                           const std::vector<uint64_t>& strps,
+                           const std::vector<const char*>& strings);
+
+  // Reads a pool written by write().
+  static StringPool* read(const uint8_t* p, size_t size);
+
+  void write(std::vector<uint8_t>* out) const;
+
+  // Restores the original .debug_str.
+  void writeDebugStr(std::vector<uint8_t>* out) const;
+
+  // Returns the entry of |offset| of .debug_str. Only for built pools.
+  uint64_t findOffset(uint64_t offset) const;
+
+  // Returns the entry of an inline string. Only for built pools.
+  uint64_t findString(const char* s) const;
+
+  // Returns the string at |offset| of the original .debug_str, or NULL if
+  // no DW_FORM_strp points there.
+  const char* stringAt(uint64_t offset) const;
+
+  uint64_t entryOffset(uint64_t entry) const {
+    return offsets_[entry];
+  }
+
+  const char* entryString(uint64_t entry) const {
+    return strings_[entries_[entry]];
+  }
+
+  size_t num_entries() const {
+    return entries_.size();
+  }
+
+private:
+  StringPool() : debug_str_size_(0) {}
+
+  uint64_t debug_str_size_;
+  // Distinct strings in sorted order. They point into .debug_str and
+  // .debug_info of the raw binary for built pools, and into data_ for
+  // read ones.
+  std::vector<const char*> strings_;
+  // The string of each entry.
+  std::vector<uint32_t> entries_;
+  // The offset of each entry of .debug_str.
+  std::vector<uint64_t> offsets_;
+  // The first entry of each string, and the first entry in each bucket
+  // of offsets. Only for built pools.
+  std::vector<uint32_t> string_entries_;
+  std::vector<uint32_t> buckets_;
+  std::vector<char> data_;
+};
+
+// Marks the string starts of .debug_str of a raw binary in |starts|.
+// Returns false if .debug_str isn't a sequence of NUL terminated strings.
+bool findStringStarts(const Binary* binary, std::vector<bool>* starts);
+
+// Appends the offsets of DW_FORM_strp which aren't string starts, and the
+// distinct values of DW_FORM_string, of CUs in [begin, end) of
+// .debug_info of a raw binary.
+void collectStrings(Binary* binary, const std::vector<bool>& starts,
+                    uint64_t begin, uint64_t end,
+                    std::vector<uint64_t>* strps,
+                    std::vector<const char*>* strings);
+
+#endif  // STRPOOL_H_
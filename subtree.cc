@@ -0,0 +1,693 @@
+#include "subtree.h"
+
+#include <dwarf.h>
+#include <err.h>
+#include <string.h>
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "binary.h"
+#include "parallel.h"
+#include "scanner.h"
+#include "zipscanner.h"
+
+using namespace std;
+
+// Smaller subtrees don't pay for their copies.
+static const uint64_t MIN_SUBTREE_SIZE = 8;
+
+// Subtrees are found in chunks of about this many bytes of .debug_info.
+static const size_t FIND_CHUNK_SIZE = 1024 * 1024;
+
+// The most bytes a copy is coded with, besides its holes, and the most
+// bytes of a hole. Copies must not code larger than twice their subtrees,
+// as chunks are delta coded into buffers of that size.
+static const uint64_t MAX_COPY_SIZE = 8;
+static const uint64_t MAX_HOLE_SIZE = 10;
+
+// The numbers of the abbrevs of a table by their content.
+struct AbbrevKeys {
+  vector<uint64_t> keys;
+  // The first number of each key.
+  unordered_map<uint64_t, uint64_t> numbers;
+};
+
+static uint64_t mix(uint64_t h, uint64_t v) {
+  h = (h ^ v) * 0x9e3779b97f4a7c15ull;
+  return h ^ (h >> 31);
+}
+
+static uint64_t abbrevKey(const Abbrev& abbrev) {
+  uint64_t h = mix(abbrev.tag, abbrev.has_children);
+  for (size_t i = 0; i < abbrev.num_attrs; i++) {
+    const Attr& attr = abbrev.attrs[i];
+    h = mix(h, attr.name << 16 | attr.form);
+    h = mix(h, attr.implicit_const);
+  }
+  return h;
+}
+
+static bool isRefForm(uint16_t form) {
+  switch (form) {
+  case DW_FORM_ref1:
+  case DW_FORM_ref2:
+  case DW_FORM_ref4:
+  case DW_FORM_ref8:
+  case DW_FORM_ref_udata:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Whether an attribute other than a reference is a hole.
+static bool isHole(uint16_t name, uint16_t form) {
+  if (indexKind(form) >= 0)
+    return true;
+  if (name != DW_AT_decl_file)
+    return false;
+  switch (form) {
+  case DW_FORM_data1:
+  case DW_FORM_data2:
+  case DW_FORM_data4:
+  case DW_FORM_data8:
+  case DW_FORM_udata:
+    return true;
+  default:
+    return false;
+  }
+}
+
+HoleKind holeKind(const Hole& hole) {
+  if (isRefForm(hole.form))
+    return HOLE_REF;
+  if (indexKind(hole.form) >= 0)
+    return HOLE_INDEX;
+  return HOLE_FILE;
+}
+
+// Writes |value| of a form which can be a hole or a reference.
+static void putValue(uint16_t form, uint64_t value, uint8_t*& p) {
+  int size;
+  switch (form) {
+  case DW_FORM_ref1:
+  case DW_FORM_data1:
+    size = 1;
+    break;
+  case DW_FORM_ref2:
+  case DW_FORM_data2:
+    size = 2;
+    break;
+  case DW_FORM_ref4:
+  case DW_FORM_data4:
+    size = 4;
+    break;
+  case DW_FORM_ref8:
+  case DW_FORM_data8:
+    size = 8;
+    break;
+  default:
+    size = indexSize(form);
+    if (!size) {
+      uleb128o(value, p);
+      return;
+    }
+  }
+  memcpy(p, &value, size);
+  p += size;
+}
+
+// The roots of subtrees which can be copies.
+struct Candidate {
+  uint64_t offset;
+  uint64_t end;
+  uint64_t cu_offset;
+  uint64_t hash;
+};
+
+static bool copyLess(const SubtreeCopy& a, const SubtreeCopy& b) {
+  return a.offset < b.offset;
+}
+
+static bool candidateLess(const Candidate& a, const Candidate& b) {
+  if (a.hash != b.hash)
+    return a.hash < b.hash;
+  return a.offset < b.offset;
+}
+
+// Finds the subtrees of raw CUs whose parents are unit DIEs or
+// namespaces.
+class RootFinder : public Scanner<RootFinder> {
+public:
+  RootFinder(Binary* binary, vector<Candidate>* roots)
+    : Scanner<RootFinder>(binary),
+      roots_(roots) {
+  }
+
+private:
+  friend class Scanner<RootFinder>;
+
+  static const bool kMergeRuns = true;
+
+  // The parents of the current DIE, which are HOLDER for unit DIEs and
+  // namespaces, or the index of the root, or OTHER.
+  static const int64_t HOLDER = -2;
+  static const int64_t OTHER = -1;
+
+  void onCU(const CU* cu, uint64_t offset) {
+    cu_offset_ = offset - cu->header_size;
+    pos_ = offset;
+    parents_.clear();
+    leaf_ = OTHER;
+  }
+
+  void onAbbrev(uint64_t, const Abbrev* abbrev, uint64_t offset) {
+    uint64_t start = pos_;
+    pos_ = offset;
+    if (leaf_ != OTHER) {
+      (*roots_)[leaf_].end = start;
+      leaf_ = OTHER;
+    }
+    if (!abbrev) {
+      if (parents_.back() >= 0)
+        (*roots_)[parents_.back()].end = offset;
+      parents_.pop_back();
+      return;
+    }
+
+    int64_t parent = OTHER;
+    if (parents_.empty() ||
+        (parents_.back() == HOLDER && abbrev->tag == DW_TAG_namespace)) {
+      parent = HOLDER;
+    } else if (parents_.back() == HOLDER) {
+      Candidate root = { start, 0, cu_offset_, 0 };
+      parent = roots_->size();
+      roots_->push_back(root);
+    }
+    if (abbrev->has_children)
+      parents_.push_back(parent);
+    else if (parent >= 0)
+      leaf_ = parent;
+  }
+
+  template <bool kZipped, int kPtrSize, int kOffsetSize>
+  void onAttr(uint16_t, uint16_t, uint64_t, uint64_t offset) {
+    pos_ = offset;
+  }
+
+  void onRun(uint64_t offset) {
+    pos_ = offset;
+  }
+
+  vector<Candidate>* roots_;
+  uint64_t cu_offset_;
+  uint64_t pos_;
+  vector<int64_t> parents_;
+  int64_t leaf_;
+};
+
+// Walks a subtree of a raw binary as its template has it. Abbrevs are
+// hashed by their content, so copies in CUs with other abbrev tables have
+// the same hash.
+class SubtreeWalker : public Scanner<SubtreeWalker> {
+public:
+  SubtreeWalker(Binary* binary, SubtreeTable* table)
+    : Scanner<SubtreeWalker>(binary),
+      table_(table) {
+  }
+
+  // Walks the subtree at [offset, end) of the CU at |cu_offset| and
+  // writes its template to |out| unless it's NULL. Returns false if the
+  // subtree doesn't end at |end|.
+  bool walk(uint64_t cu_offset, uint64_t offset, uint64_t end,
+            vector<uint8_t>* out) {
+    const uint8_t* dinfo = (const uint8_t*)binary_->debug_info;
+    CU cu;
+    readCU(dinfo + cu_offset, &cu);
+    cu_offset_ = cu_offset;
+    root_ = offset;
+    end_ = end;
+    header_size_ = cu.header_size;
+    pos_ = offset;
+    out_ = out;
+    hash_ = mix(mix(cu.version, cu.ptrsize), cu.offset_size);
+    holes_.clear();
+    if (out) {
+      // The template has the header of the CU.
+      out->assign(dinfo + cu_offset, dinfo + cu_offset + cu.header_size);
+    }
+
+    const AbbrevTable* abbrevs =
+      binary_->abbrev_cache->get(cu.abbrev_offset);
+    keys_ = table_->abbrevKeys(abbrevs);
+    MemoryInput in(dinfo, offset);
+    scanSubtree<false>(&in, cu, abbrevs);
+    if (in.offset() != end)
+      return false;
+    if (out) {
+      uint64_t length = out->size() - (cu.offset_size == 8 ? 12 : 4);
+      if (cu.offset_size == 8)
+        memcpy(&(*out)[4], &length, 8);
+      else
+        memcpy(&(*out)[0], &length, 4);
+    }
+    return true;
+  }
+
+  uint64_t hash() const {
+    return hash_;
+  }
+
+  const vector<uint64_t>& holes() const {
+    return holes_;
+  }
+
+private:
+  friend class Scanner<SubtreeWalker>;
+
+  static const bool kMergeRuns = false;
+
+  void onCU(const CU*, uint64_t) {}
+
+  void onAbbrev(uint64_t number, const Abbrev*, uint64_t offset) {
+    hash_ = mix(hash_, keys_->keys[number]);
+    if (out_)
+      put(number, DW_FORM_udata);
+    pos_ = offset;
+  }
+
+  template <bool kZipped, int kPtrSize, int kOffsetSize>
+  void onAttr(uint16_t name, uint16_t form, uint64_t value,
+              uint64_t offset) {
+    uint64_t target = cu_offset_ + value;
+    if (isRefForm(form) && target >= root_ && target <= end_) {
+      // References into the subtree are rebased to the template.
+      uint64_t v = target - root_ + header_size_;
+      hash_ = mix(mix(hash_, 1), v);
+      if (out_)
+        put(v, form);
+    } else if (isRefForm(form) || isHole(name, form)) {
+      holes_.push_back(value);
+      hash_ = mix(hash_, 2);
+      if (out_)
+        put(0, form);
+    } else {
+      for (uint64_t i = pos_; i < offset; i++)
+        hash_ = mix(hash_, input_[i]);
+      if (out_)
+        out_->insert(out_->end(), input_ + pos_, input_ + offset);
+    }
+    pos_ = offset;
+  }
+
+  void onRun(uint64_t) {}
+
+  void put(uint64_t value, uint16_t form) {
+    uint8_t buf[16];
+    uint8_t* p = buf;
+    putValue(form, value, p);
+    out_->insert(out_->end(), buf, p);
+  }
+
+  SubtreeTable* table_;
+  const AbbrevKeys* keys_;
+  uint64_t cu_offset_;
+  uint64_t root_;
+  uint64_t end_;
+  uint64_t header_size_;
+  uint64_t pos_;
+  vector<uint8_t>* out_;
+  uint64_t hash_;
+  vector<uint64_t> holes_;
+};
+
+// Walks a template to list its holes or to write a copy.
+class TemplateWalker : public Scanner<TemplateWalker> {
+public:
+  explicit TemplateWalker(Binary* binary)
+    : Scanner<TemplateWalker>(binary),
+      holes_(NULL),
+      out_(NULL) {
+  }
+
+  void listHoles(const uint8_t* p, vector<Hole>* holes) {
+    holes_ = holes;
+    walk(p);
+  }
+
+  // Writes the copy whose root is at |root| of its CU to |out|, mapping
+  // the abbrevs of the template by |from| and |to|. Returns the end, or
+  // NULL if |to| lacks an abbrev.
+  uint8_t* expand(const uint8_t* p, const AbbrevKeys* from,
+                  const AbbrevKeys* to, uint64_t root,
+                  const uint64_t* values, uint8_t* out) {
+    from_ = from;
+    to_ = to;
+    root_ = root;
+    values_ = values;
+    out_ = out;
+    failed_ = false;
+    walk(p);
+    return failed_ ? NULL : out_;
+  }
+
+private:
+  friend class Scanner<TemplateWalker>;
+
+  static const bool kMergeRuns = false;
+
+  void walk(const uint8_t* p) {
+    MemoryInput in(p, 0);
+    scan<false>(&in, cuSize(p));
+  }
+
+  void onCU(const CU* cu, uint64_t offset) {
+    header_size_ = cu->header_size;
+    pos_ = offset;
+  }
+
+  void onAbbrev(uint64_t number, const Abbrev* abbrev, uint64_t offset) {
+    pos_ = offset;
+    if (abbrev)
+      tag_ = abbrev->tag;
+    if (!out_ || failed_)
+      return;
+    if (!abbrev) {
+      *out_++ = 0;
+      return;
+    }
+    unordered_map<uint64_t, uint64_t>::const_iterator found =
+      to_->numbers.find(from_->keys[number]);
+    if (found == to_->numbers.end()) {
+      failed_ = true;
+      return;
+    }
+    uleb128o(found->second, out_);
+  }
+
+  template <bool kZipped, int kPtrSize, int kOffsetSize>
+  void onAttr(uint16_t name, uint16_t form, uint64_t value,
+              uint64_t offset) {
+    bool hole = isRefForm(form) ? value == 0 : isHole(name, form);
+    if (holes_ && hole) {
+      Hole h = { tag_, name, form };
+      holes_->push_back(h);
+    } else if (out_ && !failed_) {
+      if (hole)
+        putValue(form, *values_++, out_);
+      else if (isRefForm(form))
+        putValue(form, root_ + value - header_size_, out_);
+      else
+        out_ = (uint8_t*)mempcpy(out_, input_ + pos_, offset - pos_);
+    }
+    pos_ = offset;
+  }
+
+  void onRun(uint64_t) {}
+
+  vector<Hole>* holes_;
+  const AbbrevKeys* from_;
+  const AbbrevKeys* to_;
+  uint64_t root_;
+  const uint64_t* values_;
+  uint8_t* out_;
+  bool failed_;
+  uint64_t header_size_;
+  uint64_t pos_;
+  uint16_t tag_;
+};
+
+SubtreeTable::SubtreeTable()
+  : num_templates_(0),
+    zip_(NULL),
+    loaded_(true) {
+  memset(&header_, 0, sizeof(header_));
+  pthread_mutex_init(&mu_, NULL);
+}
+
+SubtreeTable::~SubtreeTable() {
+  for (map<const AbbrevTable*, AbbrevKeys*>::iterator iter = keys_.begin();
+       iter != keys_.end();
+       ++iter) {
+    delete iter->second;
+  }
+  pthread_mutex_destroy(&mu_);
+}
+
+const AbbrevKeys* SubtreeTable::abbrevKeys(const AbbrevTable* abbrevs) {
+  pthread_mutex_lock(&mu_);
+  AbbrevKeys*& keys = keys_[abbrevs];
+  if (!keys) {
+    keys = new AbbrevKeys();
+    keys->keys.resize(abbrevs->num_abbrevs);
+    for (size_t i = 1; i < abbrevs->num_abbrevs; i++) {
+      if (!abbrevs->abbrevs[i].tag)
+        continue;
+      keys->keys[i] = abbrevKey(abbrevs->abbrevs[i]);
+      keys->numbers.insert(make_pair(keys->keys[i], i));
+    }
+  }
+  pthread_mutex_unlock(&mu_);
+  return keys;
+}
+
+void SubtreeTable::indexTemplates(Binary* binary) {
+  offsets_.clear();
+  tables_.clear();
+  holes_.clear();
+  uint64_t offset = 0;
+  while (offset + CU_HEADER_SIZE < templates_.size()) {
+    const uint8_t* p = &templates_[offset];
+    CU cu;
+    readCU(p, &cu);
+    offsets_.push_back(offset);
+    tables_.push_back(binary->abbrev_cache->get(cu.abbrev_offset));
+    holes_.push_back(vector<Hole>());
+    TemplateWalker walker(binary);
+    walker.listHoles(p, &holes_.back());
+    offset += cuSize(p);
+  }
+  if (offset != templates_.size() || offsets_.size() != num_templates_)
+    errx(1, "broken templates");
+}
+
+size_t SubtreeTable::findCopy(uint64_t offset) const {
+  size_t lo = 0;
+  size_t hi = copies_.size();
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (copies_[mid].offset < offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+uint8_t* SubtreeTable::expand(Binary* binary, size_t index,
+                              const AbbrevTable* abbrevs, uint64_t root,
+                              const uint64_t* holes, uint8_t* out) {
+  TemplateWalker walker(binary);
+  return walker.expand(&templates_[offsets_[index]],
+                       abbrevKeys(tables_[index]), abbrevKeys(abbrevs),
+                       root, holes, out);
+}
+
+// The subtrees of each chunk, hashed in parallel.
+struct FindJob {
+  Binary* binary;
+  SubtreeTable* table;
+  const ZipChunk* chunks;
+  vector<vector<Candidate> > roots;
+};
+
+static void findChunk(void* arg, size_t i) {
+  FindJob* job = static_cast<FindJob*>(arg);
+  vector<Candidate> roots;
+  RootFinder finder(job->binary, &roots);
+  finder.run(job->chunks[i].orig_offset, job->chunks[i + 1].orig_offset);
+
+  SubtreeWalker walker(job->binary, job->table);
+  vector<Candidate>& out = job->roots[i];
+  for (size_t j = 0; j < roots.size(); j++) {
+    Candidate& root = roots[j];
+    if (root.end - root.offset < MIN_SUBTREE_SIZE)
+      continue;
+    if (!walker.walk(root.cu_offset, root.offset, root.end, NULL))
+      continue;
+    root.hash = walker.hash();
+    out.push_back(root);
+  }
+}
+
+// A template and its copies, which are checked in parallel.
+struct Group {
+  size_t begin;
+  size_t end;
+  vector<uint8_t> bytes;
+  vector<Hole> holes;
+  vector<SubtreeCopy> copies;
+  vector<uint64_t> values;
+};
+
+struct CheckJob {
+  Binary* binary;
+  SubtreeTable* table;
+  const vector<Candidate>* roots;
+  vector<Group> groups;
+};
+
+// Keeps the subtrees of a group whose copies restore them exactly.
+static void checkGroup(void* arg, size_t i) {
+  CheckJob* job = static_cast<CheckJob*>(arg);
+  Binary* binary = job->binary;
+  const uint8_t* dinfo = (const uint8_t*)binary->debug_info;
+  const vector<Candidate>& roots = *job->roots;
+  Group& group = job->groups[i];
+  const Candidate& first = roots[group.begin];
+  SubtreeWalker walker(binary, job->table);
+  if (!walker.walk(first.cu_offset, first.offset, first.end, &group.bytes))
+    return;
+  TemplateWalker(binary).listHoles(&group.bytes[0], &group.holes);
+  CU first_cu;
+  readCU(dinfo + first.cu_offset, &first_cu);
+  const AbbrevKeys* from = job->table->abbrevKeys(
+    binary->abbrev_cache->get(first_cu.abbrev_offset));
+
+  size_t num_holes = group.holes.size();
+  vector<uint8_t> copy;
+  for (size_t j = group.begin; j < group.end; j++) {
+    const Candidate& root = roots[j];
+    uint64_t size = root.end - root.offset;
+    if (MAX_COPY_SIZE + MAX_HOLE_SIZE * num_holes > size * 2)
+      continue;
+    if (!walker.walk(root.cu_offset, root.offset, root.end, NULL) ||
+        walker.holes().size() != num_holes)
+      continue;
+    CU cu;
+    readCU(dinfo + root.cu_offset, &cu);
+    const AbbrevTable* abbrevs = binary->abbrev_cache->get(cu.abbrev_offset);
+    copy.resize(group.bytes.size() * 3 + MAX_HOLE_SIZE * num_holes);
+    uint8_t* end = TemplateWalker(binary).expand(
+      &group.bytes[0], from, job->table->abbrevKeys(abbrevs),
+      root.offset - root.cu_offset, walker.holes().data(), &copy[0]);
+    if (!end || (uint64_t)(end - &copy[0]) != size ||
+        memcmp(&copy[0], dinfo + root.offset, size))
+      continue;
+    SubtreeCopy c = { root.offset, root.end, 0,
+                      (uint32_t)group.values.size() };
+    group.copies.push_back(c);
+    group.values.insert(group.values.end(), walker.holes().begin(),
+                        walker.holes().end());
+  }
+}
+
+SubtreeTable* SubtreeTable::build(Binary* binary, int num_threads) {
+  SubtreeTable* table = new SubtreeTable();
+  vector<ZipChunk> chunks;
+  splitChunks(binary, FIND_CHUNK_SIZE, &chunks);
+  FindJob find_job;
+  find_job.binary = binary;
+  find_job.table = table;
+  find_job.chunks = &chunks[0];
+  find_job.roots.resize(chunks.size() - 1);
+  parallelFor(num_threads, find_job.roots.size(), findChunk, &find_job);
+
+  vector<Candidate> roots;
+  for (size_t i = 0; i < find_job.roots.size(); i++) {
+    roots.insert(roots.end(), find_job.roots[i].begin(),
+                 find_job.roots[i].end());
+    vector<Candidate>().swap(find_job.roots[i]);
+  }
+  sort(roots.begin(), roots.end(), candidateLess);
+
+  // Subtrees with the same hash are checked against the template of the
+  // first one, as a hash says nothing of values in holes.
+  CheckJob check_job;
+  check_job.binary = binary;
+  check_job.table = table;
+  check_job.roots = &roots;
+  for (size_t i = 0; i < roots.size();) {
+    size_t j = i + 1;
+    while (j < roots.size() && roots[j].hash == roots[i].hash)
+      j++;
+    if (j - i >= 2) {
+      check_job.groups.push_back(Group());
+      check_job.groups.back().begin = i;
+      check_job.groups.back().end = j;
+    }
+    i = j;
+  }
+  parallelFor(num_threads, check_job.groups.size(), checkGroup, &check_job);
+
+  // Templates are numbered in the order of their first copies, which are
+  // often in the same order in the next CU.
+  vector<pair<uint64_t, size_t> > order;
+  for (size_t i = 0; i < check_job.groups.size(); i++) {
+    const Group& group = check_job.groups[i];
+    if (group.copies.size() >= 2)
+      order.push_back(make_pair(group.copies[0].offset, i));
+  }
+  sort(order.begin(), order.end());
+  for (size_t i = 0; i < order.size(); i++) {
+    const Group& group = check_job.groups[order[i].second];
+    table->templates_.insert(table->templates_.end(), group.bytes.begin(),
+                             group.bytes.end());
+    for (size_t j = 0; j < group.copies.size(); j++) {
+      SubtreeCopy copy = group.copies[j];
+      copy.index = i;
+      copy.holes += table->hole_values_.size();
+      table->copies_.push_back(copy);
+    }
+    table->hole_values_.insert(table->hole_values_.end(),
+                               group.values.begin(), group.values.end());
+  }
+  table->num_templates_ = order.size();
+  if (!table->num_templates_) {
+    delete table;
+    return NULL;
+  }
+  sort(table->copies_.begin(), table->copies_.end(), copyLess);
+  table->indexTemplates(binary);
+  return table;
+}
+
+SubtreeTable* SubtreeTable::read(const uint8_t* p, size_t* size) {
+  SubtreeTable* table = new SubtreeTable();
+  memcpy(&table->header_, p, sizeof(table->header_));
+  table->zip_ = p + sizeof(table->header_);
+  table->num_templates_ = table->header_.num_templates;
+  table->loaded_ = false;
+  *size = sizeof(table->header_) + table->header_.zip_size;
+  return table;
+}
+
+void SubtreeTable::write(Binary* binary, uint32_t flags,
+                         vector<uint8_t>* out) {
+  vector<uint8_t> buf;
+  encodeUnits(binary, flags, &templates_[0], templates_.size(), &buf);
+  SubtreesHeader header;
+  header.size = templates_.size();
+  header.zip_size = buf.size();
+  header.num_templates = num_templates_;
+  out->insert(out->end(), (const uint8_t*)&header,
+              (const uint8_t*)(&header + 1));
+  out->insert(out->end(), buf.begin(), buf.end());
+}
+
+void SubtreeTable::load(Binary* binary) {
+  if (__atomic_load_n(&loaded_, __ATOMIC_ACQUIRE))
+    return;
+  pthread_mutex_lock(&mu_);
+  if (!loaded_) {
+    templates_.resize(header_.size);
+    if (templates_.empty() ||
+        decodeUnits(binary, binary->zip_flags, zip_, header_.zip_size,
+                    &templates_[0]) != &templates_[0] + templates_.size())
+      errx(1, "broken templates");
+    indexTemplates(binary);
+    __atomic_store_n(&loaded_, true, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&mu_);
+}
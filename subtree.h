@@ -0,0 +1,141 @@
+#ifndef SUBTREE_H_
+#define SUBTREE_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <vector>
+
+class Binary;
+struct AbbrevKeys;
+struct AbbrevTable;
+
+// Headers included by many CUs put the same types and declarations into
+// each of them, so .debug_info repeats whole subtrees of DIEs which only
+// differ in references to DIEs out of the subtree and in the files they
+// were declared in. Zipped binaries with ZIP_SUBTREES keep each such
+// subtree once as a template, and its copies only refer to it.
+//
+// A template is a synthetic CU with the header of the CU of the first
+// copy, whose unit DIE is the root of the subtree, so templates are coded
+// like any chunk. References into the subtree are rebased to the
+// template, and holes are zero. Holes are references out of the subtree,
+// DW_AT_decl_file and indexes of DWARF 5, whose values differ by copy.
+// The coded templates follow ZipHeader, and the dictionary id with
+// ZIP_DICT, as
+//
+//   SubtreesHeader
+//   the templates coded as a chunk with the flags of ZipHeader
+//
+// Copies are coded in place of their subtrees. See Scanner::scanDIEs.
+// Roots of copies are children of unit DIEs or of namespaces, which are
+// where headers put types, and the abbrevs of each DIE of a copy must be
+// the first ones with the same content in the abbrev table of its CU, so
+// the abbrev numbers of copies follow from the templates.
+struct SubtreesHeader {
+  // The size of the templates.
+  uint64_t size;
+  uint64_t zip_size;
+  uint64_t num_templates;
+};
+
+// A hole of a template, in the context of the attribute.
+struct Hole {
+  uint16_t tag;
+  uint16_t name;
+  uint16_t form;
+};
+
+// The kind of a hole, by which its values are coded.
+enum HoleKind {
+  // The CU offset of the referred DIE, coded from the root of the copy.
+  HOLE_REF,
+  // DW_AT_decl_file, coded from the last one of the CU.
+  HOLE_FILE,
+  // An index, coded from the last one of its IndexKind like other ones.
+  HOLE_INDEX
+};
+
+HoleKind holeKind(const Hole& hole);
+
+// A subtree of .debug_info of a raw binary coded as a copy.
+struct SubtreeCopy {
+  uint64_t offset;
+  uint64_t end;
+  uint32_t index;
+  // The first value of its holes in the hole values of the table.
+  uint32_t holes;
+};
+
+class SubtreeTable {
+public:
+  // Finds the duplicate subtrees of a raw binary with |num_threads|
+  // threads. Returns NULL if there are none worth it.
+  static SubtreeTable* build(Binary* binary, int num_threads);
+
+  // Reads SubtreesHeader at |p| of a zipped binary and keeps the coded
+  // templates, which load() decodes. Sets |size| to the bytes it took.
+  static SubtreeTable* read(const uint8_t* p, size_t* size);
+
+  ~SubtreeTable();
+
+  // Appends SubtreesHeader and the coded templates to |out|.
+  void write(Binary* binary, uint32_t flags, std::vector<uint8_t>* out);
+
+  // Decodes the templates of a zipped binary unless they are decoded.
+  // May be called from multiple threads.
+  void load(Binary* binary);
+
+  size_t num_templates() const {
+    return num_templates_;
+  }
+
+  const std::vector<Hole>& holes(size_t index) const {
+    return holes_[index];
+  }
+
+  // The copies of a built table in the order of offsets.
+  const std::vector<SubtreeCopy>& copies() const {
+    return copies_;
+  }
+
+  const uint64_t* copyHoles(const SubtreeCopy& copy) const {
+    return &hole_values_[copy.holes];
+  }
+
+  // Returns the first copy at |offset| or after it.
+  size_t findCopy(uint64_t offset) const;
+
+  // Writes the bytes of a copy of template |index| whose root is at
+  // |root| of its CU, with |abbrevs| and |holes|, to |out|. Returns the
+  // end, or NULL if the copy can't use the abbrevs of the CU.
+  uint8_t* expand(Binary* binary, size_t index, const AbbrevTable* abbrevs,
+                  uint64_t root, const uint64_t* holes, uint8_t* out);
+
+  // Returns the numbers of the abbrevs of |abbrevs| by their content.
+  const AbbrevKeys* abbrevKeys(const AbbrevTable* abbrevs);
+
+private:
+  SubtreeTable();
+
+  // Sets the offsets, the abbrevs and the holes of the templates.
+  void indexTemplates(Binary* binary);
+
+  std::vector<uint8_t> templates_;
+  size_t num_templates_;
+  std::vector<uint64_t> offsets_;
+  std::vector<const AbbrevTable*> tables_;
+  std::vector<std::vector<Hole> > holes_;
+  std::vector<SubtreeCopy> copies_;
+  std::vector<uint64_t> hole_values_;
+  // The coded templates of a zipped binary until load().
+  const uint8_t* zip_;
+  SubtreesHeader header_;
+  bool loaded_;
+  pthread_mutex_t mu_;
+  std::map<const AbbrevTable*, AbbrevKeys*> keys_;
+};
+
+#endif  // SUBTREE_H_
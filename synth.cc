@@ -0,0 +1,778 @@
+#include "synth.h"
+
+#include <dwarf.h>
+#include <elf.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "leb128.h"
+
+using namespace std;
+
+// CUs are kept far from the lengths which escape to 64-bit DWARF.
+static const uint64_t MAX_CU_SIZE = 1ull << 30;
+// The first offset of .debug_line which 32-bit DWARF can't refer to.
+static const uint64_t MAX_OFFSET32 = 1ull << 32;
+
+static const uint32_t NUM_NAMES = 8192;
+static const uint32_t NUM_FILES = 4096;
+// Types of shared headers, of which the first ones are the most common.
+static const uint32_t NUM_SHARED = 1024;
+static const uint64_t TEXT_ADDRESS = 0x401000;
+static const uint64_t DATA_ADDRESS = 0x10000000;
+
+// The sections of generated binaries in the order of offsets.
+enum {
+  SECTION_ABBREV = 1,
+  SECTION_INFO,
+  SECTION_LINE,
+  SECTION_STR,
+  SECTION_SHSTRTAB,
+  NUM_SECTIONS
+};
+
+static const char* SECTION_NAMES[NUM_SECTIONS] = {
+  "", ".debug_abbrev", ".debug_info", ".debug_line", ".debug_str",
+  ".shstrtab"
+};
+
+enum {
+  ABBREV_CU = 1,
+  ABBREV_BASE_TYPE,
+  ABBREV_STRUCT,
+  ABBREV_MEMBER,
+  ABBREV_POINTER,
+  ABBREV_TYPEDEF,
+  ABBREV_FUNC,
+  ABBREV_PARAM,
+  ABBREV_LOCAL,
+  ABBREV_VAR,
+  ABBREV_ENUM,
+  ABBREV_ENUMERATOR
+};
+
+// The tag, whether it has children, and the name and the form of each
+// attribute, in the order of abbrev numbers.
+static const uint16_t ABBREVS[][24] = {
+  { DW_TAG_compile_unit, 1,
+    DW_AT_producer, DW_FORM_strp, DW_AT_language, DW_FORM_data2,
+    DW_AT_name, DW_FORM_strp, DW_AT_comp_dir, DW_FORM_strp,
+    DW_AT_low_pc, DW_FORM_addr, DW_AT_high_pc, DW_FORM_data8,
+    DW_AT_stmt_list, DW_FORM_sec_offset, 0 },
+  { DW_TAG_base_type, 0,
+    DW_AT_name, DW_FORM_strp, DW_AT_encoding, DW_FORM_data1,
+    DW_AT_byte_size, DW_FORM_data1, 0 },
+  { DW_TAG_structure_type, 1,
+    DW_AT_name, DW_FORM_strp, DW_AT_byte_size, DW_FORM_data2,
+    DW_AT_decl_file, DW_FORM_data1, DW_AT_decl_line, DW_FORM_data2,
+    DW_AT_sibling, DW_FORM_ref4, 0 },
+  { DW_TAG_member, 0,
+    DW_AT_name, DW_FORM_strp, DW_AT_decl_file, DW_FORM_data1,
+    DW_AT_decl_line, DW_FORM_data2, DW_AT_type, DW_FORM_ref4,
+    DW_AT_data_member_location, DW_FORM_data2, 0 },
+  { DW_TAG_pointer_type, 0,
+    DW_AT_byte_size, DW_FORM_data1, DW_AT_type, DW_FORM_ref4, 0 },
+  { DW_TAG_typedef, 0,
+    DW_AT_name, DW_FORM_strp, DW_AT_decl_file, DW_FORM_data1,
+    DW_AT_decl_line, DW_FORM_data2, DW_AT_type, DW_FORM_ref4, 0 },
+  { DW_TAG_subprogram, 1,
+    DW_AT_external, DW_FORM_flag_present, DW_AT_name, DW_FORM_strp,
+    DW_AT_decl_file, DW_FORM_data1, DW_AT_decl_line, DW_FORM_data2,
+    DW_AT_type, DW_FORM_ref4, DW_AT_low_pc, DW_FORM_addr,
+    DW_AT_high_pc, DW_FORM_data8, DW_AT_frame_base, DW_FORM_exprloc,
+    DW_AT_sibling, DW_FORM_ref4, 0 },
+  { DW_TAG_formal_parameter, 0,
+    DW_AT_name, DW_FORM_strp, DW_AT_decl_file, DW_FORM_data1,
+    DW_AT_decl_line, DW_FORM_data2, DW_AT_type, DW_FORM_ref4,
+    DW_AT_location, DW_FORM_exprloc, 0 },
+  { DW_TAG_variable, 0,
+    DW_AT_name, DW_FORM_strp, DW_AT_decl_file, DW_FORM_data1,
+    DW_AT_decl_line, DW_FORM_data2, DW_AT_type, DW_FORM_ref4,
+    DW_AT_location, DW_FORM_exprloc, 0 },
+  { DW_TAG_variable, 0,
+    DW_AT_name, DW_FORM_strp, DW_AT_decl_file, DW_FORM_data1,
+    DW_AT_decl_line, DW_FORM_data2, DW_AT_type, DW_FORM_ref4,
+    DW_AT_external, DW_FORM_flag_present, DW_AT_location, DW_FORM_exprloc,
+    0 },
+  { DW_TAG_enumeration_type, 1,
+    DW_AT_name, DW_FORM_strp, DW_AT_byte_size, DW_FORM_data1,
+    DW_AT_type, DW_FORM_ref4, DW_AT_decl_file, DW_FORM_data1,
+    DW_AT_decl_line, DW_FORM_data2, 0 },
+  { DW_TAG_enumerator, 0,
+    DW_AT_name, DW_FORM_strp, DW_AT_const_value, DW_FORM_sdata, 0 },
+};
+
+static const char* BASE_TYPES[] = {
+  "int", "char", "long int", "unsigned int", "float", "double"
+};
+static const uint8_t BASE_ENCODINGS[] = {
+  DW_ATE_signed, DW_ATE_signed_char, DW_ATE_signed, DW_ATE_unsigned,
+  DW_ATE_float, DW_ATE_float
+};
+static const uint8_t BASE_SIZES[] = { 4, 1, 8, 4, 4, 8 };
+static const size_t NUM_BASE_TYPES = sizeof(BASE_SIZES);
+
+static const char* SYLLABLES[] = {
+  "buf", "ctx", "get", "set", "node", "map", "key", "val", "len", "ptr",
+  "list", "item", "init", "read", "write", "state", "next", "size", "data",
+  "info", "hash", "table", "cache", "entry"
+};
+static const size_t NUM_SYLLABLES = sizeof(SYLLABLES) / sizeof(SYLLABLES[0]);
+
+// The line program header of DWARF 4 compilers emit.
+static const int8_t LINE_BASE = -5;
+static const uint8_t LINE_RANGE = 14;
+static const uint8_t OPCODE_BASE = 13;
+static const uint8_t STANDARD_OPCODE_LENGTHS[OPCODE_BASE - 1] = {
+  0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1
+};
+
+template <class T>
+static void append(vector<uint8_t>* out, const T& v) {
+  out->insert(out->end(), (const uint8_t*)&v, (const uint8_t*)&v + sizeof(v));
+}
+
+static void appendUleb(vector<uint8_t>* out, uint64_t v) {
+  uint8_t buf[16];
+  uint8_t* p = buf;
+  uleb128o(v, p);
+  out->insert(out->end(), buf, p);
+}
+
+static void appendSleb(vector<uint8_t>* out, int64_t v) {
+  uint8_t buf[16];
+  uint8_t* p = buf;
+  sleb128o(v, p);
+  out->insert(out->end(), buf, p);
+}
+
+static void appendString(vector<uint8_t>* out, const char* s) {
+  out->insert(out->end(), s, s + strlen(s) + 1);
+}
+
+// splitmix64, whose consecutive seeds give unrelated streams.
+class Rng {
+public:
+  explicit Rng(uint64_t seed)
+    : s_(seed) {
+  }
+
+  uint64_t next() {
+    uint64_t z = (s_ += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+
+  // Returns a value in [0, n).
+  uint32_t below(uint32_t n) {
+    return ((next() >> 32) * n) >> 32;
+  }
+
+private:
+  uint64_t s_;
+};
+
+// The seed of stream |stream| of |seed|, such as the one of a CU.
+static uint64_t streamSeed(uint64_t seed, uint64_t stream) {
+  Rng rng(seed ^ (stream * 0xff51afd7ed558ccdull));
+  return rng.next();
+}
+
+// .debug_str, whose offsets are known before any CU.
+struct SynthStrings {
+  vector<char> bytes;
+  uint32_t producer;
+  uint32_t comp_dir;
+  uint32_t base_types[NUM_BASE_TYPES];
+  vector<uint32_t> names;
+  vector<uint32_t> files;
+
+  uint32_t add(const string& s) {
+    uint32_t offset = bytes.size();
+    bytes.insert(bytes.end(), s.c_str(), s.c_str() + s.size() + 1);
+    return offset;
+  }
+};
+
+static void makeStrings(uint64_t seed, SynthStrings* strings) {
+  Rng rng(streamSeed(seed, 0));
+  strings->producer = strings->add("dwarfbench synthetic DWARF 4");
+  strings->comp_dir = strings->add("/src/synthetic");
+  for (size_t i = 0; i < NUM_BASE_TYPES; i++)
+    strings->base_types[i] = strings->add(BASE_TYPES[i]);
+  vector<string> names;
+  for (uint32_t i = 0; i < NUM_NAMES; i++) {
+    string name = SYLLABLES[rng.below(NUM_SYLLABLES)];
+    for (uint32_t n = rng.below(3); n > 0; n--) {
+      name += "_";
+      name += SYLLABLES[rng.below(NUM_SYLLABLES)];
+    }
+    names.push_back(name);
+    strings->names.push_back(strings->add(name));
+  }
+  for (uint32_t i = 0; i < NUM_FILES; i++) {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "%u.cc", i);
+    strings->files.push_back(
+        strings->add("src/" + names[i % NUM_NAMES] + suffix));
+  }
+}
+
+// The unused abbrevs are copies of the last one.
+static void makeAbbrevs(uint32_t num_unused, vector<uint8_t>* out) {
+  size_t num_abbrevs = sizeof(ABBREVS) / sizeof(ABBREVS[0]);
+  for (size_t n = 1; n < num_abbrevs + num_unused + 1; n++) {
+    size_t i = 0;
+    if (n > num_unused + 1)
+      i = n - num_unused - 1;
+    else if (n > 1)
+      i = num_abbrevs - 1;
+    const uint16_t* a = ABBREVS[i];
+    appendUleb(out, n);
+    appendUleb(out, a[0]);
+    out->push_back(a[1] ? DW_CHILDREN_yes : DW_CHILDREN_no);
+    for (a += 2; *a; a += 2) {
+      appendUleb(out, a[0]);
+      appendUleb(out, a[1]);
+    }
+    out->push_back(0);
+    out->push_back(0);
+  }
+  out->push_back(0);
+}
+
+// Generates CUs in order. Addresses go on across CUs.
+class CUGenerator {
+public:
+  CUGenerator(const SynthOptions& options, const SynthStrings& strings)
+    : options_(options),
+      strings_(strings),
+      out_(NULL),
+      lines_(NULL),
+      dwarf64_(false),
+      rng_(0),
+      pc_(TEXT_ADDRESS),
+      data_(DATA_ADDRESS),
+      num_dies_(0),
+      total_weight_(0),
+      shared_seen_(NUM_SHARED) {
+    for (int i = 0; i < NUM_SYNTH_KINDS; i++)
+      total_weight_ += options.weights[i];
+  }
+
+  uint64_t num_dies() const {
+    return num_dies_;
+  }
+
+  // Replaces |out| with CU |index| of at least |budget| bytes, or of
+  // only the unit DIE and base types if they're bigger, and |lines| with
+  // its line program, which will be at |line_offset| of .debug_line. The
+  // CU and its line program are 64-bit DWARF from dwarf64_offset of the
+  // options, or from 4 GiB of .debug_line, on.
+  void generate(uint32_t index, uint64_t budget, uint64_t line_offset,
+                vector<uint8_t>* out, vector<uint8_t>* lines) {
+    out_ = out;
+    out_->clear();
+    lines_ = lines;
+    // A 32-bit stmt_list can't refer past MAX_OFFSET32.
+    dwarf64_ = line_offset >= min(options_.dwarf64_offset, MAX_OFFSET32);
+    rng_ = Rng(streamSeed(options_.seed, index + 1));
+    types_.clear();
+    shared_seen_.assign(NUM_SHARED, false);
+    num_files_ = 1 + rng_.below(30);
+    line_ = 1;
+    startLines();
+
+    size_t length = startUnit(out_);
+    u16(4);
+    sectionOffset(0);
+    u8(8);
+    die(ABBREV_CU);
+    sectionOffset(strings_.producer);
+    u16(DW_LANG_C_plus_plus);
+    sectionOffset(strings_.files[index % NUM_FILES]);
+    sectionOffset(strings_.comp_dir);
+    u64(pc_);
+    size_t high_pc = out_->size();
+    u64(0);
+    sectionOffset(line_offset);
+    uint64_t low_pc = pc_;
+
+    for (size_t i = 0; i < NUM_BASE_TYPES; i++) {
+      types_.push_back(out_->size());
+      die(ABBREV_BASE_TYPE);
+      sectionOffset(strings_.base_types[i]);
+      u8(BASE_ENCODINGS[i]);
+      u8(BASE_SIZES[i]);
+    }
+
+    while (out_->size() < budget) {
+      if (rng_.below(100) < options_.shared_percent && sharedType())
+        continue;
+      uint32_t w = rng_.below(total_weight_);
+      int kind = 0;
+      while (w >= options_.weights[kind])
+        w -= options_.weights[kind++];
+      switch (kind) {
+      case SYNTH_STRUCT:
+        structType(&rng_, file(), &line_, true);
+        break;
+      case SYNTH_FUNC:
+        func();
+        break;
+      case SYNTH_VAR:
+        var();
+        break;
+      case SYNTH_ENUM:
+        enumType(&rng_, file(), &line_);
+        break;
+      }
+    }
+    u8(0);
+
+    endUnit(out_, length);
+    endUnit(lines_, line_length_);
+    uint64_t size = pc_ - low_pc;
+    memcpy(&(*out_)[high_pc], &size, sizeof(size));
+  }
+
+private:
+  void u8(uint8_t v) {
+    out_->push_back(v);
+  }
+
+  void u16(uint16_t v) {
+    append(out_, v);
+  }
+
+  void u32(uint32_t v) {
+    append(out_, v);
+  }
+
+  void u64(uint64_t v) {
+    append(out_, v);
+  }
+
+  void sleb(int64_t v) {
+    appendSleb(out_, v);
+  }
+
+  static void patch32(vector<uint8_t>* out, size_t offset, uint32_t v) {
+    memcpy(&(*out)[offset], &v, sizeof(v));
+  }
+
+  // A section offset, such as of a string, in the format of the CU.
+  void sectionOffset(uint64_t v) {
+    appendOffset(out_, v);
+  }
+
+  void appendOffset(vector<uint8_t>* out, uint64_t v) {
+    if (dwarf64_)
+      append(out, v);
+    else
+      append(out, (uint32_t)v);
+  }
+
+  void patchOffset(vector<uint8_t>* out, size_t offset, uint64_t v) {
+    if (dwarf64_)
+      memcpy(&(*out)[offset], &v, sizeof(v));
+    else
+      patch32(out, offset, v);
+  }
+
+  // Starts a unit in |out|, whose length endUnit() patches at the
+  // returned offset. 64-bit units escape the length with 0xffffffff.
+  size_t startUnit(vector<uint8_t>* out) {
+    if (dwarf64_)
+      append(out, (uint32_t)0xffffffff);
+    size_t length = out->size();
+    appendOffset(out, 0);
+    return length;
+  }
+
+  void endUnit(vector<uint8_t>* out, size_t length) {
+    size_t size = dwarf64_ ? 8 : 4;
+    patchOffset(out, length, out->size() - length - size);
+  }
+
+  // Starts the line program of the CU with a file for each decl_file.
+  void startLines() {
+    lines_->clear();
+    line_length_ = startUnit(lines_);
+    append(lines_, (uint16_t)4);
+    size_t header_length = lines_->size();
+    appendOffset(lines_, 0);
+    size_t header_start = lines_->size();
+    lines_->push_back(1);
+    lines_->push_back(1);
+    lines_->push_back(1);
+    lines_->push_back(LINE_BASE);
+    lines_->push_back(LINE_RANGE);
+    lines_->push_back(OPCODE_BASE);
+    lines_->insert(lines_->end(), STANDARD_OPCODE_LENGTHS,
+                   STANDARD_OPCODE_LENGTHS + OPCODE_BASE - 1);
+    appendString(lines_, "include");
+    lines_->push_back(0);
+    for (uint32_t i = 1; i <= num_files_; i++) {
+      char name[16];
+      snprintf(name, sizeof(name), "file%u.h", i);
+      appendString(lines_, name);
+      appendUleb(lines_, 1);
+      appendUleb(lines_, 0);
+      appendUleb(lines_, 0);
+    }
+    lines_->push_back(0);
+    patchOffset(lines_, header_length, lines_->size() - header_start);
+  }
+
+  // Adds a sequence of |size| bytes at |pc| from |line| of |file|, with
+  // rows every few instructions.
+  void addSequence(uint64_t pc, uint64_t size, uint8_t file, uint16_t line) {
+    lines_->push_back(0);
+    appendUleb(lines_, 1 + sizeof(pc));
+    lines_->push_back(DW_LNE_set_address);
+    append(lines_, pc);
+    if (file != 1) {
+      lines_->push_back(DW_LNS_set_file);
+      appendUleb(lines_, file);
+    }
+    lines_->push_back(DW_LNS_advance_line);
+    appendSleb(lines_, line - 1);
+    lines_->push_back(DW_LNS_copy);
+    uint64_t offset = 0;
+    for (;;) {
+      uint32_t advance = 1 + rng_.below(8);
+      if (offset + advance >= size)
+        break;
+      offset += advance;
+      int line_advance = rng_.below(4);
+      lines_->push_back(line_advance - LINE_BASE + LINE_RANGE * advance +
+                        OPCODE_BASE);
+    }
+    lines_->push_back(DW_LNS_advance_pc);
+    appendUleb(lines_, size - offset);
+    lines_->push_back(0);
+    appendUleb(lines_, 1);
+    lines_->push_back(DW_LNE_end_sequence);
+  }
+
+  void die(uint32_t abbrev) {
+    if (abbrev != ABBREV_CU)
+      abbrev += options_.num_unused_abbrevs;
+    appendUleb(out_, abbrev);
+    num_dies_++;
+  }
+
+  uint32_t name(Rng* rng) {
+    return strings_.names[rng->below(NUM_NAMES)];
+  }
+
+  uint8_t file() {
+    return 1 + rng_.below(num_files_);
+  }
+
+  // Advances |line| like declarations which follow each other.
+  static uint16_t nextLine(Rng* rng, uint16_t* line) {
+    *line = (*line + 1 + rng->below(20)) & 0xffff;
+    return *line;
+  }
+
+  uint16_t line() {
+    return nextLine(&rng_, &line_);
+  }
+
+  uint32_t type() {
+    return types_[rng_.below(types_.size())];
+  }
+
+  // A stack slot as DW_OP_fbreg.
+  void fbreg(int64_t offset) {
+    uint8_t buf[16];
+    uint8_t* p = buf;
+    sleb128o(offset, p);
+    u8(1 + (p - buf));
+    u8(DW_OP_fbreg);
+    out_->insert(out_->end(), buf, p);
+  }
+
+  // Types of shared headers only refer to base types, whose offsets are
+  // the same in each CU, so their subtrees have the same bytes wherever
+  // they are. Returns false if the picked one is already in the CU.
+  bool sharedType() {
+    // Squaring the pick makes the first types the most common.
+    uint32_t index = rng_.below(rng_.below(NUM_SHARED) + 1);
+    if (shared_seen_[index])
+      return false;
+    shared_seen_[index] = true;
+    Rng rng(streamSeed(options_.seed, (1ull << 32) + index));
+    uint8_t decl_file = 1 + rng.below(num_files_);
+    uint16_t line = rng.below(1000);
+    if (rng.below(4))
+      structType(&rng, decl_file, &line, false);
+    else
+      enumType(&rng, decl_file, &line);
+    return true;
+  }
+
+  void structType(Rng* rng, uint8_t decl_file, uint16_t* line,
+                  bool local) {
+    size_t offset = out_->size();
+    die(ABBREV_STRUCT);
+    sectionOffset(name(rng));
+    size_t byte_size = out_->size();
+    u16(0);
+    u8(decl_file);
+    u16(nextLine(rng, line));
+    size_t sibling = out_->size();
+    u32(0);
+    uint16_t member_offset = 0;
+    for (uint32_t n = 1 + rng->below(10); n > 0; n--) {
+      uint32_t t = rng->below(NUM_BASE_TYPES);
+      die(ABBREV_MEMBER);
+      sectionOffset(name(rng));
+      u8(decl_file);
+      u16(nextLine(rng, line));
+      u32(local ? type() : types_[t]);
+      u16(member_offset);
+      member_offset += 8;
+    }
+    u8(0);
+    uint16_t size = member_offset;
+    memcpy(&(*out_)[byte_size], &size, sizeof(size));
+    patch32(out_, sibling, out_->size());
+    types_.push_back(offset);
+
+    if (!local)
+      return;
+    if (rng->below(2)) {
+      types_.push_back(out_->size());
+      die(ABBREV_POINTER);
+      u8(8);
+      u32(offset);
+    }
+    if (!rng->below(3)) {
+      types_.push_back(out_->size());
+      die(ABBREV_TYPEDEF);
+      sectionOffset(name(rng));
+      u8(decl_file);
+      u16(nextLine(rng, line));
+      u32(offset);
+    }
+  }
+
+  void enumType(Rng* rng, uint8_t decl_file, uint16_t* line) {
+    types_.push_back(out_->size());
+    die(ABBREV_ENUM);
+    sectionOffset(name(rng));
+    u8(4);
+    u32(types_[0]);
+    u8(decl_file);
+    u16(nextLine(rng, line));
+    int64_t value = rng->below(2) ? -1 : 0;
+    for (uint32_t n = 2 + rng->below(12); n > 0; n--) {
+      die(ABBREV_ENUMERATOR);
+      sectionOffset(name(rng));
+      value += 1 + rng->below(4);
+      sleb(value);
+    }
+    u8(0);
+  }
+
+  void func() {
+    uint8_t decl_file = file();
+    uint64_t size = 16 + rng_.below(512);
+    uint16_t decl_line = line();
+    addSequence(pc_, size, decl_file, decl_line);
+    die(ABBREV_FUNC);
+    sectionOffset(name(&rng_));
+    u8(decl_file);
+    u16(decl_line);
+    u32(type());
+    u64(pc_);
+    u64(size);
+    u8(1);
+    u8(DW_OP_call_frame_cfa);
+    size_t sibling = out_->size();
+    u32(0);
+    int64_t slot = -24;
+    for (uint32_t n = rng_.below(5); n > 0; n--, slot -= 8) {
+      die(ABBREV_PARAM);
+      sectionOffset(name(&rng_));
+      u8(decl_file);
+      u16(line());
+      u32(type());
+      fbreg(slot);
+    }
+    for (uint32_t n = rng_.below(8); n > 0; n--, slot -= 8) {
+      die(ABBREV_LOCAL);
+      sectionOffset(name(&rng_));
+      u8(decl_file);
+      u16(line());
+      u32(type());
+      fbreg(slot);
+    }
+    u8(0);
+    patch32(out_, sibling, out_->size());
+    pc_ += (size + 15) & ~15ull;
+  }
+
+  void var() {
+    die(ABBREV_VAR);
+    sectionOffset(name(&rng_));
+    u8(file());
+    u16(line());
+    u32(type());
+    u8(9);
+    u8(DW_OP_addr);
+    u64(data_);
+    data_ += 8;
+  }
+
+  const SynthOptions& options_;
+  const SynthStrings& strings_;
+  vector<uint8_t>* out_;
+  vector<uint8_t>* lines_;
+  // Whether the CU is 64-bit DWARF, and where the length of its line
+  // program is.
+  bool dwarf64_;
+  size_t line_length_;
+  Rng rng_;
+  uint64_t pc_;
+  uint64_t data_;
+  uint64_t num_dies_;
+  uint32_t total_weight_;
+  uint32_t num_files_;
+  uint16_t line_;
+  // The CU offsets of the types the CU has so far.
+  vector<uint32_t> types_;
+  vector<bool> shared_seen_;
+};
+
+void initSynthOptions(SynthOptions* options) {
+  options->size = 16 << 20;
+  options->num_cus = 64;
+  options->weights[SYNTH_STRUCT] = 4;
+  options->weights[SYNTH_FUNC] = 4;
+  options->weights[SYNTH_VAR] = 1;
+  options->weights[SYNTH_ENUM] = 1;
+  options->shared_percent = 50;
+  options->num_unused_abbrevs = 0;
+  options->seed = 1;
+  options->dwarf64_offset = MAX_OFFSET32;
+}
+
+static void writeBytes(FILE* fp, const void* p, size_t size,
+                       uint64_t* offset) {
+  fwrite(p, 1, size, fp);
+  *offset += size;
+}
+
+uint64_t writeSynthBinary(const char* filename, const SynthOptions& options,
+                          uint64_t* num_dies) {
+  uint32_t total_weight = 0;
+  for (int i = 0; i < NUM_SYNTH_KINDS; i++)
+    total_weight += options.weights[i];
+  if (!total_weight)
+    errx(1, "no kind of DIEs to generate");
+  if (!options.num_cus)
+    errx(1, "no CUs to generate");
+  if (options.size / options.num_cus >= MAX_CU_SIZE)
+    errx(1, "CUs of %lu bytes are too big, use more CUs",
+         options.size / options.num_cus);
+
+  FILE* fp = fopen(filename, "wb");
+  if (!fp)
+    err(1, "open failed: %s", filename);
+  // .debug_line comes after .debug_info, so it's kept aside as CUs are
+  // generated.
+  FILE* lines_fp = tmpfile();
+  if (!lines_fp)
+    err(1, "tmpfile failed");
+
+  Elf64_Shdr shdrs[NUM_SECTIONS];
+  memset(shdrs, 0, sizeof(shdrs));
+  string shstrtab(1, '\0');
+  for (int i = 1; i < NUM_SECTIONS; i++) {
+    shdrs[i].sh_name = shstrtab.size();
+    shdrs[i].sh_type = i == SECTION_SHSTRTAB ? SHT_STRTAB : SHT_PROGBITS;
+    shdrs[i].sh_addralign = 1;
+    shstrtab += SECTION_NAMES[i];
+    shstrtab += '\0';
+  }
+  shdrs[SECTION_STR].sh_flags = SHF_MERGE | SHF_STRINGS;
+  shdrs[SECTION_STR].sh_entsize = 1;
+
+  // The ELF header is written last, when the section headers are known.
+  Elf64_Ehdr ehdr;
+  memset(&ehdr, 0, sizeof(ehdr));
+  uint64_t offset = 0;
+  writeBytes(fp, &ehdr, sizeof(ehdr), &offset);
+
+  vector<uint8_t> abbrevs;
+  makeAbbrevs(options.num_unused_abbrevs, &abbrevs);
+  shdrs[SECTION_ABBREV].sh_offset = offset;
+  writeBytes(fp, &abbrevs[0], abbrevs.size(), &offset);
+
+  SynthStrings strings;
+  makeStrings(options.seed, &strings);
+  CUGenerator gen(options, strings);
+  vector<uint8_t> cu, lines;
+  uint64_t lines_size = 0;
+  shdrs[SECTION_INFO].sh_offset = offset;
+  for (uint32_t i = 0; i < options.num_cus; i++) {
+    uint64_t budget = options.size / options.num_cus +
+        (i < options.size % options.num_cus);
+    gen.generate(i, budget, lines_size, &cu, &lines);
+    writeBytes(fp, &cu[0], cu.size(), &offset);
+    writeBytes(lines_fp, &lines[0], lines.size(), &lines_size);
+  }
+
+  shdrs[SECTION_LINE].sh_offset = offset;
+  rewind(lines_fp);
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), lines_fp)) > 0)
+    writeBytes(fp, buf, n, &offset);
+  if (ferror(lines_fp))
+    err(1, "tmpfile read failed");
+  fclose(lines_fp);
+
+  shdrs[SECTION_STR].sh_offset = offset;
+  writeBytes(fp, &strings.bytes[0], strings.bytes.size(), &offset);
+  shdrs[SECTION_SHSTRTAB].sh_offset = offset;
+  writeBytes(fp, shstrtab.c_str(), shstrtab.size(), &offset);
+  for (int i = 1; i < NUM_SECTIONS; i++) {
+    uint64_t end = i + 1 < NUM_SECTIONS ? shdrs[i + 1].sh_offset : offset;
+    shdrs[i].sh_size = end - shdrs[i].sh_offset;
+  }
+
+  static const char PADDING[8] = {};
+  writeBytes(fp, PADDING, -offset & 7, &offset);
+  ehdr.e_shoff = offset;
+  writeBytes(fp, shdrs, sizeof(shdrs), &offset);
+
+  memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+  ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+  ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr.e_type = ET_REL;
+  ehdr.e_machine = EM_X86_64;
+  ehdr.e_version = EV_CURRENT;
+  ehdr.e_ehsize = sizeof(ehdr);
+  ehdr.e_shentsize = sizeof(Elf64_Shdr);
+  ehdr.e_shnum = NUM_SECTIONS;
+  ehdr.e_shstrndx = SECTION_SHSTRTAB;
+  if (fseeko(fp, 0, SEEK_SET) < 0)
+    err(1, "seek failed: %s", filename);
+  fwrite(&ehdr, sizeof(ehdr), 1, fp);
+  if (ferror(fp) || fclose(fp))
+    err(1, "write failed: %s", filename);
+  *num_dies = gen.num_dies();
+  return shdrs[SECTION_INFO].sh_size;
+}
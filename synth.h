@@ -0,0 +1,53 @@
+#ifndef SYNTH_H_
+#define SYNTH_H_
+
+#include <stdint.h>
+
+// The kinds of DIEs the generator puts at the top level of CUs.
+enum SynthKind {
+  // Structs with members, and pointers and typedefs of some of them.
+  SYNTH_STRUCT,
+  // Functions with parameters and local variables.
+  SYNTH_FUNC,
+  // Global variables.
+  SYNTH_VAR,
+  // Enums with enumerators.
+  SYNTH_ENUM,
+  NUM_SYNTH_KINDS
+};
+
+struct SynthOptions {
+  // The size of .debug_info, which the generated one reaches by up to a
+  // top level DIE per CU.
+  uint64_t size;
+  uint32_t num_cus;
+  // The relative weights of each SynthKind.
+  uint32_t weights[NUM_SYNTH_KINDS];
+  // The percentage of top level DIEs which are types of shared headers,
+  // the same in each CU which has them.
+  uint32_t shared_percent;
+  // The number of abbrevs no DIE uses which are numbered after the unit
+  // DIE and before the others, as in a table of a producer which numbers
+  // abbrevs by first use and shares the table between CUs.
+  uint32_t num_unused_abbrevs;
+  uint64_t seed;
+  // The offset of .debug_line from which CUs and their line programs are
+  // 64-bit DWARF. It's at most 4 GiB, where 32-bit stmt_lists end.
+  uint64_t dwarf64_offset;
+};
+
+// Sets the defaults: 16MB in 64 CUs, with a mix of kinds and shared types
+// like C++ code has.
+void initSynthOptions(SynthOptions* options);
+
+// Writes a 64-bit ELF relocatable with .debug_abbrev, .debug_info of
+// DWARF 4 CUs, .debug_line and .debug_str to |filename|. The same options
+// and seed always make the same bytes. CUs are generated one at a time, so
+// only one of them is in memory. As CUs switch to 64-bit DWARF when their
+// line programs start past 4 GiB, the size is only bounded by the 1 GiB of
+// each CU times the number of CUs. Returns the size of .debug_info and
+// sets |num_dies|.
+uint64_t writeSynthBinary(const char* filename, const SynthOptions& options,
+                          uint64_t* num_dies);
+
+#endif  // SYNTH_H_
@@ -0,0 +1,638 @@
+#include "zipscanner.h"
+
+#include <dwarf.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "addrindex.h"
+#include "binary.h"
+#include "dict.h"
+#include "entropy.h"
+#include "leb128.h"
+#include "rans.h"
+#include "streams.h"
+#include "strpool.h"
+#include "subtree.h"
+
+using namespace std;
+
+ZipScanner::ZipScanner(Binary* binary, uint8_t* out, uint32_t flags)
+  : Scanner<ZipScanner>(binary),
+    p_(out),
+    last_offset_(0),
+    cu_out_(NULL),
+    cu_cnt_(0),
+    verbose_(false),
+    last_values_(flags & 3),
+    last_file_(0),
+    code_copies_(false),
+    next_copy_(0),
+    units_(NULL),
+    unit_abbrev_(NULL),
+    unit_attr_(0),
+    unit_next_(false),
+    predict_refs_(flags & ZIP_PREDICT),
+    abbrev_ranks_(NULL),
+    bases_(NULL) {
+}
+
+void ZipScanner::finish() {
+  if (predict_refs_)
+    p_ = refs_.finish(cu_out_, p_);
+}
+
+void ZipScanner::codeCopiesFrom(uint64_t offset) {
+  if (!binary_->subtrees)
+    return;
+  code_copies_ = true;
+  next_copy_ = binary_->subtrees->findCopy(offset);
+}
+
+void ZipScanner::onCU(const CU* cu, uint64_t offset) {
+  if (verbose_) {
+    fprintf(stderr, "CU: %d @0x%lx len=%lx version=%x ptrsize=%x\n",
+            cu_cnt_, last_offset_, cu->length, cu->version, cu->ptrsize);
+  }
+
+  finish();
+  cu_offset_ = offset - cu->header_size;
+  cu_out_ = p_;
+  memcpy(p_, input_ + offset - cu->header_size, cu->header_size);
+  p_ += cu->header_size;
+  // Abbrev offsets of chunks with ZIP_REBASED are in the side data.
+  if (bases_ && abbrev_offsets_) {
+    bases_->nextCU();
+    writeAbbrevOffset(cu_out_, *cu, cu->abbrev_offset);
+  } else if (bases_) {
+    bases_->addCU(cu->abbrev_offset);
+    writeAbbrevOffset(cu_out_, *cu, 0);
+  }
+
+  last_values_.reset();
+  memset(last_indexes_, 0, sizeof(last_indexes_));
+  last_file_ = 0;
+  // Delta coded CUs are read by their ranks.
+  abbrev_ranks_ = !abbrev_numbers_ && binary_->abbrev_order ?
+    binary_->abbrev_order->ranks(cu->abbrev_offset) : NULL;
+  if (predict_refs_) {
+    refs_.reset();
+    parents_.clear();
+  }
+
+  if (units_) {
+    UnitAddrs unit;
+    initUnitAddrs(&unit, *cu, cu_offset_);
+    units_->push_back(unit);
+    unit_next_ = true;
+  }
+
+  cu_cnt_++;
+  last_offset_ = offset;
+}
+
+void ZipScanner::onAbbrev(uint64_t number, const Abbrev* abbrev,
+                          uint64_t offset) {
+  if (predict_refs_) {
+    // A null entry ends the children of the last parent.
+    if (!abbrev) {
+      if (!parents_.empty())
+        parents_.pop_back();
+    } else {
+      die_.raw = last_offset_ - cu_offset_;
+      die_.zipped = p_ - cu_out_;
+      if (parents_.empty()) {
+        parent_.raw = parent_.zipped = 0;
+      } else {
+        parent_ = parents_.back();
+      }
+      if (abbrev->has_children)
+        parents_.push_back(die_);
+    }
+  }
+  uleb128o(abbrev_ranks_ ? abbrev_ranks_[number] : number, p_);
+  if (abbrev)
+    last_values_.setDIE(number, abbrev->tag);
+  if (units_) {
+    unit_abbrev_ = unit_next_ ? abbrev : NULL;
+    unit_attr_ = 0;
+    unit_next_ = false;
+  }
+
+  //fprintf(stderr, "abbr %lu @%lx\n", number, last_offset_);
+  last_offset_ = offset;
+}
+
+template <bool kZipped>
+void ZipScanner::onIndex(uint16_t form, uint64_t value) {
+  uint64_t& last = last_indexes_[indexKind(form)];
+  if (kZipped) {
+    uint64_t v = last + value;
+    int size = indexSize(form);
+    if (size) {
+      memcpy(p_, &v, size);
+      p_ += size;
+    } else {
+      uleb128o(v, p_);
+    }
+    last = v;
+  } else {
+    sleb128o(value - last, p_);
+    last = value;
+  }
+}
+
+// The offsets of raw CUs are in the input, and those of delta coded ones
+// are in the output, where the CU is restored.
+template <bool kZipped>
+void ZipScanner::onRef(uint16_t name, uint64_t value) {
+  uint64_t& last = last_values_.get(name);
+  if (kZipped) {
+    int32_t v = refs_.decode(name, value, last, die_.zipped,
+                             parent_.zipped);
+    memcpy(p_, &v, 4);
+    p_ += 4;
+    last = v;
+  } else {
+    int32_t v = static_cast<int32_t>(value);
+    int32_t diff = v - static_cast<int32_t>(last);
+    refs_.encode(name, v, diff, die_.raw, parent_.raw, cu_out_, p_);
+    last = v;
+  }
+}
+
+// Strings of a pool are delta coded by their entries, in the same slots
+// as other values of the attribute.
+template <bool kZipped, int kOffsetSize>
+void ZipScanner::onString(uint16_t name, uint16_t form, uint64_t value) {
+  const StringPool* pool = binary_->string_pool;
+  uint64_t& last = last_values_.get(name);
+  if (kZipped) {
+    uint64_t entry = last + value;
+    if (form == DW_FORM_strp) {
+      uint64_t offset = pool->entryOffset(entry);
+      memcpy(p_, &offset, kOffsetSize);
+      p_ += kOffsetSize;
+    } else {
+      const char* s = pool->entryString(entry);
+      size_t len = strlen(s) + 1;
+      memcpy(p_, s, len);
+      p_ += len;
+    }
+    last = entry;
+  } else {
+    uint64_t entry = (form == DW_FORM_strp ? pool->findOffset(value) :
+                      pool->findString((const char*)value));
+    sleb128o(entry - last, p_);
+    last = entry;
+  }
+}
+
+// Strings of chunks with ZIP_REBASED are delta coded by their indexes in
+// the CU.
+template <bool kZipped, int kOffsetSize>
+void ZipScanner::onRebasedString(uint16_t name, uint16_t form,
+                                 uint64_t value) {
+  uint64_t& last = last_values_.get(name);
+  if (kZipped) {
+    uint64_t index = last + value;
+    uint64_t offset = bases_->string(form, index);
+    memcpy(p_, &offset, kOffsetSize);
+    p_ += kOffsetSize;
+    last = index;
+  } else {
+    uint64_t index = bases_->addString(form, value);
+    sleb128o(index - last, p_);
+    last = index;
+  }
+}
+
+// Whether values of |form| are coded from the base of their attribute in
+// chunks with ZIP_REBASED.
+static bool isRebased(uint16_t form) {
+  return (form == DW_FORM_addr || form == DW_FORM_ref_addr ||
+          form == DW_FORM_sec_offset);
+}
+
+template <bool kZipped, int kPtrSize, int kOffsetSize>
+void ZipScanner::onAttr(uint16_t name, uint16_t form, uint64_t value,
+                        uint64_t offset) {
+  if (!kZipped && unit_abbrev_)
+    onUnitAttr(name, form, value);
+  if (indexKind(form) >= 0) {
+    onIndex<kZipped>(form, value);
+    last_offset_ = offset;
+    return;
+  }
+  if ((form == DW_FORM_strp || form == DW_FORM_string) &&
+      binary_->string_pool) {
+    onString<kZipped, kOffsetSize>(name, form, value);
+    last_offset_ = offset;
+    return;
+  }
+  if (form == DW_FORM_ref4 && predict_refs_) {
+    onRef<kZipped>(name, value);
+    last_offset_ = offset;
+    return;
+  }
+  if ((form == DW_FORM_strp || form == DW_FORM_line_strp) && bases_) {
+    onRebasedString<kZipped, kOffsetSize>(name, form, value);
+    last_offset_ = offset;
+    return;
+  }
+
+  // The delta coded values of chunks with ZIP_REBASED are from the base.
+  uint64_t base = 0;
+  if (bases_ && isRebased(form))
+    base = kZipped ? bases_->base(name) : bases_->addBase(name, value);
+
+  switch (deltaSize<kPtrSize, kOffsetSize>(form, cu_version_)) {
+  case 8: {
+    uint64_t& last = last_values_.get(name);
+    if (kZipped) {
+      int64_t v = last + value;
+      int64_t* op = (int64_t*)p_;
+      *op = v + base;
+      p_ += 8;
+      last = v;
+    } else {
+      int64_t diff = value - base - last;
+      sleb128o(diff, p_);
+      last = value - base;
+    }
+    break;
+  }
+
+  case 4: {
+    uint64_t& last = last_values_.get(name);
+    if (kZipped) {
+      int32_t v = (static_cast<int32_t>(last) +
+                   static_cast<int32_t>(value));
+      int32_t* op = (int32_t*)p_;
+      *op = v + static_cast<int32_t>(base);
+      p_ += 4;
+      last = v;
+    } else {
+      int32_t v = static_cast<int32_t>(value - base);
+      int32_t diff = v - static_cast<int32_t>(last);
+      sleb128o(diff, p_);
+      last = v;
+    }
+    break;
+  }
+
+  default: {
+    size_t sz = offset - last_offset_;
+    memcpy(p_, input_ + last_offset_, sz);
+    p_ += sz;
+  }
+  }
+
+  //fprintf(stderr, "attr %d %d @%lx\n", name, form, last_offset_);
+
+  last_offset_ = offset;
+}
+
+void ZipScanner::onRun(uint64_t offset) {
+  if (unit_abbrev_) {
+    // The run has the attributes of fixed-size forms from the next one.
+    const uint8_t* p = input_ + last_offset_;
+    while (unit_attr_ < unit_abbrev_->num_attrs) {
+      const Attr& attr = unit_abbrev_->attrs[unit_attr_];
+      int size = fixedFormSize(attr.form);
+      if (size < 0)
+        break;
+      uint64_t value = attr.implicit_const;
+      if (attr.form != DW_FORM_implicit_const)
+        value = readFixed(p, min(size, 8));
+      onUnitAttr(attr.name, attr.form, value);
+      p += size;
+    }
+  }
+  size_t sz = offset - last_offset_;
+  memcpy(p_, input_ + last_offset_, sz);
+  p_ += sz;
+  last_offset_ = offset;
+}
+
+void ZipScanner::onUnitAttr(uint16_t name, uint16_t form, uint64_t value) {
+  units_->back().onAttr(name, form, value);
+  unit_attr_++;
+}
+
+// The values of holes are coded by their HoleKind. Copies don't change
+// the last values of attributes, so they are decoded from the same ones.
+uint64_t ZipScanner::findCopy(uint64_t offset, const AbbrevTable* abbrevs) {
+  if (!code_copies_)
+    return 0;
+  const SubtreeTable* subtrees = binary_->subtrees;
+  const vector<SubtreeCopy>& copies = subtrees->copies();
+  if (next_copy_ >= copies.size() || copies[next_copy_].offset != offset)
+    return 0;
+  const SubtreeCopy& copy = copies[next_copy_++];
+  uleb128o(abbrevs->num_abbrevs, p_);
+  sleb128o((int64_t)copy.index - last_template_ - 1, p_);
+  last_template_ = copy.index;
+
+  const vector<Hole>& holes = subtrees->holes(copy.index);
+  const uint64_t* values = subtrees->copyHoles(copy);
+  uint64_t root = offset - cu_offset_;
+  for (size_t i = 0; i < holes.size(); i++) {
+    switch (holeKind(holes[i])) {
+    case HOLE_REF:
+      sleb128o(values[i] - root, p_);
+      break;
+    case HOLE_FILE:
+      sleb128o(values[i] - last_file_, p_);
+      last_file_ = values[i];
+      break;
+    case HOLE_INDEX: {
+      uint64_t& last = last_indexes_[indexKind(holes[i].form)];
+      sleb128o(values[i] - last, p_);
+      last = values[i];
+      break;
+    }
+    }
+  }
+  last_offset_ = copy.end;
+  return copy.end;
+}
+
+void ZipScanner::onCopy(size_t index, const AbbrevTable* abbrevs,
+                        const int64_t* coded, uint64_t offset) {
+  SubtreeTable* subtrees = binary_->subtrees;
+  const vector<Hole>& holes = subtrees->holes(index);
+  uint64_t root = p_ - cu_out_;
+  hole_values_.resize(holes.size() + 1);
+  for (size_t i = 0; i < holes.size(); i++) {
+    switch (holeKind(holes[i])) {
+    case HOLE_REF:
+      hole_values_[i] = root + coded[i];
+      break;
+    case HOLE_FILE:
+      last_file_ += coded[i];
+      hole_values_[i] = last_file_;
+      break;
+    case HOLE_INDEX: {
+      uint64_t& last = last_indexes_[indexKind(holes[i].form)];
+      last += coded[i];
+      hole_values_[i] = last;
+      break;
+    }
+    }
+  }
+  uint8_t* end = subtrees->expand(binary_, index, abbrevs, root,
+                                  &hole_values_[0], p_);
+  if (!end)
+    bug("Bad copy of template %zu\n", index);
+  p_ = end;
+  last_offset_ = offset;
+}
+
+template class Scanner<ZipScanner>;
+
+void splitChunks(const Binary* binary, size_t chunk_size,
+                 vector<ZipChunk>* chunks) {
+  ZipChunk chunk = { 0, 0 };
+  chunks->push_back(chunk);
+  splitMoreChunks(binary, chunk_size, -1, chunks);
+}
+
+bool splitMoreChunks(const Binary* binary, size_t chunk_size, uint64_t size,
+                     vector<ZipChunk>* chunks) {
+  const uint8_t* dinfo = (const uint8_t*)binary->debug_info;
+  ZipChunk chunk = { 0, 0 };
+  uint64_t begin = chunks->back().orig_offset;
+  uint64_t offset = begin;
+  while (offset + CU_HEADER_SIZE < binary->debug_info_len) {
+    offset += cuSize(dinfo + offset);
+    if (offset - chunks->back().orig_offset >= chunk_size ||
+        offset + CU_HEADER_SIZE >= binary->debug_info_len) {
+      chunk.orig_offset = offset;
+      chunks->push_back(chunk);
+      if (offset - begin >= size)
+        break;
+    }
+  }
+  return offset + CU_HEADER_SIZE < binary->debug_info_len;
+}
+
+// Returns the delta buffer of the calling thread with room for |size|
+// bytes. It's kept across chunks, and across files in batch mode, so
+// chunks don't allocate and clear their own.
+static uint8_t* deltaBuffer(size_t size) {
+  static thread_local vector<uint8_t> buf;
+  if (buf.size() < size || buf.empty())
+    buf.resize(max<size_t>(size, 1));
+  return &buf[0];
+}
+
+// A delta can be twice as large as the original in the worst case, where
+// 1-byte indexes become 2-byte SLEB128, or five times with a string pool,
+// where an empty inline string becomes an entry. With ZIP_ABBREVS, a DIE
+// of only a 1-byte abbrev number may take the most bytes of a rank.
+// Copies are smaller than their subtrees.
+static size_t maxDeltaSize(const Binary* binary, size_t len) {
+  size_t factor = binary->string_pool ? 5 : 2;
+  if (binary->abbrev_order)
+    factor = max<size_t>(factor, binary->abbrev_order->maxRankSize());
+  return len * factor + 16;
+}
+
+void codeDelta(Binary* binary, uint32_t flags, const uint8_t* delta,
+               size_t size, const UnitBases* bases, vector<uint8_t>* buf) {
+  const vector<uint64_t>* abbrev_offsets =
+    bases ? &bases->abbrev_offsets() : NULL;
+  if (flags & ZIP_ENTROPY) {
+    // Entropy coded chunks start with the size of the delta coded CUs.
+    uint64_t delta_size = size;
+    buf->insert(buf->end(), (uint8_t*)&delta_size,
+                (uint8_t*)(&delta_size + 1));
+    entropyEncode(binary, flags, delta, size, abbrev_offsets, buf);
+  } else if (flags & ZIP_STREAMS) {
+    splitStreams(binary, delta, size, abbrev_offsets, buf);
+  } else {
+    buf->insert(buf->end(), delta, delta + size);
+  }
+}
+
+const uint8_t* deltaChunk(Binary* binary, uint32_t flags, uint64_t begin,
+                          uint64_t end, bool verbose, UnitBases* bases,
+                          vector<UnitAddrs>* units, size_t* size) {
+  uint8_t* delta = deltaBuffer(maxDeltaSize(binary, end - begin));
+  ZipScanner zip(binary, delta, flags);
+  zip.set_verbose(verbose);
+  zip.set_units(units);
+  if (flags & ZIP_REBASED)
+    zip.set_bases(bases);
+  zip.codeCopiesFrom(begin);
+  zip.run(begin, end);
+  zip.finish();
+  *size = zip.cur() - delta;
+  return delta;
+}
+
+void encodeChunk(Binary* binary, uint32_t flags, uint64_t begin,
+                 uint64_t end, bool verbose, vector<uint8_t>* buf,
+                 vector<UnitAddrs>* units) {
+  UnitBases bases;
+  size_t size;
+  const uint8_t* delta = deltaChunk(binary, flags, begin, end, verbose,
+                                    &bases, units, &size);
+  buf->clear();
+  if (flags & ZIP_REBASED)
+    bases.write(buf);
+  codeDelta(binary, flags, delta, size,
+            flags & ZIP_REBASED ? &bases : NULL, buf);
+}
+
+// Templates of subtrees are coded apart from CUs, so they aren't rebased.
+void encodeUnits(Binary* binary, uint32_t flags, const uint8_t* p,
+                 size_t size, vector<uint8_t>* buf) {
+  uint8_t* delta = deltaBuffer(maxDeltaSize(binary, size));
+  ZipScanner zip(binary, delta, flags);
+  MemoryInput in(p, 0);
+  zip.scan<false>(&in, size);
+  zip.finish();
+  buf->clear();
+  codeDelta(binary, flags & ~ZIP_REBASED, delta, zip.cur() - delta, NULL,
+            buf);
+}
+
+void countChunkModels(Binary* binary, uint32_t flags, uint64_t begin,
+                      uint64_t end, ModelCounts* counts) {
+  uint8_t* delta = deltaBuffer(maxDeltaSize(binary, end - begin));
+  ZipScanner zip(binary, delta, flags);
+  zip.run(begin, end);
+  zip.finish();
+  countModels(binary, delta, zip.cur() - delta, counts);
+}
+
+uint8_t* decodeChunk(Binary* binary, size_t index, bool verbose,
+                     uint8_t* out) {
+  size_t size;
+  const uint8_t* in = binary->zipChunk(index, &size);
+  return decodeChunkData(binary, binary->zip_flags, in, size, verbose, out);
+}
+
+// Decodes CUs like decodeChunkData, but copies of templates need them to
+// be loaded.
+static uint8_t* decodeCUs(Binary* binary, uint32_t flags, const uint8_t* in,
+                          size_t in_size, bool verbose, uint8_t* out) {
+  ZipScanner zip(binary, out, flags);
+  zip.set_verbose(verbose);
+  UnitBases bases;
+  if (flags & ZIP_REBASED) {
+    size_t side_size = bases.read(in, in_size);
+    in += side_size;
+    in_size -= side_size;
+    zip.set_bases(&bases);
+    zip.set_abbrev_offsets(&bases.abbrev_offsets());
+  }
+  if (!(flags & (ZIP_ENTROPY | ZIP_STREAMS))) {
+    MemoryInput mem(in, 0);
+    zip.scan<true>(&mem, in_size);
+    return const_cast<uint8_t*>(zip.cur());
+  }
+
+  // The delta coded CUs are restored as the scanner reads them, and
+  // ZipScanner restores the original bytes in the same walk.
+  uint64_t size = *(const uint64_t*)in;
+  uint8_t* delta = deltaBuffer(size);
+  const uint8_t* coded = in + sizeof(size);
+  size_t coded_size = in_size - sizeof(size);
+  if (flags & ZIP_STATIC) {
+    RansDecoder dec(coded, coded_size, delta,
+                    dictPriors(binary, DICT_MODELS_INFO));
+    zip.scan<true>(&dec, size);
+  } else if (flags & ZIP_ENTROPY) {
+    EntropyDecoder dec(coded, coded_size, delta, size,
+                       dictPriors(binary, DICT_MODELS_INFO));
+    zip.scan<true>(&dec, size);
+  } else {
+    StreamMerger merger(in, delta);
+    zip.scan<true>(&merger, size);
+  }
+  return const_cast<uint8_t*>(zip.cur());
+}
+
+uint8_t* decodeChunkData(Binary* binary, uint32_t flags, const uint8_t* in,
+                         size_t in_size, bool verbose, uint8_t* out) {
+  if (binary->subtrees)
+    binary->subtrees->load(binary);
+  return decodeCUs(binary, flags, in, in_size, verbose, out);
+}
+
+uint8_t* decodeUnits(Binary* binary, uint32_t flags, const uint8_t* in,
+                     size_t size, uint8_t* out) {
+  return decodeCUs(binary, flags & ~ZIP_REBASED, in, size, false, out);
+}
+
+// Writes the abbrev offsets which the scanner takes from the side data of
+// a chunk with ZIP_REBASED into the headers of its delta coded CUs.
+class AbbrevOffsetWriter : public Scanner<AbbrevOffsetWriter> {
+public:
+  AbbrevOffsetWriter(Binary* binary, uint8_t* delta)
+    : Scanner<AbbrevOffsetWriter>(binary),
+      delta_(delta) {
+  }
+
+private:
+  friend class Scanner<AbbrevOffsetWriter>;
+
+  static const bool kMergeRuns = true;
+
+  void onCU(const CU* cu, uint64_t offset) {
+    writeAbbrevOffset(delta_ + offset - cu->header_size, *cu,
+                      cu->abbrev_offset);
+  }
+  void onAbbrev(uint64_t, const Abbrev*, uint64_t) {}
+  template <bool kZipped, int kPtrSize, int kOffsetSize>
+  void onAttr(uint16_t, uint16_t, uint64_t, uint64_t) {}
+  void onRun(uint64_t) {}
+
+  uint8_t* delta_;
+};
+
+void decodeDeltaData(Binary* binary, uint32_t flags, const uint8_t* in,
+                     size_t in_size, vector<uint8_t>* delta) {
+  // Walks of delta coded copies read the holes of their templates.
+  if (binary->subtrees)
+    binary->subtrees->load(binary);
+  UnitBases bases;
+  const vector<uint64_t>* abbrev_offsets = NULL;
+  if (flags & ZIP_REBASED) {
+    size_t side_size = bases.read(in, in_size);
+    in += side_size;
+    in_size -= side_size;
+    abbrev_offsets = &bases.abbrev_offsets();
+  }
+  size_t start = delta->size();
+  uint64_t size = in_size;
+  if (!(flags & (ZIP_ENTROPY | ZIP_STREAMS))) {
+    delta->insert(delta->end(), in, in + in_size);
+  } else {
+    size = *(const uint64_t*)in;
+    delta->resize(start + size);
+    if (flags & ZIP_ENTROPY) {
+      entropyDecode(binary, flags, in + sizeof(size),
+                    in_size - sizeof(size), abbrev_offsets,
+                    &(*delta)[start], size);
+    } else {
+      mergeStreams(binary, in, abbrev_offsets, &(*delta)[start]);
+    }
+  }
+  if (abbrev_offsets) {
+    AbbrevOffsetWriter writer(binary, &(*delta)[start]);
+    writer.set_abbrev_offsets(abbrev_offsets);
+    MemoryInput mem(&(*delta)[start], 0);
+    writer.scan<true>(&mem, size);
+  }
+}
+
+void readDeltaChunk(Binary* binary, size_t index, vector<uint8_t>* delta) {
+  size_t in_size;
+  const uint8_t* in = binary->zipChunk(index, &in_size);
+  decodeDeltaData(binary, binary->zip_flags, in, in_size, delta);
+}
@@ -0,0 +1,186 @@
+#ifndef ZIPSCANNER_H_
+#define ZIPSCANNER_H_
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "delta.h"
+#include "rebase.h"
+#include "refcoder.h"
+#include "scanner.h"
+
+struct ModelCounts;
+struct UnitAddrs;
+struct ZipChunk;
+
+// Compresses .debug_info of a raw binary into |out|, or decompresses it
+// if the binary is zipped. |flags| are the ones of ZipHeader.
+class ZipScanner : public Scanner<ZipScanner> {
+public:
+  ZipScanner(Binary* binary, uint8_t* out, uint32_t flags);
+
+  const uint8_t* cur() const {
+    return p_;
+  }
+
+  void set_verbose(bool verbose) {
+    verbose_ = verbose;
+  }
+
+  // Makes a raw binary's scan append the address attributes of each unit
+  // DIE to |units|.
+  void set_units(std::vector<UnitAddrs>* units) {
+    units_ = units;
+  }
+
+  // Makes the scan code CUs with ZIP_REBASED. A scan of a raw binary adds
+  // to |bases|. A scan of delta coded CUs reads them, and also needs
+  // set_abbrev_offsets() with their abbrev offsets.
+  void set_bases(UnitBases* bases) {
+    bases_ = bases;
+  }
+
+  // Codes the copies of the subtree table of a raw binary, starting with
+  // the first one at |offset| or after it.
+  void codeCopiesFrom(uint64_t offset);
+
+  // Ends the encoding of the last CU. Must be called after a scan of a raw
+  // binary with ZIP_PREDICT.
+  void finish();
+
+private:
+  friend class Scanner<ZipScanner>;
+
+  static const bool kMergeRuns = true;
+
+  void onCU(const CU* cu, uint64_t offset);
+  void onAbbrev(uint64_t number, const Abbrev* abbrev, uint64_t offset);
+  template <bool kZipped, int kPtrSize, int kOffsetSize>
+  void onAttr(uint16_t name, uint16_t form, uint64_t value, uint64_t offset);
+  template <bool kZipped>
+  void onIndex(uint16_t form, uint64_t value);
+  template <bool kZipped, int kOffsetSize>
+  void onString(uint16_t name, uint16_t form, uint64_t value);
+  template <bool kZipped, int kOffsetSize>
+  void onRebasedString(uint16_t name, uint16_t form, uint64_t value);
+  template <bool kZipped>
+  void onRef(uint16_t name, uint64_t value);
+  void onRun(uint64_t offset);
+  void onUnitAttr(uint16_t name, uint16_t form, uint64_t value);
+  uint64_t findCopy(uint64_t offset, const AbbrevTable* abbrevs);
+  void onCopy(size_t index, const AbbrevTable* abbrevs, const int64_t* holes,
+              uint64_t offset);
+
+  uint8_t* p_;
+  uint64_t last_offset_;
+  // The start of the CU in the input and in the output.
+  uint64_t cu_offset_;
+  uint8_t* cu_out_;
+  int cu_cnt_;
+  bool verbose_;
+  DeltaTable last_values_;
+  // The last index of each IndexKind in the CU.
+  uint64_t last_indexes_[NUM_INDEX_KINDS];
+  // The last DW_AT_decl_file of copies in the CU.
+  uint64_t last_file_;
+  // Whether copies are coded, and the next one.
+  bool code_copies_;
+  size_t next_copy_;
+  std::vector<uint64_t> hole_values_;
+  std::vector<UnitAddrs>* units_;
+  // The abbrev of the unit DIE while its attributes are scanned, and the
+  // next of them.
+  const Abbrev* unit_abbrev_;
+  uint16_t unit_attr_;
+  bool unit_next_;
+  // Whether DW_FORM_ref4 is coded by RefCoder (ZIP_PREDICT).
+  bool predict_refs_;
+  RefCoder refs_;
+  // The offsets in the CU of the current DIE and of its parent, and of
+  // the DIEs whose children are scanned, for raw and delta coded input.
+  struct DIEOffsets {
+    uint32_t raw;
+    uint32_t zipped;
+  };
+  DIEOffsets die_;
+  DIEOffsets parent_;
+  std::vector<DIEOffsets> parents_;
+  // The ranks of the abbrev numbers of the CU when a raw binary is coded
+  // with ZIP_ABBREVS, or NULL.
+  const uint32_t* abbrev_ranks_;
+  // The side data of a chunk with ZIP_REBASED, or NULL.
+  UnitBases* bases_;
+};
+
+extern template class Scanner<ZipScanner>;
+
+// Groups CUs of a raw binary into chunks of about |chunk_size| bytes and
+// appends num_chunks + 1 entries to |chunks|. Only orig_offset is set.
+// Each CU is its own chunk if |chunk_size| is 0.
+void splitChunks(const Binary* binary, size_t chunk_size,
+                 std::vector<ZipChunk>* chunks);
+
+// Like splitChunks, but continues from the last entry of |chunks| and
+// stops once the new chunks cover at least |size| bytes, so a big binary
+// can be walked a batch at a time. Returns false at the end of
+// .debug_info.
+bool splitMoreChunks(const Binary* binary, size_t chunk_size, uint64_t size,
+                     std::vector<ZipChunk>* chunks);
+
+// Encodes CUs in [begin, end) of .debug_info of a raw binary into |buf|.
+// |flags| are the ones of ZipHeader. Appends the address attributes of
+// the unit DIEs to |units| unless it's NULL.
+void encodeChunk(Binary* binary, uint32_t flags, uint64_t begin,
+                 uint64_t end, bool verbose, std::vector<uint8_t>* buf,
+                 std::vector<UnitAddrs>* units);
+
+// The steps of encodeChunk. Delta codes the CUs into a buffer of the
+// calling thread, which is valid until its next chunk, and returns it
+// and sets |size|. With ZIP_REBASED, adds the side data to |bases|.
+const uint8_t* deltaChunk(Binary* binary, uint32_t flags, uint64_t begin,
+                          uint64_t end, bool verbose, UnitBases* bases,
+                          std::vector<UnitAddrs>* units, size_t* size);
+
+// Appends |size| bytes of delta coded CUs at |delta| coded with |flags|
+// to |buf|. |bases| are those of deltaChunk.
+void codeDelta(Binary* binary, uint32_t flags, const uint8_t* delta,
+               size_t size, const UnitBases* bases,
+               std::vector<uint8_t>* buf);
+
+// Encodes |size| bytes of CUs at |p| which aren't in .debug_info, such as
+// templates of subtrees, like a chunk into |buf|. Copies aren't coded.
+void encodeUnits(Binary* binary, uint32_t flags, const uint8_t* p,
+                 size_t size, std::vector<uint8_t>* buf);
+
+// Decodes CUs coded by encodeUnits into |out|.
+uint8_t* decodeUnits(Binary* binary, uint32_t flags, const uint8_t* in,
+                     size_t size, uint8_t* out);
+
+// Adds the bits the CUs in [begin, end) of a raw binary would code with
+// ZIP_ENTROPY to |counts|.
+void countChunkModels(Binary* binary, uint32_t flags, uint64_t begin,
+                      uint64_t end, ModelCounts* counts);
+
+// Decodes chunk |index| of a zipped binary into |out|, which must have
+// room for its original bytes. Returns the end of the decoded bytes.
+uint8_t* decodeChunk(Binary* binary, size_t index, bool verbose,
+                     uint8_t* out);
+
+// Decodes |size| compressed bytes of a chunk at |in| into |out|. |flags|
+// are the ones of ZipHeader.
+uint8_t* decodeChunkData(Binary* binary, uint32_t flags, const uint8_t* in,
+                         size_t size, bool verbose, uint8_t* out);
+
+// Appends the delta coded CUs of |size| compressed bytes of a chunk at
+// |in| to |delta|, undoing entropy coding or stream splitting of |flags|.
+// The abbrev offsets of CUs with ZIP_REBASED are restored, but their
+// other values stay rebased.
+void decodeDeltaData(Binary* binary, uint32_t flags, const uint8_t* in,
+                     size_t size, std::vector<uint8_t>* delta);
+
+// Like decodeDeltaData for chunk |index| of a zipped binary.
+void readDeltaChunk(Binary* binary, size_t index,
+                    std::vector<uint8_t>* delta);
+
+#endif  // ZIPSCANNER_H_